@@ -0,0 +1,232 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#pragma GCC diagnostic ignored "-Wscalar-storage-order"
+
+#define ARC_LE __attribute__((scalar_storage_order("little-endian")))
+
+typedef char CHAR, * PCHAR;
+typedef uint8_t UCHAR, * PUCHAR;
+typedef uint16_t USHORT, * PUSHORT;
+typedef uint32_t ULONG, * PULONG;
+
+// Boot trace file format, from the firmware's arctrace.h.
+enum {
+	ARC_TRACE_MAGIC = 0x42545243, // 'BTRC'
+	ARC_TRACE_VERSION = 1,
+	ARC_TRACE_NAME_LENGTH = 16,
+};
+
+typedef enum _ARC_TRACE_TYPE {
+	ArcTraceTypeBegin,
+	ArcTraceTypeEnd,
+	ArcTraceTypeMark
+} ARC_TRACE_TYPE;
+
+typedef struct ARC_LE _ARC_TRACE_FILE_HEADER {
+	ULONG Magic;
+	USHORT Version;
+	USHORT RecordSize;
+	ULONG TicksPerSecond;
+	ULONG Count;
+	ULONG Lost;
+} ARC_TRACE_FILE_HEADER, *PARC_TRACE_FILE_HEADER;
+
+typedef struct ARC_LE _ARC_TRACE_FILE_RECORD {
+	uint64_t Ticks;
+	ULONG Arg;
+	UCHAR Type;
+	UCHAR Depth;
+	USHORT Reserved;
+	CHAR Name[ARC_TRACE_NAME_LENGTH];
+} ARC_TRACE_FILE_RECORD, *PARC_TRACE_FILE_RECORD;
+
+enum {
+	MAX_DEPTH = 64,
+	TIMELINE_WIDTH = 60,
+};
+
+// A begin event with its matching end.
+typedef struct _TRACE_SPAN {
+	double Start, Duration; // microseconds from the first event
+	ULONG Depth;
+	ULONG Arg;
+	char Name[ARC_TRACE_NAME_LENGTH + 1];
+	char Stack[MAX_DEPTH * (ARC_TRACE_NAME_LENGTH + 1)]; // folded stack, outermost first
+} TRACE_SPAN, *PTRACE_SPAN;
+
+typedef enum _RENDER_MODE {
+	RENDER_TIMELINE,
+	RENDER_FOLDED,
+	RENDER_CHROME
+} RENDER_MODE;
+
+static void BAD_ARGS(const char* Self) {
+	printf("Usage: %s [-t|-f|-j] <boottrace.bin>\n", Self);
+	printf("  -t: text timeline (default)\n");
+	printf("  -f: folded stacks, for flamegraph.pl\n");
+	printf("  -j: Chrome trace event JSON, for chrome://tracing or Perfetto\n");
+	exit(-1);
+}
+
+// Pairs begin and end events. Spans still open at the end of the trace end at the last event.
+static ULONG BuildSpans(PARC_TRACE_FILE_RECORD Records, ULONG Count, double TicksPerUs, PTRACE_SPAN Spans) {
+	ULONG Open[MAX_DEPTH];
+	ULONG OpenCount = 0;
+	ULONG SpanCount = 0;
+	uint64_t Base = Records[0].Ticks;
+	for (ULONG i = 0; i < Count; i++) {
+		PARC_TRACE_FILE_RECORD Record = &Records[i];
+		double Time = (Record->Ticks - Base) / TicksPerUs;
+		if (Record->Type == ArcTraceTypeEnd) {
+			// Close the innermost span of this name, and anything left open inside it.
+			ULONG Match = OpenCount;
+			while (Match > 0 && strncmp(Spans[Open[Match - 1]].Name, Record->Name, ARC_TRACE_NAME_LENGTH) != 0) Match--;
+			if (Match == 0) continue;
+			while (OpenCount >= Match) {
+				PTRACE_SPAN Span = &Spans[Open[--OpenCount]];
+				Span->Duration = Time - Span->Start;
+			}
+			continue;
+		}
+
+		PTRACE_SPAN Span = &Spans[SpanCount];
+		memset(Span, 0, sizeof(*Span));
+		memcpy(Span->Name, Record->Name, ARC_TRACE_NAME_LENGTH);
+		Span->Start = Time;
+		Span->Depth = OpenCount;
+		Span->Arg = Record->Arg;
+		Span->Duration = -1;
+		ULONG Used = 0;
+		for (ULONG d = 0; d < OpenCount; d++) {
+			Used += snprintf(&Span->Stack[Used], sizeof(Span->Stack) - Used, "%s;", Spans[Open[d]].Name);
+		}
+		snprintf(&Span->Stack[Used], sizeof(Span->Stack) - Used, "%s", Span->Name);
+		SpanCount++;
+
+		if (Record->Type == ArcTraceTypeMark) {
+			Span->Duration = 0;
+			continue;
+		}
+		if (OpenCount < MAX_DEPTH) Open[OpenCount++] = SpanCount - 1;
+	}
+
+	double End = (Records[Count - 1].Ticks - Base) / TicksPerUs;
+	for (ULONG i = 0; i < SpanCount; i++) {
+		if (Spans[i].Duration < 0) Spans[i].Duration = End - Spans[i].Start;
+	}
+	return SpanCount;
+}
+
+static void RenderTimeline(PTRACE_SPAN Spans, ULONG Count) {
+	double Total = 0;
+	for (ULONG i = 0; i < Count; i++) {
+		if (Spans[i].Start + Spans[i].Duration > Total) Total = Spans[i].Start + Spans[i].Duration;
+	}
+	if (Total <= 0) Total = 1;
+
+	printf("%12s %12s  %-*s  %s\n", "start(us)", "time(us)", TIMELINE_WIDTH, "", "event");
+	for (ULONG i = 0; i < Count; i++) {
+		PTRACE_SPAN Span = &Spans[i];
+		char Bar[TIMELINE_WIDTH + 1];
+		ULONG From = (ULONG)(Span->Start * TIMELINE_WIDTH / Total);
+		ULONG To = (ULONG)((Span->Start + Span->Duration) * TIMELINE_WIDTH / Total);
+		if (From >= TIMELINE_WIDTH) From = TIMELINE_WIDTH - 1;
+		if (To >= TIMELINE_WIDTH) To = TIMELINE_WIDTH - 1;
+		for (ULONG x = 0; x < TIMELINE_WIDTH; x++) Bar[x] = (x >= From && x <= To) ? '#' : '.';
+		if (Span->Duration == 0) Bar[From] = '|';
+		Bar[TIMELINE_WIDTH] = 0;
+		printf("%12.0f %12.0f  %s  %*s%s (%x)\n", Span->Start, Span->Duration, Bar, Span->Depth * 2, "", Span->Name, Span->Arg);
+	}
+}
+
+static void RenderFolded(PTRACE_SPAN Spans, ULONG Count) {
+	// Each span's own time is its duration minus that of its direct children.
+	for (ULONG i = 0; i < Count; i++) {
+		double Self = Spans[i].Duration;
+		for (ULONG j = i + 1; j < Count && Spans[j].Depth > Spans[i].Depth; j++) {
+			if (Spans[j].Depth == Spans[i].Depth + 1) Self -= Spans[j].Duration;
+		}
+		if (Self >= 1) printf("%s %.0f\n", Spans[i].Stack, Self);
+	}
+}
+
+static void RenderChrome(PTRACE_SPAN Spans, ULONG Count) {
+	printf("[\n");
+	for (ULONG i = 0; i < Count; i++) {
+		PTRACE_SPAN Span = &Spans[i];
+		if (Span->Duration == 0) {
+			printf("{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"g\",\"ts\":%.3f,\"pid\":0,\"tid\":0,\"args\":{\"arg\":%u}}", Span->Name, Span->Start, Span->Arg);
+		} else {
+			printf("{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":0,\"args\":{\"arg\":%u}}", Span->Name, Span->Start, Span->Duration, Span->Arg);
+		}
+		printf("%s\n", (i + 1 < Count) ? "," : "");
+	}
+	printf("]\n");
+}
+
+int main(int argc, char** argv) {
+	RENDER_MODE Mode = RENDER_TIMELINE;
+	int arg = 1;
+	for (; arg < argc && argv[arg][0] == '-'; arg++) {
+		if (!strcmp(argv[arg], "-t")) Mode = RENDER_TIMELINE;
+		else if (!strcmp(argv[arg], "-f")) Mode = RENDER_FOLDED;
+		else if (!strcmp(argv[arg], "-j")) Mode = RENDER_CHROME;
+		else BAD_ARGS(argv[0]);
+	}
+	if (arg + 1 != argc) BAD_ARGS(argv[0]);
+
+	FILE* f = fopen(argv[arg], "rb");
+	if (f == NULL) {
+		printf("Could not open %s\n", argv[arg]);
+		return -2;
+	}
+	ARC_TRACE_FILE_HEADER Header;
+	if (fread(&Header, sizeof(Header), 1, f) != 1 || Header.Magic != ARC_TRACE_MAGIC) {
+		printf("%s is not a boot trace\n", argv[arg]);
+		return -3;
+	}
+	if (Header.Version != ARC_TRACE_VERSION || Header.RecordSize != sizeof(ARC_TRACE_FILE_RECORD)) {
+		printf("%s is boot trace version %d, this tool supports version %d\n", argv[arg], Header.Version, ARC_TRACE_VERSION);
+		return -3;
+	}
+	if (Header.Count == 0 || Header.TicksPerSecond < 1000000) {
+		printf("%s has no events\n", argv[arg]);
+		return -3;
+	}
+
+	PARC_TRACE_FILE_RECORD Records = malloc(Header.Count * sizeof(*Records));
+	PTRACE_SPAN Spans = malloc(Header.Count * sizeof(*Spans));
+	if (Records == NULL || Spans == NULL) {
+		printf("Out of memory\n");
+		return -4;
+	}
+	ULONG Count = fread(Records, sizeof(*Records), Header.Count, f);
+	fclose(f);
+	if (Count == 0) {
+		printf("%s is truncated\n", argv[arg]);
+		return -3;
+	}
+	if (Count != Header.Count) fprintf(stderr, "%s is truncated, rendering %d of %d events\n", argv[arg], Count, Header.Count);
+	if (Header.Lost != 0) fprintf(stderr, "%d earlier events were lost, spans begun before the trace starts are missing\n", Header.Lost);
+
+	ULONG SpanCount = BuildSpans(Records, Count, Header.TicksPerSecond / 1000000.0, Spans);
+	switch (Mode) {
+	case RENDER_FOLDED:
+		RenderFolded(Spans, SpanCount);
+		break;
+	case RENDER_CHROME:
+		RenderChrome(Spans, SpanCount);
+		break;
+	default:
+		RenderTimeline(Spans, SpanCount);
+		break;
+	}
+
+	free(Records);
+	free(Spans);
+	return 0;
+}
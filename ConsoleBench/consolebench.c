@@ -0,0 +1,231 @@
+// Host build of the firmware framebuffer console, for measuring how fast it prints.
+// arcconsole.c is the firmware's own source, built unchanged, drawing into a framebuffer in RAM.
+
+#define _GNU_SOURCE
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/mman.h>
+
+// arc.h truncates K0 addresses to 32 bits, which is what this host build wants.
+#pragma GCC diagnostic ignored "-Wpointer-to-int-cast"
+
+#include "arc.h"
+#include "arcconsole.h"
+
+enum {
+	DEFAULT_WIDTH = 1024,
+	DEFAULT_HEIGHT = 768,
+	DEFAULT_LINES = 5000,
+	DEFAULT_MENUS = 200,
+	FNV_OFFSET_BASIS = 0x811c9dc5,
+	FNV_PRIME = 0x01000193,
+	FONT_XSIZE = 8,
+	FONT_YSIZE = 16,
+};
+
+extern u8 console_font_8x16[];
+
+// The console's colour table, in SGR order, normal then bright.
+static const ULONG s_ColourTable[] = {
+	0x00000000, 0x00aa0000, 0x0000aa00, 0x00aaaa00, 0x000000aa, 0x00aa00aa, 0x0000aaaa, 0x00aaaaaa,
+	0x00555555, 0x00ff5555, 0x0055ff55, 0x00ffff55, 0x005555ff, 0x00ff55ff, 0x0055ffff, 0x00ffffff,
+};
+
+static void BAD_ARGS(const char* Self) {
+	printf("Usage: %s [-c] [-w width] [-h height] [-l lines] [-m menus] [-f file]\n", Self);
+	printf("  -c: first check every glyph in every colour, and clearing, against a reference renderer\n");
+	printf("  -w, -h: framebuffer size in pixels (default %dx%d)\n", DEFAULT_WIDTH, DEFAULT_HEIGHT);
+	printf("  -l: lines of boot output to print (default %d)\n", DEFAULT_LINES);
+	printf("  -m: times to redraw the setup menu (default %d)\n", DEFAULT_MENUS);
+	printf("  -f: also print this text file\n");
+	exit(-1);
+}
+
+static double Now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static void ConsolePrint(const char* Text) {
+	ArcConsoleWrite((const BYTE*)Text, strlen(Text));
+}
+
+// Verbose boot: the kernel and drivers printing a line each, scrolling all the way.
+static ULONG RunBootOutput(ULONG Lines) {
+	char Line[160];
+	for (ULONG i = 0; i < Lines; i++) {
+		snprintf(Line, sizeof(Line), "\\SystemRoot\\System32\\DRIVERS\\drv%04u.sys loaded at 0x%08x, %u bytes\r\n", i % 1000, 0x80400000 + i * 0x3000, 10000 + (i * 37) % 90000);
+		ConsolePrint(Line);
+	}
+	return Lines;
+}
+
+// Setup menu: clear the screen and redraw it, as fwsetup.c does on every key press.
+static ULONG RunMenu(ULONG Redraws) {
+	static const char* s_MenuItems[] = {
+		"Set default configuration", "Set default environment", "Set system time",
+		"Set boot selections", "Run setup from CD", "Repartition disk for NT installation",
+		"Show boot trace", "Save boot trace to system partition", "Exit",
+	};
+	char Line[160];
+	ULONG Lines = 0;
+	for (ULONG Redraw = 0; Redraw < Redraws; Redraw++) {
+		ConsolePrint("\x9b" "37m\x9b" "44m\x9b" "2J");
+		ConsolePrint("\x9b" "2;5H ARC Multiboot Firmware Setup\r\n\r\n");
+		Lines += 2;
+		for (ULONG i = 0; i < sizeof(s_MenuItems) / sizeof(s_MenuItems[0]); i++) {
+			bool Selected = i == Redraw % (sizeof(s_MenuItems) / sizeof(s_MenuItems[0]));
+			snprintf(Line, sizeof(Line), "\x9b%u;5H%s    %s%s", i + 4, Selected ? "\x9b" "7m" : "", s_MenuItems[i], Selected ? "\x9b" "0m\x9b" "37m\x9b" "44m" : "");
+			ConsolePrint(Line);
+			Lines++;
+		}
+		ConsolePrint("\x9b" "20;5HUse the arrow keys to select, then press Enter.");
+		Lines++;
+	}
+	return Lines;
+}
+
+static ULONG RunFile(const char* Path) {
+	FILE* f = fopen(Path, "rb");
+	if (f == NULL) {
+		printf("Could not open %s\n", Path);
+		exit(-2);
+	}
+	char Buffer[4096];
+	ULONG Lines = 0;
+	size_t Length;
+	while ((Length = fread(Buffer, 1, sizeof(Buffer), f)) != 0) {
+		for (size_t i = 0; i < Length; i++) if (Buffer[i] == '\n') Lines++;
+		ArcConsoleWrite((const BYTE*)Buffer, Length);
+	}
+	fclose(f);
+	return Lines;
+}
+
+// Draws a glyph a pixel at a time from the font, as the console originally did, and compares it with the framebuffer.
+static bool CheckGlyph(const ULONG* Framebuffer, ULONG Width, ULONG Row, ULONG Col, UCHAR Chr, ULONG Foreground, ULONG Background) {
+	const UCHAR* Bits = &console_font_8x16[Chr * FONT_YSIZE];
+	const ULONG* Line = &Framebuffer[(Row * FONT_YSIZE * Width) + (Col * FONT_XSIZE)];
+	for (ULONG y = 0; y < FONT_YSIZE; y++, Line += Width) {
+		for (ULONG x = 0; x < FONT_XSIZE; x++) {
+			ULONG Expected = (Bits[y] & (0x80 >> x)) ? Foreground : Background;
+			if (Line[x] != Expected) {
+				printf("Glyph %02x at %u,%u: pixel %u,%u is %08x, expected %08x\n", Chr, Row, Col, x, y, Line[x], Expected);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+static bool CheckFill(const ULONG* Framebuffer, size_t Pixels, ULONG Colour) {
+	for (size_t i = 0; i < Pixels; i++) {
+		if (Framebuffer[i] != Colour) {
+			printf("Cleared screen: pixel %zu is %08x, expected %08x\n", i, Framebuffer[i], Colour);
+			return false;
+		}
+	}
+	return true;
+}
+
+// Every printable glyph, in every colour SGR can select, at positions across the screen.
+static bool CheckRenderer(const ULONG* Framebuffer, ULONG Width, ULONG Height) {
+	ULONG Rows = Height / FONT_YSIZE, Cols = Width / FONT_XSIZE;
+	char Buf[64];
+	for (ULONG Attr = 0; Attr < 8 * 8 * 2 * 2; Attr++) {
+		ULONG Fg = Attr & 7, Bg = (Attr >> 3) & 7;
+		bool High = (Attr >> 6) & 1, Reverse = (Attr >> 7) & 1;
+		snprintf(Buf, sizeof(Buf), "\x9b" "0m\x9b" "%um\x9b" "%um%s%s", 30 + Fg, 40 + Bg, High ? "\x9b" "1m" : "", Reverse ? "\x9b" "7m" : "");
+		ConsolePrint(Buf);
+		ULONG RealFg = Fg + (High ? 8 : 0), RealBg = Bg;
+		if (Reverse) {
+			RealBg = RealFg;
+			RealFg = Bg;
+		}
+
+		ConsolePrint("\x9b" "2J");
+		if (!CheckFill(Framebuffer, (size_t)Width * Height, s_ColourTable[RealBg])) return false;
+
+		for (ULONG Chr = 1; Chr < 256; Chr++) {
+			// Control characters are not drawn.
+			if (Chr == '\n' || Chr == '\r' || Chr == '\b' || Chr == '\t' || Chr == 0xb || Chr == '\f' || Chr == 0x1b || Chr == 0x9b) continue;
+			ULONG Row = (Chr * 7 + Attr) % Rows, Col = (Chr * 13 + Attr) % Cols;
+			snprintf(Buf, sizeof(Buf), "\x9b" "%u;%uH%c", Row + 1, Col + 1, (char)Chr);
+			ConsolePrint(Buf);
+			if (!CheckGlyph(Framebuffer, Width, Row, Col, Chr, s_ColourTable[RealFg], s_ColourTable[RealBg])) return false;
+		}
+	}
+	ConsolePrint("\x9b" "0m\x9b" "37m\x9b" "40m\x9b" "2J");
+	return true;
+}
+
+static ULONG HashFramebuffer(const void* Framebuffer, size_t Length) {
+	const UCHAR* p = (const UCHAR*)Framebuffer;
+	ULONG Hash = FNV_OFFSET_BASIS;
+	for (size_t i = 0; i < Length; i++) Hash = (Hash ^ p[i]) * FNV_PRIME;
+	return Hash;
+}
+
+static void Report(const char* Name, ULONG Lines, double Seconds, const void* Framebuffer, size_t Length) {
+	printf("%-8s %8u lines %8.3f s %10.0f lines/s  framebuffer %08x\n", Name, Lines, Seconds, Lines / (Seconds > 0 ? Seconds : 1e-9), HashFramebuffer(Framebuffer, Length));
+}
+
+int main(int argc, char** argv) {
+	ULONG Width = DEFAULT_WIDTH, Height = DEFAULT_HEIGHT, Lines = DEFAULT_LINES, Menus = DEFAULT_MENUS;
+	const char* File = NULL;
+	bool Check = false;
+	int arg = 1;
+	for (; arg < argc && argv[arg][0] == '-'; arg++) {
+		if (!strcmp(argv[arg], "-c")) {
+			Check = true;
+			continue;
+		}
+		if (arg + 1 >= argc) BAD_ARGS(argv[0]);
+		if (!strcmp(argv[arg], "-w")) Width = strtoul(argv[++arg], NULL, 0);
+		else if (!strcmp(argv[arg], "-h")) Height = strtoul(argv[++arg], NULL, 0);
+		else if (!strcmp(argv[arg], "-l")) Lines = strtoul(argv[++arg], NULL, 0);
+		else if (!strcmp(argv[arg], "-m")) Menus = strtoul(argv[++arg], NULL, 0);
+		else if (!strcmp(argv[arg], "-f")) File = argv[++arg];
+		else BAD_ARGS(argv[0]);
+	}
+	if (arg != argc || Width < 8 || Height < 16) BAD_ARGS(argv[0]);
+
+	// The console truncates framebuffer pointers to 32 bits.
+	size_t Length = (size_t)Width * Height * sizeof(ULONG);
+	void* Framebuffer = mmap(NULL, Length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+	if (Framebuffer == MAP_FAILED) {
+		printf("Could not map a %ux%u framebuffer\n", Width, Height);
+		return -4;
+	}
+	// Cleared, as the loader leaves it.
+	ArcConsoleInit(Framebuffer, 0, 0, Width, Height, Width * sizeof(ULONG));
+
+	if (Check) {
+		if (!CheckRenderer((const ULONG*)Framebuffer, Width, Height)) {
+			printf("Renderer check failed\n");
+			return 1;
+		}
+		printf("Renderer check passed\n");
+	}
+
+	double Start = Now();
+	ULONG Done = RunBootOutput(Lines);
+	Report("boot", Done, Now() - Start, Framebuffer, Length);
+
+	Start = Now();
+	Done = RunMenu(Menus);
+	Report("menu", Done, Now() - Start, Framebuffer, Length);
+
+	if (File != NULL) {
+		Start = Now();
+		Done = RunFile(File);
+		Report("file", Done, Now() - Start, Framebuffer, Length);
+	}
+	return 0;
+}
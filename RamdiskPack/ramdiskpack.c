@@ -0,0 +1,326 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#pragma GCC diagnostic ignored "-Wscalar-storage-order"
+
+#define ARC_LE __attribute__((scalar_storage_order("little-endian")))
+
+typedef uint8_t UCHAR, * PUCHAR;
+typedef uint16_t USHORT, * PUSHORT;
+typedef uint32_t ULONG, * PULONG;
+
+// Compressed ramdisk format, from the firmware's arcramdisk.h.
+enum {
+	RAMDISK_COMPRESSED_MAGIC = 0x5A445241, // 'ARDZ'
+	RAMDISK_COMPRESSED_VERSION = 1,
+	RAMDISK_MINIMUM_BLOCK_SIZE = 0x1000,
+	RAMDISK_MAXIMUM_BLOCK_SIZE = 0x10000,
+	RAMDISK_MAXIMUM_FILE_SIZE = 0x400000,
+	RAMDISK_MAXIMUM_IMAGE_SIZE = 0x1000000,
+};
+
+typedef struct ARC_LE _RAMDISK_COMPRESSED_HEADER {
+	ULONG Magic;
+	ULONG Version;
+	ULONG ImageSize;
+	ULONG BlockSize;
+	ULONG BlockCount;
+	ULONG Offsets[];
+} RAMDISK_COMPRESSED_HEADER, *PRAMDISK_COMPRESSED_HEADER;
+
+enum {
+	DEFAULT_BLOCK_SIZE = 0x4000,
+	// Largest drivers.img the Open Firmware loaders read.
+	LOADER_MAXIMUM_FILE_SIZE = 0x200000,
+	// An LZ4 block ends with at least this many literals, and its last match starts at least this far from the end.
+	LZ4_LAST_LITERALS = 5,
+	LZ4_MATCH_LIMIT = 12,
+	LZ4_MINIMUM_MATCH = 4,
+	LZ4_MAXIMUM_OFFSET = 0xFFFF,
+	LZ4_HASH_BITS = 14,
+};
+
+static void BAD_ARGS(const char* Self) {
+	printf("Usage: %s [-b blocksize] [-x] <input> <output>\n", Self);
+	printf("  -b: uncompressed size of each block, a power of two from 0x%x to 0x%x (default 0x%x)\n", RAMDISK_MINIMUM_BLOCK_SIZE, RAMDISK_MAXIMUM_BLOCK_SIZE, DEFAULT_BLOCK_SIZE);
+	printf("  -x: expand a compressed image back to the FAT image it was made from\n");
+	exit(-1);
+}
+
+static ULONG Read32(const UCHAR* p) {
+	ULONG Value;
+	memcpy(&Value, p, sizeof(Value));
+	return Value;
+}
+
+static PUCHAR Lz4PutLength(PUCHAR Dest, ULONG Length) {
+	for (; Length >= 255; Length -= 255) *Dest++ = 255;
+	*Dest++ = (UCHAR)Length;
+	return Dest;
+}
+
+// Greedy LZ4 block compressor, remembering the last position of each 4-byte sequence.
+// Returns the compressed length, or 0 if it would not be smaller than the input.
+static ULONG Lz4Compress(const UCHAR* Source, ULONG Length, PUCHAR Dest) {
+	static int32_t s_Table[1 << LZ4_HASH_BITS];
+	for (ULONG i = 0; i < (1 << LZ4_HASH_BITS); i++) s_Table[i] = -1;
+
+	// Worst case is every byte a literal, so Dest must hold Length plus the length bytes and token.
+	PUCHAR DestStart = Dest;
+	ULONG Anchor = 0;
+	ULONG Pos = 0;
+	ULONG MatchLimit = Length > LZ4_MATCH_LIMIT ? Length - LZ4_MATCH_LIMIT : 0;
+	while (Pos < MatchLimit) {
+		ULONG Sequence = Read32(&Source[Pos]);
+		ULONG Hash = (Sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+		int32_t Candidate = s_Table[Hash];
+		s_Table[Hash] = Pos;
+		if (Candidate < 0 || Pos - Candidate > LZ4_MAXIMUM_OFFSET || Read32(&Source[Candidate]) != Sequence) {
+			Pos++;
+			continue;
+		}
+
+		ULONG Match = Candidate;
+		ULONG MatchLength = LZ4_MINIMUM_MATCH;
+		while (Pos + MatchLength < Length - LZ4_LAST_LITERALS && Source[Match + MatchLength] == Source[Pos + MatchLength]) MatchLength++;
+		while (Pos > Anchor && Match > 0 && Source[Pos - 1] == Source[Match - 1]) {
+			Pos--;
+			Match--;
+			MatchLength++;
+		}
+
+		ULONG Literals = Pos - Anchor;
+		PUCHAR Token = Dest++;
+		*Token = (UCHAR)(((Literals < 15 ? Literals : 15) << 4) | (MatchLength - LZ4_MINIMUM_MATCH < 15 ? MatchLength - LZ4_MINIMUM_MATCH : 15));
+		if (Literals >= 15) Dest = Lz4PutLength(Dest, Literals - 15);
+		memcpy(Dest, &Source[Anchor], Literals);
+		Dest += Literals;
+		ULONG Offset = Pos - Match;
+		*Dest++ = (UCHAR)Offset;
+		*Dest++ = (UCHAR)(Offset >> 8);
+		if (MatchLength - LZ4_MINIMUM_MATCH >= 15) Dest = Lz4PutLength(Dest, MatchLength - LZ4_MINIMUM_MATCH - 15);
+
+		Pos += MatchLength;
+		Anchor = Pos;
+		if ((ULONG)(Dest - DestStart) >= Length) return 0;
+	}
+
+	ULONG Literals = Length - Anchor;
+	*Dest++ = (UCHAR)((Literals < 15 ? Literals : 15) << 4);
+	if (Literals >= 15) Dest = Lz4PutLength(Dest, Literals - 15);
+	memcpy(Dest, &Source[Anchor], Literals);
+	Dest += Literals;
+
+	ULONG Compressed = (ULONG)(Dest - DestStart);
+	return Compressed < Length ? Compressed : 0;
+}
+
+// The firmware's decompressor, from arcconfig.c, to check what was written.
+static bool Lz4Decompress(const UCHAR* Source, ULONG SourceLength, PUCHAR Dest, ULONG DestLength) {
+	const UCHAR* SourceEnd = Source + SourceLength;
+	PUCHAR DestStart = Dest;
+	PUCHAR DestEnd = Dest + DestLength;
+
+	while (Source < SourceEnd) {
+		UCHAR Token = *Source++;
+		ULONG Literals = Token >> 4;
+		if (Literals == 15) {
+			UCHAR Extra;
+			do {
+				if (Source == SourceEnd) return false;
+				Extra = *Source++;
+				Literals += Extra;
+			} while (Extra == 255);
+		}
+		if (Literals > (ULONG)(SourceEnd - Source) || Literals > (ULONG)(DestEnd - Dest)) return false;
+		memcpy(Dest, Source, Literals);
+		Dest += Literals;
+		Source += Literals;
+		if (Source == SourceEnd) break;
+
+		if ((SourceEnd - Source) < 2) return false;
+		ULONG Offset = Source[0] | (Source[1] << 8);
+		Source += 2;
+		if (Offset == 0 || Offset > (ULONG)(Dest - DestStart)) return false;
+		ULONG MatchLength = (Token & 15) + 4;
+		if ((Token & 15) == 15) {
+			UCHAR Extra;
+			do {
+				if (Source == SourceEnd) return false;
+				Extra = *Source++;
+				MatchLength += Extra;
+			} while (Extra == 255);
+		}
+		if (MatchLength > (ULONG)(DestEnd - Dest)) return false;
+
+		const UCHAR* Match = Dest - Offset;
+		for (ULONG i = 0; i < MatchLength; i++) *Dest++ = *Match++;
+	}
+
+	return Dest == DestEnd;
+}
+
+static PUCHAR ReadWholeFile(const char* Path, ULONG MaximumSize, PULONG Length) {
+	FILE* f = fopen(Path, "rb");
+	if (f == NULL) {
+		printf("Could not open %s\n", Path);
+		exit(-2);
+	}
+	fseek(f, 0, SEEK_END);
+	long Size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if (Size <= 0 || Size > MaximumSize) {
+		printf("%s is %ld bytes, it must be between 1 and %u\n", Path, Size, MaximumSize);
+		exit(-3);
+	}
+	PUCHAR Data = (PUCHAR)malloc(Size);
+	if (Data == NULL || fread(Data, 1, Size, f) != (size_t)Size) {
+		printf("Could not read %s\n", Path);
+		exit(-2);
+	}
+	fclose(f);
+	*Length = (ULONG)Size;
+	return Data;
+}
+
+static void WriteWholeFile(const char* Path, const void* Data, ULONG Length) {
+	FILE* f = fopen(Path, "wb");
+	if (f == NULL || fwrite(Data, 1, Length, f) != Length || fclose(f) != 0) {
+		printf("Could not write %s\n", Path);
+		exit(-2);
+	}
+}
+
+// Decompresses every block, checking the header the same way the firmware does. Returns NULL if anything is wrong.
+static PUCHAR Expand(const UCHAR* File, ULONG FileSize) {
+	const RAMDISK_COMPRESSED_HEADER* Header = (const RAMDISK_COMPRESSED_HEADER*)File;
+	if (FileSize < sizeof(*Header)) return NULL;
+	if (Header->Magic != RAMDISK_COMPRESSED_MAGIC || Header->Version != RAMDISK_COMPRESSED_VERSION) return NULL;
+	ULONG BlockSize = Header->BlockSize;
+	if (BlockSize < RAMDISK_MINIMUM_BLOCK_SIZE || BlockSize > RAMDISK_MAXIMUM_BLOCK_SIZE || (BlockSize & (BlockSize - 1)) != 0) return NULL;
+	if (Header->ImageSize == 0 || Header->ImageSize > RAMDISK_MAXIMUM_IMAGE_SIZE) return NULL;
+	if (Header->BlockCount != (Header->ImageSize + BlockSize - 1) / BlockSize) return NULL;
+	ULONG TableEnd = sizeof(*Header) + ((Header->BlockCount + 1) * sizeof(Header->Offsets[0]));
+	if (TableEnd > FileSize || Header->Offsets[0] < TableEnd) return NULL;
+
+	PUCHAR Image = (PUCHAR)malloc(Header->ImageSize);
+	if (Image == NULL) return NULL;
+	for (ULONG i = 0; i < Header->BlockCount; i++) {
+		ULONG Start = i * BlockSize;
+		ULONG Length = Header->ImageSize - Start;
+		if (Length > BlockSize) Length = BlockSize;
+		ULONG StoredStart = Header->Offsets[i], StoredEnd = Header->Offsets[i + 1];
+		if (StoredEnd < StoredStart || StoredEnd > FileSize || StoredEnd - StoredStart > Length) {
+			free(Image);
+			return NULL;
+		}
+		if (StoredEnd - StoredStart == Length) memcpy(&Image[Start], &File[StoredStart], Length);
+		else if (!Lz4Decompress(&File[StoredStart], StoredEnd - StoredStart, &Image[Start], Length)) {
+			printf("Block %u is corrupt\n", i);
+			free(Image);
+			return NULL;
+		}
+	}
+	return Image;
+}
+
+static bool LooksLikeFat(const UCHAR* Image, ULONG Length) {
+	if (Length < 512 || Image[510] != 0x55 || Image[511] != 0xAA) return false;
+	USHORT BytesPerSector = Image[11] | (Image[12] << 8);
+	return BytesPerSector == 512 && Image[13] != 0;
+}
+
+int main(int argc, char** argv) {
+	ULONG BlockSize = DEFAULT_BLOCK_SIZE;
+	bool Extract = false;
+	int arg = 1;
+	for (; arg < argc && argv[arg][0] == '-'; arg++) {
+		if (!strcmp(argv[arg], "-x")) {
+			Extract = true;
+			continue;
+		}
+		if (arg + 1 >= argc) BAD_ARGS(argv[0]);
+		if (!strcmp(argv[arg], "-b")) BlockSize = strtoul(argv[++arg], NULL, 0);
+		else BAD_ARGS(argv[0]);
+	}
+	if (arg + 2 != argc) BAD_ARGS(argv[0]);
+	if (BlockSize < RAMDISK_MINIMUM_BLOCK_SIZE || BlockSize > RAMDISK_MAXIMUM_BLOCK_SIZE || (BlockSize & (BlockSize - 1)) != 0) BAD_ARGS(argv[0]);
+	const char* InputPath = argv[arg];
+	const char* OutputPath = argv[arg + 1];
+
+	if (Extract) {
+		ULONG FileSize;
+		PUCHAR File = ReadWholeFile(InputPath, RAMDISK_MAXIMUM_FILE_SIZE, &FileSize);
+		PUCHAR Image = Expand(File, FileSize);
+		if (Image == NULL) {
+			printf("%s is not a valid compressed ramdisk\n", InputPath);
+			return -3;
+		}
+		ULONG ImageSize = ((PRAMDISK_COMPRESSED_HEADER)File)->ImageSize;
+		WriteWholeFile(OutputPath, Image, ImageSize);
+		printf("%u bytes expanded to %u bytes\n", FileSize, ImageSize);
+		return 0;
+	}
+
+	ULONG ImageSize;
+	PUCHAR Image = ReadWholeFile(InputPath, RAMDISK_MAXIMUM_IMAGE_SIZE, &ImageSize);
+	if (!LooksLikeFat(Image, ImageSize)) {
+		printf("%s does not look like a FAT disk image\n", InputPath);
+		return -3;
+	}
+
+	ULONG BlockCount = (ImageSize + BlockSize - 1) / BlockSize;
+	ULONG HeaderSize = sizeof(RAMDISK_COMPRESSED_HEADER) + ((BlockCount + 1) * sizeof(ULONG));
+	// Each block is at most its own size, stored; compressing only needs a little more than that before giving up.
+	PUCHAR File = (PUCHAR)calloc(1, HeaderSize + ImageSize);
+	PUCHAR Scratch = (PUCHAR)malloc(BlockSize + (BlockSize / 255) + 16);
+	if (File == NULL || Scratch == NULL) {
+		printf("Out of memory\n");
+		return -4;
+	}
+
+	PRAMDISK_COMPRESSED_HEADER Header = (PRAMDISK_COMPRESSED_HEADER)File;
+	Header->Magic = RAMDISK_COMPRESSED_MAGIC;
+	Header->Version = RAMDISK_COMPRESSED_VERSION;
+	Header->ImageSize = ImageSize;
+	Header->BlockSize = BlockSize;
+	Header->BlockCount = BlockCount;
+
+	ULONG Offset = HeaderSize;
+	ULONG StoredBlocks = 0;
+	for (ULONG i = 0; i < BlockCount; i++) {
+		ULONG Start = i * BlockSize;
+		ULONG Length = ImageSize - Start;
+		if (Length > BlockSize) Length = BlockSize;
+		Header->Offsets[i] = Offset;
+		ULONG Compressed = Lz4Compress(&Image[Start], Length, Scratch);
+		if (Compressed == 0) {
+			memcpy(&File[Offset], &Image[Start], Length);
+			Offset += Length;
+			StoredBlocks++;
+		}
+		else {
+			memcpy(&File[Offset], Scratch, Compressed);
+			Offset += Compressed;
+		}
+	}
+	Header->Offsets[BlockCount] = Offset;
+
+	PUCHAR Check = Expand(File, Offset);
+	if (Check == NULL || memcmp(Check, Image, ImageSize) != 0) {
+		printf("Compressed image does not expand back to the original\n");
+		return -5;
+	}
+
+	WriteWholeFile(OutputPath, File, Offset);
+	printf("%u bytes in %u blocks of 0x%x (%u stored) compressed to %u bytes, %u%%\n", ImageSize, BlockCount, BlockSize, StoredBlocks, Offset, (ULONG)(((uint64_t)Offset * 100) / ImageSize));
+	if (Offset > RAMDISK_MAXIMUM_FILE_SIZE) {
+		printf("Warning: the firmware does not load a drivers.img larger than %u bytes\n", RAMDISK_MAXIMUM_FILE_SIZE);
+		return 1;
+	}
+	if (Offset > LOADER_MAXIMUM_FILE_SIZE) printf("Warning: the Open Firmware loaders do not load a drivers.img larger than %u bytes\n", LOADER_MAXIMUM_FILE_SIZE);
+	return 0;
+}
@@ -0,0 +1,255 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#pragma GCC diagnostic ignored "-Wscalar-storage-order"
+
+#include "pereloc.h"
+
+enum {
+	DEFAULT_ITERATIONS = 200,
+	DEFAULT_DIFF = 0x00100000
+};
+
+// The relocation routine as it was before pereloc.h, which the fast path must match byte for byte.
+static bool RelocatePEBlockReference(PUCHAR VirtualAddress, ULONG Length, PU16LE Block, LONG Diff, bool IsLittleEndian) {
+	for (ULONG Index = 0; Index < Length; Index++) {
+		USHORT Offset = Block[Index].v;
+		USHORT Type = Offset >> 12;
+		Offset &= (ARC_BIT(12) - 1);
+		PUCHAR FixupVA = VirtualAddress + Offset;
+		PU16BE DataBig = (PU16BE)FixupVA;
+		PU16LE DataLittle = (PU16LE)FixupVA;
+		switch (Type) {
+		case IMAGE_REL_BASED_HIGHLOW:
+		{
+			U32LE BaseLittle;
+			U32BE BaseBig;
+			if (IsLittleEndian) {
+				memcpy(&BaseLittle, FixupVA, sizeof(BaseLittle));
+				BaseLittle.v += Diff;
+				memcpy(FixupVA, &BaseLittle, sizeof(BaseLittle));
+			} else {
+				memcpy(&BaseBig, FixupVA, sizeof(BaseBig));
+				BaseBig.v += Diff;
+				memcpy(FixupVA, &BaseBig, sizeof(BaseBig));
+			}
+		}
+		break;
+
+		case IMAGE_REL_BASED_HIGH:
+		{
+			ULONG Temp = (IsLittleEndian ? DataLittle->v : DataBig->v) << 16;
+			Temp += Diff;
+			if (IsLittleEndian) DataLittle->v = (Temp >> 16);
+			else DataBig->v = (Temp >> 16);
+		}
+		break;
+
+		case IMAGE_REL_BASED_HIGHADJ:
+		{
+			if (Index + 1 >= Length) return false;
+			ULONG Temp = (IsLittleEndian ? DataLittle->v : DataBig->v) << 16;
+			Index++;
+			PU16BE BlockBig = (PU16BE)Block;
+			Temp += (IsLittleEndian ? Block[Index].v : BlockBig[Index].v);
+			Temp += Diff;
+			Temp += INT16_MAX + 1;
+
+			if (IsLittleEndian) DataLittle->v = (Temp >> 16);
+			else DataBig->v = (Temp >> 16);
+		}
+		break;
+
+		case IMAGE_REL_BASED_LOW:
+		{
+			ULONG Temp = (IsLittleEndian ? DataLittle->v : DataBig->v);
+			Temp += Diff;
+			if (IsLittleEndian) DataLittle->v = Temp;
+			else DataBig->v = Temp;
+		}
+		break;
+
+		case IMAGE_REL_BASED_ABSOLUTE:
+			break;
+
+		default:
+			return false;
+		}
+	}
+
+	return true;
+}
+
+typedef struct _LOADED_IMAGE {
+	PUCHAR Image;
+	ULONG SizeOfImage;
+	ULONG RelocOffset;
+	ULONG RelocSize;
+	ULONG Relocations;
+	bool IsLittleEndian;
+} LOADED_IMAGE, *PLOADED_IMAGE;
+
+// Lays out a COFF file the way ArcLoad does, each section at its virtual address.
+static bool LoadImage(const char* Path, PLOADED_IMAGE Loaded) {
+	FILE* f = fopen(Path, "rb");
+	if (f == NULL) {
+		printf("%s: could not open\n", Path);
+		return false;
+	}
+	fseek(f, 0, SEEK_END);
+	long Length = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	PUCHAR File = malloc(Length);
+	if (File == NULL || fread(File, 1, Length, f) != (size_t)Length) {
+		printf("%s: could not read\n", Path);
+		fclose(f);
+		free(File);
+		return false;
+	}
+	fclose(f);
+
+	bool Ret = false;
+	do {
+		PIMAGE_FILE_HEADER FileHeader = (PIMAGE_FILE_HEADER)File;
+		if (Length < (long)(sizeof(*FileHeader) + sizeof(IMAGE_OPTIONAL_HEADER)) ||
+			(FileHeader->Machine != IMAGE_FILE_MACHINE_POWERPC && FileHeader->Machine != IMAGE_FILE_MACHINE_POWERPCBE) ||
+			FileHeader->SizeOfOptionalHeader < sizeof(IMAGE_OPTIONAL_HEADER)) {
+			printf("%s: not a PowerPC COFF\n", Path);
+			break;
+		}
+		PIMAGE_OPTIONAL_HEADER OptionalHeader = (PIMAGE_OPTIONAL_HEADER)&FileHeader[1];
+		PIMAGE_SECTION_HEADER Sections = (PIMAGE_SECTION_HEADER)((PUCHAR)OptionalHeader + FileHeader->SizeOfOptionalHeader);
+		if ((PUCHAR)&Sections[FileHeader->NumberOfSections] > File + Length) {
+			printf("%s: section table is truncated\n", Path);
+			break;
+		}
+		PIMAGE_DATA_DIRECTORY RelocDir = &OptionalHeader->DataDirectory[IMAGE_DIRECTORY_ENTRY_BASERELOC];
+		if (RelocDir->VirtualAddress == 0 || RelocDir->Size == 0) {
+			printf("%s: has no base relocations\n", Path);
+			break;
+		}
+
+		Loaded->SizeOfImage = OptionalHeader->SizeOfImage;
+		Loaded->Image = calloc(1, Loaded->SizeOfImage + sizeof(ULONG));
+		if (Loaded->Image == NULL) break;
+		bool Valid = true;
+		for (ULONG i = 0; i < FileHeader->NumberOfSections; i++) {
+			PIMAGE_SECTION_HEADER Section = &Sections[i];
+			if ((Section->Characteristics & (IMAGE_SCN_CNT_CODE | IMAGE_SCN_CNT_INITIALIZED_DATA)) == 0) continue;
+			if (Section->VirtualAddress + Section->SizeOfRawData > Loaded->SizeOfImage ||
+				Section->PointerToRawData + Section->SizeOfRawData > (ULONG)Length) {
+				printf("%s: section %d is out of bounds\n", Path, i);
+				Valid = false;
+				break;
+			}
+			memcpy(Loaded->Image + Section->VirtualAddress, File + Section->PointerToRawData, Section->SizeOfRawData);
+		}
+		if (!Valid || RelocDir->VirtualAddress + RelocDir->Size > Loaded->SizeOfImage) {
+			if (Valid) printf("%s: relocations are out of bounds\n", Path);
+			free(Loaded->Image);
+			break;
+		}
+		Loaded->RelocOffset = RelocDir->VirtualAddress;
+		Loaded->RelocSize = RelocDir->Size;
+		Loaded->IsLittleEndian = FileHeader->Machine == IMAGE_FILE_MACHINE_POWERPC;
+		Ret = true;
+	} while (false);
+
+	free(File);
+	return Ret;
+}
+
+// Applies every base relocation block of an image, with the reference or the fast routine.
+static bool RelocateImage(PLOADED_IMAGE Loaded, PUCHAR Image, LONG Diff, bool Fast) {
+	ULONG Relocations = 0;
+	for (ULONG Offset = 0; Offset < Loaded->RelocSize;) {
+		PIMAGE_BASE_RELOCATION Block = (PIMAGE_BASE_RELOCATION)(Image + Loaded->RelocOffset + Offset);
+		if (Block->SizeOfBlock < sizeof(IMAGE_BASE_RELOCATION) || Offset + Block->SizeOfBlock > Loaded->RelocSize) return false;
+		// A fixup can straddle the end of its page, but not the end of the image.
+		if (Block->VirtualAddress + ARC_BIT(12) > Loaded->SizeOfImage) return false;
+		ULONG Length = (Block->SizeOfBlock - sizeof(IMAGE_BASE_RELOCATION)) / sizeof(USHORT);
+		PUCHAR Page = Image + Block->VirtualAddress;
+		if (Fast) {
+			USHORT Type;
+			if (PeRelocateBlock(Page, Length, (PU16LE)&Block[1], Diff, Loaded->IsLittleEndian, &Type) != PE_RELOC_OK) return false;
+		} else {
+			if (!RelocatePEBlockReference(Page, Length, (PU16LE)&Block[1], Diff, Loaded->IsLittleEndian)) return false;
+		}
+		Relocations += Length;
+		Offset += Block->SizeOfBlock;
+	}
+	Loaded->Relocations = Relocations;
+	return true;
+}
+
+static double NowUs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+// Times relocating the image repeatedly. The relocations section itself is never a fixup target, so this is stable.
+static double Benchmark(PLOADED_IMAGE Loaded, PUCHAR Image, LONG Diff, bool Fast, int Iterations) {
+	double Start = NowUs();
+	for (int i = 0; i < Iterations; i++) RelocateImage(Loaded, Image, Diff, Fast);
+	return (NowUs() - Start) / Iterations;
+}
+
+int main(int argc, char** argv) {
+	int Iterations = DEFAULT_ITERATIONS;
+	LONG Diff = DEFAULT_DIFF;
+	int arg = 1;
+	for (; arg < argc && argv[arg][0] == '-'; arg++) {
+		if (!strcmp(argv[arg], "-n") && arg + 1 < argc) Iterations = atoi(argv[++arg]);
+		else if (!strcmp(argv[arg], "-d") && arg + 1 < argc) Diff = (LONG)strtoul(argv[++arg], NULL, 0);
+		else break;
+	}
+	if (arg >= argc || Iterations <= 0) {
+		printf("Usage: %s [-n iterations] [-d diff] <coff>...\n", argv[0]);
+		return -1;
+	}
+
+	int Failed = 0;
+	for (; arg < argc; arg++) {
+		LOADED_IMAGE Loaded;
+		if (!LoadImage(argv[arg], &Loaded)) {
+			Failed++;
+			continue;
+		}
+
+		PUCHAR Reference = malloc(Loaded.SizeOfImage + sizeof(ULONG));
+		PUCHAR Fast = malloc(Loaded.SizeOfImage + sizeof(ULONG));
+		memcpy(Reference, Loaded.Image, Loaded.SizeOfImage + sizeof(ULONG));
+		memcpy(Fast, Loaded.Image, Loaded.SizeOfImage + sizeof(ULONG));
+
+		bool RefOk = RelocateImage(&Loaded, Reference, Diff, false);
+		bool FastOk = RelocateImage(&Loaded, Fast, Diff, true);
+		if (RefOk != FastOk) {
+			printf("%s: MISMATCH, reference %s but fast path %s\n", argv[arg], RefOk ? "succeeded" : "failed", FastOk ? "succeeded" : "failed");
+			Failed++;
+		} else if (!RefOk) {
+			printf("%s: relocations are invalid\n", argv[arg]);
+			Failed++;
+		} else if (memcmp(Reference, Fast, Loaded.SizeOfImage) != 0) {
+			ULONG Offset = 0;
+			while (Reference[Offset] == Fast[Offset]) Offset++;
+			printf("%s: MISMATCH at image offset %08x\n", argv[arg], Offset);
+			Failed++;
+		} else {
+			double RefUs = Benchmark(&Loaded, Reference, Diff, false, Iterations);
+			double FastUs = Benchmark(&Loaded, Fast, Diff, true, Iterations);
+			printf("%s: %u relocations, reference %.1fus, fast %.1fus (%.2fx)\n",
+				argv[arg], Loaded.Relocations, RefUs, FastUs, RefUs / FastUs);
+		}
+
+		free(Reference);
+		free(Fast);
+		free(Loaded.Image);
+	}
+
+	return Failed;
+}
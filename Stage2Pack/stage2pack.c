@@ -0,0 +1,331 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#pragma GCC diagnostic ignored "-Wscalar-storage-order"
+
+#define ARC_LE __attribute__((scalar_storage_order("little-endian")))
+
+typedef uint8_t UCHAR, * PUCHAR;
+typedef uint16_t USHORT, * PUSHORT;
+typedef uint32_t ULONG, * PULONG;
+
+// Compressed stage2.elf format, from the loaders' main.c.
+enum {
+	STAGE2_COMPRESSED_MAGIC = 0x5A4C3253, // 'S2LZ'
+	STAGE2_COMPRESSED_VERSION = 1,
+};
+
+typedef struct ARC_LE _STAGE2_COMPRESSED_HEADER {
+	ULONG Magic;
+	ULONG Version;
+	ULONG HeadersSize;
+	ULONG FileSize;
+} STAGE2_COMPRESSED_HEADER, *PSTAGE2_COMPRESSED_HEADER;
+
+// The parts of the ELF format needed here.
+enum {
+	EM_PPC = 20,
+	ET_EXEC = 2,
+	PT_LOAD = 1,
+};
+
+typedef struct ARC_LE _ELF32_EHDR {
+	UCHAR e_ident[16];
+	USHORT e_type;
+	USHORT e_machine;
+	ULONG e_version;
+	ULONG e_entry;
+	ULONG e_phoff;
+	ULONG e_shoff;
+	ULONG e_flags;
+	USHORT e_ehsize;
+	USHORT e_phentsize;
+	USHORT e_phnum;
+	USHORT e_shentsize;
+	USHORT e_shnum;
+	USHORT e_shstrndx;
+} ELF32_EHDR, *PELF32_EHDR;
+
+typedef struct ARC_LE _ELF32_PHDR {
+	ULONG p_type;
+	ULONG p_offset;
+	ULONG p_vaddr;
+	ULONG p_paddr;
+	ULONG p_filesz;
+	ULONG p_memsz;
+	ULONG p_flags;
+	ULONG p_align;
+} ELF32_PHDR, *PELF32_PHDR;
+
+enum {
+	// Largest stage2.elf the Mac99 loader reads.
+	LOADER_MAXIMUM_FILE_SIZE = 0x100000,
+	// Space for stage2.elf in boot.img, written to the boot partition by the firmware.
+	BOOT_PARTITION_STAGE2_SIZE = 224 * 1024,
+	// An LZ4 block ends with at least this many literals, and its last match starts at least this far from the end.
+	LZ4_LAST_LITERALS = 5,
+	LZ4_MATCH_LIMIT = 12,
+	LZ4_MINIMUM_MATCH = 4,
+	LZ4_MAXIMUM_OFFSET = 0xFFFF,
+	LZ4_HASH_BITS = 16,
+};
+
+static void BAD_ARGS(const char* Self) {
+	printf("Usage: %s <stage2.elf> <output>\n", Self);
+	exit(-1);
+}
+
+static ULONG Read32(const UCHAR* p) {
+	ULONG Value;
+	memcpy(&Value, p, sizeof(Value));
+	return Value;
+}
+
+static PUCHAR Lz4PutLength(PUCHAR Dest, ULONG Length) {
+	for (; Length >= 255; Length -= 255) *Dest++ = 255;
+	*Dest++ = (UCHAR)Length;
+	return Dest;
+}
+
+static ULONG Lz4CompressBound(ULONG Length) {
+	return Length + (Length / 255) + 16;
+}
+
+// Greedy LZ4 block compressor, remembering the last position of each 4-byte sequence.
+// Dest must hold Lz4CompressBound(Length) bytes. Returns the compressed length.
+static ULONG Lz4Compress(const UCHAR* Source, ULONG Length, PUCHAR Dest) {
+	static int32_t s_Table[1 << LZ4_HASH_BITS];
+	for (ULONG i = 0; i < (1 << LZ4_HASH_BITS); i++) s_Table[i] = -1;
+
+	PUCHAR DestStart = Dest;
+	ULONG Anchor = 0;
+	ULONG Pos = 0;
+	ULONG MatchLimit = Length > LZ4_MATCH_LIMIT ? Length - LZ4_MATCH_LIMIT : 0;
+	while (Pos < MatchLimit) {
+		ULONG Sequence = Read32(&Source[Pos]);
+		ULONG Hash = (Sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+		int32_t Candidate = s_Table[Hash];
+		s_Table[Hash] = Pos;
+		if (Candidate < 0 || Pos - Candidate > LZ4_MAXIMUM_OFFSET || Read32(&Source[Candidate]) != Sequence) {
+			Pos++;
+			continue;
+		}
+
+		ULONG Match = Candidate;
+		ULONG MatchLength = LZ4_MINIMUM_MATCH;
+		while (Pos + MatchLength < Length - LZ4_LAST_LITERALS && Source[Match + MatchLength] == Source[Pos + MatchLength]) MatchLength++;
+		while (Pos > Anchor && Match > 0 && Source[Pos - 1] == Source[Match - 1]) {
+			Pos--;
+			Match--;
+			MatchLength++;
+		}
+
+		ULONG Literals = Pos - Anchor;
+		PUCHAR Token = Dest++;
+		*Token = (UCHAR)(((Literals < 15 ? Literals : 15) << 4) | (MatchLength - LZ4_MINIMUM_MATCH < 15 ? MatchLength - LZ4_MINIMUM_MATCH : 15));
+		if (Literals >= 15) Dest = Lz4PutLength(Dest, Literals - 15);
+		memcpy(Dest, &Source[Anchor], Literals);
+		Dest += Literals;
+		ULONG Offset = Pos - Match;
+		*Dest++ = (UCHAR)Offset;
+		*Dest++ = (UCHAR)(Offset >> 8);
+		if (MatchLength - LZ4_MINIMUM_MATCH >= 15) Dest = Lz4PutLength(Dest, MatchLength - LZ4_MINIMUM_MATCH - 15);
+
+		Pos += MatchLength;
+		Anchor = Pos;
+	}
+
+	ULONG Literals = Length - Anchor;
+	*Dest++ = (UCHAR)((Literals < 15 ? Literals : 15) << 4);
+	if (Literals >= 15) Dest = Lz4PutLength(Dest, Literals - 15);
+	memcpy(Dest, &Source[Anchor], Literals);
+	Dest += Literals;
+	return (ULONG)(Dest - DestStart);
+}
+
+// The loaders' decompressor, from their main.c, to check what was written.
+static bool Lz4DecompressSwap64(const UCHAR* src, ULONG srclen, UCHAR* dest, ULONG len) {
+	const UCHAR* srcend = src + srclen;
+	ULONG out = 0;
+
+	while (src < srcend) {
+		UCHAR token = *src++;
+		ULONG literals = token >> 4;
+		if (literals == 15) {
+			UCHAR extra;
+			do {
+				if (src == srcend) return false;
+				extra = *src++;
+				literals += extra;
+			} while (extra == 255);
+		}
+		if (literals > (ULONG)(srcend - src) || literals > len - out) return false;
+		for (; literals != 0 && (out & 7) != 0; literals--) dest[(out++) ^ 7] = *src++;
+		for (; literals >= sizeof(uint64_t); literals -= sizeof(uint64_t), out += sizeof(uint64_t), src += sizeof(uint64_t)) {
+			uint64_t val64;
+			memcpy(&val64, src, sizeof(val64));
+			*(uint64_t*)&dest[out] = __builtin_bswap64(val64);
+		}
+		for (; literals != 0; literals--) dest[(out++) ^ 7] = *src++;
+		if (src == srcend) break;
+
+		if ((srcend - src) < 2) return false;
+		ULONG offset = src[0] | (src[1] << 8);
+		src += 2;
+		if (offset == 0 || offset > out) return false;
+		ULONG matchlen = (token & 15) + 4;
+		if ((token & 15) == 15) {
+			UCHAR extra;
+			do {
+				if (src == srcend) return false;
+				extra = *src++;
+				matchlen += extra;
+			} while (extra == 255);
+		}
+		if (matchlen > len - out) return false;
+
+		ULONG from = out - offset;
+		if ((offset & 7) == 0) {
+			for (; matchlen != 0 && (out & 7) != 0; matchlen--) dest[(out++) ^ 7] = dest[(from++) ^ 7];
+			for (; matchlen >= sizeof(uint64_t); matchlen -= sizeof(uint64_t), out += sizeof(uint64_t), from += sizeof(uint64_t))
+				*(uint64_t*)&dest[out] = *(uint64_t*)&dest[from];
+		}
+		for (; matchlen != 0; matchlen--) dest[(out++) ^ 7] = dest[(from++) ^ 7];
+	}
+
+	return out == len;
+}
+
+// Checks a compressed segment against what the loader's MsrLeSwap64 does to the original.
+static bool CheckSegment(const UCHAR* Compressed, ULONG CompressedLength, const UCHAR* Original, ULONG Length) {
+	ULONG Aligned = (Length + 7) & ~7;
+	uint64_t* Buffer = (uint64_t*)calloc(1, Aligned);
+	PUCHAR Expected = (PUCHAR)calloc(1, Aligned);
+	if (Buffer == NULL || Expected == NULL) {
+		printf("Out of memory\n");
+		exit(-4);
+	}
+	for (ULONG i = 0; i < Length; i++) Expected[i ^ 7] = Original[i];
+	bool Valid = Lz4DecompressSwap64(Compressed, CompressedLength, (PUCHAR)Buffer, Length) && !memcmp(Buffer, Expected, Aligned);
+	free(Buffer);
+	free(Expected);
+	return Valid;
+}
+
+static PUCHAR ReadWholeFile(const char* Path, PULONG Length) {
+	FILE* f = fopen(Path, "rb");
+	if (f == NULL) {
+		printf("Could not open %s\n", Path);
+		exit(-2);
+	}
+	fseek(f, 0, SEEK_END);
+	long Size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if (Size <= 0 || Size > LOADER_MAXIMUM_FILE_SIZE * 16) {
+		printf("%s is %ld bytes, too big to be stage2\n", Path, Size);
+		exit(-3);
+	}
+	PUCHAR Data = (PUCHAR)malloc(Size);
+	if (Data == NULL || fread(Data, 1, Size, f) != (size_t)Size) {
+		printf("Could not read %s\n", Path);
+		exit(-2);
+	}
+	fclose(f);
+	*Length = (ULONG)Size;
+	return Data;
+}
+
+// The same checks as the loaders' ElfValid and ElfLoad, so a file that would not load is not packed.
+static bool ElfCheck(const UCHAR* Elf, ULONG Length) {
+	if (Length < sizeof(ELF32_EHDR)) return false;
+	const ELF32_EHDR* Ehdr = (const ELF32_EHDR*)Elf;
+	if (memcmp(Ehdr->e_ident, "\x7f" "ELF", 4) != 0) return false;
+	// 32-bit, little endian, current version
+	if (Ehdr->e_ident[4] != 1 || Ehdr->e_ident[5] != 1 || Ehdr->e_ident[6] != 1) return false;
+	if (Ehdr->e_type != ET_EXEC || Ehdr->e_machine != EM_PPC) return false;
+	if (Ehdr->e_phoff == 0 || Ehdr->e_phnum == 0 || Ehdr->e_phentsize != sizeof(ELF32_PHDR)) return false;
+	if (Ehdr->e_phoff > Length || (Ehdr->e_phnum * sizeof(ELF32_PHDR)) > Length - Ehdr->e_phoff) return false;
+
+	const ELF32_PHDR* Phdrs = (const ELF32_PHDR*)&Elf[Ehdr->e_phoff];
+	for (ULONG i = 0; i < Ehdr->e_phnum; i++) {
+		if (Phdrs[i].p_type != PT_LOAD || Phdrs[i].p_filesz == 0) continue;
+		if (Phdrs[i].p_filesz > Phdrs[i].p_memsz) return false;
+		if (Phdrs[i].p_offset > Length || Phdrs[i].p_filesz > Length - Phdrs[i].p_offset) return false;
+		// Segments are decompressed straight into place, 64 bits at a time.
+		if ((Phdrs[i].p_paddr & 7) != 0) {
+			printf("Segment %u is not 64-bit aligned\n", i);
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char** argv) {
+	if (argc != 3) BAD_ARGS(argv[0]);
+
+	ULONG Length;
+	PUCHAR Elf = ReadWholeFile(argv[1], &Length);
+	if (!ElfCheck(Elf, Length)) {
+		printf("%s is not a loadable little endian PowerPC ELF\n", argv[1]);
+		return -3;
+	}
+	const ELF32_EHDR* Ehdr = (const ELF32_EHDR*)Elf;
+	const ELF32_PHDR* Phdrs = (const ELF32_PHDR*)&Elf[Ehdr->e_phoff];
+
+	ULONG HeadersSize = Ehdr->e_phoff + (Ehdr->e_phnum * sizeof(ELF32_PHDR));
+	if (HeadersSize < sizeof(ELF32_EHDR)) HeadersSize = sizeof(ELF32_EHDR);
+
+	ULONG Capacity = sizeof(STAGE2_COMPRESSED_HEADER) + HeadersSize;
+	for (ULONG i = 0; i < Ehdr->e_phnum; i++) {
+		if (Phdrs[i].p_type != PT_LOAD || Phdrs[i].p_filesz == 0) continue;
+		Capacity += sizeof(ULONG) + Lz4CompressBound(Phdrs[i].p_filesz);
+	}
+	PUCHAR File = (PUCHAR)calloc(1, Capacity);
+	if (File == NULL) {
+		printf("Out of memory\n");
+		return -4;
+	}
+
+	PSTAGE2_COMPRESSED_HEADER Header = (PSTAGE2_COMPRESSED_HEADER)File;
+	Header->Magic = STAGE2_COMPRESSED_MAGIC;
+	Header->Version = STAGE2_COMPRESSED_VERSION;
+	Header->HeadersSize = HeadersSize;
+	memcpy(&File[sizeof(*Header)], Elf, HeadersSize);
+
+	ULONG Offset = sizeof(*Header) + HeadersSize;
+	ULONG Loaded = 0;
+	for (ULONG i = 0; i < Ehdr->e_phnum; i++) {
+		if (Phdrs[i].p_type != PT_LOAD || Phdrs[i].p_filesz == 0) continue;
+		const UCHAR* Segment = &Elf[Phdrs[i].p_offset];
+		ULONG Compressed = Lz4Compress(Segment, Phdrs[i].p_filesz, &File[Offset + sizeof(ULONG)]);
+		File[Offset + 0] = (UCHAR)Compressed;
+		File[Offset + 1] = (UCHAR)(Compressed >> 8);
+		File[Offset + 2] = (UCHAR)(Compressed >> 16);
+		File[Offset + 3] = (UCHAR)(Compressed >> 24);
+		if (!CheckSegment(&File[Offset + sizeof(ULONG)], Compressed, Segment, Phdrs[i].p_filesz)) {
+			printf("Segment %u does not decompress back to the original\n", i);
+			return -5;
+		}
+		printf("Segment %u: 0x%08x, %u bytes compressed to %u\n", i, Phdrs[i].p_paddr, Phdrs[i].p_filesz, Compressed);
+		Offset += sizeof(ULONG) + Compressed;
+		Loaded += Phdrs[i].p_filesz;
+	}
+	Header->FileSize = Offset;
+
+	FILE* f = fopen(argv[2], "wb");
+	if (f == NULL || fwrite(File, 1, Offset, f) != Offset || fclose(f) != 0) {
+		printf("Could not write %s\n", argv[2]);
+		return -2;
+	}
+
+	printf("%u bytes (%u loaded) compressed to %u bytes, %u%%\n", Length, Loaded, Offset, (ULONG)(((uint64_t)Offset * 100) / Length));
+	if (Offset > LOADER_MAXIMUM_FILE_SIZE) {
+		printf("Warning: the Mac99 loader does not load a stage2.elf larger than %u bytes\n", LOADER_MAXIMUM_FILE_SIZE);
+		return 1;
+	}
+	if (Offset > BOOT_PARTITION_STAGE2_SIZE) printf("Warning: stage2.elf larger than %u bytes does not fit in the boot partition\n", BOOT_PARTITION_STAGE2_SIZE);
+	return 0;
+}
@@ -0,0 +1,691 @@
+// Host build of the firmware storage stack, for benchmarking it against disk images.
+// The deblocker, sector cache, partition code and filesystems are the firmware's own sources, built unchanged.
+// This file stands in for everything below them (the IDE driver, over image files) and beside them (the component tree, environment and memory allocator).
+
+#define _GNU_SOURCE
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <malloc.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// arc.h truncates K0 addresses to 32 bits, which is what this host build wants.
+#pragma GCC diagnostic ignored "-Wpointer-to-int-cast"
+
+#include "arc.h"
+#include "arcdevice.h"
+#include "arcconfig.h"
+#include "arcdisk.h"
+#include "arcenv.h"
+#include "arcio.h"
+#include "arcmem.h"
+#include "arctrace.h"
+#include "arcdiskcache.h"
+#include "usb.h"
+#include "usbmsc.h"
+#include "ide.h"
+
+enum {
+	MAXIMUM_IMAGES = 8, // one per emulated IDE channel, the firmware supports 8 drives
+	MAXIMUM_SLOTS = 16, // open files a trace can refer to
+	MAXIMUM_COMPONENTS = 64,
+	MAXIMUM_DEVICE_KEYS = 64,
+	MAXIMUM_FILES = 256, // rows in the per-file report
+	BENCH_PATH_SIZE = 128,
+	TRACE_LINE_LENGTH = 512,
+	READ_BUFFER_SIZE = 0x200000,
+	MEMORY_POOL_SIZE = 0x800000, // for ArcMemAllocTemp, the sector cache lives here
+	DEFAULT_COMMAND_US = 150, // device model: cost of each command
+	DEFAULT_BANDWIDTH_KBPS = 8192, // device model: transfer rate
+	FNV_OFFSET_BASIS = 0x811c9dc5,
+	FNV_PRIME = 0x01000193,
+};
+
+// Counters for the emulated devices.
+typedef struct _DEVICE_COUNTERS {
+	ULONG Reads; // Read commands.
+	ULONG AsyncReads; // Of which started without waiting.
+	ULONG Writes; // Write commands.
+	uint64_t BytesRead;
+	uint64_t BytesWritten;
+	ULONG Mounts; // Filesystem mounts.
+	ULONG DeviceOpens; // Devices opened by ArcOpen.
+} DEVICE_COUNTERS, *PDEVICE_COUNTERS;
+
+static DEVICE_COUNTERS s_Counters = { 0 };
+
+// Emulated IDE: one channel per image, with the drive as master.
+
+typedef struct _BENCH_IMAGE {
+	const char* Path;
+	PUCHAR Data; // Private mapping, writes never reach the image file.
+	size_t Length;
+} BENCH_IMAGE, *PBENCH_IMAGE;
+
+static BENCH_IMAGE s_Images[MAXIMUM_IMAGES];
+static IDE_CHANNEL s_Channels[MAXIMUM_IMAGES];
+static ULONG s_ImageCount = 0;
+static bool s_InFlight = false;
+
+static PBENCH_IMAGE IdeImageForDrive(PIDE_DRIVE drive) {
+	return &s_Images[drive->channel->channel];
+}
+
+static bool IdeImageInRange(PIDE_DRIVE drive, ULONG sector, ULONG count) {
+	return count <= drive->max_sectors && sector < drive->sectors && count <= drive->sectors - sector;
+}
+
+PIDE_DRIVE ob_ide_open(int channel, int unit) {
+	if (channel < 0 || channel >= s_ImageCount || unit != 0) return NULL;
+	return &s_Channels[channel].drives[unit];
+}
+
+ULONG ob_ide_read_blocks(PIDE_DRIVE drive, PVOID buffer, ULONG sector, ULONG count) {
+	if (!IdeImageInRange(drive, sector, count)) return 0;
+	s_Counters.Reads++;
+	s_Counters.BytesRead += (uint64_t)count * drive->bs;
+	memcpy(buffer, &IdeImageForDrive(drive)->Data[(uint64_t)sector * drive->bs], (size_t)count * drive->bs);
+	return count;
+}
+
+ULONG ob_ide_write_blocks(PIDE_DRIVE drive, PVOID buffer, ULONG sector, ULONG count) {
+	if (drive->type == ide_type_atapi || !IdeImageInRange(drive, sector, count)) return 0;
+	s_Counters.Writes++;
+	s_Counters.BytesWritten += (uint64_t)count * drive->bs;
+	memcpy(&IdeImageForDrive(drive)->Data[(uint64_t)sector * drive->bs], buffer, (size_t)count * drive->bs);
+	return count;
+}
+
+ULONG ob_ide_read_blocks_start(PIDE_DRIVE drive, PVOID buffer, ULONG sector, ULONG count) {
+	// The transfer is done by the time the caller polls, which is what a fast enough drive would look like.
+	// Like ide.c, start at most one command's worth.
+	if (count > drive->max_sectors) count = drive->max_sectors;
+	if (ob_ide_read_blocks(drive, buffer, sector, count) != count) return 0;
+	s_Counters.AsyncReads++;
+	s_InFlight = true;
+	return count;
+}
+
+int ob_ide_read_blocks_poll(PIDE_DRIVE drive) {
+	if (!s_InFlight) return 1;
+	s_InFlight = false;
+	return 0;
+}
+
+bool ob_ide_eject(PIDE_DRIVE drive) {
+	return drive->type == ide_type_atapi;
+}
+
+bool ob_ide_media_changed(PIDE_DRIVE drive) {
+	// The image stays the same, but a trace can make the drive report a swap, as ide.c does for a unit attention.
+	bool Changed = drive->media_changed != 0;
+	drive->media_changed = 0;
+	return Changed;
+}
+
+const IDE_CHANNEL* ob_ide_get_first_channel(void) {
+	if (s_ImageCount == 0) return NULL;
+	return &s_Channels[0];
+}
+
+// USB is not emulated.
+int readwrite_blocks(usbdev_t* dev, int start, int n, cbw_direction dir, u8* buf) {
+	return -1;
+}
+
+static bool BenchImageIsCdrom(const char* Path) {
+	size_t Length = strlen(Path);
+	return Length > 4 && strcasecmp(&Path[Length - 4], ".iso") == 0;
+}
+
+static bool BenchImageAdd(const char* Path) {
+	if (s_ImageCount == MAXIMUM_IMAGES) {
+		printf("%s: too many images\n", Path);
+		return false;
+	}
+	int fd = open(Path, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		printf("%s: could not open\n", Path);
+		if (fd >= 0) close(fd);
+		return false;
+	}
+	PUCHAR Data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (Data == MAP_FAILED) {
+		printf("%s: could not map\n", Path);
+		return false;
+	}
+
+	ULONG Index = s_ImageCount;
+	PBENCH_IMAGE Image = &s_Images[Index];
+	Image->Path = Path;
+	Image->Data = Data;
+	Image->Length = st.st_size;
+
+	PIDE_CHANNEL Channel = &s_Channels[Index];
+	memset(Channel, 0, sizeof(*Channel));
+	Channel->channel = Index;
+	Channel->present = 1;
+	if (Index != 0) s_Channels[Index - 1].next = Channel;
+
+	// Same geometry as ide.c gives a drive of each kind.
+	PIDE_DRIVE Drive = &Channel->drives[0];
+	Drive->unit = 0;
+	Drive->present = 1;
+	Drive->channel = Channel;
+	snprintf(Drive->model, sizeof(Drive->model), "%s", Path);
+	if (BenchImageIsCdrom(Path)) {
+		Drive->type = ide_type_atapi;
+		Drive->media = ide_media_cdrom;
+		Drive->bs = 2048;
+		Drive->max_sectors = 31;
+	} else {
+		Drive->type = ide_type_ata;
+		Drive->media = ide_media_disk;
+		Drive->addressing = ide_lba28;
+		Drive->bs = 512;
+		Drive->max_sectors = 255;
+	}
+	Drive->sectors = Image->Length / Drive->bs;
+
+	s_ImageCount++;
+	return true;
+}
+
+// Component tree, just enough of arcconfig.c for the disk devices to be added and found.
+
+static const PCHAR s_DeviceNames[] = {
+	[MultiFunctionAdapter] = "multi",
+	[ScsiAdapter] = "scsi",
+	[DiskController] = "disk",
+	[CdromController] = "cdrom",
+	[DiskPeripheral] = "rdisk",
+	[FloppyDiskPeripheral] = "fdisk",
+	[PartitionEntry] = "partition",
+};
+
+static DEVICE_ENTRY s_Components[MAXIMUM_COMPONENTS];
+static ULONG s_ComponentCount = 0;
+static DEVICE_ENTRY s_Root = { 0 };
+
+bool ArcDeviceParse(PCHAR* pPath, CONFIGURATION_TYPE ExpectedType, ULONG* Key) {
+	if (ExpectedType >= sizeof(s_DeviceNames) / sizeof(s_DeviceNames[0]) || s_DeviceNames[ExpectedType] == NULL) return false;
+	PCHAR ExpectedString = s_DeviceNames[ExpectedType];
+
+	PCHAR Path = *pPath;
+	while (*ExpectedString != 0) {
+		if ((*Path | 0x20) != *ExpectedString) return false;
+		ExpectedString++;
+		Path++;
+	}
+
+	if (*Path != '(') return false;
+	Path++;
+
+	ULONG ParsedKey = 0;
+	while (*Path != ')' && *Path != 0) {
+		if (*Path < '0' || *Path > '9') return false;
+		ParsedKey = (ParsedKey * 10) + (*Path - '0');
+		Path++;
+	}
+	if (*Path != ')') return false;
+	Path++;
+
+	*pPath = Path;
+	*Key = ParsedKey;
+	return true;
+}
+
+static PCONFIGURATION_COMPONENT BenchAddChild(PCONFIGURATION_COMPONENT Component, PCONFIGURATION_COMPONENT NewComponent, PVOID ConfigurationData) {
+	if (s_ComponentCount == MAXIMUM_COMPONENTS) return NULL;
+	PDEVICE_ENTRY Parent = (PDEVICE_ENTRY)Component;
+	if (Parent == NULL) Parent = &s_Root;
+	PDEVICE_ENTRY Entry = &s_Components[s_ComponentCount++];
+	memset(Entry, 0, sizeof(*Entry));
+	Entry->Component = *NewComponent;
+	Entry->Parent = Parent;
+	Entry->Peer = Parent->Child;
+	Parent->Child = Entry;
+	return &Entry->Component;
+}
+
+// Returns the deepest component matching the start of the path, like ArcGetComponent.
+static PCONFIGURATION_COMPONENT BenchGetComponent(PCHAR PathName) {
+	PDEVICE_ENTRY Match = &s_Root;
+	PCHAR Path = PathName;
+	while (*Path != 0) {
+		PDEVICE_ENTRY Child = Match->Child;
+		for (; Child != NULL; Child = Child->Peer) {
+			PCHAR Next = Path;
+			ULONG Key;
+			if (!ArcDeviceParse(&Next, Child->Component.Type, &Key) || Key != Child->Component.Key) continue;
+			Path = Next;
+			break;
+		}
+		if (Child == NULL) break;
+		Match = Child;
+	}
+	if (Match == &s_Root) return NULL;
+	return &Match->Component;
+}
+
+static void BenchComponentsInit(void) {
+	// multi(1)multi(0) for IDE, multi(0)scsi(0) for USB, as the firmware's tree has.
+	CONFIGURATION_COMPONENT Multi0 = ARC_MAKE_COMPONENT(AdapterClass, MultiFunctionAdapter, 0, 0, 0);
+	CONFIGURATION_COMPONENT Multi1 = ARC_MAKE_COMPONENT(AdapterClass, MultiFunctionAdapter, 0, 1, 0);
+	CONFIGURATION_COMPONENT Scsi0 = ARC_MAKE_COMPONENT(AdapterClass, ScsiAdapter, 0, 0, 0);
+	PCONFIGURATION_COMPONENT Usb = BenchAddChild(NULL, &Multi0, NULL);
+	BenchAddChild(Usb, &Scsi0, NULL);
+	PCONFIGURATION_COMPONENT Mio = BenchAddChild(NULL, &Multi1, NULL);
+	BenchAddChild(Mio, &Multi0, NULL);
+}
+
+// Environment: only the device keys ArcDiskInit sets, which traces can use as path prefixes.
+
+typedef struct _DEVICE_KEY {
+	char Key[16];
+	char Value[BENCH_PATH_SIZE];
+} DEVICE_KEY, *PDEVICE_KEY;
+
+static DEVICE_KEY s_DeviceKeys[MAXIMUM_DEVICE_KEYS];
+static ULONG s_DeviceKeyCount = 0;
+
+ARC_STATUS ArcEnvSetDevice(PCHAR Key, PCHAR Value) {
+	for (ULONG i = 0; i < s_DeviceKeyCount; i++) {
+		if (strcmp(s_DeviceKeys[i].Key, Key) != 0) continue;
+		snprintf(s_DeviceKeys[i].Value, sizeof(s_DeviceKeys[i].Value), "%s", Value);
+		return _ESUCCESS;
+	}
+	if (s_DeviceKeyCount == MAXIMUM_DEVICE_KEYS) return _ENOSPC;
+	PDEVICE_KEY Entry = &s_DeviceKeys[s_DeviceKeyCount++];
+	snprintf(Entry->Key, sizeof(Entry->Key), "%s", Key);
+	snprintf(Entry->Value, sizeof(Entry->Value), "%s", Value);
+	return _ESUCCESS;
+}
+
+// Expands a device key at the start of a trace path ("hd00p1:\file") to its ARC path.
+static void BenchExpandPath(const char* Path, PCHAR Expanded, ULONG Length) {
+	for (ULONG i = 0; i < s_DeviceKeyCount; i++) {
+		size_t KeyLength = strlen(s_DeviceKeys[i].Key);
+		if (strncasecmp(Path, s_DeviceKeys[i].Key, KeyLength) != 0) continue;
+		snprintf(Expanded, Length, "%s%s", s_DeviceKeys[i].Value, &Path[KeyLength]);
+		return;
+	}
+	snprintf(Expanded, Length, "%s", Path);
+}
+
+// Memory: the firmware's temporary allocations come from a fixed pool.
+// It's static so it sits in the low 4GB, where the firmware's pointer to ULONG casts still work.
+
+static UCHAR s_MemoryPool[MEMORY_POOL_SIZE] __attribute__((aligned(0x1000)));
+static size_t s_MemoryPoolUsed = 0;
+static bool s_NoCache = false;
+
+PVOID ArcMemAllocTemp(size_t length) {
+	// Without the pool the sector cache is not allocated, and every transfer goes to the device.
+	if (s_NoCache) return NULL;
+	length = (length + 0xFFF) & ~(size_t)0xFFF;
+	if (length > MEMORY_POOL_SIZE - s_MemoryPoolUsed) return NULL;
+	PVOID Ret = &s_MemoryPool[s_MemoryPoolUsed];
+	s_MemoryPoolUsed += length;
+	return Ret;
+}
+
+ARC_STATUS ArcDiskInitRamdisk(void) {
+	return _ENODEV;
+}
+
+// Boot trace: only the phases that say how much work the filesystem layer did.
+void ArcTraceBegin(const char* Name, ULONG Arg) {
+	if (strcmp(Name, "FsMount") == 0) s_Counters.Mounts++;
+	else if (strcmp(Name, "DeviceOpen") == 0) s_Counters.DeviceOpens++;
+}
+
+void ArcTraceEnd(const char* Name, ULONG Arg) {}
+
+// The vendor vector table is found through the system parameter block at its fixed address.
+static VENDOR_VECTOR_TABLE s_VendorVectors = { 0 };
+
+static bool BenchSystemTableInit(void) {
+	size_t Base = ARC_SYSTEM_TABLE_ADDRESS & ~0xFFFF;
+	PVOID Mapping = mmap((PVOID)Base, 0x10000, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+	if (Mapping != (PVOID)Base) {
+		printf("Could not map the system parameter block at %08x\n", ARC_SYSTEM_TABLE_ADDRESS);
+		return false;
+	}
+	s_VendorVectors.AddChildRoutine = BenchAddChild;
+	s_VendorVectors.GetComponentRoutine = BenchGetComponent;
+	ARC_SYSTEM_TABLE_LE()->VendorVector = (size_t)&s_VendorVectors;
+	return true;
+}
+
+// Trace replay.
+
+typedef struct _FILE_REPORT {
+	char Path[BENCH_PATH_SIZE];
+	uint64_t BytesRequested; // Bytes the trace read from the file.
+	ULONG Hash; // FNV-1a of those bytes, to tell a faster run from a wrong one.
+	DEVICE_COUNTERS Device; // Device work done while the file was open.
+	double Us;
+} FILE_REPORT, *PFILE_REPORT;
+
+typedef struct _TRACE_SLOT {
+	bool Open;
+	ULONG FileId;
+	PFILE_REPORT Report;
+	DEVICE_COUNTERS DeviceAtOpen;
+	double UsAtOpen;
+} TRACE_SLOT, *PTRACE_SLOT;
+
+static FILE_REPORT s_Reports[MAXIMUM_FILES];
+static ULONG s_ReportCount = 0;
+static TRACE_SLOT s_Slots[MAXIMUM_SLOTS];
+static UCHAR s_ReadBuffer[READ_BUFFER_SIZE] __attribute__((aligned(0x1000)));
+
+static double NowUs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+static void CountersSubtract(PDEVICE_COUNTERS Result, PDEVICE_COUNTERS Now, PDEVICE_COUNTERS Then) {
+	Result->Reads = Now->Reads - Then->Reads;
+	Result->AsyncReads = Now->AsyncReads - Then->AsyncReads;
+	Result->Writes = Now->Writes - Then->Writes;
+	Result->BytesRead = Now->BytesRead - Then->BytesRead;
+	Result->BytesWritten = Now->BytesWritten - Then->BytesWritten;
+	Result->Mounts = Now->Mounts - Then->Mounts;
+	Result->DeviceOpens = Now->DeviceOpens - Then->DeviceOpens;
+}
+
+static void CountersAdd(PDEVICE_COUNTERS Result, PDEVICE_COUNTERS Add) {
+	Result->Reads += Add->Reads;
+	Result->AsyncReads += Add->AsyncReads;
+	Result->Writes += Add->Writes;
+	Result->BytesRead += Add->BytesRead;
+	Result->BytesWritten += Add->BytesWritten;
+	Result->Mounts += Add->Mounts;
+	Result->DeviceOpens += Add->DeviceOpens;
+}
+
+// Reads from a file, in pieces no bigger than the read buffer. Returns the number of bytes read, or -1 on error.
+static int64_t BenchRead(PTRACE_SLOT Slot, uint64_t Length, bool Async) {
+	PVENDOR_VECTOR_TABLE Api = ARC_VENDOR_VECTORS();
+	uint64_t Total = 0;
+	while (Total < Length) {
+		ULONG Chunk = (Length - Total) > READ_BUFFER_SIZE ? READ_BUFFER_SIZE : (ULONG)(Length - Total);
+		U32LE Count = { 0 };
+		ARC_STATUS Status;
+		if (Async) {
+			Status = Api->ReadAsyncRoutine(Slot->FileId, s_ReadBuffer, Chunk);
+			if (ARC_SUCCESS(Status)) Status = Api->ReadAsyncWaitRoutine(Slot->FileId, &Count);
+		} else {
+			Status = Api->ReadRoutine(Slot->FileId, s_ReadBuffer, Chunk, &Count);
+		}
+		if (ARC_FAIL(Status)) return -1;
+		for (ULONG i = 0; i < Count.v; i++) Slot->Report->Hash = (Slot->Report->Hash ^ s_ReadBuffer[i]) * FNV_PRIME;
+		Total += Count.v;
+		if (Count.v < Chunk) break;
+	}
+	Slot->Report->BytesRequested += Total;
+	return Total;
+}
+
+static PTRACE_SLOT BenchGetSlot(const char* Arg, bool MustBeOpen) {
+	char* End;
+	ULONG Index = strtoul(Arg, &End, 0);
+	if (*End != 0 || Index >= MAXIMUM_SLOTS) return NULL;
+	if (s_Slots[Index].Open != MustBeOpen) return NULL;
+	return &s_Slots[Index];
+}
+
+static bool BenchClose(PTRACE_SLOT Slot) {
+	ARC_STATUS Status = ARC_VENDOR_VECTORS()->CloseRoutine(Slot->FileId);
+	DEVICE_COUNTERS Delta;
+	CountersSubtract(&Delta, &s_Counters, &Slot->DeviceAtOpen);
+	CountersAdd(&Slot->Report->Device, &Delta);
+	Slot->Report->Us += NowUs() - Slot->UsAtOpen;
+	Slot->Open = false;
+	return ARC_SUCCESS(Status);
+}
+
+// Runs one trace line. Returns false if it failed.
+static bool BenchStep(char* Line, ULONG LineNumber) {
+	PVENDOR_VECTOR_TABLE Api = ARC_VENDOR_VECTORS();
+	char* Args[4] = { NULL };
+	ULONG ArgCount = 0;
+	for (char* Token = strtok(Line, " \t\r\n"); Token != NULL && ArgCount < 4; Token = strtok(NULL, " \t\r\n")) {
+		if (ArgCount == 0 && Token[0] == '#') break;
+		Args[ArgCount++] = Token;
+	}
+	if (ArgCount == 0) return true;
+
+	const char* Op = Args[0];
+	PTRACE_SLOT Slot = NULL;
+	if (ArgCount >= 2) Slot = BenchGetSlot(Args[1], strcmp(Op, "open") != 0);
+	if (Slot == NULL) {
+		printf("line %d: bad or unopened slot\n", LineNumber);
+		return false;
+	}
+
+	if (strcmp(Op, "open") == 0 && ArgCount == 3) {
+		// open <slot> <path>
+		char Path[BENCH_PATH_SIZE];
+		BenchExpandPath(Args[2], Path, sizeof(Path));
+		PFILE_REPORT Report = NULL;
+		for (ULONG i = 0; i < s_ReportCount; i++) {
+			if (strcmp(s_Reports[i].Path, Args[2]) == 0) Report = &s_Reports[i];
+		}
+		if (Report == NULL && s_ReportCount < MAXIMUM_FILES) {
+			Report = &s_Reports[s_ReportCount++];
+			memset(Report, 0, sizeof(*Report));
+			snprintf(Report->Path, sizeof(Report->Path), "%s", Args[2]);
+			Report->Hash = FNV_OFFSET_BASIS;
+		}
+		if (Report == NULL) {
+			printf("line %d: too many files\n", LineNumber);
+			return false;
+		}
+		Slot->Report = Report;
+		Slot->DeviceAtOpen = s_Counters;
+		Slot->UsAtOpen = NowUs();
+		U32LE FileId;
+		ARC_STATUS Status = Api->OpenRoutine(Path, ArcOpenReadOnly, &FileId);
+		if (ARC_FAIL(Status)) {
+			printf("line %d: could not open %s (%s): %d\n", LineNumber, Args[2], Path, Status);
+			return false;
+		}
+		Slot->FileId = FileId.v;
+		Slot->Open = true;
+		return true;
+	}
+
+	if ((strcmp(Op, "read") == 0 || strcmp(Op, "readasync") == 0) && ArgCount == 3) {
+		// read <slot> <length>
+		int64_t Length = strtoll(Args[2], NULL, 0);
+		if (BenchRead(Slot, Length, Op[4] != 0) < 0) {
+			printf("line %d: read of %s failed\n", LineNumber, Slot->Report->Path);
+			return false;
+		}
+		return true;
+	}
+
+	if (strcmp(Op, "readall") == 0 && ArgCount >= 2) {
+		// readall <slot> [chunk]: reads to the end of the file, as a loader does
+		int64_t Chunk = ArgCount == 3 ? strtoll(Args[2], NULL, 0) : READ_BUFFER_SIZE;
+		if (Chunk <= 0) Chunk = READ_BUFFER_SIZE;
+		while (true) {
+			int64_t Read = BenchRead(Slot, Chunk, false);
+			if (Read < 0) {
+				printf("line %d: read of %s failed\n", LineNumber, Slot->Report->Path);
+				return false;
+			}
+			if (Read < Chunk) return true;
+		}
+	}
+
+	if (strcmp(Op, "seek") == 0 && ArgCount == 3) {
+		// seek <slot> <offset>
+		LARGE_INTEGER Offset = INT64_TO_LARGE_INTEGER(strtoll(Args[2], NULL, 0));
+		if (ARC_FAIL(Api->SeekRoutine(Slot->FileId, &Offset, SeekAbsolute))) {
+			printf("line %d: seek in %s failed\n", LineNumber, Slot->Report->Path);
+			return false;
+		}
+		return true;
+	}
+
+	if (strcmp(Op, "info") == 0 && ArgCount == 2) {
+		// info <slot>
+		FILE_INFORMATION Info;
+		if (ARC_FAIL(Api->GetFileInformationRoutine(Slot->FileId, &Info))) {
+			printf("line %d: getting information of %s failed\n", LineNumber, Slot->Report->Path);
+			return false;
+		}
+		return true;
+	}
+
+	if (strcmp(Op, "mediachange") == 0 && ArgCount == 2) {
+		// mediachange <slot>: the drive holding the file reports a media change on its next open
+		PARC_FILE_TABLE File = ArcIoGetFile(Slot->FileId);
+		PARC_FILE_TABLE Device = File != NULL ? ArcIoGetFile(File->DeviceId) : NULL;
+		if (Device == NULL || Device->u.DiskContext.IdeDrive == NULL) {
+			printf("line %d: %s is not on a drive\n", LineNumber, Slot->Report->Path);
+			return false;
+		}
+		Device->u.DiskContext.IdeDrive->media_changed = 1;
+		return true;
+	}
+
+	if (strcmp(Op, "close") == 0 && ArgCount == 2) {
+		// close <slot>
+		if (!BenchClose(Slot)) {
+			printf("line %d: close of %s failed\n", LineNumber, Slot->Report->Path);
+			return false;
+		}
+		return true;
+	}
+
+	printf("line %d: unknown operation %s\n", LineNumber, Op);
+	return false;
+}
+
+static void BAD_ARGS(const char* Self) {
+	printf("Usage: %s [options] <trace> <image>...\n", Self);
+	printf("Images ending in .iso are attached as IDE cdrom drives, anything else as IDE hard disks.\n");
+	printf("  -n: run without the sector cache\n");
+	printf("  -l <us>: device model, cost of each command (default %d)\n", DEFAULT_COMMAND_US);
+	printf("  -k <KB/s>: device model, transfer rate (default %d)\n", DEFAULT_BANDWIDTH_KBPS);
+	printf("  -r <count>: fail if the trace takes more than this many device commands\n");
+	printf("  -b <bytes>: fail if the trace moves more than this many bytes\n");
+	printf("  -q: only print the summary\n");
+	exit(-1);
+}
+
+int main(int argc, char** argv) {
+	ULONG CommandUs = DEFAULT_COMMAND_US;
+	ULONG BandwidthKbps = DEFAULT_BANDWIDTH_KBPS;
+	uint64_t MaxCommands = 0, MaxBytes = 0;
+	bool Quiet = false;
+	int arg = 1;
+	for (; arg < argc && argv[arg][0] == '-'; arg++) {
+		if (!strcmp(argv[arg], "-n")) s_NoCache = true;
+		else if (!strcmp(argv[arg], "-q")) Quiet = true;
+		else if (!strcmp(argv[arg], "-l") && arg + 1 < argc) CommandUs = strtoul(argv[++arg], NULL, 0);
+		else if (!strcmp(argv[arg], "-k") && arg + 1 < argc) BandwidthKbps = strtoul(argv[++arg], NULL, 0);
+		else if (!strcmp(argv[arg], "-r") && arg + 1 < argc) MaxCommands = strtoull(argv[++arg], NULL, 0);
+		else if (!strcmp(argv[arg], "-b") && arg + 1 < argc) MaxBytes = strtoull(argv[++arg], NULL, 0);
+		else BAD_ARGS(argv[0]);
+	}
+	if (arg + 2 > argc || BandwidthKbps == 0) BAD_ARGS(argv[0]);
+
+	const char* TracePath = argv[arg++];
+	FILE* Trace = fopen(TracePath, "r");
+	if (Trace == NULL) {
+		printf("%s: could not open\n", TracePath);
+		return -2;
+	}
+	for (; arg < argc; arg++) {
+		if (!BenchImageAdd(argv[arg])) return -2;
+	}
+
+	// Keep the heap in the low 4GB too.
+	mallopt(M_MMAP_MAX, 0);
+	if (!BenchSystemTableInit()) return -3;
+	BenchComponentsInit();
+	ArcIoInit();
+	// The disk scan prints each device it finds.
+	fflush(stdout);
+	int SavedStdout = dup(STDOUT_FILENO);
+	if (Quiet) {
+		int Null = open("/dev/null", O_WRONLY);
+		dup2(Null, STDOUT_FILENO);
+		close(Null);
+	}
+	ArcDiskInit();
+	fflush(stdout);
+	dup2(SavedStdout, STDOUT_FILENO);
+	close(SavedStdout);
+	// Disk scanning is not part of the trace.
+	memset(&s_Counters, 0, sizeof(s_Counters));
+	ARC_DISK_CACHE_STATS CacheAtStart;
+	ArcDiskCacheGetStats(&CacheAtStart);
+
+	ULONG Failed = 0;
+	ULONG LineNumber = 0;
+	char Line[TRACE_LINE_LENGTH];
+	double Start = NowUs();
+	while (fgets(Line, sizeof(Line), Trace) != NULL) {
+		LineNumber++;
+		if (!BenchStep(Line, LineNumber)) Failed++;
+	}
+	for (ULONG i = 0; i < MAXIMUM_SLOTS; i++) {
+		if (s_Slots[i].Open) BenchClose(&s_Slots[i]);
+	}
+	double WallUs = NowUs() - Start;
+	fclose(Trace);
+
+	ARC_DISK_CACHE_STATS Cache;
+	ArcDiskCacheGetStats(&Cache);
+	uint64_t Commands = (uint64_t)s_Counters.Reads + s_Counters.Writes;
+	uint64_t Bytes = s_Counters.BytesRead + s_Counters.BytesWritten;
+	double ModelUs = (Commands * (double)CommandUs) + (Bytes * 1000000.0 / (BandwidthKbps * 1024.0));
+
+	if (!Quiet) {
+		printf("\n%-40s %10s %8s %8s %10s %6s %10s\n", "file", "read", "hash", "commands", "device", "mounts", "wall(us)");
+		for (ULONG i = 0; i < s_ReportCount; i++) {
+			PFILE_REPORT Report = &s_Reports[i];
+			printf("%-40s %10llu %08x %8u %10llu %6u %10.0f\n", Report->Path, (unsigned long long)Report->BytesRequested, Report->Hash,
+				Report->Device.Reads + Report->Device.Writes, (unsigned long long)(Report->Device.BytesRead + Report->Device.BytesWritten),
+				Report->Device.Mounts, Report->Us);
+		}
+		printf("\n");
+	}
+
+	printf("%s: %u reads (%u async), %u writes, %llu bytes, %u device opens, %u mounts\n", TracePath,
+		s_Counters.Reads, s_Counters.AsyncReads, s_Counters.Writes, (unsigned long long)Bytes, s_Counters.DeviceOpens, s_Counters.Mounts);
+	printf("cache: %u hits, %u misses, %u lines read ahead%s\n", Cache.Hits - CacheAtStart.Hits, Cache.Misses - CacheAtStart.Misses,
+		Cache.ReadAheadLines - CacheAtStart.ReadAheadLines, s_NoCache ? " (disabled)" : "");
+	printf("wall time %.0fus, modelled device time %.0fus\n", WallUs, ModelUs);
+
+	if (Failed != 0) {
+		printf("FAIL: %u trace lines failed\n", Failed);
+		return 1;
+	}
+	if (MaxCommands != 0 && Commands > MaxCommands) {
+		printf("FAIL: %llu device commands, limit is %llu\n", (unsigned long long)Commands, (unsigned long long)MaxCommands);
+		return 1;
+	}
+	if (MaxBytes != 0 && Bytes > MaxBytes) {
+		printf("FAIL: %llu bytes moved, limit is %llu\n", (unsigned long long)Bytes, (unsigned long long)MaxBytes);
+		return 1;
+	}
+	return 0;
+}
@@ -4,25 +4,24 @@
 
 #include <string.h>
 #include <stdint.h>
+#include "memops.h"
 
 void *memcpy(void *dst, const void *src, size_t n)
 {
 	const char *p = src;
 	char *q = dst;
-#if defined(__i386__)
+#if MEMOPS_X86 && defined(__i386__)
 	size_t nl = n >> 2;
 	asm volatile ("cld ; rep ; movsl ; movl %3,%0 ; rep ; movsb":"+c" (nl),
 		      "+S"(p), "+D"(q)
 		      :"r"(n & 3));
-#elif defined(__x86_64__)
+#elif MEMOPS_X86 && defined(__x86_64__)
 	size_t nq = n >> 3;
 	asm volatile ("cld ; rep ; movsq ; movl %3,%%ecx ; rep ; movsb":"+c"
 		      (nq), "+S"(p), "+D"(q)
 		      :"r"((uint32_t) (n & 7)));
 #else
-	while (n--) {
-		*q++ = *p++;
-	}
+	memops_copy_forward((unsigned char *)q, (const unsigned char *)p, n, 1);
 #endif
 
 	return dst;
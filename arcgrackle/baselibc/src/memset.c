@@ -4,23 +4,63 @@
 
 #include <string.h>
 #include <stdint.h>
+#include "memops.h"
+
+/* empty until the platform says where cacheable RAM is */
+uintptr_t __memops_cacheable_start = 0;
+uintptr_t __memops_cacheable_end = 0;
+
+void memops_set_cacheable(void *start, size_t n)
+{
+	__memops_cacheable_start = (uintptr_t)start;
+	__memops_cacheable_end = (uintptr_t)start + n;
+}
 
 void *memset(void *dst, int c, size_t n)
 {
 	char *q = dst;
 
-#if defined(__i386__)
+#if MEMOPS_X86 && defined(__i386__)
 	size_t nl = n >> 2;
 	asm volatile ("cld ; rep ; stosl ; movl %3,%0 ; rep ; stosb"
 		      : "+c" (nl), "+D" (q)
 		      : "a" ((unsigned char)c * 0x01010101U), "r" (n & 3));
-#elif defined(__x86_64__)
+#elif MEMOPS_X86 && defined(__x86_64__)
 	size_t nq = n >> 3;
 	asm volatile ("cld ; rep ; stosq ; movl %3,%%ecx ; rep ; stosb"
 		      :"+c" (nq), "+D" (q)
 		      : "a" ((unsigned char)c * 0x0101010101010101U),
 			"r" ((uint32_t) n & 7));
 #else
+	if (n >= 16) {
+		uint32_t w = (unsigned char)c * 0x01010101U;
+		while ((uintptr_t)q & 3) {
+			*q++ = c;
+			n--;
+		}
+
+		memops_word *dw = (memops_word *)q;
+		while (((uintptr_t)dw & (MEMOPS_LINE - 1)) && n >= 4) {
+			*dw++ = w;
+			n -= 4;
+		}
+		/* zeroing whole lines of RAM doesn't need to store anything */
+		if (w == 0 && memops_can_dcbz(dw, n & ~(size_t)(MEMOPS_LINE - 1))) {
+			for (; n >= MEMOPS_LINE; n -= MEMOPS_LINE) {
+				memops_dcbz((void *)dw);
+				dw += MEMOPS_LINE_WORDS;
+			}
+		}
+		for (; n >= MEMOPS_LINE; n -= MEMOPS_LINE) {
+			dw[0] = w; dw[1] = w; dw[2] = w; dw[3] = w;
+			dw[4] = w; dw[5] = w; dw[6] = w; dw[7] = w;
+			dw += MEMOPS_LINE_WORDS;
+		}
+		for (; n >= 4; n -= 4)
+			*dw++ = w;
+		q = (char *)dw;
+	}
+
 	while (n--) {
 		*q++ = c;
 	}
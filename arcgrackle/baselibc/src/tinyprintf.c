@@ -171,6 +171,21 @@ static int putsf(FILE *putp, char* str, int len) {
 	return 0;
 }
 
+/* Puts n copies of a space or zero, a few at a time */
+static int putfill(FILE *putp, char c, int n)
+{
+	static const char spaces[] = "                ";
+	static const char zeros[] = "0000000000000000";
+	const char *fill = (c == '0') ? zeros : spaces;
+
+	while (n > 0) {
+		int len = n < (int)sizeof(spaces) - 1 ? n : (int)sizeof(spaces) - 1;
+		putsf(putp, (char *)fill, len);
+		n -= len;
+	}
+	return 0;
+}
+
 static unsigned putchw(FILE *putp, struct param *p)
 {
     unsigned written = 0;
@@ -188,10 +203,8 @@ static unsigned putchw(FILE *putp, struct param *p)
         n--;
 
     /* Fill with space, before alternate or sign */
-    if (!p->lz) {
-        while (n-- > 0)
-            written += putf(putp, ' ');
-    }
+    if (!p->lz && n > 0)
+        written += putfill(putp, ' ', n);
 
     /* print sign */
     if (p->sign)
@@ -206,10 +219,8 @@ static unsigned putchw(FILE *putp, struct param *p)
     }
 
     /* Fill with zeros, after alternate or sign */
-    if (p->lz) {
-        while (n-- > 0)
-            written += putf(putp, '0');
-    }
+    if (p->lz && n > 0)
+        written += putfill(putp, '0', n);
 
     /* Put actual buffer */
     bf = p->bf;
@@ -233,7 +244,11 @@ size_t tfp_format(FILE *putp, const char *fmt, va_list va)
 
     while ((ch = *(fmt++))) {
         if (ch != '%') {
-            written += putf(putp, ch);
+            /* Put the text up to the next conversion in one write */
+            const char *run = fmt - 1;
+            while (*fmt && *fmt != '%')
+                fmt++;
+            written += putsf(putp, (char *)run, fmt - run);
         } else {
             /* Init parameter struct */
             p.lz = 0;
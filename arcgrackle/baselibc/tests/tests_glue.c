@@ -28,6 +28,6 @@ static struct File _stderr = {
         &stdio_methods
 };
 
-FILE* const stdout = &_stdout;
-FILE* const stderr = &_stderr;
+FILE* stdout = &_stdout;
+FILE* stderr = &_stderr;
 
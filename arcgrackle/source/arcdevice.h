@@ -3,6 +3,9 @@
 
 typedef struct _DEVICE_ENTRY DEVICE_ENTRY, *PDEVICE_ENTRY;
 
+// Gets the contiguous range of the underlying device that backs a file from its current position.
+typedef ARC_STATUS(*PARC_GET_SECTOR_RUN_ROUTINE) (ULONG FileId, ULONG Length, int64_t* DeviceOffset, PULONG RunLength);
+
 typedef struct _DEVICE_VECTORS {
     PARC_CLOSE_ROUTINE Close;
     PARC_MOUNT_ROUTINE Mount;
@@ -14,6 +17,7 @@ typedef struct _DEVICE_VECTORS {
     PARC_GET_FILE_INFO_ROUTINE GetFileInformation;
     PARC_SET_FILE_INFO_ROUTINE SetFileInformation;
     PARC_GET_DIRECTORY_ENTRY_ROUTINE_INTERNAL GetDirectoryEntry;
+    PARC_GET_SECTOR_RUN_ROUTINE GetSectorRun; // Optional, lets asynchronous reads go straight to the device.
 } DEVICE_VECTORS, *PDEVICE_VECTORS;
 
 struct _DEVICE_ENTRY {
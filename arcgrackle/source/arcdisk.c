@@ -17,6 +17,7 @@
 #include "usbmsc.h"
 #include "usbdisk.h"
 #include "ide.h"
+#include "arcdiskcache.h"
 #include "scsi_mesh.h"
 
 // ARC firmware support for disks:
@@ -74,6 +75,8 @@ void ARC_WEAK usbdisk_create(usbdev_t* dev) {
 
 	MountEntry->Address = (ULONG)dev->address;
 	MountEntry->ReferenceCount = 0;
+	// Mount entries get reused, so make sure nothing from a previous device is cached.
+	ArcDiskCacheInvalidate(MountEntry);
 	MountEntry->Mount = dev;
 	MountEntry->SectorSize = MSC_INST(dev)->blocksize;
 }
@@ -83,6 +86,7 @@ void ARC_WEAK usbdisk_remove(usbdev_t* dev) {
 	for (ULONG i = 0; i < sizeof(s_MountTable) / sizeof(s_MountTable[0]); i++) {
 		if (s_MountTable[i].Mount == dev) {
 			// found it, wipe it
+			ArcDiskCacheInvalidate(&s_MountTable[i]);
 			if (s_MountTable[i].ReferenceCount != 0) {
 				// something's using this. just wipe the pointer for now
 				s_MountTable[i].Mount = NULL;
@@ -150,6 +154,8 @@ static ARC_STATUS IdeMount(PCHAR MountPath, MOUNT_OPERATION Operation);
 static ARC_STATUS IdeSeek(ULONG FileId, PLARGE_INTEGER Offset, SEEK_MODE SeekMode);
 static ARC_STATUS IdeRead(PARC_FILE_TABLE FileEntry, ULONG StartSector, ULONG CountSectors, PVOID Buffer);
 static ARC_STATUS IdeWrite(PARC_FILE_TABLE FileEntry, ULONG StartSector, ULONG CountSectors, PVOID Buffer);
+static ULONG IdeStartRead(PARC_FILE_TABLE FileEntry, ULONG StartSector, ULONG CountSectors, PVOID Buffer);
+static ARC_STATUS IdePollRead(PARC_FILE_TABLE FileEntry);
 static ARC_STATUS IdeGetReadStatus(ULONG FileId);
 static ARC_STATUS IdeGetFileInformation(ULONG FileId, PFILE_INFORMATION FileInfo);
 
@@ -345,7 +351,7 @@ static ARC_STATUS DeblockerRead(ULONG FileId, PVOID Buffer, ULONG Length, PULONG
 	else CurrentSector = (FileEntry->Position - Offset) / SectorSize;
 	
 	if (Offset != 0) {
-		Status = FileEntry->ReadSectors(FileEntry, CurrentSector + SectorStart, 1, LocalPointer);
+		Status = ArcDiskCacheRead(FileEntry, SectorSize, CurrentSector + SectorStart, 1, LocalPointer);
 		if (ARC_FAIL(Status)) {
 			return Status;
 		}
@@ -374,7 +380,7 @@ static ARC_STATUS DeblockerRead(ULONG FileId, PVOID Buffer, ULONG Length, PULONG
 
 		if (SectorsToTransfer == 0) break;
 
-		Status = FileEntry->ReadSectors(FileEntry, CurrentSector + SectorStart, SectorsToTransfer, Buffer);
+		Status = ArcDiskCacheRead(FileEntry, SectorSize, CurrentSector + SectorStart, SectorsToTransfer, Buffer);
 		if (ARC_FAIL(Status)) {
 			return Status;
 		}
@@ -390,7 +396,7 @@ static ARC_STATUS DeblockerRead(ULONG FileId, PVOID Buffer, ULONG Length, PULONG
 
 	// If there's any data left to read, read the last sector.
 	if (Length != 0) {
-		Status = FileEntry->ReadSectors(FileEntry, CurrentSector + SectorStart, 1, LocalPointer);
+		Status = ArcDiskCacheRead(FileEntry, SectorSize, CurrentSector + SectorStart, 1, LocalPointer);
 		if (ARC_FAIL(Status)) {
 			return Status;
 		}
@@ -436,7 +442,7 @@ static ARC_STATUS DeblockerWrite(ULONG FileId, PVOID Buffer, ULONG Length, PULON
 	else CurrentSector = (FileEntry->Position - Offset) / SectorSize;
 	
 	if (Offset != 0) {
-		Status = FileEntry->ReadSectors(FileEntry, CurrentSector + SectorStart, 1, LocalPointer);
+		Status = ArcDiskCacheRead(FileEntry, SectorSize, CurrentSector + SectorStart, 1, LocalPointer);
 		if (ARC_FAIL(Status)) {
 			return Status;
 		}
@@ -447,7 +453,7 @@ static ARC_STATUS DeblockerWrite(ULONG FileId, PVOID Buffer, ULONG Length, PULON
 		memcpy(&LocalPointer[Offset], Buffer, Limit);
 
 		// Write the sector.
-		Status = FileEntry->WriteSectors(FileEntry, CurrentSector + SectorStart, 1, LocalPointer);
+		Status = ArcDiskCacheWrite(FileEntry, SectorSize, CurrentSector + SectorStart, 1, LocalPointer);
 		if (ARC_FAIL(Status)) {
 			return Status;
 		}
@@ -472,7 +478,7 @@ static ARC_STATUS DeblockerWrite(ULONG FileId, PVOID Buffer, ULONG Length, PULON
 
 		if (SectorsToTransfer == 0) break;
 
-		Status = FileEntry->WriteSectors(FileEntry, CurrentSector + SectorStart, SectorsToTransfer, Buffer);
+		Status = ArcDiskCacheWrite(FileEntry, SectorSize, CurrentSector + SectorStart, SectorsToTransfer, Buffer);
 		if (ARC_FAIL(Status)) return Status;
 
 		ULONG Limit = SectorsToTransfer * SectorSize;
@@ -486,14 +492,14 @@ static ARC_STATUS DeblockerWrite(ULONG FileId, PVOID Buffer, ULONG Length, PULON
 
 	// If there's any data left to write, read the last sector seperately, replace the data, and write back to disk.
 	if (Length != 0) {
-		Status = FileEntry->ReadSectors(FileEntry, CurrentSector + SectorStart, 1, LocalPointer);
+		Status = ArcDiskCacheRead(FileEntry, SectorSize, CurrentSector + SectorStart, 1, LocalPointer);
 		if (ARC_FAIL(Status)) {
 			return Status;
 		}
 
 		memcpy(LocalPointer, Buffer, Length);
 
-		Status = FileEntry->WriteSectors(FileEntry, CurrentSector + SectorStart, 1, LocalPointer);
+		Status = ArcDiskCacheWrite(FileEntry, SectorSize, CurrentSector + SectorStart, 1, LocalPointer);
 		if (ARC_FAIL(Status)) return Status;
 
 		*Count += Length;
@@ -641,6 +647,8 @@ static ARC_STATUS IdeOpen(PCHAR OpenPath, OPEN_MODE OpenMode, PULONG FileId) {
 		if (IsCdRom) IdeDrive = ob_ide_open(Channel, Unit);
 		if (IdeDrive == NULL) return _ENODEV;
 	}
+	// If the drive saw its media change since it was last used, what's cached from it is stale.
+	if (ob_ide_media_changed(IdeDrive)) ArcDiskCacheInvalidate(IdeDrive);
 	FileEntry->u.DiskContext.IdeDrive = IdeDrive;
 	FileEntry->u.DiskContext.MaxSectorTransfer = IdeDrive->max_sectors;
 
@@ -650,6 +658,8 @@ static ARC_STATUS IdeOpen(PCHAR OpenPath, OPEN_MODE OpenMode, PULONG FileId) {
 	FileEntry->GetSectorSize = IdeGetSectorSize;
 	FileEntry->ReadSectors = IdeRead;
 	FileEntry->WriteSectors = IdeWrite;
+	FileEntry->StartReadSectors = IdeStartRead;
+	FileEntry->PollReadSectors = IdePollRead;
 
 	ULONG DiskSectors = IdeDrive->sectors;
 	ULONG PartitionSectors = DiskSectors;
@@ -705,6 +715,18 @@ static ARC_STATUS IdeWrite(PARC_FILE_TABLE FileEntry, ULONG StartSector, ULONG C
 	return _ESUCCESS;
 }
 
+static ULONG IdeStartRead(PARC_FILE_TABLE FileEntry, ULONG StartSector, ULONG CountSectors, PVOID Buffer) {
+	// Bypasses the sector cache; the read goes straight into the caller's buffer by DMA.
+	return ob_ide_read_blocks_start(FileEntry->u.DiskContext.IdeDrive, Buffer, StartSector, CountSectors);
+}
+
+static ARC_STATUS IdePollRead(PARC_FILE_TABLE FileEntry) {
+	int Result = ob_ide_read_blocks_poll(FileEntry->u.DiskContext.IdeDrive);
+	if (Result < 0) return _EAGAIN;
+	if (Result != 0) return _EIO;
+	return _ESUCCESS;
+}
+
 static ARC_STATUS IdeGetReadStatus(ULONG FileId) {
 	PARC_FILE_TABLE FileEntry = ArcIoGetFile(FileId);
 	if (FileEntry == NULL) return _EBADF;
@@ -828,6 +850,8 @@ static ARC_STATUS ScsiOpen(PCHAR OpenPath, OPEN_MODE OpenMode, PULONG FileId) {
 		if (IsCdRom) ScsiDrive = mesh_open_drive(DeviceId, ScsiLun);
 		if (ScsiDrive == NULL) return _ENODEV;
 	}
+	// If the drive saw its media change since it was last used, what's cached from it is stale.
+	if (mesh_media_changed(ScsiDrive)) ArcDiskCacheInvalidate(ScsiDrive);
 	FileEntry->u.DiskContext.ScsiDrive = ScsiDrive;
 	FileEntry->u.DiskContext.MaxSectorTransfer = 0xFFFF;
 
@@ -1028,6 +1052,7 @@ ULONG ArcDiskGetSizeMb(ULONG Disk) {
 ARC_STATUS ArcDiskInitRamdisk(void);
 
 void ArcDiskInit() {
+	ArcDiskCacheInit();
 	ArcDiskIdeInit();
 	ArcDiskScsiInit();
 	ArcDiskUsbInit();
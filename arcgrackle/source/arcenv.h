@@ -34,6 +34,13 @@ PCHAR ArcEnvGetDevice(PCHAR Key);
 /// <returns>ARC status.</returns>
 ARC_STATUS ArcEnvSetDevice(PCHAR Key, PCHAR Value);
 
+/// <summary>
+/// Writes the environment to ARC non-volatile storage, if it has been changed since it was last written.
+/// Setting an environment variable only marks the environment as changed; this must be called before control leaves the firmware.
+/// </summary>
+/// <returns>ARC status.</returns>
+ARC_STATUS ArcEnvCommit(void);
+
 /// <summary>
 /// Sets the hard disk containing ARC NV storage, after it has been formatted.
 /// </summary>
@@ -11,9 +11,11 @@
 #include "arcio.h"
 #include "arcfs.h"
 #include "coff.h"
+#include "arctrace.h"
 
 enum {
-	ARC_DEVICE_PATH_SIZE = 64
+	ARC_CANONICAL_PATH_CACHE_SIZE = 16, // Device paths remembered with their canonical form, a power of two.
+	ARC_ASYNC_SLICE = 0x10000 // Bytes an asynchronous read without device support transfers per step.
 };
 
 typedef struct _OPENED_PATHNAME_ENTRY {
@@ -21,9 +23,36 @@ typedef struct _OPENED_PATHNAME_ENTRY {
 	CHAR    DeviceName[ARC_DEVICE_PATH_SIZE];
 } OPENED_PATHNAME_ENTRY, * POPENED_PATHNAME_ENTRY;
 
+// A device path as passed to ArcOpen, and its canonical form.
+typedef struct _CANONICAL_PATH_ENTRY {
+	ULONG Hash; // Of the path as passed.
+	ULONG Length; // Of the path as passed.
+	ULONG CanonicalLength; // Including the null terminator, zero if the entry is unused.
+	CHAR Path[ARC_DEVICE_PATH_SIZE];
+	CHAR Canonical[ARC_DEVICE_PATH_SIZE];
+} CANONICAL_PATH_ENTRY, *PCANONICAL_PATH_ENTRY;
+
+// Asynchronous read. Only one is in flight at a time.
+typedef struct _ARC_ASYNC_READ {
+	ULONG FileId; // File being read.
+	PUCHAR Buffer; // Caller's buffer.
+	ULONG Length; // Bytes requested.
+	ULONG Done; // Bytes transferred so far.
+	int64_t Start; // File position the read started at.
+	PARC_FILE_TABLE Device; // Device running a started transfer, NULL if there is none.
+	ULONG Pending; // Bytes in the started transfer.
+	ARC_STATUS Status; // Result, once complete.
+	bool Active; // A read was submitted and its result was not yet collected.
+	bool Complete; // The read has finished.
+	bool NoDevice; // A device transfer failed, read the rest synchronously.
+	bool InStep; // The worker is running, the file calls it makes must not wait for it.
+} ARC_ASYNC_READ, *PARC_ASYNC_READ;
+
 static ARC_FILE_TABLE s_FileTable[FILE_TABLE_SIZE] = { 0 };
 static OPENED_PATHNAME_ENTRY s_OpenedFiles[FILE_TABLE_SIZE] = { 0 };
 _Static_assert((sizeof(s_OpenedFiles) / sizeof(*s_OpenedFiles)) == (sizeof(s_FileTable) / sizeof(*s_FileTable)), "Number of file table entries must equal number of opened pathname entries");
+static ARC_ASYNC_READ s_AsyncRead = { 0 };
+static CANONICAL_PATH_ENTRY s_CanonicalPaths[ARC_CANONICAL_PATH_CACHE_SIZE] = { 0 };
 
 /// <summary>
 /// Gets the file table entry by file ID.
@@ -41,6 +70,17 @@ PARC_FILE_TABLE ArcIoGetFile(ULONG FileId) {
 	return Entry;
 }
 
+/// <summary>
+/// Gets the canonical ARC path of an open device.
+/// </summary>
+/// <param name="DeviceId">Device ID.</param>
+/// <returns>Device path, or NULL if the device is not open.</returns>
+PCHAR ArcIoGetDeviceName(ULONG DeviceId) {
+	if (DeviceId >= FILE_TABLE_SIZE) return NULL;
+	if (s_OpenedFiles[DeviceId].ReferenceCounter == 0) return NULL;
+	return s_OpenedFiles[DeviceId].DeviceName;
+}
+
 /// <summary>
 /// Gets the file table entry by file ID. (file ID must not be open)
 /// </summary>
@@ -79,8 +119,118 @@ static ARC_STATUS ArcIoEnsurePermissions(PARC_FILE_TABLE File, bool Read, bool W
 	return _ESUCCESS;
 }
 
+/// <summary>
+/// Starts a device transfer for the next part of the asynchronous read, if it lies on one contiguous run of a device that can transfer without waiting.
+/// </summary>
+/// <param name="Read">Asynchronous read, with its file positioned at the next byte to transfer.</param>
+/// <param name="HeadLength">If the next byte is not at the start of a device sector, obtains the length up to the next one, which has to be read synchronously first. Otherwise 0.</param>
+/// <returns>True if a transfer was started.</returns>
+static bool ArcIoAsyncStartDevice(PARC_ASYNC_READ Read, PULONG HeadLength) {
+	PARC_FILE_TABLE File = &s_FileTable[Read->FileId];
+	ULONG Remaining = Read->Length - Read->Done;
+	int64_t DeviceOffset = Read->Start + Read->Done;
+	ULONG RunLength = Remaining;
+	ULONG DeviceId = Read->FileId;
+	*HeadLength = 0;
+
+	// A file on a filesystem needs to know where its data is on the device.
+	if (File->DeviceId != FILE_IS_RAW_DEVICE) {
+		if (File->DeviceEntryTable->GetSectorRun == NULL) return false;
+		if (ARC_FAIL(File->DeviceEntryTable->GetSectorRun(Read->FileId, Remaining, &DeviceOffset, &RunLength))) return false;
+		DeviceId = File->DeviceId;
+	}
+
+	PARC_FILE_TABLE Device = ArcIoGetFile(DeviceId);
+	if (Device == NULL || Device->StartReadSectors == NULL || Device->GetSectorSize == NULL) return false;
+	ULONG SectorSize;
+	if (ARC_FAIL(Device->GetSectorSize(DeviceId, &SectorSize)) || SectorSize == 0) return false;
+	if ((DeviceOffset % SectorSize) != 0) {
+		// File data is often not sector aligned on the device (PE sections on a CD are aligned to 0x200 or 0x400).
+		// Read up to the sector boundary, the rest of the run can then be transferred.
+		ULONG Head = SectorSize - (ULONG)(DeviceOffset % SectorSize);
+		*HeadLength = Head < RunLength ? Head : 0;
+		return false;
+	}
+
+	// Only whole sectors inside the partition, the driver may start fewer than asked for.
+	int64_t FirstSector = DeviceOffset / SectorSize;
+	ULONG SectorCount = Device->u.DiskContext.SectorCount;
+	if (FirstSector >= SectorCount) return false;
+	ULONG Sectors = RunLength / SectorSize;
+	if (Sectors > SectorCount - FirstSector) Sectors = SectorCount - FirstSector;
+	if (Sectors == 0) return false;
+
+	ULONG Started = Device->StartReadSectors(Device, Device->u.DiskContext.SectorStart + (ULONG)FirstSector, Sectors, Read->Buffer + Read->Done);
+	if (Started == 0) return false;
+	Read->Device = Device;
+	Read->Pending = Started * SectorSize;
+	return true;
+}
+
+/// <summary>
+/// Advances the asynchronous read by one step: polls the device transfer in progress, or starts the next one, or reads the next slice synchronously when no device transfer is possible.
+/// </summary>
+static void ArcIoAsyncStep(void) {
+	PARC_ASYNC_READ Read = &s_AsyncRead;
+	if (!Read->Active || Read->Complete || Read->InStep) return;
+	Read->InStep = true;
+
+	if (Read->Device != NULL) {
+		ARC_STATUS Status = Read->Device->PollReadSectors(Read->Device);
+		if (Status == _EAGAIN) {
+			Read->InStep = false;
+			return;
+		}
+		// If the transfer failed, the same range gets read again synchronously, which has the driver's own fallbacks.
+		if (ARC_SUCCESS(Status)) Read->Done += Read->Pending;
+		else Read->NoDevice = true;
+		Read->Device = NULL;
+		Read->Pending = 0;
+	}
+
+	PARC_FILE_TABLE File = &s_FileTable[Read->FileId];
+	ULONG Remaining = Read->Length - Read->Done;
+	if (Remaining != 0) {
+		LARGE_INTEGER Offset = Int64ToLargeInteger(Read->Start + Read->Done);
+		ARC_STATUS Status = File->DeviceEntryTable->Seek(Read->FileId, &Offset, SeekAbsolute);
+		ULONG HeadLength = 0;
+		if (ARC_SUCCESS(Status) && !Read->NoDevice && ArcIoAsyncStartDevice(Read, &HeadLength)) {
+			Read->InStep = false;
+			return;
+		}
+
+		ULONG Slice = Remaining;
+		if (Slice > ARC_ASYNC_SLICE) Slice = ARC_ASYNC_SLICE;
+		if (HeadLength != 0 && Slice > HeadLength) Slice = HeadLength;
+		ULONG Count = 0;
+		if (ARC_SUCCESS(Status)) Status = File->DeviceEntryTable->Read(Read->FileId, Read->Buffer + Read->Done, Slice, &Count);
+		if (ARC_SUCCESS(Status)) Read->Done += Count;
+		else Read->Status = Status;
+		// A short read is the end of the file.
+		if (ARC_FAIL(Status) || Count < Slice) Remaining = 0;
+		else Remaining = Read->Length - Read->Done;
+	}
+
+	if (Remaining == 0) {
+		// Leave the file positioned after the data read, the same as a synchronous read would.
+		LARGE_INTEGER Offset = Int64ToLargeInteger(Read->Start + Read->Done);
+		File->DeviceEntryTable->Seek(Read->FileId, &Offset, SeekAbsolute);
+		Read->Complete = true;
+	}
+	Read->InStep = false;
+}
+
+/// <summary>
+/// Runs the asynchronous read to completion, so the devices it uses are free for another request.
+/// Its result is kept for ArcReadAsyncWait.
+/// </summary>
+static void ArcIoAsyncDrain(void) {
+	while (s_AsyncRead.Active && !s_AsyncRead.Complete && !s_AsyncRead.InStep) ArcIoAsyncStep();
+}
+
 
 static ARC_STATUS ArcGetFileInformation(ULONG FileId, PFILE_INFORMATION Info) {
+	ArcIoAsyncDrain();
 	// Get the file table entry.
 	PARC_FILE_TABLE File = ArcIoGetFile(FileId);
 	ARC_STATUS Status = ArcIoEnsurePermissions(File, false, false);
@@ -101,6 +251,7 @@ static ARC_STATUS ArcGetFileInformation(ULONG FileId, PFILE_INFORMATION Info) {
 }
 
 static ARC_STATUS ArcSetFileInformation(ULONG FileId, ULONG AttributeFlags, ULONG AttributeMask) {
+	ArcIoAsyncDrain();
 	// Get the file table entry.
 	PARC_FILE_TABLE File = ArcIoGetFile(FileId);
 	ARC_STATUS Status = ArcIoEnsurePermissions(File, false, false);
@@ -117,6 +268,7 @@ static ARC_STATUS ArcMount(PCHAR MountPath, MOUNT_OPERATION Operation) {
 }
 
 static ARC_STATUS ArcRead(ULONG FileId, PVOID Buffer, ULONG Length, PU32LE Count) {
+	ArcIoAsyncDrain();
 	// Get the file table entry.
 	PARC_FILE_TABLE File = ArcIoGetFile(FileId);
 	ARC_STATUS Status = ArcIoEnsurePermissions(File, true, false);
@@ -134,11 +286,19 @@ static ARC_STATUS ArcGetReadStatus(ULONG FileId) {
 	ARC_STATUS Status = ArcIoEnsurePermissions(File, true, false);
 	if (ARC_FAIL(Status)) return Status;
 
+	// An asynchronous read of this file is advanced each time its status is asked for.
+	if (s_AsyncRead.Active && s_AsyncRead.FileId == FileId) {
+		ArcIoAsyncStep();
+		return s_AsyncRead.Complete ? _ESUCCESS : _EAGAIN;
+	}
+	ArcIoAsyncDrain();
+
 	if (File->DeviceEntryTable->GetReadStatus == NULL) return _EACCES;
 	return File->DeviceEntryTable->GetReadStatus(FileId);
 }
 
 static ARC_STATUS ArcSeek(ULONG FileId, PLARGE_INTEGER Offset, SEEK_MODE SeekMode) {
+	ArcIoAsyncDrain();
 	// Get the file table entry.
 	PARC_FILE_TABLE File = ArcIoGetFile(FileId);
 	ARC_STATUS Status = ArcIoEnsurePermissions(File, false, false);
@@ -148,6 +308,7 @@ static ARC_STATUS ArcSeek(ULONG FileId, PLARGE_INTEGER Offset, SEEK_MODE SeekMod
 }
 
 static ARC_STATUS ArcWrite(ULONG FileId, PVOID Buffer, ULONG Length, PU32LE Count) {
+	ArcIoAsyncDrain();
 	// Get the file table entry.
 	PARC_FILE_TABLE File = ArcIoGetFile(FileId);
 	ARC_STATUS Status = ArcIoEnsurePermissions(File, false, true);
@@ -160,6 +321,7 @@ static ARC_STATUS ArcWrite(ULONG FileId, PVOID Buffer, ULONG Length, PU32LE Coun
 }
 
 static ARC_STATUS ArcGetDirectoryEntry(ULONG FileId, PDIRECTORY_ENTRY Buffer, ULONG Length, PU32LE Count) {
+	ArcIoAsyncDrain();
 	// Get the file table entry.
 	PARC_FILE_TABLE File = ArcIoGetFile(FileId);
 	ARC_STATUS Status = ArcIoEnsurePermissions(File, true, false);
@@ -196,11 +358,15 @@ static ARC_STATUS ArcCloseDeviceImpl(PARC_FILE_TABLE File, ULONG FileId) {
 }
 
 static ARC_STATUS ArcClose(ULONG FileId) {
+	ArcIoAsyncDrain();
 	// Get the file table entry.
 	PARC_FILE_TABLE File = ArcIoGetFile(FileId);
 	ARC_STATUS Status = ArcIoEnsurePermissions(File, false, false);
 	if (ARC_FAIL(Status)) return Status;
 
+	// Nobody can collect the result of an asynchronous read of a closed file.
+	if (s_AsyncRead.Active && s_AsyncRead.FileId == FileId) s_AsyncRead.Active = false;
+
 	// Closing a device?
 	if (File->DeviceId == FILE_IS_RAW_DEVICE) {
 		return ArcCloseDeviceImpl(File, FileId);
@@ -240,38 +406,65 @@ static PCHAR ArcOpenGetFileName(PCHAR OpenPath) {
 	return FileName;
 }
 
+static ARC_STATUS ArcOpenCanonicaliseDevice(PCHAR Device, ULONG Length, PCHAR Canonical, PULONG CanonicalLength) {
+	// The canonical form is never shorter, so a longer device path can't fit.
+	if (Length >= ARC_DEVICE_PATH_SIZE) return _E2BIG;
+
+	// Programs open paths on the same few devices over and over, look in the cache first.
+	ULONG Hash = 0x811C9DC5;
+	for (ULONG i = 0; i < Length; i++) {
+		Hash ^= (UCHAR)Device[i];
+		Hash *= 0x01000193;
+	}
+	PCANONICAL_PATH_ENTRY Entry = &s_CanonicalPaths[Hash & (ARC_CANONICAL_PATH_CACHE_SIZE - 1)];
+	if (Entry->CanonicalLength != 0 && Entry->Hash == Hash && Entry->Length == Length && memcmp(Entry->Path, Device, Length) == 0) {
+		memcpy(Canonical, Entry->Canonical, Entry->CanonicalLength);
+		*CanonicalLength = Entry->CanonicalLength;
+		return _ESUCCESS;
+	}
+
+	PCHAR pCanon = Canonical;
+	ULONG lenCanon = 0;
+	char LastChar = 0;
+	for (PCHAR pDevice = Device; pDevice != &Device[Length]; pDevice++) {
+		char ThisChar = *pDevice;
+		// If this char is ')', and last char was '(', add a zero.
+		// Such that: "()" becomes "(0)"
+		if (ThisChar == ')' && LastChar == '(') {
+			*pCanon = '0';
+			pCanon++;
+			lenCanon++;
+			if (lenCanon == ARC_DEVICE_PATH_SIZE) return _E2BIG;
+		}
+
+		// Copy this char, and lowercase it if required
+		if (ThisChar >= 'A' && ThisChar <= 'Z') ThisChar |= 0x20;
+		*pCanon = ThisChar;
+		pCanon++;
+		lenCanon++;
+		if (lenCanon == ARC_DEVICE_PATH_SIZE) return _E2BIG;
+	}
+	*pCanon = 0;
+	*CanonicalLength = lenCanon + 1;
+
+	Entry->Hash = Hash;
+	Entry->Length = Length;
+	memcpy(Entry->Path, Device, Length);
+	memcpy(Entry->Canonical, Canonical, *CanonicalLength);
+	Entry->CanonicalLength = *CanonicalLength;
+	return _ESUCCESS;
+}
+
 static ARC_STATUS ArcOpen(PCHAR OpenPath, OPEN_MODE OpenMode, PU32LE FileId) {
+	ArcIoAsyncDrain();
 	// Get the device name and file name from the specified path.
 	PCHAR FileName = ArcOpenGetFileName(OpenPath);
 
 	// Canonicalise the device name.
 	char CanonicalisedDevice[ARC_DEVICE_PATH_SIZE];
 	ULONG CanonicalisedDeviceLength = 0;
-	{
-		PCHAR pCanon = CanonicalisedDevice;
-		ULONG lenCanon = 0;
-		char LastChar = 0;
-		for (PCHAR pDevice = OpenPath; pDevice != FileName; pDevice++) {
-			char ThisChar = *pDevice;
-			// If this char is ')', and last char was '(', add a zero.
-			// Such that: "()" becomes "(0)"
-			if (ThisChar == ')' && LastChar == '(') {
-				*pCanon = '0';
-				pCanon++;
-				lenCanon++;
-				if (lenCanon == sizeof(CanonicalisedDevice)) return _E2BIG;
-			}
-
-			// Copy this char, and lowercase it if required
-			if (ThisChar >= 'A' && ThisChar <= 'Z') ThisChar |= 0x20;
-			*pCanon = ThisChar;
-			pCanon++;
-			lenCanon++;
-			if (lenCanon == sizeof(CanonicalisedDevice)) return _E2BIG;
-		}
-		*pCanon = 0;
-		CanonicalisedDeviceLength = lenCanon + 1;
-	}
+	ARC_STATUS Status = ArcOpenCanonicaliseDevice(OpenPath, FileName - OpenPath, CanonicalisedDevice, &CanonicalisedDeviceLength);
+	if (ARC_FAIL(Status)) return Status;
 
 	//printf("ArcOpen: %s\r\n", CanonicalisedDevice);
 
@@ -302,8 +495,6 @@ static ARC_STATUS ArcOpen(PCHAR OpenPath, OPEN_MODE OpenMode, PU32LE FileId) {
 		break;
 	}
 
-	ARC_STATUS Status = _ESUCCESS;
-
 	if (DeviceId == sizeof(s_OpenedFiles) / sizeof(*s_OpenedFiles)) {
 		// Device is not yet opened.
 		// Find the nearest config entry for this device.
@@ -323,8 +514,13 @@ static ARC_STATUS ArcOpen(PCHAR OpenPath, OPEN_MODE OpenMode, PU32LE FileId) {
 
 		// Set the vector table in the file.
 		Device->DeviceEntryTable = DeviceEntry->Vectors;
+		// Only devices that support it set up asynchronous transfers.
+		Device->StartReadSectors = NULL;
+		Device->PollReadSectors = NULL;
 		// Open the device.
+		ArcTraceBegin("DeviceOpen", DeviceId);
 		Status = Device->DeviceEntryTable->Open(CanonicalisedDevice, DeviceOpenMode, &DeviceId);
+		ArcTraceEnd("DeviceOpen", Status);
 		if (ARC_FAIL(Status)) return Status;
 		// Mark the device as open, and as a raw device.
 		Device->Flags.Open = 1;
@@ -379,6 +575,40 @@ static ARC_STATUS ArcOpen(PCHAR OpenPath, OPEN_MODE OpenMode, PU32LE FileId) {
 	return Status;
 }
 
+static ARC_STATUS ArcReadAsync(ULONG FileId, PVOID Buffer, ULONG Length) {
+	ArcIoAsyncDrain();
+	// Get the file table entry.
+	PARC_FILE_TABLE File = ArcIoGetFile(FileId);
+	ARC_STATUS Status = ArcIoEnsurePermissions(File, true, false);
+	if (ARC_FAIL(Status)) return Status;
+
+	// Only one asynchronous read can be in flight, its result must be collected first.
+	if (s_AsyncRead.Active) return _EBUSY;
+
+	PARC_ASYNC_READ Read = &s_AsyncRead;
+	memset(Read, 0, sizeof(*Read));
+	Read->FileId = FileId;
+	Read->Buffer = (PUCHAR)Buffer;
+	Read->Length = Length;
+	Read->Start = File->Position;
+	Read->Status = _ESUCCESS;
+	Read->Active = true;
+
+	// Get the first transfer going.
+	ArcIoAsyncStep();
+	return _ESUCCESS;
+}
+
+static ARC_STATUS ArcReadAsyncWait(ULONG FileId, PU32LE Count) {
+	PARC_ASYNC_READ Read = &s_AsyncRead;
+	if (!Read->Active || Read->FileId != FileId) return _EINVAL;
+
+	ArcIoAsyncDrain();
+	Read->Active = false;
+	Count->v = Read->Done;
+	return Read->Status;
+}
+
 void ArcIoInit() {
 	PVENDOR_VECTOR_TABLE Api = ARC_VENDOR_VECTORS();
 	Api->CloseRoutine = ArcClose;
@@ -391,4 +621,6 @@ void ArcIoInit() {
 	Api->GetFileInformationRoutine = ArcGetFileInformation;
 	Api->SetFileInformationRoutine = ArcSetFileInformation;
 	Api->GetDirectoryEntryRoutine = ArcGetDirectoryEntry;
+	Api->ReadAsyncRoutine = ArcReadAsync;
+	Api->ReadAsyncWaitRoutine = ArcReadAsyncWait;
 }
\ No newline at end of file
@@ -6,9 +6,13 @@
 #include <stdio.h>
 #include "arc.h"
 #include "arcio.h"
+#include "arcenv.h"
 #include "arcmem.h"
 #include "coff.h"
 #include "ppcinst.h"
+#include "pereloc.h"
+#include "timer.h"
+#include "arctrace.h"
 
 enum {
     STYP_REG = 0x00000000,
@@ -108,153 +112,104 @@ static void InstructionPerformPatch(
     }
 }
 
-static ARC_STATUS RelocatePEBlock(ULONG VirtualAddress, ULONG Length, PU16LE Block, LONG Diff, bool IsLittleEndian) {
-    for (ULONG Index = 0; Index < Length; Index++) {
-        USHORT Offset = Block[Index].v;
-        USHORT Type = Offset >> 12;
-        Offset &= (ARC_BIT(12) - 1);
-        ULONG FixupVA = VirtualAddress + Offset;
-        PU16BE DataBig = (PU16BE)FixupVA;
-        PU16LE DataLittle = (PU16LE)FixupVA;
-        switch (Type) {
-        case IMAGE_REL_BASED_HIGHLOW:
-            // 32-bit relocation
-        {
-            LONG Base;
-            memcpy(&Base, (PVOID)FixupVA, sizeof(Base));
-            if (!IsLittleEndian) {
-                Base = SwapEndianness32(Base);
-            }
-            Base += Diff;
-            if (!IsLittleEndian) {
-                Base = SwapEndianness32(Base);
-            }
-            memcpy((PVOID)FixupVA, &Base, sizeof(Base));
-        }
-        break;
-
-        case IMAGE_REL_BASED_HIGH:
-            // high 16-bit relocation
-        {
-            ULONG Temp = (IsLittleEndian ? DataLittle->v : DataBig->v) << 16;
-            Temp += Diff;
-            if (IsLittleEndian) DataLittle->v = (Temp >> 16);
-            else DataBig->v = (Temp >> 16);
-        }
-        break;
-
-        case IMAGE_REL_BASED_HIGHADJ:
-            // high 16-bit relocation with adjustment
-        {
-            if (Index == Length) {
-                // whoops, better not overflow
-                printf("HighAdj relocation overflows table\n");
-                return _EBADF;
-            }
-            ULONG Temp = (IsLittleEndian ? DataLittle->v : DataBig->v) << 16;
-            Index++;
-            PU16BE BlockBig = (PU16BE)(ULONG)Block;
-            // tfw MS seriously did this
-            Temp += (IsLittleEndian ? Block[Index].v : BlockBig[Index].v);
-            Temp += Diff;
-            Temp += INT16_MAX + 1;
-
-            if (IsLittleEndian) DataLittle->v = (Temp >> 16);
-            else DataBig->v = (Temp >> 16);
-        }
-        break;
-
-        case IMAGE_REL_BASED_LOW:
-            // low 16-bit relocation
-        {
-            ULONG Temp = (IsLittleEndian ? DataLittle->v : DataBig->v);
-            Temp += Diff;
-            if (IsLittleEndian) DataLittle->v = Temp;
-            else DataBig->v = Temp;
-        }
-        break;
+enum {
+    PATCH_POLL_INTERVAL = 0x1000 // Instructions patched between polls of an asynchronous read.
+};
 
-        //case IMAGE_REL_BASED_MIPS_JMPADDR: // not valid for PowerPC, osloader does it for all architectures for some reason
+// Patches a section containing code, advancing an asynchronous read of PollFileId (if not FILE_TABLE_SIZE) as it goes.
+static void InstructionPatchSection(ULONG ImageBase, PIMAGE_SECTION_HEADER Section, ULONG PollFileId) {
+    if ((Section->Characteristics & IMAGE_SCN_CNT_CODE) == 0) return;
 
-        case IMAGE_REL_BASED_ABSOLUTE:
-            // no fixup required
-            break;
+    PVENDOR_VECTOR_TABLE Api = ARC_VENDOR_VECTORS();
+    PU32LE SectionBaseLittle = (PU32LE)(ImageBase + Section->VirtualAddress);
+    ULONG Length = Section->SizeOfRawData / sizeof(ULONG);
 
-        default:
-            // invalid for powerpc
-            printf("Invalid relocation %x\n", Type);
-            return _EBADF;
+    for (ULONG off = 0; off < Length; off++) {
+        InstructionPerformPatch(SectionBaseLittle, off);
+        if (PollFileId != FILE_TABLE_SIZE && (off % PATCH_POLL_INTERVAL) == (PATCH_POLL_INTERVAL - 1)) {
+            Api->ReadStatusRoutine(PollFileId);
         }
     }
-
-    // all good
-    return _ESUCCESS;
 }
 
-static ARC_STATUS RelocatePE(ULONG ImageBase, PIMAGE_FILE_HEADER FileHeader, PIMAGE_OPTIONAL_HEADER OptionalHeader, PIMAGE_SECTION_HEADER Sections) {
-    bool IsLittleEndian = FileHeader->Machine == IMAGE_FILE_MACHINE_POWERPC;
-
-    PIMAGE_DATA_DIRECTORY RelocDir = &OptionalHeader->DataDirectory[IMAGE_DIRECTORY_ENTRY_BASERELOC];
-    bool HasRelocations = RelocDir->VirtualAddress != 0 && RelocDir->Size != 0;
-    PIMAGE_DATA_DIRECTORY ExceptionDir = &OptionalHeader->DataDirectory[IMAGE_DIRECTORY_ENTRY_EXCEPTION];
-    bool HasExceptions = ExceptionDir->VirtualAddress != 0 && ExceptionDir->Size != 0;
-
-    if (ImageBase == OptionalHeader->ImageBase) {
-        // no need to relocate
-        HasRelocations = false;
-    }
-    else if (HasRelocations) {
-        // no relocations yet base moved
-        printf("Needs relocation but image has none\n");
-        return _EBADF;
-    }
-
-    if (!HasRelocations && !IsLittleEndian) {
-        // nothing needs to be done here
+static ARC_STATUS RelocatePEBlock(ULONG VirtualAddress, ULONG Length, PU16LE Block, LONG Diff, bool IsLittleEndian) {
+    USHORT Type = 0;
+    switch (PeRelocateBlock((PUCHAR)VirtualAddress, Length, Block, Diff, IsLittleEndian, &Type)) {
+    case PE_RELOC_OK:
         return _ESUCCESS;
+    case PE_RELOC_HIGHADJ_OVERFLOW:
+        // whoops, better not overflow
+        printf("HighAdj relocation overflows table\n");
+        return _EBADF;
+    default:
+        // invalid for powerpc
+        printf("Invalid relocation %x\n", Type);
+        return _EBADF;
     }
+}
 
-    ARC_STATUS Status;
-
-    // apply all PE relocations first. remember endianness.
-    if (HasRelocations) {
-        ULONG OldBase = OptionalHeader->ImageBase;
-        PIMAGE_BASE_RELOCATION Block = (PIMAGE_BASE_RELOCATION)(ImageBase + RelocDir->VirtualAddress);
-        ULONG BlockStart = (ULONG)Block;
-        ULONG RelocLength = RelocDir->Size;
+void sync_before_exec(const void* p, ULONG len);
 
-        for (ULONG Offset = 0; Offset < RelocLength;) {
-            Offset += Block->SizeOfBlock;
-            ULONG SizeOfBlock = Block->SizeOfBlock - sizeof(IMAGE_BASE_RELOCATION);
-            PU16LE Entries = (PU16LE)(ULONG)&Block[1];
+// Progress of relocating, patching and flushing an image while its sections are loaded.
+typedef struct _LOAD_FIXUP_STATE {
+    ULONG ImageBase; // Address the image is loaded at.
+    LONG Diff; // Difference from the address it was linked at, 0 if base relocations are not applied.
+    ULONG NextBlock; // Next base relocation block to apply.
+    ULONG RelocEnd; // End of the base relocation blocks.
+    ULONG FinishedSections; // Sections already relocated, patched and flushed.
+    bool IsLittleEndian; // Endianness of the relocation blocks.
+    bool Patch; // Instructions need patching.
+    bool Deferred; // Blocks are not in address order, so nothing is fixed up until every section is loaded.
+} LOAD_FIXUP_STATE, *PLOAD_FIXUP_STATE;
 
-            Status = RelocatePEBlock(
-                ImageBase + Block->VirtualAddress, 
-                SizeOfBlock / sizeof(USHORT),
-                Entries,
-                ImageBase - OldBase,
-                IsLittleEndian
-            );
+/// <summary>
+/// Relocates, patches and flushes everything below the given image offset that has not been yet.
+/// </summary>
+/// <param name="State">Fixup progress.</param>
+/// <param name="Sections">Section table.</param>
+/// <param name="NumberOfSections">Number of sections.</param>
+/// <param name="LandedEnd">Image offset everything below which is in memory, 0xFFFFFFFF once all sections are.</param>
+/// <param name="PollFileId">File with an asynchronous read to advance while patching, FILE_TABLE_SIZE if none.</param>
+/// <returns>ARC status code.</returns>
+static ARC_STATUS LoadFixupAdvance(PLOAD_FIXUP_STATE State, PIMAGE_SECTION_HEADER Sections, ULONG NumberOfSections, ULONG LandedEnd, ULONG PollFileId) {
+    // A section can only be patched and flushed once no later block can touch it.
+    if (State->Deferred && LandedEnd != 0xFFFFFFFF) return _ESUCCESS;
+
+    // Apply base relocation blocks once every page they touch is in memory. A fixup can straddle the end of its page.
+    ULONG RelocatedEnd = LandedEnd;
+    while (State->Diff != 0 && State->NextBlock < State->RelocEnd) {
+        PIMAGE_BASE_RELOCATION Block = (PIMAGE_BASE_RELOCATION)State->NextBlock;
+        if (Block->SizeOfBlock < sizeof(IMAGE_BASE_RELOCATION)) {
+            printf("Bad relocation block\r\n");
+            return _EBADF;
+        }
+        if (LandedEnd != 0xFFFFFFFF && Block->VirtualAddress + PAGE_SIZE + sizeof(ULONG) > LandedEnd) {
+            RelocatedEnd = Block->VirtualAddress;
+            break;
+        }
 
-            if (ARC_FAIL(Status)) return Status;
+        ULONG SizeOfBlock = Block->SizeOfBlock - sizeof(IMAGE_BASE_RELOCATION);
+        ARC_STATUS Status = RelocatePEBlock(
+            State->ImageBase + Block->VirtualAddress,
+            SizeOfBlock / sizeof(USHORT),
+            (PU16LE)(ULONG)&Block[1],
+            State->Diff,
+            State->IsLittleEndian
+        );
+        if (ARC_FAIL(Status)) return Status;
 
-            Block = (PIMAGE_BASE_RELOCATION)(BlockStart + Offset);
-        }
+        State->NextBlock += Block->SizeOfBlock;
     }
 
-    // Instructions need patching here.
-    {
-        // Exception data is never present, just check every 32 bit value of every section containing code.
-        for (int i = 0; i < FileHeader->NumberOfSections - 1; i++) {
-            if ((Sections[i].Characteristics & IMAGE_SCN_CNT_CODE) == 0) continue;
-
-            ULONG SectionBase = ImageBase + Sections[i].VirtualAddress;
-            PU32BE SectionBaseBig = (PU32BE)SectionBase;
-            PU32LE SectionBaseLittle = (PU32LE)SectionBase;
+    // Patch the code of relocated sections, and flush everything that was written.
+    // Exception data is never present, just check every 32 bit value of every section containing code.
+    for (; State->FinishedSections < NumberOfSections; State->FinishedSections++) {
+        PIMAGE_SECTION_HEADER Section = &Sections[State->FinishedSections];
+        if (Section->VirtualAddress + Section->SizeOfRawData > RelocatedEnd) break;
 
-            for (ULONG off = 0; off < Sections[i].SizeOfRawData / sizeof(ULONG); off++) {
-                InstructionPerformPatch(SectionBaseLittle, off);
-            }
+        if (State->Patch && State->FinishedSections < NumberOfSections - 1) InstructionPatchSection(State->ImageBase, Section, PollFileId);
+        if ((Section->Characteristics & (SECTION_REQUIRES_LOAD | SECTION_REQUIRES_ZERO)) != 0) {
+            sync_before_exec((PVOID)(State->ImageBase + Section->VirtualAddress), Section->SizeOfRawData);
         }
     }
 
@@ -518,73 +473,131 @@ static ARC_STATUS ArcLoadImpl(
         }
 #endif
 
-        ULONG SectionOffset = 0;
-
-        // Load sections into memory.
-        USHORT NumberOfSectionsToLoad = NumberOfSections;
-        //if (IsLittleEndian) NumberOfSectionsToLoad--;
-        for (int i = 0; i < NumberOfSectionsToLoad; i++) {
-            ULONG Flags = Sections[i].Characteristics;
-            ULONG SectionBase = ImageBaseK0 + SectionOffset;
+        ULONG LoadStart = currmsecs();
+        ULONG ReadCount = 0, ReadBytes = 0;
 
-#if 0
-            if (HasRelocations && !HasPEOptionalHeader) {
-                PSECTION_RELOCATION_ENTRY RelocEntry = &RelocationTable[i];
-                RelocEntry->FixupValue = SectionBase - Sections[i].VirtualAddress;
-                RelocEntry->NumberOfRelocations = Sections[i].NumberOfRelocations;
-                RelocEntry->PointerToRelocations = Sections[i].PointerToRelocations;
+        // Base relocations are only applied when the image is not loaded where it was linked.
+        LOAD_FIXUP_STATE Fixup = { 0 };
+        Fixup.ImageBase = ImageBaseK0;
+        Fixup.IsLittleEndian = IsLittleEndian;
+        int RelocSection = -1;
+        if (ImageBaseK0 != OptionalHeader->ImageBase && HasRelocations) {
+            // Read the relocations first, so each section can be relocated as soon as it is loaded.
+            PIMAGE_DATA_DIRECTORY RelocDir = &OptionalHeader->DataDirectory[IMAGE_DIRECTORY_ENTRY_BASERELOC];
+            for (int i = 0; i < NumberOfSections; i++) {
+                if ((Sections[i].Characteristics & SECTION_REQUIRES_LOAD) == 0) continue;
+                if (RelocDir->VirtualAddress < Sections[i].VirtualAddress) continue;
+                if (RelocDir->VirtualAddress + RelocDir->Size > Sections[i].VirtualAddress + Sections[i].SizeOfRawData) continue;
+                RelocSection = i;
+                break;
             }
-            else
-#endif
-            {
-                SectionBase = Sections[i].VirtualAddress;
-                //if (HasPEOptionalHeader)
-                {
-                    SectionBase += ImageBaseK0;
-                }
+            if (RelocSection < 0) {
+                printf("Relocations are not in a loaded section\n");
+                Status = _EBADF;
+                break;
             }
 
-            // If needed, read this section into memory
-            bool IncreaseOffset = false;
-            if ((Flags & SECTION_REQUIRES_LOAD) != 0) {
-                LARGE_INTEGER SeekPosition = Int64ToLargeInteger(Sections[i].PointerToRawData);
-                Status = Api->SeekRoutine(FileId, &SeekPosition, SeekAbsolute);
-                if (ARC_FAIL(Status)) break;
-                Status = Api->ReadRoutine(FileId, (PVOID)SectionBase, Sections[i].SizeOfRawData, &Count);
-                if (ARC_FAIL(Status)) break;
-                if (Count.v != Sections[i].SizeOfRawData) {
-                    printf("Tried to read %x bytes and read %x bytes\n", Sections[i].SizeOfRawData, Count.v);
-                    Status = _EFAULT;
+            LARGE_INTEGER SeekPosition = Int64ToLargeInteger(Sections[RelocSection].PointerToRawData);
+            Status = Api->SeekRoutine(FileId, &SeekPosition, SeekAbsolute);
+            if (ARC_FAIL(Status)) break;
+            Status = Api->ReadRoutine(FileId, (PVOID)(ImageBaseK0 + Sections[RelocSection].VirtualAddress), Sections[RelocSection].SizeOfRawData, &Count);
+            if (ARC_FAIL(Status)) break;
+            if (Count.v != Sections[RelocSection].SizeOfRawData) {
+                printf("Tried to read %x bytes and read %x bytes\n", Sections[RelocSection].SizeOfRawData, Count.v);
+                Status = _EFAULT;
+                break;
+            }
+            ReadCount++;
+            ReadBytes += Count.v;
+
+            Fixup.Diff = ImageBaseK0 - OptionalHeader->ImageBase;
+            Fixup.NextBlock = ImageBaseK0 + RelocDir->VirtualAddress;
+            Fixup.RelocEnd = Fixup.NextBlock + RelocDir->Size;
+
+            // Sections are fixed up as the blocks reach past them, which relies on the blocks being in address order.
+            ULONG LastBlockAddress = 0;
+            for (ULONG Next = Fixup.NextBlock; Next < Fixup.RelocEnd;) {
+                PIMAGE_BASE_RELOCATION Block = (PIMAGE_BASE_RELOCATION)Next;
+                // A bad block is reported when it is applied.
+                if (Block->SizeOfBlock < sizeof(IMAGE_BASE_RELOCATION)) break;
+                if (Block->VirtualAddress < LastBlockAddress) {
+                    Fixup.Deferred = true;
                     break;
                 }
-                IncreaseOffset = true;
+                LastBlockAddress = Block->VirtualAddress;
+                Next += Block->SizeOfBlock;
             }
-            else if ((Flags & SECTION_REQUIRES_ZERO) != 0) {
-                memset((PVOID)SectionBase, 0, Sections[i].SizeOfRawData);
-                IncreaseOffset = true;
+        }
+        // Big endian images linked where they are loaded need nothing done to them.
+        Fixup.Patch = IsLittleEndian || Fixup.Diff != 0;
+
+        // Load sections into memory.
+        // Sections following each other in the file are read together, into the first section's address.
+        // The others are then moved up to their own addresses, so the file range can't be longer than the memory range it lands in.
+        // While a read is in flight, what was loaded before it gets relocated and patched.
+        ULONG LandedEnd = 0;
+        for (int i = 0; i < NumberOfSections;) {
+            ULONG Flags = Sections[i].Characteristics;
+            ULONG SectionBase = ImageBaseK0 + Sections[i].VirtualAddress;
+
+            if (i == RelocSection || (Flags & SECTION_REQUIRES_LOAD) == 0) {
+                if (i != RelocSection && (Flags & SECTION_REQUIRES_ZERO) != 0) {
+                    memset((PVOID)SectionBase, 0, Sections[i].SizeOfRawData);
+                }
+                LandedEnd = Sections[i].VirtualAddress + Sections[i].SizeOfRawData;
+                i++;
+                continue;
             }
 
-            if (IncreaseOffset) {
-                SectionOffset += Sections[i].SizeOfRawData;
+            int Last = i;
+            ULONG ReadLength = Sections[i].SizeOfRawData;
+            while (Last + 1 < NumberOfSections) {
+                PIMAGE_SECTION_HEADER Next = &Sections[Last + 1];
+                if (Last + 1 == RelocSection || (Next->Characteristics & SECTION_REQUIRES_LOAD) == 0) break;
+                if (Next->PointerToRawData != Sections[i].PointerToRawData + ReadLength) break;
+                if (Next->VirtualAddress < Sections[i].VirtualAddress + ReadLength) break;
+                ReadLength += Next->SizeOfRawData;
+                Last++;
             }
-        }
-        if (ARC_FAIL(Status)) break;
 
-        // Relocate the COFF.
-#if 0 // Required code patching is done here (to fix overly strict processor checks). Enforce it.
-        if (HasRelocations || IsLittleEndian)
-#endif
-        {
-            Status = RelocatePE(ImageBaseK0, FileHeader, OptionalHeader, Sections);
-#if 0
-            if (HasPEOptionalHeader) {
-                Status = RelocatePE(ImageBaseK0, FileHeader, OptionalHeader, Sections);
+            LARGE_INTEGER SeekPosition = Int64ToLargeInteger(Sections[i].PointerToRawData);
+            Status = Api->SeekRoutine(FileId, &SeekPosition, SeekAbsolute);
+            if (ARC_FAIL(Status)) break;
+            Status = Api->ReadAsyncRoutine(FileId, (PVOID)SectionBase, ReadLength);
+            if (ARC_FAIL(Status)) break;
+            ARC_STATUS FixupStatus = LoadFixupAdvance(&Fixup, Sections, NumberOfSections, LandedEnd, FileId);
+            Status = Api->ReadAsyncWaitRoutine(FileId, &Count);
+            if (ARC_SUCCESS(Status)) Status = FixupStatus;
+            if (ARC_FAIL(Status)) break;
+            if (Count.v != ReadLength) {
+                printf("Tried to read %x bytes and read %x bytes\n", ReadLength, Count.v);
+                Status = _EFAULT;
+                break;
             }
-            else {
-                Status = RelocateCoff(FileId, RelocationTable, NumberOfSections, FileHeader->PointerToSymbolTable);
+            ReadCount++;
+            ReadBytes += ReadLength;
+
+            // Move the sections to their own addresses, the last one first as they only ever move up.
+            for (int Section = Last; Section > i; Section--) {
+                PVOID Source = (PVOID)(SectionBase + Sections[Section].PointerToRawData - Sections[i].PointerToRawData);
+                PVOID Dest = (PVOID)(ImageBaseK0 + Sections[Section].VirtualAddress);
+                if (Source == Dest) continue;
+                memmove(Dest, Source, Sections[Section].SizeOfRawData);
+                // Nothing else is read into the gap below the section, so don't leave what was read there for it.
+                ULONG GapStart = ImageBaseK0 + Sections[Section - 1].VirtualAddress + Sections[Section - 1].SizeOfRawData;
+                if (GapStart < (ULONG)Dest) memset((PVOID)GapStart, 0, (ULONG)Dest - GapStart);
             }
-#endif
+
+            LandedEnd = Sections[Last].VirtualAddress + Sections[Last].SizeOfRawData;
+            i = Last + 1;
         }
+        if (ARC_FAIL(Status)) break;
+
+        // Everything is in memory, finish the fixups.
+        Status = LoadFixupAdvance(&Fixup, Sections, NumberOfSections, 0xFFFFFFFF, FILE_TABLE_SIZE);
+        if (ARC_FAIL(Status)) break;
+
+        printf("Loaded %dKB in %d reads, %dms\r\n", ReadBytes / 1024, ReadCount, currmsecs() - LoadStart);
 
         if (ARC_FAIL(Status)) break;
         s_OldCoffLoaded = IsOldCoff;
@@ -612,8 +625,7 @@ static ARC_STATUS ArcLoadImpl(
         }
 #endif
 
-        // Flush all caches.
-        Api->FlushAllCachesRoutine();
+        // Every loaded section was flushed once it was fixed up.
     } while (false);
     if (RelocationTable != NULL) free(RelocationTable);
     Api->CloseRoutine(FileId);
@@ -635,7 +647,9 @@ static ARC_STATUS ArcLoad(
     OUT PU32LE LowAddress
 ) {
     ULONG LocalEntry, LocalLow;
+    ArcTraceBegin("ArcLoad", 0);
     ARC_STATUS Status = ArcLoadImpl(ImagePath, TopAddress, &LocalEntry, &LocalLow, NULL, NULL);
+    ArcTraceEnd("ArcLoad", Status);
     if (ARC_FAIL(Status)) return Status;
     if (EntryAddress != NULL) EntryAddress->v = LocalEntry;
     if (LowAddress != NULL) LowAddress->v = LocalLow;
@@ -698,6 +712,10 @@ static ARC_STATUS ArcInvoke(
     // Read from the entry point to make sure it's mapped, yay for having pagetables instead of BATs!
     *(volatile ULONG*)(CallingConv[0].v);
     extern void __ArcInvokeImpl(ULONG EntryAddress, ULONG Toc, ULONG Argc, PCHAR Argv[], PCHAR Envp[]);
+    ArcTraceMark("ArcInvoke", CallingConv[0].v);
+    // The invoked program may never return, so anything it (or a previous program) set must be on disk first.
+    // ArcExecute hands off through here too.
+    ArcEnvCommit();
     __ArcInvokeImpl(CallingConv[0].v, CallingConv[1].v, Argc, Argv, Envp);
     return _ESUCCESS;
 }
@@ -766,7 +784,9 @@ static ARC_STATUS ArcExecute(
 
         // Try to load here
         ULONG EntryPoint, BaseAddress, ImageBasePage, ImageSizePage;
+        ArcTraceBegin("ArcLoad", 1);
         Status = ArcLoadImpl(CopyPath, MemChunk->BasePage + MemChunk->PageCount, &EntryPoint, &BaseAddress, &ImageBasePage, &ImageSizePage);
+        ArcTraceEnd("ArcLoad", Status);
         if (ARC_FAIL(Status)) {
             if (Status != _ENOMEM) return Status;
             continue;
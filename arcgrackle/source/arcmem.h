@@ -41,6 +41,12 @@ PVOID ArcMemAllocTemp(size_t length);
 /// <returns>Pointer to allocated memory.</returns>
 PVOID ArcMemAllocDirect(size_t length);
 
+/// <summary>
+/// Frees a chunk of memory allocated by ArcMemAllocTemp or ArcMemAllocDirect.
+/// </summary>
+/// <param name="Pointer">Pointer to allocated memory.</param>
+void ArcMemFree(PVOID Pointer);
+
 /// <summary>
 /// Initialise the default memory descriptors so ArcMemAllocFromDdrDirect can work.
 /// </summary>
@@ -0,0 +1,27 @@
+#pragma once
+
+// Compressed ramdisk image format, as written by RamdiskPack. All fields are little endian.
+// The image is split into blocks, each compressed on its own as an LZ4 block so that any one can be read without the others.
+// A block that would not get smaller is stored as it is, with a stored length equal to its uncompressed length.
+enum {
+	RAMDISK_COMPRESSED_MAGIC = 0x5A445241, // 'ARDZ'
+	RAMDISK_COMPRESSED_VERSION = 1,
+	RAMDISK_MINIMUM_BLOCK_SIZE = 0x1000,
+	RAMDISK_MAXIMUM_BLOCK_SIZE = 0x10000,
+	RAMDISK_MAXIMUM_FILE_SIZE = 0x400000, // Largest drivers.img read into memory, compressed or not.
+	RAMDISK_MAXIMUM_IMAGE_SIZE = 0x1000000, // Largest image a compressed drivers.img can hold.
+};
+
+typedef struct ARC_LE _RAMDISK_COMPRESSED_HEADER {
+	ULONG Magic;
+	ULONG Version;
+	ULONG ImageSize; // Size of the uncompressed image.
+	ULONG BlockSize; // Power of two, the last block may be shorter.
+	ULONG BlockCount;
+	ULONG Offsets[]; // BlockCount + 1 entries; block N is stored from Offsets[N] to Offsets[N + 1], from the start of the file.
+} RAMDISK_COMPRESSED_HEADER, *PRAMDISK_COMPRESSED_HEADER;
+
+/// <summary>
+/// Decompresses whatever part of a compressed ramdisk has not been read yet, so the whole image is in place for the NT driver.
+/// </summary>
+void ArcDiskRamdiskComplete(void);
@@ -0,0 +1,65 @@
+#pragma once
+
+// Boot trace file format, as written by ArcTraceSave. All fields are little endian (native).
+enum {
+	ARC_TRACE_MAGIC = 0x42545243, // 'BTRC'
+	ARC_TRACE_VERSION = 1,
+	ARC_TRACE_NAME_LENGTH = 16,
+};
+
+typedef enum _ARC_TRACE_TYPE {
+	ArcTraceTypeBegin,
+	ArcTraceTypeEnd,
+	ArcTraceTypeMark
+} ARC_TRACE_TYPE;
+
+typedef struct _ARC_TRACE_FILE_HEADER {
+	ULONG Magic;
+	USHORT Version;
+	USHORT RecordSize;
+	ULONG TicksPerSecond; // Decrementer frequency.
+	ULONG Count; // Records following the header, oldest first.
+	ULONG Lost; // Records overwritten before the trace was saved.
+} ARC_TRACE_FILE_HEADER, *PARC_TRACE_FILE_HEADER;
+
+typedef struct _ARC_TRACE_FILE_RECORD {
+	uint64_t Ticks; // Timebase when the event was recorded.
+	ULONG Arg; // Event specific value.
+	UCHAR Type; // ARC_TRACE_TYPE
+	UCHAR Depth; // Number of events begun and not yet ended.
+	USHORT Reserved;
+	CHAR Name[ARC_TRACE_NAME_LENGTH];
+} ARC_TRACE_FILE_RECORD, *PARC_TRACE_FILE_RECORD;
+
+/// <summary>
+/// Records the start of a boot phase.
+/// </summary>
+/// <param name="Name">Name of the phase, must be a static string.</param>
+/// <param name="Arg">Phase specific value.</param>
+void ArcTraceBegin(const char* Name, ULONG Arg);
+
+/// <summary>
+/// Records the end of a boot phase.
+/// </summary>
+/// <param name="Name">Name of the phase, must be a static string.</param>
+/// <param name="Arg">Phase specific value.</param>
+void ArcTraceEnd(const char* Name, ULONG Arg);
+
+/// <summary>
+/// Records a single point in time.
+/// </summary>
+/// <param name="Name">Name of the event, must be a static string.</param>
+/// <param name="Arg">Event specific value.</param>
+void ArcTraceMark(const char* Name, ULONG Arg);
+
+/// <summary>
+/// Prints the recorded trace to the console, a screen at a time.
+/// </summary>
+void ArcTraceDump(void);
+
+/// <summary>
+/// Writes the recorded trace to an existing file, which must be big enough to hold it.
+/// </summary>
+/// <param name="Path">ARC path of the file.</param>
+/// <returns>ARC status code.</returns>
+ARC_STATUS ArcTraceSave(PCHAR Path);
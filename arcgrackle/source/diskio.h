@@ -30,6 +30,7 @@ typedef enum {
 
 DSTATUS disk_initialize (void);
 DRESULT disk_readp (UINT DeviceId, BYTE* buff, DWORD sector, UINT offser, UINT count);
+DRESULT disk_readm (UINT DeviceId, BYTE* buff, DWORD sector, UINT count);
 DRESULT disk_writep (UINT DeviceId, const BYTE* buff, DWORD sc);
 
 #define STA_NOINIT		0x01	/* Drive not initialized */
@@ -13,12 +13,15 @@
 #include "arcconsole.h"
 #include "arcfs.h"
 #include "getstr.h"
+#include "arctrace.h"
 
 enum {
 	SETUP_MENU_CHOICE_SYSPART,
 	SETUP_MENU_CHOICE_UPDATE,
 	SETUP_MENU_CHOICE_LOADRD,
 	SETUP_MENU_CHOICE_NOMBRBOOT,
+	SETUP_MENU_CHOICE_TRACESHOW,
+	SETUP_MENU_CHOICE_TRACESAVE,
 	SETUP_MENU_CHOICE_EXIT,
 	SETUP_MENU_CHOICES_COUNT
 };
@@ -291,6 +294,7 @@ static void ArcFwPartitionerSelected(ULONG Hd) {
 				// Set the ARC system partition
 				snprintf(TempName, sizeof(TempName), "%spartition(3)", HdDevice);
 				Status = Api->SetEnvironmentRoutine("SYSTEMPARTITION", TempName);
+				if (ARC_SUCCESS(Status)) Status = ArcEnvCommit();
 				if (ARC_FAIL(Status)) printf("Could not set ARC system partition in NVRAM: %s\r\n", ArcGetErrorString(Status));
 #if 0 // todo: reimplement?
 				// Set the Open Firmware boot device.
@@ -517,6 +521,8 @@ void ArcFwSetup(void) {
 			"Update boot partition on disk",
 			"Load driver ramdisk",
 			"Reboot to OSX install or OS8/OS9",
+			"Show boot trace",
+			"Save boot trace to system partition",
 			"Exit"
 		};
 
@@ -612,6 +618,34 @@ void ArcFwSetup(void) {
 			return;
 		}
 
+		if (DefaultChoice == SETUP_MENU_CHOICE_TRACESHOW) {
+			ArcClearScreen();
+			ArcSetPosition(1, 0);
+			ArcTraceDump();
+			continue;
+		}
+
+		if (DefaultChoice == SETUP_MENU_CHOICE_TRACESAVE) {
+			PVENDOR_VECTOR_TABLE Api = ARC_VENDOR_VECTORS();
+			PCHAR SysPart = Api->GetEnvironmentRoutine("SYSTEMPARTITION");
+			if (SysPart == NULL) {
+				printf(" No system partition present.\r\n");
+				printf(" Press any key to continue...\r\n");
+				IOSKBD_ReadChar();
+				continue;
+			}
+
+			// The filesystem can't create files, the trace overwrites an existing one.
+			char TracePath[ARC_ENV_MAXIMUM_VALUE_SIZE + sizeof("\\boottrace.bin")];
+			snprintf(TracePath, sizeof(TracePath), "%s\\boottrace.bin", SysPart);
+			ARC_STATUS Status = ArcTraceSave(TracePath);
+			if (ARC_SUCCESS(Status)) printf(" Saved boot trace to %s\r\n", TracePath);
+			else printf(" Failed to save boot trace to %s: %s\r\n", TracePath, ArcGetErrorString(Status));
+			printf(" Press any key to continue...\r\n");
+			IOSKBD_ReadChar();
+			continue;
+		}
+
 		if (DefaultChoice == SETUP_MENU_CHOICE_NOMBRBOOT) {
 			PVENDOR_VECTOR_TABLE Api = ARC_VENDOR_VECTORS();
 			// Get the system partition drive
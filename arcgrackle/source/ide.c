@@ -21,10 +21,13 @@
 
 #include "ide.h"
 #include "hdreg.h"
+#include "timer.h"
 
 #define __be32_to_cpu(x) ((PU32BE)(ULONG)&(x))->v
 
 static int ob_ide_atapi_request_sense(struct ide_drive* drive);
+static void ob_ide_software_reset(struct ide_drive *drive);
+static int ob_ide_set_multiple(struct ide_drive *drive, unsigned int sectors);
 
 static struct ide_channel* s_channels_head = NULL;
 
@@ -70,6 +73,11 @@ do { printk("IDE - %s: " fmt, __func__ , ##__VA_ARGS__); } while (0)
 #define DEV_NAME CONFIG_IDE_DEV_NAME
 #endif
 
+/*
+ * define to keep every transfer on pio, even for drives that can busmaster
+ */
+//#define CONFIG_IDE_FORCE_PIO
+
 static int current_channel = FIRST_UNIT;
 
 /*
@@ -315,10 +323,23 @@ ob_ide_write_registers(struct ide_drive *drive, struct ata_command *cmd)
 	ob_ide_400ns_delay(drive);
 }
 
+/*
+ * write the taskfile, or the tasklet for lba48, and issue the command
+ */
+static void
+ob_ide_write_command(struct ide_drive *drive, struct ata_command *cmd,
+                     int tasklet)
+{
+	if (tasklet) {
+		ob_ide_pio_writeb(drive, IDEREG_CONTROL, cmd->control | IDECON_NIEN);
+		ob_ide_write_tasklet(drive, cmd);
+	} else
+		ob_ide_write_registers(drive, cmd);
+}
+
 /*
  * execute command with "pio non data" protocol
  */
-#if 0
 static int
 ob_ide_pio_non_data(struct ide_drive *drive, struct ata_command *cmd)
 {
@@ -327,21 +348,21 @@ ob_ide_pio_non_data(struct ide_drive *drive, struct ata_command *cmd)
 
 	ob_ide_write_registers(drive, cmd);
 
-	if (ob_ide_wait_stat(drive, 0, BUSY_STAT, NULL))
+	if (ob_ide_wait_stat(drive, 0, BUSY_STAT | ERR_STAT, &cmd->stat))
 		return 1;
 
 	return 0;
 }
-#endif
 
 /*
  * execute given command with a pio data-in phase.
  */
 static int
-ob_ide_pio_data_in(struct ide_drive *drive, struct ata_command *cmd)
+ob_ide_pio_data_in(struct ide_drive *drive, struct ata_command *cmd,
+                   int tasklet)
 {
 	unsigned char stat;
-	unsigned int bytes, timeout;
+	unsigned int bytes, timeout, drq;
 
 	if (ob_ide_select_drive(drive))
 		return 1;
@@ -378,17 +399,24 @@ ob_ide_pio_data_in(struct ide_drive *drive, struct ata_command *cmd)
 		return 1;
 	}
 
-	ob_ide_write_registers(drive, cmd);
+	ob_ide_write_command(drive, cmd, tasklet);
+
+	/*
+	 * read multiple transfers several sectors per drq block
+	 */
+	drq = drive->bs;
+	if (cmd->command == WIN_MULTREAD || cmd->command == WIN_MULTREAD_EXT)
+		drq *= drive->multi;
 
 	/*
 	 * now read the data
 	 */
 	bytes = cmd->buflen;
 	do {
-		unsigned count = cmd->buflen;
+		unsigned count = bytes;
 
-		if (count > drive->bs)
-			count = drive->bs;
+		if (count > drq)
+			count = drq;
 
 		/* delay 100ms for ATAPI? */
 
@@ -434,10 +462,11 @@ ob_ide_pio_data_in(struct ide_drive *drive, struct ata_command *cmd)
  * execute given command with a pio data-out phase.
  */
 static int
-ob_ide_pio_data_out(struct ide_drive *drive, struct ata_command *cmd)
+ob_ide_pio_data_out(struct ide_drive *drive, struct ata_command *cmd,
+                   int tasklet)
 {
 	unsigned char stat;
-	unsigned int bytes, timeout;
+	unsigned int bytes, timeout, drq;
 
 	if (ob_ide_select_drive(drive))
 		return 1;
@@ -474,17 +503,24 @@ ob_ide_pio_data_out(struct ide_drive *drive, struct ata_command *cmd)
 		return 1;
 	}
 
-	ob_ide_write_registers(drive, cmd);
+	ob_ide_write_command(drive, cmd, tasklet);
+
+	/*
+	 * write multiple transfers several sectors per drq block
+	 */
+	drq = drive->bs;
+	if (cmd->command == WIN_MULTWRITE || cmd->command == WIN_MULTWRITE_EXT)
+		drq *= drive->multi;
 
 	/*
 	 * now write the data
 	 */
 	bytes = cmd->buflen;
 	do {
-		unsigned count = cmd->buflen;
+		unsigned count = bytes;
 
-		if (count > drive->bs)
-			count = drive->bs;
+		if (count > drq)
+			count = drq;
 
 		/* delay 100ms for ATAPI? */
 
@@ -678,6 +714,14 @@ ob_ide_atapi_packet(struct ide_drive *drive, struct atapi_command *cmd)
 		if (ob_ide_atapi_request_sense(drive))
 			break;
 
+		/*
+		 * the media was swapped, or the tray is open or empty. keep
+		 * that for the next open, cached sectors are stale now
+		 */
+		if (cmd->sense.sense_key == ATAPI_SENSE_UNIT_ATTENTION ||
+		    cmd->sense.sense_key == ATAPI_SENSE_NOT_READY)
+			drive->media_changed = 1;
+
 		/*
 		 * we know sense is valid. retry if the drive isn't ready,
 		 * otherwise don't bother.
@@ -787,11 +831,400 @@ ob_ide_atapi_drive_ready(struct ide_drive *drive, bool on_open)
 }
 
 /*
- * read from an atapi device, using READ_10
+ * Apple DBDMA, the mac-io ide cells busmaster through one of these
+ */
+#define DBDMA_CONTROL		0x00
+#define DBDMA_STATUS		0x04
+#define DBDMA_CMDPTR_HI		0x08
+#define DBDMA_CMDPTR_LO		0x0C
+
+#define DBDMA_RUN		0x8000
+#define DBDMA_PAUSE		0x4000
+#define DBDMA_FLUSH		0x2000
+#define DBDMA_WAKE		0x1000
+#define DBDMA_DEAD		0x0800
+#define DBDMA_ACTIVE		0x0400
+
+#define DBDMA_OUTPUT_MORE	0x0000
+#define DBDMA_OUTPUT_LAST	0x1000
+#define DBDMA_INPUT_MORE	0x2000
+#define DBDMA_INPUT_LAST	0x3000
+#define DBDMA_STOP		0x7000
+
+/*
+ * req_count is 16 bits, keep segments a multiple of the largest block size
+ */
+#define IDE_DMA_SEGMENT		0xF800
+#define IDE_DMA_TABLE_SIZE	16
+#define IDE_DMA_MAX_BYTES	((IDE_DMA_TABLE_SIZE - 1) * IDE_DMA_SEGMENT)
+
+/*
+ * dma failures in a row, with pio working each time, before a drive that
+ * passed the verify read is put back on pio
+ */
+#define IDE_DMA_MAX_ERRORS	3
+
+/*
+ * only cached ram is handed to the controller, buffers must cover whole
+ * cachelines so flushing them can't clobber anything else
+ */
+#define IDE_DMA_RAM_START	0x80000000
+#define IDE_DMA_RAM_END		0x90000000
+#define IDE_DMA_ALIGN		0x20
+
+/*
+ * 5 seconds in 10us steps
+ */
+#define IDE_DMA_TIMEOUT		500000
+#define IDE_DMA_TIMEOUT_MS	5000
+
+/*
+ * descriptors are little endian, the same as us
+ */
+typedef volatile struct {
+	u32 command;		/* command << 16 | req_count */
+	u32 phy_addr;
+	u32 cmd_dep;
+	u32 xfer_status;	/* xfer_status << 16 | res_count */
+} dbdma_cmd_t;
+
+/*
+ * only one transfer is ever in flight, so one table is enough
+ */
+static dbdma_cmd_t s_dma_table[IDE_DMA_TABLE_SIZE] __attribute__((aligned(IDE_DMA_ALIGN)));
+static unsigned int s_dma_count;
+static unsigned char s_dma_verify[2048] __attribute__((aligned(IDE_DMA_ALIGN)));
+
+/*
+ * a read started by ob_ide_read_blocks_start, finished by polling
+ */
+static struct {
+	struct ide_drive *drive;	/* 0: nothing started */
+	unsigned char *buf;
+	unsigned int bytes;
+	unsigned long start;		/* currmsecs() when issued */
+	int finished;
+	int ret;
+} s_dma_async;
+
+void DCFlushRangeNoSync(PVOID Start, ULONG Length);
+
+static void
+ob_ide_dma_flush(void *buf, unsigned int len)
+{
+	DCFlushRangeNoSync(buf, len);
+	__asm__ __volatile__("sync");
+}
+
+/*
+ * can this transfer be done by the dbdma engine?
  */
 static int
-ob_ide_read_atapi(struct ide_drive *drive, unsigned long long block,
-                  unsigned char *buf, unsigned int sectors)
+ob_ide_dma_usable(struct ide_drive *drive, unsigned char *buf,
+                  unsigned int bytes)
+{
+	unsigned long addr = (unsigned long)buf;
+
+	if (drive->dma == ide_dma_none || !drive->channel->dma_regs)
+		return 0;
+	if (drive->bs > sizeof(s_dma_verify))
+		return 0;
+	if (drive->type == ide_type_ata && drive->addressing == ide_chs)
+		return 0;
+	if (addr < IDE_DMA_RAM_START || addr + bytes > IDE_DMA_RAM_END)
+		return 0;
+	if ((addr | bytes) & (IDE_DMA_ALIGN - 1))
+		return 0;
+
+	return 1;
+}
+
+/*
+ * most sectors one dma command moves: the descriptor table limits it, and
+ * without lba48 so does the 8-bit sector count, where 0 means 256
+ */
+static unsigned int
+ob_ide_dma_max_sectors(struct ide_drive *drive)
+{
+	unsigned int max = IDE_DMA_MAX_BYTES / drive->bs;
+
+	if (drive->type == ide_type_ata && drive->addressing != ide_lba48) {
+		if (max > 256)
+			max = 256;
+		if (drive->addressing == ide_chs && max > 255)
+			max = 255;
+	}
+
+	return max;
+}
+
+/*
+ * a dma transfer failed but pio did the same transfer fine. a drive still
+ * being verified goes to pio at once, one that passed only after several
+ * failures in a row.
+ */
+static void
+ob_ide_dma_failed(struct ide_drive *drive)
+{
+	if (drive->dma == ide_dma_untested ||
+	    ++drive->dma_errors >= IDE_DMA_MAX_ERRORS) {
+		IDE_DPRINTF("%d: dma failed, using pio\n", drive->nr);
+		drive->dma = ide_dma_none;
+	}
+}
+
+static void
+ob_ide_dma_stop(struct ide_channel *chan)
+{
+	PUCHAR regs = (PUCHAR)chan->dma_regs;
+	int timeout;
+
+	MmioWrite32L(regs + DBDMA_CONTROL,
+	             (DBDMA_RUN | DBDMA_PAUSE | DBDMA_FLUSH | DBDMA_WAKE | DBDMA_DEAD) << 16);
+
+	for (timeout = 1000; timeout; timeout--) {
+		if (!(MmioRead32L(regs + DBDMA_STATUS) & DBDMA_ACTIVE))
+			break;
+		udelay(1);
+	}
+}
+
+/*
+ * build the descriptor table for a buffer and start the channel. the drive
+ * will not request any data until the command is issued.
+ */
+static void
+ob_ide_dma_setup(struct ide_drive *drive, unsigned char *buf,
+                 unsigned int bytes, int write)
+{
+	struct ide_channel *chan = drive->channel;
+	PUCHAR regs = (PUCHAR)chan->dma_regs;
+	unsigned long phys = (unsigned long)buf - IDE_DMA_RAM_START;
+	unsigned int i = 0;
+
+	ob_ide_dma_flush(buf, bytes);
+
+	while (bytes) {
+		unsigned int len = bytes;
+		unsigned int command;
+
+		if (len > IDE_DMA_SEGMENT)
+			len = IDE_DMA_SEGMENT;
+		bytes -= len;
+
+		if (write)
+			command = bytes ? DBDMA_OUTPUT_MORE : DBDMA_OUTPUT_LAST;
+		else
+			command = bytes ? DBDMA_INPUT_MORE : DBDMA_INPUT_LAST;
+
+		s_dma_table[i].command = (command << 16) | len;
+		s_dma_table[i].phy_addr = phys;
+		s_dma_table[i].cmd_dep = 0;
+		s_dma_table[i].xfer_status = 0;
+
+		phys += len;
+		i++;
+	}
+
+	s_dma_table[i].command = DBDMA_STOP << 16;
+	s_dma_table[i].phy_addr = 0;
+	s_dma_table[i].cmd_dep = 0;
+	s_dma_table[i].xfer_status = 0;
+	s_dma_count = i;
+
+	ob_ide_dma_flush((void *)s_dma_table, sizeof(s_dma_table));
+
+	ob_ide_dma_stop(chan);
+	MmioWrite32L(regs + DBDMA_CMDPTR_HI, 0);
+	MmioWrite32L(regs + DBDMA_CMDPTR_LO,
+	             (unsigned long)s_dma_table - IDE_DMA_RAM_START);
+	MmioWrite32L(regs + DBDMA_CONTROL, (DBDMA_RUN << 16) | DBDMA_RUN);
+}
+
+/*
+ * has the transfer the channel is running stopped, one way or another?
+ */
+static int
+ob_ide_dma_done(struct ide_drive *drive)
+{
+	PUCHAR regs = (PUCHAR)drive->channel->dma_regs;
+	unsigned char stat = ob_ide_pio_readb(drive, IDEREG_ASTATUS);
+	unsigned long dstat = MmioRead32L(regs + DBDMA_STATUS);
+
+	if (dstat & DBDMA_DEAD)
+		return 1;
+
+	return !(stat & BUSY_STAT) &&
+	       ((stat & ERR_STAT) || !(dstat & DBDMA_ACTIVE));
+}
+
+/*
+ * stop the channel once the transfer is over and hand the buffer back to
+ * the cpu. returns 1 on failure.
+ */
+static int
+ob_ide_dma_finish(struct ide_drive *drive, unsigned char *buf,
+                  unsigned int bytes, int write, unsigned char *ret_stat,
+                  int timed_out)
+{
+	struct ide_channel *chan = drive->channel;
+	PUCHAR regs = (PUCHAR)chan->dma_regs;
+	unsigned char stat = 0;
+	unsigned long dstat = MmioRead32L(regs + DBDMA_STATUS);
+	unsigned int i;
+	int ret = 0;
+
+	ob_ide_dma_stop(chan);
+
+	/*
+	 * reading status also acks the drive
+	 */
+	stat = ob_ide_pio_readb(drive, IDEREG_STATUS);
+	if (ret_stat)
+		*ret_stat = stat;
+
+	if (timed_out) {
+		ob_ide_error(drive, stat, "dma timed out");
+		ob_ide_software_reset(drive);
+		ret = 1;
+	} else if ((dstat & DBDMA_DEAD) ||
+	           (stat & (BUSY_STAT | DRQ_STAT | WRERR_STAT | ERR_STAT))) {
+		ob_ide_error(drive, stat, "dma failed");
+		ret = 1;
+	}
+
+	/*
+	 * every data descriptor must have run to completion
+	 */
+	ob_ide_dma_flush((void *)s_dma_table, sizeof(s_dma_table));
+	for (i = 0; !ret && i < s_dma_count; i++) {
+		u32 status = s_dma_table[i].xfer_status;
+
+		if (!(status & (DBDMA_RUN << 16)) || (status & 0xffff))
+			ret = 1;
+	}
+
+	if (!write)
+		ob_ide_dma_flush(buf, bytes);
+
+	return ret;
+}
+
+/*
+ * wait for the drive to finish and the channel to drain, then stop the
+ * channel and hand the buffer back to the cpu. returns 1 on failure.
+ */
+static int
+ob_ide_dma_complete(struct ide_drive *drive, unsigned char *buf,
+                    unsigned int bytes, int write, unsigned char *ret_stat)
+{
+	int timeout;
+
+	ob_ide_400ns_delay(drive);
+
+	for (timeout = IDE_DMA_TIMEOUT; timeout; timeout--) {
+		if (ob_ide_dma_done(drive))
+			break;
+
+		udelay(10);
+	}
+
+	return ob_ide_dma_finish(drive, buf, bytes, write, ret_stat, !timeout);
+}
+
+/*
+ * issue given ata command with a dma data phase. the taskfile, or the
+ * tasklet for lba48, must already be filled in.
+ */
+static int
+ob_ide_dma_data_start(struct ide_drive *drive, struct ata_command *cmd,
+                      int tasklet, int write)
+{
+	unsigned char stat;
+
+	if (ob_ide_select_drive(drive))
+		return 1;
+
+	if (ob_ide_wait_stat(drive, READY_STAT, BUSY_STAT | DRQ_STAT, &stat)) {
+		ob_ide_error(drive, stat, "drive not ready for dma");
+		cmd->stat = stat;
+		return 1;
+	}
+
+	ob_ide_dma_setup(drive, cmd->buffer, cmd->buflen, write);
+
+	ob_ide_write_command(drive, cmd, tasklet);
+
+	return 0;
+}
+
+static int
+ob_ide_dma_data(struct ide_drive *drive, struct ata_command *cmd,
+                int tasklet, int write)
+{
+	if (ob_ide_dma_data_start(drive, cmd, tasklet, write))
+		return 1;
+
+	return ob_ide_dma_complete(drive, cmd->buffer, cmd->buflen, write,
+	                           &cmd->stat);
+}
+
+/*
+ * issue a data-in packet command with the data phase done by dma. no
+ * retries, on any failure the caller falls back to pio.
+ */
+static int
+ob_ide_dma_packet_start(struct ide_drive *drive, struct atapi_command *cmd)
+{
+	struct ata_command *acmd = &drive->channel->ata_cmd;
+	unsigned char stat;
+
+	if (cmd->data_direction != atapi_ddir_read || cmd->buflen > 0xffff)
+		return 1;
+
+	if (ob_ide_select_drive(drive))
+		return 1;
+
+	ob_ide_dma_setup(drive, cmd->buffer, cmd->buflen, 0);
+
+	memset(acmd, 0, sizeof(*acmd));
+	acmd->feature = 0x01; /* dma */
+	acmd->lcyl = cmd->buflen & 0xff;
+	acmd->hcyl = (cmd->buflen >> 8) & 0xff;
+	acmd->command = WIN_PACKET;
+	ob_ide_write_registers(drive, acmd);
+
+	/*
+	 * the cdb is always sent by pio
+	 */
+	if (ob_ide_wait_stat(drive, 0, BUSY_STAT | ERR_STAT, &stat) ||
+	    (stat & (BUSY_STAT | DRQ_STAT)) != DRQ_STAT) {
+		cmd->stat = stat;
+		ob_ide_dma_stop(drive->channel);
+		return 1;
+	}
+
+	ob_ide_pio_outsw(drive, IDEREG_DATA, cmd->cdb, sizeof(cmd->cdb));
+
+	return 0;
+}
+
+static int
+ob_ide_dma_packet(struct ide_drive *drive, struct atapi_command *cmd)
+{
+	if (ob_ide_dma_packet_start(drive, cmd))
+		return 1;
+
+	return ob_ide_dma_complete(drive, cmd->buffer, cmd->buflen, 0,
+	                           &cmd->stat);
+}
+
+/*
+ * fill in READ_10 for an atapi device, once it is ready
+ */
+static int
+ob_ide_atapi_read_cmd(struct ide_drive *drive, unsigned long long block,
+                      unsigned char *buf, unsigned int sectors)
 {
 	struct atapi_command *cmd = &drive->channel->atapi_cmd;
 
@@ -815,6 +1248,24 @@ ob_ide_read_atapi(struct ide_drive *drive, unsigned long long block,
 	cmd->buflen = sectors * 2048;
 	cmd->data_direction = atapi_ddir_read;
 
+	return 0;
+}
+
+/*
+ * read from an atapi device, using READ_10
+ */
+static int
+ob_ide_read_atapi(struct ide_drive *drive, unsigned long long block,
+                  unsigned char *buf, unsigned int sectors, int dma)
+{
+	struct atapi_command *cmd = &drive->channel->atapi_cmd;
+
+	if (ob_ide_atapi_read_cmd(drive, block, buf, sectors))
+		return 1;
+
+	if (dma)
+		return ob_ide_dma_packet(drive, cmd);
+
 	return ob_ide_atapi_packet(drive, cmd);
 }
 
@@ -840,9 +1291,9 @@ ob_ide_read_ata_chs(struct ide_drive *drive, unsigned long long block,
 	cmd->hcyl = cyl >> 8;
 	cmd->device_head = head;
 
-	cmd->command = WIN_READ;
+	cmd->command = drive->multi ? WIN_MULTREAD : WIN_READ;
 
-	return ob_ide_pio_data_in(drive, cmd);
+	return ob_ide_pio_data_in(drive, cmd, 0);
 }
 
 static int
@@ -866,9 +1317,9 @@ ob_ide_read_ata_lba28(struct ide_drive *drive, unsigned long long block,
 	cmd->device_head = ((block >> 8) & 0x0f);
 	cmd->device_head |= (1 << 6);
 
-	cmd->command = WIN_READ;
+	cmd->command = drive->multi ? WIN_MULTREAD : WIN_READ;
 
-	return ob_ide_pio_data_in(drive, cmd);
+	return ob_ide_pio_data_in(drive, cmd, 0);
 }
 
 static int
@@ -894,11 +1345,11 @@ ob_ide_read_ata_lba48(struct ide_drive *drive, unsigned long long block,
 	cmd->task[8] = (u64) block >> 32;
 	cmd->task[9] = (u64) block >> 40;
 
-	cmd->command = WIN_READ_EXT;
+	cmd->device_head = IDEHEAD_LBA;
 
-	ob_ide_write_tasklet(drive, cmd);
+	cmd->command = drive->multi ? WIN_MULTREAD_EXT : WIN_READ_EXT;
 
-	return ob_ide_pio_data_in(drive, cmd);
+	return ob_ide_pio_data_in(drive, cmd, 1);
 }
 /*
  * read 'sectors' sectors from ata device
@@ -926,6 +1377,154 @@ ob_ide_read_ata(struct ide_drive *drive, unsigned long long block,
 	return ob_ide_read_ata_chs(drive, block, buf, sectors);
 }
 
+/*
+ * fill in a dma read or write of 'sectors' sectors for an ata device.
+ * tasklet is set when the command needs lba48.
+ */
+static int
+ob_ide_ata_dma_cmd(struct ide_drive *drive, unsigned long long block,
+                   unsigned char *buf, unsigned int sectors, int write,
+                   int *tasklet)
+{
+	struct ata_command *cmd = &drive->channel->ata_cmd;
+	unsigned long long end_block = block + sectors;
+	/* a sector count of 0 asks for 256 */
+	const int need_lba48 = (end_block > (1ULL << 28)) || (sectors > 256);
+
+	if (end_block > drive->sectors)
+		return 1;
+	if (need_lba48 && drive->addressing != ide_lba48)
+		return 1;
+
+	*tasklet = need_lba48;
+
+	memset(cmd, 0, sizeof(*cmd));
+
+	cmd->buffer = buf;
+	cmd->buflen = sectors * 512;
+
+	if (need_lba48) {
+		cmd->task[2] = sectors;
+		cmd->task[3] = sectors >> 8;
+		cmd->task[4] = block;
+		cmd->task[5] = block >>  8;
+		cmd->task[6] = block >> 16;
+		cmd->task[7] = block >> 24;
+		cmd->task[8] = (u64) block >> 32;
+		cmd->task[9] = (u64) block >> 40;
+		cmd->device_head = IDEHEAD_LBA;
+
+		cmd->command = write ? WIN_WRITEDMA_EXT : WIN_READDMA_EXT;
+	} else {
+		cmd->nsector = sectors;
+		cmd->sector = block;
+		cmd->lcyl = block >> 8;
+		cmd->hcyl = block >> 16;
+		cmd->device_head = ((block >> 24) & 0x0f) | IDEHEAD_LBA;
+
+		cmd->command = write ? WIN_WRITEDMA : WIN_READDMA;
+	}
+
+	return 0;
+}
+
+/*
+ * read or write 'sectors' sectors from ata device by dma
+ */
+static int
+ob_ide_ata_dma(struct ide_drive *drive, unsigned long long block,
+               unsigned char *buf, unsigned int sectors, int write)
+{
+	int tasklet;
+
+	if (ob_ide_ata_dma_cmd(drive, block, buf, sectors, write, &tasklet))
+		return 1;
+
+	return ob_ide_dma_data(drive, &drive->channel->ata_cmd, tasklet, write);
+}
+
+static int
+ob_ide_read_pio(struct ide_drive *drive, unsigned long long block,
+                unsigned char *buf, unsigned int sectors)
+{
+	if (drive->type == ide_type_ata)
+		return ob_ide_read_ata(drive, block, buf, sectors);
+	else
+		return ob_ide_read_atapi(drive, block, buf, sectors, 0);
+}
+
+/*
+ * read by dma, in chunks one command can cover. the first read a drive does
+ * is checked against pio. if pio succeeds where dma failed, the drive is put
+ * on pio by ob_ide_dma_failed.
+ */
+static int
+ob_ide_read_dma(struct ide_drive *drive, unsigned long long block,
+                unsigned char *buf, unsigned int sectors)
+{
+	unsigned int max = ob_ide_dma_max_sectors(drive);
+	unsigned int count;
+	int ret;
+
+	for (; sectors; block += count, buf += count * drive->bs, sectors -= count) {
+		count = sectors;
+		if (count > max)
+			count = max;
+
+		if (drive->type == ide_type_ata)
+			ret = ob_ide_ata_dma(drive, block, buf, count, 0);
+		else
+			ret = ob_ide_read_atapi(drive, block, buf, count, 1);
+
+		if (!ret && drive->dma == ide_dma_untested) {
+			ret = ob_ide_read_pio(drive, block, s_dma_verify, 1) ||
+			      memcmp(buf, s_dma_verify, drive->bs);
+			if (!ret)
+				drive->dma = ide_dma_ok;
+		}
+
+		if (ret) {
+			if (ob_ide_read_pio(drive, block, buf, sectors))
+				return 1;
+
+			ob_ide_dma_failed(drive);
+			return 0;
+		}
+		drive->dma_errors = 0;
+	}
+
+	return 0;
+}
+
+/*
+ * see if the read started by ob_ide_read_blocks_start is over, waiting for
+ * it if asked to. returns 1 once it is, the result is in s_dma_async.ret.
+ */
+static int
+ob_ide_dma_async_step(int wait)
+{
+	struct ide_drive *drive = s_dma_async.drive;
+	int timed_out = 0;
+
+	if (!drive || s_dma_async.finished)
+		return 1;
+
+	while (!ob_ide_dma_done(drive)) {
+		timed_out = currmsecs() - s_dma_async.start >= IDE_DMA_TIMEOUT_MS;
+		if (timed_out)
+			break;
+		if (!wait)
+			return 0;
+		udelay(10);
+	}
+
+	s_dma_async.ret = ob_ide_dma_finish(drive, s_dma_async.buf,
+	                                    s_dma_async.bytes, 0, NULL,
+	                                    timed_out);
+	s_dma_async.finished = 1;
+	return 1;
+}
+
 static int
 ob_ide_read_sectors(struct ide_drive *drive, unsigned long long block,
                     unsigned char *buf, unsigned int sectors)
@@ -938,10 +1537,10 @@ ob_ide_read_sectors(struct ide_drive *drive, unsigned long long block,
 	IDE_DPRINTF("ob_ide_read_sectors: block=%lu sectors=%u\n",
 	            (unsigned long) block, sectors);
 
-	if (drive->type == ide_type_ata)
-		return ob_ide_read_ata(drive, block, buf, sectors);
-	else
-		return ob_ide_read_atapi(drive, block, buf, sectors);
+	if (ob_ide_dma_usable(drive, buf, sectors * drive->bs))
+		return ob_ide_read_dma(drive, block, buf, sectors);
+
+	return ob_ide_read_pio(drive, block, buf, sectors);
 }
 
 /*
@@ -998,9 +1597,9 @@ ob_ide_write_ata_chs(struct ide_drive *drive, unsigned long long block,
 	cmd->hcyl = cyl >> 8;
 	cmd->device_head = head;
 
-	cmd->command = WIN_WRITE;
+	cmd->command = drive->multi ? WIN_MULTWRITE : WIN_WRITE;
 
-	return ob_ide_pio_data_out(drive, cmd);
+	return ob_ide_pio_data_out(drive, cmd, 0);
 }
 
 static int
@@ -1024,9 +1623,9 @@ ob_ide_write_ata_lba28(struct ide_drive *drive, unsigned long long block,
 	cmd->device_head = ((block >> 8) & 0x0f);
 	cmd->device_head |= (1 << 6);
 
-	cmd->command = WIN_WRITE;
+	cmd->command = drive->multi ? WIN_MULTWRITE : WIN_WRITE;
 
-	return ob_ide_pio_data_out(drive, cmd);
+	return ob_ide_pio_data_out(drive, cmd, 0);
 }
 
 static int
@@ -1052,11 +1651,11 @@ ob_ide_write_ata_lba48(struct ide_drive *drive, unsigned long long block,
 	cmd->task[8] = (u64) block >> 32;
 	cmd->task[9] = (u64) block >> 40;
 
-	cmd->command = WIN_WRITE_EXT;
+	cmd->device_head = IDEHEAD_LBA;
 
-	ob_ide_write_tasklet(drive, cmd);
+	cmd->command = drive->multi ? WIN_MULTWRITE_EXT : WIN_WRITE_EXT;
 
-	return ob_ide_pio_data_out(drive, cmd);
+	return ob_ide_pio_data_out(drive, cmd, 1);
 }
 /*
  * write 'sectors' sectors to ata device
@@ -1084,6 +1683,34 @@ ob_ide_write_ata(struct ide_drive *drive, unsigned long long block,
 	return ob_ide_write_ata_chs(drive, block, buf, sectors);
 }
 
+/*
+ * write by dma, only once reads have proven dma works for this drive
+ */
+static int
+ob_ide_write_dma(struct ide_drive *drive, unsigned long long block,
+                 unsigned char *buf, unsigned int sectors)
+{
+	unsigned int max = ob_ide_dma_max_sectors(drive);
+	unsigned int count;
+
+	for (; sectors; block += count, buf += count * drive->bs, sectors -= count) {
+		count = sectors;
+		if (count > max)
+			count = max;
+
+		if (ob_ide_ata_dma(drive, block, buf, count, 1)) {
+			if (ob_ide_write_ata(drive, block, buf, sectors))
+				return 1;
+
+			ob_ide_dma_failed(drive);
+			return 0;
+		}
+		drive->dma_errors = 0;
+	}
+
+	return 0;
+}
+
 static int
 ob_ide_write_sectors(struct ide_drive *drive, unsigned long long block,
                     unsigned char *buf, unsigned int sectors)
@@ -1096,6 +1723,10 @@ ob_ide_write_sectors(struct ide_drive *drive, unsigned long long block,
 	IDE_DPRINTF("ob_ide_write_sectors: block=%lu sectors=%u\n",
 	            (unsigned long) block, sectors);
 
+	if (drive->type == ide_type_ata && drive->dma == ide_dma_ok &&
+	    ob_ide_dma_usable(drive, buf, sectors * drive->bs))
+		return ob_ide_write_dma(drive, block, buf, sectors);
+
 	if (drive->type == ide_type_ata)
 		return ob_ide_write_ata(drive, block, buf, sectors);
 	else
@@ -1129,6 +1760,21 @@ ob_ide_fixup_string(unsigned char *s, unsigned int len)
 		*p++ = '\0';
 }
 
+/*
+ * set the number of sectors per drq block for read/write multiple
+ */
+static int
+ob_ide_set_multiple(struct ide_drive *drive, unsigned int sectors)
+{
+	struct ata_command *cmd = &drive->channel->ata_cmd;
+
+	memset(cmd, 0, sizeof(*cmd));
+	cmd->nsector = sectors;
+	cmd->command = WIN_SETMULT;
+
+	return ob_ide_pio_non_data(drive, cmd);
+}
+
 /*
  * it's big endian, we need to swap (if on little endian) the items we use
  */
@@ -1143,6 +1789,9 @@ ob_ide_fixup_id(struct hd_driveid *id)
 	id->sectors = __le16_to_cpu(id->sectors);
 	id->command_set_2 = __le16_to_cpu(id->command_set_2);
 	id->cfs_enable_2 = __le16_to_cpu(id->cfs_enable_2);
+	id->field_valid = __le16_to_cpu(id->field_valid);
+	id->dma_mword = __le16_to_cpu(id->dma_mword);
+	id->dma_ultra = __le16_to_cpu(id->dma_ultra);
 
 	return 0;
 }
@@ -1167,7 +1816,7 @@ ob_ide_identify_drive(struct ide_drive *drive)
 		return 1;
 	}
 
-	if (ob_ide_pio_data_in(drive, cmd))
+	if (ob_ide_pio_data_in(drive, cmd, 0))
 		return 1;
 
 	ob_ide_fixup_id(&id);
@@ -1187,6 +1836,15 @@ ob_ide_identify_drive(struct ide_drive *drive)
 		if ((id.command_set_2 & 0x0400) && (id.cfs_enable_2 & 0x0400)) {
 			drive->addressing = ide_lba48;
 			drive->max_sectors = 65535;
+
+			/*
+			 * sector numbers are 32 bits above this driver, so
+			 * only the first 2TB are reachable
+			 */
+			if (id.lba_capacity_2 > 0xffffffffULL)
+				drive->sectors = 0xffffffff;
+			else if (id.lba_capacity_2 > drive->sectors)
+				drive->sectors = id.lba_capacity_2;
 		} else
 #endif
 		if (id.capability & 2)
@@ -1199,7 +1857,28 @@ ob_ide_identify_drive(struct ide_drive *drive)
 		drive->cyl = id.cyls;
 		drive->head = id.heads;
 		drive->sect = id.sectors;
+
+		/*
+		 * move as many sectors per drq block as the drive allows
+		 */
+		drive->multi = 0;
+		if (id.max_multsect && !ob_ide_set_multiple(drive, id.max_multsect))
+			drive->multi = id.max_multsect;
+	}
+
+	/*
+	 * only busmaster if the drive has a dma mode selected, firmware has
+	 * already programmed the controller timings to match it
+	 */
+	drive->dma = ide_dma_none;
+	drive->dma_errors = 0;
+#ifndef CONFIG_IDE_FORCE_PIO
+	if (drive->channel->dma_regs && (id.capability & 1)) {
+		if ((id.dma_mword & 0x0700) ||
+		    ((id.field_valid & 4) && (id.dma_ultra & 0x7f00)))
+			drive->dma = ide_dma_untested;
 	}
+#endif
 
 	strncpy(drive->model, (char*)id.model, sizeof(drive->model));
 	drive->model[40] = '\0';
@@ -1232,6 +1911,7 @@ static void
 ob_ide_software_reset(struct ide_drive *drive)
 {
 	struct ide_channel *chan = drive->channel;
+	int i;
 
 	//ob_ide_pio_writeb(drive, IDEREG_CONTROL, IDECON_NIEN);
 	//ob_ide_400ns_delay(drive);
@@ -1274,6 +1954,18 @@ ob_ide_software_reset(struct ide_drive *drive)
 	 */
 	drive->channel->selected = -1;
 	ob_ide_select_drive(drive);
+
+	/*
+	 * the reset may have put the drives back to single sector drq blocks
+	 */
+	for (i = 0; i < 2; i++) {
+		struct ide_drive *d = &chan->drives[i];
+
+		if (d->present && d->multi && ob_ide_set_multiple(d, d->multi))
+			d->multi = 0;
+	}
+
+	ob_ide_select_drive(drive);
 }
 
 /*
@@ -1400,6 +2092,8 @@ ULONG ob_ide_read_blocks(PIDE_DRIVE drive, PVOID buffer, ULONG sector, ULONG cou
 	ULONG blk = sector;
 	ULONG transferred = 0;
 
+	ob_ide_dma_async_step(1);
+
 	while (n) {
 		ULONG len = n;
 		if (len > drive->max_sectors)
@@ -1425,6 +2119,8 @@ ULONG ob_ide_write_blocks(PIDE_DRIVE drive, PVOID buffer, ULONG sector, ULONG co
 	ULONG blk = sector;
 	ULONG transferred = 0;
 
+	ob_ide_dma_async_step(1);
+
 	while (n) {
 		ULONG len = n;
 		if (len > drive->max_sectors)
@@ -1443,6 +2139,62 @@ ULONG ob_ide_write_blocks(PIDE_DRIVE drive, PVOID buffer, ULONG sector, ULONG co
 	return transferred;
 }
 
+ULONG ob_ide_read_blocks_start(PIDE_DRIVE drive, PVOID buffer, ULONG sector, ULONG count)
+{
+	unsigned char *buf = (unsigned char *)buffer;
+	unsigned int max = ob_ide_dma_max_sectors(drive);
+	int tasklet, ret;
+
+	ob_ide_dma_async_step(1);
+	s_dma_async.drive = NULL;
+
+	/*
+	 * only drives whose dma already proved itself, anything else goes
+	 * through the checked path in ob_ide_read_sectors
+	 */
+	if (drive->dma != ide_dma_ok)
+		return 0;
+	if (count > drive->max_sectors)
+		count = drive->max_sectors;
+	if (count > max)
+		count = max;
+	if (!count || sector + count > drive->sectors)
+		return 0;
+	if (!ob_ide_dma_usable(drive, buf, count * drive->bs))
+		return 0;
+
+	if (drive->type == ide_type_ata)
+		ret = ob_ide_ata_dma_cmd(drive, sector, buf, count, 0, &tasklet) ||
+		      ob_ide_dma_data_start(drive, &drive->channel->ata_cmd,
+		                            tasklet, 0);
+	else
+		ret = ob_ide_atapi_read_cmd(drive, sector, buf, count) ||
+		      ob_ide_dma_packet_start(drive, &drive->channel->atapi_cmd);
+	if (ret)
+		return 0;
+
+	ob_ide_400ns_delay(drive);
+
+	s_dma_async.drive = drive;
+	s_dma_async.buf = buf;
+	s_dma_async.bytes = count * drive->bs;
+	s_dma_async.start = currmsecs();
+	s_dma_async.finished = 0;
+	s_dma_async.ret = 0;
+	return count;
+}
+
+int ob_ide_read_blocks_poll(PIDE_DRIVE drive)
+{
+	if (s_dma_async.drive != drive)
+		return 1;
+	if (!ob_ide_dma_async_step(0))
+		return -1;
+
+	s_dma_async.drive = NULL;
+	return s_dma_async.ret;
+}
+
 PIDE_DRIVE ob_ide_open(int channel, int unit)
 {
 	PIDE_CHANNEL pChan;
@@ -1469,6 +2221,13 @@ PIDE_DRIVE ob_ide_open(int channel, int unit)
 	return drive;
 }
 
+bool ob_ide_media_changed(PIDE_DRIVE drive)
+{
+	bool changed = drive->media_changed != 0;
+	drive->media_changed = 0;
+	return changed;
+}
+
 const IDE_CHANNEL* ob_ide_get_first_channel(void) {
 	return (const IDE_CHANNEL*)s_channels_head;
 }
@@ -1501,6 +2260,8 @@ macio_ide_outsw(struct ide_channel *chan,
 
 #define MACIO_IDE_OFFSET	0x00020000
 #define MACIO_IDE_SIZE		0x00001000
+#define MACIO_IDE_DMA_OFFSET	0x00008B00
+#define MACIO_IDE_DMA_SIZE	0x00000100
 
 int macio_ide_init(uint32_t addr, int nb_channels)
 {
@@ -1520,6 +2281,7 @@ int macio_ide_init(uint32_t addr, int nb_channels)
 		memset(chan, 0, sizeof(*chan));
 
 		chan->mmio = addr + MACIO_IDE_OFFSET + i * MACIO_IDE_SIZE;
+		chan->dma_regs = addr + MACIO_IDE_DMA_OFFSET + i * MACIO_IDE_DMA_SIZE;
 		chan->channel = i;
 
 		chan->obide_inb = macio_ide_inb;
@@ -507,6 +507,92 @@ static CLUST get_clust (
 }
 
 
+/*-----------------------------------------------------------------------*/
+/* File cluster map - Get cluster# of the file by cluster index          */
+/*-----------------------------------------------------------------------*/
+
+static CLUST walk_fat (	/* 1:Error, Else:Cluster# */
+	FATFS* fs,
+	CLUST clst,		/* Cluster# to start from */
+	DWORD n			/* Number of links to follow */
+)
+{
+	while (n--) {
+		clst = get_fat(fs, clst);
+		if (clst <= 1 || clst >= fs->n_fatent) return 1;
+	}
+	return clst;
+}
+
+
+#if PF_EXTENT_MAP
+static CLUST get_file_clust (	/* 1:Error or end of chain, Else:Cluster# */
+	FATFS* fs,
+	DWORD clidx		/* Cluster index from top of the file */
+)
+{
+	PFEXTENT *ext;
+	CLUST clst, nclst;
+	UINT i;
+
+
+	if (!fs->n_ext) {						/* Start the map with the first cluster */
+		if (fs->org_clust < 2 || fs->org_clust >= fs->n_fatent) return 1;
+		fs->ext[0].clust = fs->org_clust;
+		fs->ext[0].count = 1;
+		fs->n_ext = 1;
+		fs->ext_clust = 1;
+		fs->ext_flag = 0;
+	}
+	ext = &fs->ext[fs->n_ext - 1];
+	while (clidx >= fs->ext_clust) {		/* Extend the map along the cluster chain */
+		if (fs->ext_flag & EXT_END) return 1;	/* Beyond the end of the chain */
+		clst = ext->clust + ext->count - 1;	/* Last mapped cluster */
+		if (fs->ext_flag & EXT_FULL) {		/* Map overflowed, follow the chain from the last mapped cluster */
+			return walk_fat(fs, clst, clidx - (fs->ext_clust - 1));
+		}
+		nclst = get_fat(fs, clst);
+		if (nclst <= 1) return 1;
+		if (nclst >= fs->n_fatent) {		/* End of the chain */
+			fs->ext_flag |= EXT_END;
+			return 1;
+		}
+		if (nclst == clst + 1) {			/* Contiguous, grow the last extent */
+			ext->count++;
+		} else if (fs->n_ext < PF_EXTENT_MAP) {	/* Fragmented, start a new extent */
+			ext++;
+			ext->clust = nclst;
+			ext->count = 1;
+			fs->n_ext++;
+		} else {
+			fs->ext_flag |= EXT_FULL;
+			continue;
+		}
+		fs->ext_clust++;
+	}
+
+	for (i = 0; clidx >= fs->ext[i].count; i++) clidx -= fs->ext[i].count;	/* Find the extent */
+	return fs->ext[i].clust + (CLUST)clidx;
+}
+#endif
+
+
+static CLUST next_clust (	/* 1:Error, Else:Cluster status */
+	FATFS* fs,
+	DWORD clidx		/* Cluster index of the cluster following fs->curr_clust */
+)
+{
+#if PF_EXTENT_MAP
+	if (clidx < fs->ext_clust || !(fs->ext_flag & EXT_FULL)) return get_file_clust(fs, clidx);
+#else
+	(void)clidx;
+#endif
+	return get_fat(fs, fs->curr_clust);
+}
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Directory handling - Rewind directory index                           */
 /*-----------------------------------------------------------------------*/
@@ -916,6 +1002,11 @@ FRESULT pf_open (
 	fs->org_clust = get_clust(fs, dir);		/* File start cluster */
 	fs->fsize = ld_dword(dir+DIR_FileSize);	/* File size */
 	fs->fptr = 0;						/* File pointer */
+#if PF_EXTENT_MAP
+	fs->n_ext = 0;						/* Extent map is built on first use */
+	fs->ext_flag = 0;
+	fs->ext_clust = 0;
+#endif
 	fs->flag = FA_OPENED;
 
 	return FR_OK;
@@ -938,7 +1029,7 @@ FRESULT pf_read (
 {
 	DRESULT dr;
 	CLUST clst;
-	DWORD sect, remain;
+	DWORD sect, remain, clidx;
 	UINT rcnt;
 	BYTE cs, *rbuff = buff;
 
@@ -957,7 +1048,7 @@ FRESULT pf_read (
 				if (fs->fptr == 0) {				/* On the top of the file? */
 					clst = fs->org_clust;
 				} else {
-					clst = get_fat(fs, fs->curr_clust);
+					clst = next_clust(fs, fs->fptr / 512 / fs->csize);
 				}
 				if (clst <= 1) ABORT(FR_DISK_ERR);
 				fs->curr_clust = clst;				/* Update current cluster */
@@ -965,6 +1056,30 @@ FRESULT pf_read (
 			sect = clust2sect(fs, fs->curr_clust);		/* Get current sector */
 			if (!sect) ABORT(FR_DISK_ERR);
 			fs->dsect = sect + cs;
+			if (rbuff && btr >= 512) {				/* Whole sectors to memory? */
+				remain = btr / 512;					/* Sectors wanted */
+				rcnt = fs->csize - cs;				/* Sectors left in this cluster */
+				if (rcnt > remain) rcnt = (UINT)remain;
+				remain -= rcnt;
+				clidx = fs->fptr / 512 / fs->csize;	/* Cluster index of the current cluster */
+				while (remain) {					/* Extend the run over physically contiguous clusters */
+					clst = next_clust(fs, ++clidx);
+					if (clst <= 1 || clust2sect(fs, clst) != fs->dsect + rcnt) break;
+					fs->curr_clust = clst;
+					cs = fs->csize;
+					if (cs > remain) cs = (BYTE)remain;
+					rcnt += cs;
+					remain -= cs;
+				}
+				dr = disk_readm(fs->DeviceId, rbuff, fs->dsect, rcnt);	/* Read the run straight into the buffer */
+				if (dr) ABORT(FR_DISK_ERR);
+				fs->dsect += rcnt - 1;
+				rcnt *= 512;
+				fs->fptr += rcnt;
+				btr -= rcnt; *br += rcnt;
+				rbuff += rcnt;
+				continue;
+			}
 		}
 		rcnt = 512 - (UINT)fs->fptr % 512;			/* Get partial sector data from sector buffer */
 		if (rcnt > btr) rcnt = btr;
@@ -1023,7 +1138,7 @@ FRESULT pf_write (
 				if (fs->fptr == 0) {				/* On the top of the file? */
 					clst = fs->org_clust;
 				} else {
-					clst = get_fat(fs, fs->curr_clust);
+					clst = next_clust(fs, fs->fptr / 512 / fs->csize);
 				}
 				if (clst <= 1) ABORT(FR_DISK_ERR);
 				fs->curr_clust = clst;				/* Update current cluster */
@@ -1063,6 +1178,9 @@ FRESULT pf_lseek (
 {
 	CLUST clst;
 	DWORD bcs, sect, ifptr;
+#if PF_EXTENT_MAP
+	DWORD clidx;
+#endif
 
 
 	if (!fs) return FR_NOT_ENABLED;		/* Check file system */
@@ -1073,6 +1191,17 @@ FRESULT pf_lseek (
 	fs->fptr = 0;
 	if (ofs > 0) {
 		bcs = (DWORD)fs->csize * 512;		/* Cluster size (byte) */
+#if PF_EXTENT_MAP
+		clidx = (ofs - 1) / bcs;			/* Cluster index of the target */
+		if (!(fs->ext_flag & EXT_FULL) || clidx < fs->ext_clust || ifptr == 0 ||
+			(ifptr - 1) / bcs < fs->ext_clust || (ifptr - 1) / bcs > clidx) {	/* Unless following the chain from the current cluster is shorter, */
+			clst = get_file_clust(fs, clidx);	/* get the cluster from the extent map */
+			if (clst <= 1) ABORT(FR_DISK_ERR);
+			fs->curr_clust = clst;
+			fs->fptr = ofs;
+			ofs = 0;
+		} else
+#endif
 		if (ifptr > 0 &&
 			(ofs - 1) / bcs >= (ifptr - 1) / bcs) {	/* When seek to same or following cluster, */
 			fs->fptr = (ifptr - 1) & ~(bcs - 1);	/* start from the current cluster */
@@ -1101,6 +1230,60 @@ FRESULT pf_lseek (
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Get the contiguous disk run at the file R/W pointer                   */
+/*-----------------------------------------------------------------------*/
+#if PF_USE_READ && PF_EXTENT_MAP
+
+FRESULT pf_run (
+	FATFS* fs,
+	UINT btr,		/* Number of bytes wanted */
+	DWORD* sect,	/* Pointer to the first sector of the run */
+	UINT* br		/* Pointer to number of bytes in the run (whole sectors, 0:None) */
+)
+{
+	CLUST clst;
+	DWORD remain, clidx;
+	UINT rcnt;
+	BYTE cs;
+
+
+	*br = 0;
+	if (!fs) return FR_NOT_ENABLED;		/* Check file system */
+	if (!(fs->flag & FA_OPENED)) return FR_NOT_OPENED;	/* Check if opened */
+
+	remain = fs->fsize - fs->fptr;
+	if (btr > remain) btr = (UINT)remain;			/* Truncate btr by remaining bytes */
+	if (fs->fptr % 512 || btr < 512) return FR_OK;	/* Only whole sectors from a sector boundary */
+
+	clidx = fs->fptr / 512 / fs->csize;			/* Cluster index of the file pointer */
+	cs = (BYTE)(fs->fptr / 512 & (fs->csize - 1));	/* Sector offset in the cluster */
+	clst = get_file_clust(fs, clidx);
+	if (clst <= 1) return FR_DISK_ERR;
+	*sect = clust2sect(fs, clst);
+	if (!*sect) return FR_DISK_ERR;
+	*sect += cs;
+
+	remain = btr / 512;							/* Sectors wanted */
+	rcnt = fs->csize - cs;						/* Sectors left in this cluster */
+	if (rcnt > remain) rcnt = (UINT)remain;
+	remain -= rcnt;
+	while (remain) {							/* Extend the run over physically contiguous clusters */
+		clst = get_file_clust(fs, ++clidx);
+		if (clst <= 1 || clust2sect(fs, clst) != *sect + rcnt) break;
+		cs = fs->csize;
+		if (cs > remain) cs = (BYTE)remain;
+		rcnt += cs;
+		remain -= cs;
+	}
+	*br = rcnt * 512;
+
+	return FR_OK;
+}
+#endif
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Create a Directroy Object                                             */
 /*-----------------------------------------------------------------------*/
@@ -56,6 +56,16 @@ typedef unsigned long	DWORD;	/* 32-bit unsigned integer */
 #endif
 
 
+/* Cluster extent structure */
+
+#if PF_EXTENT_MAP
+typedef struct {
+	CLUST	clust;		/* First cluster of the extent */
+	CLUST	count;		/* Number of contiguous clusters */
+} PFEXTENT;
+#endif
+
+
 /* File system object structure */
 
 typedef struct {
@@ -74,6 +84,12 @@ typedef struct {
 	CLUST	curr_clust;	/* File current cluster */
 	DWORD	dsect;		/* File current data sector */
 	DWORD   DeviceId;   /* ARC device ID */
+#if PF_EXTENT_MAP
+	BYTE	n_ext;		/* Number of extents in ext[] (0:Not built yet) */
+	BYTE	ext_flag;	/* Extent map status flags */
+	DWORD	ext_clust;	/* Number of file clusters covered by ext[] */
+	PFEXTENT ext[PF_EXTENT_MAP];	/* Cluster extents of the open file */
+#endif
 } FATFS;
 
 
@@ -124,6 +140,7 @@ FRESULT pf_open (FATFS* fs, const char* path);							/* Open a file */
 FRESULT pf_read (FATFS* fs, void* buff, UINT btr, UINT* br);			/* Read data from the open file */
 FRESULT pf_write (FATFS* fs, const void* buff, UINT btw, UINT* bw);	/* Write data to the open file */
 FRESULT pf_lseek (FATFS* fs, DWORD ofs);								/* Move file pointer of the open file */
+FRESULT pf_run (FATFS* fs, UINT btr, DWORD* sect, UINT* br);			/* Get the contiguous disk run at the file pointer */
 FRESULT pf_opendir (FATFS* fs, DIR* dj, const char* path);				/* Open a directory */
 FRESULT pf_readdir (FATFS* fs, DIR* dj, FILINFO* fno);					/* Read a directory item from the open directory */
 
@@ -138,6 +155,10 @@ FRESULT pf_readdir (FATFS* fs, DIR* dj, FILINFO* fno);					/* Read a directory i
 #define	FA_WPRT		0x02
 #define	FA__WIP		0x40
 
+/* Extent map status flag (FATFS.ext_flag) */
+#define	EXT_END		0x01	/* The whole cluster chain is in the map */
+#define	EXT_FULL	0x02	/* The map overflowed before the end of the chain */
+
 
 /* FAT sub type (FATFS.fs_type) */
 #define FS_FAT12	1
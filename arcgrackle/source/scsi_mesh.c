@@ -439,7 +439,11 @@ PMESH_SCSI_DEVICE mesh_open_drive(UCHAR TargetId, UCHAR Lun) {
 			UCHAR TestUnitReady[] = { 0x00, Lun << 5, 0x00, 0x00, 0x00, 0x00 };
 			UCHAR Status = 0;
 			if (!mesh_run_scsi_command_retry(TargetId, TestUnitReady, sizeof(TestUnitReady), NULL, 0, false, &Status)) return NULL;
-			if (Status != 0) return NULL;
+			if (Status != 0) {
+				// Check condition: unit attention after a media change, or no media. The caller tries again.
+				Device->MediaChanged = 1;
+				return NULL;
+			}
 
 			// start/stop unit: start
 			UCHAR StartStopUnit[] = { 0x1B, Lun << 5, 0x00, 0x00, 0x01, 0x00 };
@@ -530,6 +534,12 @@ ULONG mesh_write_blocks(PMESH_SCSI_DEVICE drive, PVOID buffer, ULONG sector, ULO
 	return transferred;
 }
 
+bool mesh_media_changed(PMESH_SCSI_DEVICE drive) {
+	bool Changed = drive->MediaChanged != 0;
+	drive->MediaChanged = 0;
+	return Changed;
+}
+
 PMESH_SCSI_DEVICE mesh_get_first_device(void) {
 	return s_FirstScsiDevice;
 }
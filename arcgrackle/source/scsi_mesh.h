@@ -9,6 +9,7 @@ struct _MESH_SCSI_DEVICE {
 	UCHAR TargetId;
 	UCHAR Lun;
 	UCHAR IsCdRom;
+	UCHAR MediaChanged; // Check condition from test unit ready since last asked.
 };
 
 int mesh_init(uint32_t addr);
@@ -16,3 +17,4 @@ PMESH_SCSI_DEVICE mesh_get_first_device(void);
 PMESH_SCSI_DEVICE mesh_open_drive(UCHAR TargetId, UCHAR Lun);
 ULONG mesh_read_blocks(PMESH_SCSI_DEVICE drive, PVOID buffer, ULONG sector, ULONG count);
 ULONG mesh_write_blocks(PMESH_SCSI_DEVICE drive, PVOID buffer, ULONG sector, ULONG count);
+bool mesh_media_changed(PMESH_SCSI_DEVICE drive);
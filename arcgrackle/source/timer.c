@@ -26,6 +26,11 @@ void udelay(unsigned int usecs)
 	_wait_ticks(timer_freq_usecs * usecs);
 }
 
+unsigned long timer_frequency(void)
+{
+	return timer_freq;
+}
+
 unsigned long long currticks(void) {
 	unsigned long long _get_ticks(void);
 	return _get_ticks();
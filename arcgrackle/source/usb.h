@@ -138,6 +138,15 @@ typedef struct {
 			 of microframes (i.e. t = 125us * 2^interval) */
 } endpoint_t;
 
+typedef struct {
+	endpoint_t *ep;
+	int size;
+	u8 *data;
+	int finalize;
+	int result;	/* set by bulk_queue(): 0 if done, 1 if failed,
+			   -1 if it didn't run */
+} bulk_xfer_t;
+
 enum { FULL_SPEED = 0, LOW_SPEED = 1, HIGH_SPEED = 2, SUPER_SPEED = 3 };
 
 struct usbdev {
@@ -181,6 +190,12 @@ struct usbdev_hc {
 	void (*shutdown) (hci_t *controller);
 
 	int (*bulk) (endpoint_t *ep, int size, u8 *data, int finalize);
+	/* bulk_queue():	Schedule several bulk transfers together and
+				wait for them. Transfers on the same endpoint
+				run in order, and a failure cancels the ones
+				that haven't run yet. Returns 0 if all of them
+				succeeded. */
+	int (*bulk_queue) (bulk_xfer_t *xfers, int count);
 	int (*control) (usbdev_t *dev, direction_t pid, int dr_length,
 			void *devreq, int data_length, u8 *data);
 	void* (*create_intr_queue) (endpoint_t *ep, int reqsize, int reqcount, int reqtiming);
@@ -33,6 +33,7 @@ typedef struct {
 	unsigned int blocksize;
 	unsigned int numblocks;
 	unsigned int protocol;
+	unsigned int lba64;	/* use the 16-byte READ/WRITE commands */
 	endpoint_t *bulk_in;
 	endpoint_t *bulk_out;
 } usbmsc_inst_t;
@@ -257,11 +257,27 @@
 
 #define OHCI_INST(controller) ((ohci_t*)((controller)->instance))
 
+#define OHCI_TD_POOL_SIZE 64 /* general TDs preallocated per controller */
+#define OHCI_BULK_QUEUE_MAX 4 /* bulk transfers queued at once */
+#define OHCI_BULK_EDS 2 /* endpoints they can be on */
+#define OHCI_BOUNCE_COUNT 3 /* bulk bounce buffers per controller */
+#define OHCI_BOUNCE_SIZE 0x10000
+#define OHCI_DMA_ALIGN_MASK 0x1f
+#define OHCI_POLL_USECS 2 /* completion polling interval */
+#define OHCI_LIST_STOP_USECS 3000 /* wait for a start of frame at most this long */
+
 	typedef struct ohci {
 		opreg_t *opreg;
 		hcca_t *hcca;
 		usbdev_t *roothub;
 		ed_t *periodic_ed;
+		ed_t *bulk_ed; /* two banks of OHCI_BULK_EDS, bulk transfers are synchronous so they share these */
+		int bulk_bank; /* the bank the last bulk transfer left on the list */
+		int bulk_idle; /* how many of its EDs are linked */
+		ed_t *control_ed; /* the ED the last control transfer left on the list */
+		td_t *td_pool;
+		td_t *td_free; /* free pool TDs, linked through next_td */
+		u8 *bounce[OHCI_BOUNCE_COUNT];
 	} ohci_t;
 
 	typedef enum { OHCI_SETUP=0, OHCI_OUT=1, OHCI_IN=2, OHCI_FROM_TD=3 } ohci_pid_t;
@@ -383,11 +383,108 @@ static void MsrLeSwap64InPlace(void* ptr, ULONG len) {
 	}
 }
 
+// Compressed stage2.elf, as written by Stage2Pack.
+// The ELF header and program headers follow this header as they are.
+// After them, the file data of each PT_LOAD segment that has any, in program header order, as an LZ4 block preceded by its length.
+enum {
+	STAGE2_COMPRESSED_MAGIC = 0x5A4C3253, // 'S2LZ'
+	STAGE2_COMPRESSED_VERSION = 1,
+};
+
+typedef struct ARC_LE _STAGE2_COMPRESSED_HEADER {
+	ULONG Magic;
+	ULONG Version;
+	ULONG HeadersSize; // Length of the ELF headers that follow.
+	ULONG FileSize; // Length of everything that was written, the file may be padded after it.
+} STAGE2_COMPRESSED_HEADER, *PSTAGE2_COMPRESSED_HEADER;
+
+static bool Stage2IsCompressed(void* addr) {
+	return ((PSTAGE2_COMPRESSED_HEADER)addr)->Magic == STAGE2_COMPRESSED_MAGIC;
+}
+
+static int Stage2Valid(void* addr, ULONG len) {
+	PSTAGE2_COMPRESSED_HEADER Header = (PSTAGE2_COMPRESSED_HEADER)addr;
+	if (len >= sizeof(*Header) && Stage2IsCompressed(addr)) {
+		if (Header->Version != STAGE2_COMPRESSED_VERSION) return -1;
+		if (Header->FileSize > len || Header->HeadersSize < sizeof(Elf32_Ehdr)) return -1;
+		if (Header->HeadersSize > Header->FileSize - sizeof(*Header)) return -1;
+		return ElfValid(addr + sizeof(*Header));
+	}
+
+	if (len < sizeof(Elf32_Ehdr)) return 0;
+	return ElfValid(addr);
+}
+
+// Decompresses an LZ4 block into place, swapped as MsrLeSwap64 would: output byte N goes to dest[N ^ 7].
+// dest must be 64-bit aligned, and writable up to len rounded up to 64 bits.
+static bool Lz4DecompressSwap64(const UCHAR* src, ULONG srclen, UCHAR* dest, ULONG len) {
+	const UCHAR* srcend = src + srclen;
+	ULONG out = 0;
+
+	while (src < srcend) {
+		// Each sequence is a token, literals, then a match; the last sequence is only literals.
+		UCHAR token = *src++;
+		ULONG literals = token >> 4;
+		if (literals == 15) {
+			UCHAR extra;
+			do {
+				if (src == srcend) return false;
+				extra = *src++;
+				literals += extra;
+			} while (extra == 255);
+		}
+		if (literals > (ULONG)(srcend - src) || literals > len - out) return false;
+		for (; literals != 0 && (out & 7) != 0; literals--) dest[(out++) ^ 7] = *src++;
+		for (; literals >= sizeof(uint64_t); literals -= sizeof(uint64_t), out += sizeof(uint64_t), src += sizeof(uint64_t)) {
+			uint64_t val64;
+			memcpy(&val64, src, sizeof(val64));
+			*(uint64_t*)&dest[out] = __builtin_bswap64(val64);
+		}
+		for (; literals != 0; literals--) dest[(out++) ^ 7] = *src++;
+		if (src == srcend) break;
+
+		if ((srcend - src) < 2) return false;
+		ULONG offset = src[0] | (src[1] << 8);
+		src += 2;
+		if (offset == 0 || offset > out) return false;
+		ULONG matchlen = (token & 15) + 4;
+		if ((token & 15) == 15) {
+			UCHAR extra;
+			do {
+				if (src == srcend) return false;
+				extra = *src++;
+				matchlen += extra;
+			} while (extra == 255);
+		}
+		if (matchlen > len - out) return false;
+
+		ULONG from = out - offset;
+		if ((offset & 7) == 0) {
+			// What is copied was swapped the same way, so whole doublewords copy as they are.
+			for (; matchlen != 0 && (out & 7) != 0; matchlen--) dest[(out++) ^ 7] = dest[(from++) ^ 7];
+			for (; matchlen >= sizeof(uint64_t); matchlen -= sizeof(uint64_t), out += sizeof(uint64_t), from += sizeof(uint64_t))
+				*(uint64_t*)&dest[out] = *(uint64_t*)&dest[from];
+		}
+		for (; matchlen != 0; matchlen--) dest[(out++) ^ 7] = dest[(from++) ^ 7];
+	}
+
+	return out == len;
+}
+
 static ULONG ElfLoad(void* addr) {
 	Elf32_Ehdr* ehdr;
 	Elf32_Phdr* phdrs;
 	UCHAR* image;
 	int i;
+	UCHAR* compressed = NULL;
+	UCHAR* compressedend = NULL;
+
+	if (Stage2IsCompressed(addr)) {
+		PSTAGE2_COMPRESSED_HEADER Header = (PSTAGE2_COMPRESSED_HEADER)addr;
+		compressed = (UCHAR*)addr + sizeof(*Header) + Header->HeadersSize;
+		compressedend = (UCHAR*)addr + Header->FileSize;
+		addr += sizeof(*Header);
+	}
 
 	ehdr = (Elf32_Ehdr*)addr;
 
@@ -401,6 +498,11 @@ static ULONG ElfLoad(void* addr) {
 		return 0;
 	}
 
+	if (compressed != NULL && ehdr->e_phoff + (ehdr->e_phnum * sizeof(Elf32_Phdr)) > (ULONG)(compressed - (UCHAR*)addr)) {
+		//StdOutWrite("ELF phdrs outside of compressed headers\r\n");
+		return 0;
+	}
+
 	phdrs = (Elf32_Phdr*)(addr + ehdr->e_phoff);
 
 	for (i = 0; i < ehdr->e_phnum; i++) {
@@ -432,7 +534,22 @@ static ULONG ElfLoad(void* addr) {
 			return 0;
 		}
 
-		if (phdrs[i].p_filesz) {
+		if (phdrs[i].p_filesz && compressed != NULL) {
+			//print_f("-> decompress 0x%x\r\n", phdrs[i].p_filesz);
+			if ((phdrs[i].p_paddr & 7) != 0 || (ULONG)(compressedend - compressed) < sizeof(ULONG)) return 0;
+			ULONG len = compressed[0] | (compressed[1] << 8) | (compressed[2] << 16) | (compressed[3] << 24);
+			compressed += sizeof(ULONG);
+			if (len > (ULONG)(compressedend - compressed)) return 0;
+			memset((void*)phdrs[i].p_paddr, 0, (phdrs[i].p_memsz + 7) & ~7);
+			if (!Lz4DecompressSwap64(compressed, len, (UCHAR*)phdrs[i].p_paddr, phdrs[i].p_filesz)) return 0;
+			compressed += len;
+
+			if (phdrs[i].p_flags & PF_X)
+				sync_before_exec((void*)phdrs[i].p_paddr, phdrs[i].p_memsz);
+			else
+				sync_after_write((void*)phdrs[i].p_paddr, phdrs[i].p_memsz);
+		}
+		else if (phdrs[i].p_filesz) {
 			//print_f("-> load 0x%x\r\n", phdrs[i].p_filesz);
 			image = (UCHAR*)(addr + phdrs[i].p_offset);
 			MsrLeSwap64(
@@ -1032,6 +1149,11 @@ static ULONG UsbGetBase(OFHANDLE Handle) {
 	return AssignedAddress[2];
 }
 
+static bool RamdiskIsCompressed(PUCHAR Image, ULONG Length) {
+	// A compressed drivers.img starts with 'ARDZ', and can be smaller than any floppy image.
+	return Length >= 4 && Image[0] == 'A' && Image[1] == 'R' && Image[2] == 'D' && Image[3] == 'Z';
+}
+
 typedef void (*ArcFirmEntry)(PHW_DESCRIPTION HwDesc);
 extern void __attribute__((noreturn)) ModeSwitchEntry(ArcFirmEntry Start, PHW_DESCRIPTION HwDesc, ULONG FbAddr);
 
@@ -1119,7 +1241,7 @@ int _start(int argc, char** argv, tfpOpenFirmwareCall of) {
 	}
 
 	// check for validity
-	if (ActualLoad < sizeof(Elf32_Ehdr) || ElfValid(Addr) <= 0) {
+	if (Stage2Valid(Addr, ActualLoad) <= 0) {
 		StdOutWrite("Invalid ELF for stage2: ");
 		StdOutWrite(BootPath);
 		StdOutWrite("\r\n");
@@ -1145,7 +1267,7 @@ int _start(int argc, char** argv, tfpOpenFirmwareCall of) {
 	Desc->MemoryLength = s_PhysMemLength;
 	Desc->MacIoStart = s_MacIoStart;
 	
-	// Maximum of 2MB for drivers.img (minimum of 160KB, smallest possible size of a FAT12 floppy image)
+	// Maximum of 2MB for drivers.img (minimum of 160KB, smallest possible size of a FAT12 floppy image, unless compressed)
 	// Assumption: new world grackle systems have at least 32MB RAM
 	// Assumption: ARC firmware will allocate blocks for us from the end of memory
 	// Assumption: ARC firmware stays away from first 8MB as much as possible
@@ -1157,7 +1279,7 @@ int _start(int argc, char** argv, tfpOpenFirmwareCall of) {
 		ActualLoad = 0;
 		Status = OfRead(File, BootAddr, 0x200000, &ActualLoad);
 		OfClose(File);
-		if (ARC_SUCCESS(Status) && ActualLoad != 0 && ActualLoad >= 0x28000) {
+		if (ARC_SUCCESS(Status) && ActualLoad != 0 && (ActualLoad >= 0x28000 || RamdiskIsCompressed(BootAddr, ActualLoad))) {
 			// Loaded successfully, store the physical address and length into desc
 			Desc->DriversImgBase = (ULONG)BootAddr;
 			Desc->DriversImgSize = ActualLoad;
@@ -388,11 +388,108 @@ static void MsrLeSwap64InPlace(void* ptr, ULONG len) {
 	}
 }
 
+// Compressed stage2.elf, as written by Stage2Pack.
+// The ELF header and program headers follow this header as they are.
+// After them, the file data of each PT_LOAD segment that has any, in program header order, as an LZ4 block preceded by its length.
+enum {
+	STAGE2_COMPRESSED_MAGIC = 0x5A4C3253, // 'S2LZ'
+	STAGE2_COMPRESSED_VERSION = 1,
+};
+
+typedef struct ARC_LE _STAGE2_COMPRESSED_HEADER {
+	ULONG Magic;
+	ULONG Version;
+	ULONG HeadersSize; // Length of the ELF headers that follow.
+	ULONG FileSize; // Length of everything that was written, the file may be padded after it.
+} STAGE2_COMPRESSED_HEADER, *PSTAGE2_COMPRESSED_HEADER;
+
+static bool Stage2IsCompressed(void* addr) {
+	return ((PSTAGE2_COMPRESSED_HEADER)addr)->Magic == STAGE2_COMPRESSED_MAGIC;
+}
+
+static int Stage2Valid(void* addr, ULONG len) {
+	PSTAGE2_COMPRESSED_HEADER Header = (PSTAGE2_COMPRESSED_HEADER)addr;
+	if (len >= sizeof(*Header) && Stage2IsCompressed(addr)) {
+		if (Header->Version != STAGE2_COMPRESSED_VERSION) return -1;
+		if (Header->FileSize > len || Header->HeadersSize < sizeof(Elf32_Ehdr)) return -1;
+		if (Header->HeadersSize > Header->FileSize - sizeof(*Header)) return -1;
+		return ElfValid(addr + sizeof(*Header));
+	}
+
+	if (len < sizeof(Elf32_Ehdr)) return 0;
+	return ElfValid(addr);
+}
+
+// Decompresses an LZ4 block into place, swapped as MsrLeSwap64 would: output byte N goes to dest[N ^ 7].
+// dest must be 64-bit aligned, and writable up to len rounded up to 64 bits.
+static bool Lz4DecompressSwap64(const UCHAR* src, ULONG srclen, UCHAR* dest, ULONG len) {
+	const UCHAR* srcend = src + srclen;
+	ULONG out = 0;
+
+	while (src < srcend) {
+		// Each sequence is a token, literals, then a match; the last sequence is only literals.
+		UCHAR token = *src++;
+		ULONG literals = token >> 4;
+		if (literals == 15) {
+			UCHAR extra;
+			do {
+				if (src == srcend) return false;
+				extra = *src++;
+				literals += extra;
+			} while (extra == 255);
+		}
+		if (literals > (ULONG)(srcend - src) || literals > len - out) return false;
+		for (; literals != 0 && (out & 7) != 0; literals--) dest[(out++) ^ 7] = *src++;
+		for (; literals >= sizeof(uint64_t); literals -= sizeof(uint64_t), out += sizeof(uint64_t), src += sizeof(uint64_t)) {
+			uint64_t val64;
+			memcpy(&val64, src, sizeof(val64));
+			*(uint64_t*)&dest[out] = __builtin_bswap64(val64);
+		}
+		for (; literals != 0; literals--) dest[(out++) ^ 7] = *src++;
+		if (src == srcend) break;
+
+		if ((srcend - src) < 2) return false;
+		ULONG offset = src[0] | (src[1] << 8);
+		src += 2;
+		if (offset == 0 || offset > out) return false;
+		ULONG matchlen = (token & 15) + 4;
+		if ((token & 15) == 15) {
+			UCHAR extra;
+			do {
+				if (src == srcend) return false;
+				extra = *src++;
+				matchlen += extra;
+			} while (extra == 255);
+		}
+		if (matchlen > len - out) return false;
+
+		ULONG from = out - offset;
+		if ((offset & 7) == 0) {
+			// What is copied was swapped the same way, so whole doublewords copy as they are.
+			for (; matchlen != 0 && (out & 7) != 0; matchlen--) dest[(out++) ^ 7] = dest[(from++) ^ 7];
+			for (; matchlen >= sizeof(uint64_t); matchlen -= sizeof(uint64_t), out += sizeof(uint64_t), from += sizeof(uint64_t))
+				*(uint64_t*)&dest[out] = *(uint64_t*)&dest[from];
+		}
+		for (; matchlen != 0; matchlen--) dest[(out++) ^ 7] = dest[(from++) ^ 7];
+	}
+
+	return out == len;
+}
+
 static ULONG ElfLoad(void* addr) {
 	Elf32_Ehdr* ehdr;
 	Elf32_Phdr* phdrs;
 	UCHAR* image;
 	int i;
+	UCHAR* compressed = NULL;
+	UCHAR* compressedend = NULL;
+
+	if (Stage2IsCompressed(addr)) {
+		PSTAGE2_COMPRESSED_HEADER Header = (PSTAGE2_COMPRESSED_HEADER)addr;
+		compressed = (UCHAR*)addr + sizeof(*Header) + Header->HeadersSize;
+		compressedend = (UCHAR*)addr + Header->FileSize;
+		addr += sizeof(*Header);
+	}
 
 	ehdr = (Elf32_Ehdr*)addr;
 
@@ -406,6 +503,11 @@ static ULONG ElfLoad(void* addr) {
 		return 0;
 	}
 
+	if (compressed != NULL && ehdr->e_phoff + (ehdr->e_phnum * sizeof(Elf32_Phdr)) > (ULONG)(compressed - (UCHAR*)addr)) {
+		//StdOutWrite("ELF phdrs outside of compressed headers\r\n");
+		return 0;
+	}
+
 	phdrs = (Elf32_Phdr*)(addr + ehdr->e_phoff);
 
 	for (i = 0; i < ehdr->e_phnum; i++) {
@@ -437,7 +539,22 @@ static ULONG ElfLoad(void* addr) {
 			return 0;
 		}
 
-		if (phdrs[i].p_filesz) {
+		if (phdrs[i].p_filesz && compressed != NULL) {
+			//print_f("-> decompress 0x%x\r\n", phdrs[i].p_filesz);
+			if ((phdrs[i].p_paddr & 7) != 0 || (ULONG)(compressedend - compressed) < sizeof(ULONG)) return 0;
+			ULONG len = compressed[0] | (compressed[1] << 8) | (compressed[2] << 16) | (compressed[3] << 24);
+			compressed += sizeof(ULONG);
+			if (len > (ULONG)(compressedend - compressed)) return 0;
+			memset((void*)phdrs[i].p_paddr, 0, (phdrs[i].p_memsz + 7) & ~7);
+			if (!Lz4DecompressSwap64(compressed, len, (UCHAR*)phdrs[i].p_paddr, phdrs[i].p_filesz)) return 0;
+			compressed += len;
+
+			if (phdrs[i].p_flags & PF_X)
+				sync_before_exec((void*)phdrs[i].p_paddr, phdrs[i].p_memsz);
+			else
+				sync_after_write((void*)phdrs[i].p_paddr, phdrs[i].p_memsz);
+		}
+		else if (phdrs[i].p_filesz) {
 			//print_f("-> load 0x%x\r\n", phdrs[i].p_filesz);
 			image = (UCHAR*)(addr + phdrs[i].p_offset);
 			MsrLeSwap64(
@@ -1100,6 +1217,11 @@ static inline ULONG Align64(ULONG Value) {
 	return Value + (8 - Mask);
 }
 
+static bool RamdiskIsCompressed(PUCHAR Image, ULONG Length) {
+	// A compressed drivers.img starts with 'ARDZ', and can be smaller than any floppy image.
+	return Length >= 4 && Image[0] == 'A' && Image[1] == 'R' && Image[2] == 'D' && Image[3] == 'Z';
+}
+
 // returns true if everything was read, returns false if only Stage2Addr was read, exits if stage2 could not be read
 static bool ReadFiles(
 	char* BootPath,
@@ -1219,8 +1341,8 @@ static bool ReadFiles(
 		}
 		Status = OfRead(File, ReadAddr, LastAddress - (ULONG)ReadAddr - (s_FirstFreePage * PAGE_SIZE), DriversSize);
 		OfClose(File);
-		// drivers.img should be at least 160KB
-		if (ARC_FAIL(Status) || *DriversSize == 0 || *DriversSize < 0x28000) {
+		// drivers.img should be at least 160KB, unless compressed
+		if (ARC_FAIL(Status) || *DriversSize == 0 || (*DriversSize < 0x28000 && !RamdiskIsCompressed(ReadAddr, *DriversSize))) {
 #ifdef READ_DEBUG
 			if (ARC_SUCCESS(Status)) Status = _EIO;
 			StdOutWrite("Could not read: ");
@@ -1281,7 +1403,7 @@ static bool ReadFiles(
 		}
 		
 		// check for validity
-		if (ExeSize < sizeof(Elf32_Ehdr) || ElfValid(BufferStage2) <= 0) {
+		if (Stage2Valid(BufferStage2, ExeSize) <= 0) {
 			StdOutWrite("Invalid ELF for stage2: ");
 			StdOutWrite(BootPath);
 			StdOutWrite("\r\n");
@@ -1319,7 +1441,7 @@ static bool ReadFiles(
 	}
 	
 	// check for validity
-	if (ExeSize < sizeof(Elf32_Ehdr) || ElfValid(Stage2Addr) <= 0) {
+	if (Stage2Valid(Stage2Addr, ExeSize) <= 0) {
 		StdOutWrite("Invalid ELF for stage2: ");
 		StdOutWrite(BootPath);
 		StdOutWrite("\r\n");
@@ -38,6 +38,20 @@ __extern void *realloc(void *, size_t);
 __extern void add_malloc_block(void *, size_t);
 __extern void get_malloc_memory_status(size_t *, size_t *);
 
+/* Allocator statistics, for measuring fragmentation and peak usage.
+ * Sizes include the block headers. */
+struct malloc_stats {
+	size_t in_use;		/* in allocated blocks */
+	size_t peak_in_use;	/* the most ever in allocated blocks */
+	size_t free_bytes;
+	size_t largest_free;	/* free_bytes - largest_free is fragmented */
+	size_t free_blocks;
+	size_t small_free_blocks;	/* of which on the per size lists */
+	size_t allocations;
+	size_t failures;
+};
+__extern void get_malloc_stats(struct malloc_stats *);
+
 /* Malloc locking
  * Until the callbacks are set, malloc doesn't do any locking.
  * malloc_lock() *may* timeout, in which case malloc() will return NULL.
@@ -1,7 +1,13 @@
 /*
  * malloc.c
  *
- * Very simple linked-list based malloc()/free().
+ * Segregated fit malloc()/free().
+ *
+ * Free blocks smaller than MALLOC_SMALL_UNITS arena units are kept on a
+ * list per size, so small allocations and frees take constant time.
+ * Bigger free blocks are kept on one list in address order, and are
+ * allocated first fit.  Freed blocks are always coalesced with their
+ * neighbours.
  */
 
 #ifdef WITH_MALLOC
@@ -10,9 +16,9 @@
 #include <assert.h>
 #include "malloc.h"
 
-/* Both the arena list and the free memory list are double linked
-   list with head node.  This the head node. Note that the arena list
-   is sorted in order of address. */
+/* The arena list is a double linked list with head node, sorted in
+   order of address.  This head node is also the head of the free list
+   of large blocks, which is sorted in order of address too. */
 static struct free_arena_header __malloc_head = {
 	{
 		ARENA_TYPE_HEAD,
@@ -24,6 +30,17 @@ static struct free_arena_header __malloc_head = {
 	&__malloc_head
 };
 
+/* Free lists of small blocks, by size in arena units.  These are null
+   terminated, and a bit is set in the map for each list that is not
+   empty. */
+static struct free_arena_header *__malloc_small[MALLOC_SMALL_UNITS];
+static uint32_t __malloc_small_map;
+
+static size_t __malloc_in_use;
+static size_t __malloc_peak_in_use;
+static size_t __malloc_allocations;
+static size_t __malloc_failures;
+
 static bool malloc_lock_nop() {return true;}
 static void malloc_unlock_nop() {}
 
@@ -37,6 +54,11 @@ static inline void mark_block_dead(struct free_arena_header *ah)
 #endif
 }
 
+static inline bool is_small(size_t size)
+{
+	return size < MALLOC_SMALL_UNITS * ARENA_UNIT;
+}
+
 static inline void remove_from_main_chain(struct free_arena_header *ah)
 {
 	struct free_arena_header *ap, *an;
@@ -49,26 +71,73 @@ static inline void remove_from_main_chain(struct free_arena_header *ah)
 	an->a.prev = ap;
 }
 
+/* The block must still have the size it had when it was added */
 static inline void remove_from_free_chain(struct free_arena_header *ah)
 {
 	struct free_arena_header *ap, *an;
 
 	ap = ah->prev_free;
 	an = ah->next_free;
+
+	if (is_small(ah->a.size)) {
+		size_t units = ah->a.size / ARENA_UNIT;
+
+		if (ap)
+			ap->next_free = an;
+		else if (!(__malloc_small[units] = an))
+			__malloc_small_map &= ~((uint32_t)1 << units);
+		if (an)
+			an->prev_free = ap;
+		return;
+	}
+
 	ap->next_free = an;
 	an->prev_free = ap;
 }
 
-static inline void remove_from_chains(struct free_arena_header *ah)
+static void add_to_free_chain(struct free_arena_header *ah)
+{
+	struct free_arena_header *fp;
+
+	if (is_small(ah->a.size)) {
+		size_t units = ah->a.size / ARENA_UNIT;
+
+		ah->prev_free = NULL;
+		ah->next_free = __malloc_small[units];
+		if (ah->next_free)
+			ah->next_free->prev_free = ah;
+		__malloc_small[units] = ah;
+		__malloc_small_map |= (uint32_t)1 << units;
+		return;
+	}
+
+	/* Insert before the first large free block above it */
+	for (fp = __malloc_head.next_free; fp->a.type != ARENA_TYPE_HEAD;
+	     fp = fp->next_free) {
+		if (fp > ah)
+			break;
+	}
+	ah->next_free = fp;
+	ah->prev_free = fp->prev_free;
+	fp->prev_free->next_free = ah;
+	fp->prev_free = ah;
+}
+
+/* Puts 'ah' in the place of 'fp' on the large free list, for when no
+   free block lies between them */
+static inline void replace_in_free_chain(struct free_arena_header *fp,
+					 struct free_arena_header *ah)
 {
-	remove_from_free_chain(ah);
-	remove_from_main_chain(ah);
+	ah->next_free = fp->next_free;
+	ah->prev_free = fp->prev_free;
+	ah->next_free->prev_free = ah;
+	ah->prev_free->next_free = ah;
 }
 
 static void *__malloc_from_block(struct free_arena_header *fp, size_t size)
 {
 	size_t fsize;
-	struct free_arena_header *nfp, *na, *fpn, *fpp;
+	struct free_arena_header *nfp, *na;
 
 	fsize = fp->a.size;
 
@@ -81,8 +150,6 @@ static void *__malloc_from_block(struct free_arena_header *fp, size_t size)
 
 		nfp->a.type = ARENA_TYPE_FREE;
 		nfp->a.size = fsize - size;
-		fp->a.type = ARENA_TYPE_USED;
-		fp->a.size = size;
 
 		/* Insert into all-block chain */
 		nfp->a.prev = fp;
@@ -90,15 +157,23 @@ static void *__malloc_from_block(struct free_arena_header *fp, size_t size)
 		na->a.prev = nfp;
 		fp->a.next = nfp;
 
-		/* Replace current block on free chain */
-		nfp->next_free = fpn = fp->next_free;
-		nfp->prev_free = fpp = fp->prev_free;
-		fpn->prev_free = nfp;
-		fpp->next_free = nfp;
+		if (!is_small(fsize) && !is_small(nfp->a.size)) {
+			/* The rest stays where the block was on the large list */
+			replace_in_free_chain(fp, nfp);
+		} else {
+			remove_from_free_chain(fp);
+			add_to_free_chain(nfp);
+		}
+		fp->a.size = size;
 	} else {
-		fp->a.type = ARENA_TYPE_USED; /* Allocate the whole block */
-		remove_from_free_chain(fp);
+		remove_from_free_chain(fp); /* Allocate the whole block */
 	}
+	fp->a.type = ARENA_TYPE_USED;
+
+	__malloc_in_use += fp->a.size;
+	if (__malloc_in_use > __malloc_peak_in_use)
+		__malloc_peak_in_use = __malloc_in_use;
+	__malloc_allocations++;
 
 	return (void *)(&fp->a + 1);
 }
@@ -106,39 +181,47 @@ static void *__malloc_from_block(struct free_arena_header *fp, size_t size)
 static struct free_arena_header *__free_block(struct free_arena_header *ah)
 {
 	struct free_arena_header *pah, *nah;
+	bool listed = false; /* ah is already on the large free list */
 
 	pah = ah->a.prev;
 	nah = ah->a.next;
 	if (pah->a.type == ARENA_TYPE_FREE &&
 	    (char *)pah + pah->a.size == (char *)ah) {
-		/* Coalesce into the previous block */
+		/* Coalesce into the previous block, which keeps its place
+		   on the large list if it is on it */
+		if (is_small(pah->a.size))
+			remove_from_free_chain(pah);
+		else
+			listed = true;
 		pah->a.size += ah->a.size;
 		pah->a.next = nah;
 		nah->a.prev = pah;
 		mark_block_dead(ah);
 
 		ah = pah;
-		pah = ah->a.prev;
 	} else {
-		/* Need to add this block to the free chain */
 		ah->a.type = ARENA_TYPE_FREE;
-
-		ah->next_free = __malloc_head.next_free;
-		ah->prev_free = &__malloc_head;
-		__malloc_head.next_free = ah;
-		ah->next_free->prev_free = ah;
 	}
 
 	/* In either of the previous cases, we might be able to merge
 	   with the subsequent block... */
 	if (nah->a.type == ARENA_TYPE_FREE &&
 	    (char *)ah + ah->a.size == (char *)nah) {
+		if (!listed && !is_small(nah->a.size)) {
+			replace_in_free_chain(nah, ah);
+			listed = true;
+		} else {
+			remove_from_free_chain(nah);
+		}
 		ah->a.size += nah->a.size;
 
-		/* Remove the old block from the chains */
-		remove_from_chains(nah);
+		/* Remove the old block from the main chain */
+		remove_from_main_chain(nah);
 	}
 
+	if (!listed)
+		add_to_free_chain(ah);
+
 	/* Return the block that contains the called block */
 	return ah;
 }
@@ -157,6 +240,15 @@ void *malloc(size_t size)
                 return NULL;
         
         void *result = NULL;
+	if (is_small(size)) {
+		/* The smallest small block that fits */
+		uint32_t map = __malloc_small_map & ~(((uint32_t)1 << (size / ARENA_UNIT)) - 1);
+		if (map) {
+			result = __malloc_from_block(__malloc_small[__builtin_ctz(map)], size);
+			goto out;
+		}
+	}
+
 	for (fp = __malloc_head.next_free; fp->a.type != ARENA_TYPE_HEAD;
 	     fp = fp->next_free) {
 		if (fp->a.size >= size) {
@@ -166,6 +258,9 @@ void *malloc(size_t size)
 		}
 	}
 
+out:
+	if (!result)
+		__malloc_failures++;
         malloc_unlock();
 	return result;
 }
@@ -176,6 +271,8 @@ void add_malloc_block(void *buf, size_t size)
 	struct free_arena_header *fp = buf;
 	struct free_arena_header *pah;
 
+	/* Whole arena units only */
+	size &= ARENA_SIZE_MASK;
 	if (size < sizeof(struct free_arena_header))
 		return; // Too small.
 
@@ -228,26 +325,57 @@ void free(void *ptr)
         if (!malloc_lock())
             return;
         
+	__malloc_in_use -= ah->a.size;
+
 	/* Merge into adjacent free blocks */
 	ah = __free_block(ah);
         malloc_unlock();
 }
 
 void get_malloc_memory_status(size_t *free_bytes, size_t *largest_block)
+{
+    struct malloc_stats stats;
+
+    get_malloc_stats(&stats);
+    *free_bytes = stats.free_bytes;
+    *largest_block = stats.largest_free;
+}
+
+void get_malloc_stats(struct malloc_stats *stats)
 {
     struct free_arena_header *fp;
-    *free_bytes = 0;
-    *largest_block = 0;
+    size_t units;
+
+    stats->free_bytes = 0;
+    stats->largest_free = 0;
+    stats->free_blocks = 0;
+    stats->small_free_blocks = 0;
 
     if (!malloc_lock())
             return;
     
+    for (units = 0; units < MALLOC_SMALL_UNITS; units++) {
+        for (fp = __malloc_small[units]; fp; fp = fp->next_free) {
+            stats->free_bytes += fp->a.size;
+            stats->small_free_blocks++;
+            if (fp->a.size >= stats->largest_free)
+                stats->largest_free = fp->a.size;
+        }
+    }
+    stats->free_blocks = stats->small_free_blocks;
+
     for (fp = __malloc_head.next_free; fp->a.type != ARENA_TYPE_HEAD; fp = fp->next_free) {
-        *free_bytes += fp->a.size;
-        if (fp->a.size >= *largest_block) {
-            *largest_block = fp->a.size;
+        stats->free_bytes += fp->a.size;
+        stats->free_blocks++;
+        if (fp->a.size >= stats->largest_free) {
+            stats->largest_free = fp->a.size;
         }
     }
+
+    stats->in_use = __malloc_in_use;
+    stats->peak_in_use = __malloc_peak_in_use;
+    stats->allocations = __malloc_allocations;
+    stats->failures = __malloc_failures;
     
     malloc_unlock();
 }
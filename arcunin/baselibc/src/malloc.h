@@ -30,8 +30,15 @@ struct arena_header {
 #define ARENA_TYPE_HEAD 2
 #endif
 
+#define ARENA_UNIT (sizeof(struct arena_header))
 #define ARENA_SIZE_MASK (~(sizeof(struct arena_header)-1))
 
+/*
+ * Free blocks smaller than this many arena units are kept on a list per
+ * size.  At most 32, there is a bit for each list in a 32-bit map.
+ */
+#define MALLOC_SMALL_UNITS 32
+
 /*
  * This structure should be no more than twice the size of the
  * previous structure.
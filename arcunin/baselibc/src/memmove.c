@@ -3,12 +3,13 @@
  */
 
 #include <string.h>
+#include "memops.h"
 
 void *memmove(void *dst, const void *src, size_t n)
 {
 	const char *p = src;
 	char *q = dst;
-#if defined(__i386__) || defined(__x86_64__)
+#if MEMOPS_X86
 	if (q < p) {
 		asm volatile("cld; rep; movsb"
 			     : "+c" (n), "+S"(p), "+D"(q));
@@ -20,15 +21,9 @@ void *memmove(void *dst, const void *src, size_t n)
 	}
 #else
 	if (q < p) {
-		while (n--) {
-			*q++ = *p++;
-		}
+		memops_copy_forward((unsigned char *)q, (const unsigned char *)p, n, 0);
 	} else {
-		p += n;
-		q += n;
-		while (n--) {
-			*--q = *--p;
-		}
+		memops_copy_backward((unsigned char *)q, (const unsigned char *)p, n);
 	}
 #endif
 
@@ -0,0 +1,194 @@
+/*
+ * memops.h
+ *
+ * Internals for memcpy(), memmove() and memset() on targets without
+ * string instructions: a word at a time, unrolled to a cache line, with
+ * PowerPC cache block instructions where they are safe to use.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * x86 uses its string instructions.  BASELIBC_WORD_MEMOPS forces the
+ * word at a time code, so the tests can exercise it on a PC.
+ */
+#if (defined(__i386__) || defined(__x86_64__)) && !defined(BASELIBC_WORD_MEMOPS)
+#define MEMOPS_X86 1
+#else
+#define MEMOPS_X86 0
+#endif
+
+/*
+ * Data cache block size of the 750 and 74xx.
+ */
+#define MEMOPS_LINE 32
+#define MEMOPS_LINE_WORDS (MEMOPS_LINE / 4)
+
+typedef uint32_t __attribute__((may_alias)) memops_word;
+
+/*
+ * The word starting 'shift' bits into 'lo' and running into 'hi', for
+ * copying from a source that is not word aligned.  'shift' is never 0.
+ */
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define MEMOPS_MERGE(lo, hi, shift) (((lo) << (shift)) | ((hi) >> (32 - (shift))))
+#else
+#define MEMOPS_MERGE(lo, hi, shift) (((lo) >> (shift)) | ((hi) << (32 - (shift))))
+#endif
+
+/*
+ * Memory that dcbz may be used on, set by memops_set_cacheable().
+ * dcbz takes an alignment exception on caching-inhibited and write-through
+ * memory, so it is never used until the platform says where RAM is.
+ */
+extern uintptr_t __memops_cacheable_start;
+extern uintptr_t __memops_cacheable_end;
+
+static inline int memops_can_dcbz(const void *p, size_t n)
+{
+#if defined(__powerpc__)
+	uintptr_t a = (uintptr_t)p;
+	return a >= __memops_cacheable_start && a <= __memops_cacheable_end &&
+	       n <= __memops_cacheable_end - a;
+#else
+	(void)p;
+	(void)n;
+	return 0;
+#endif
+}
+
+/*
+ * Establishes a cache line of zeroes without reading it from memory.
+ */
+static inline void memops_dcbz(void *p)
+{
+#if defined(__powerpc__)
+	asm volatile ("dcbz 0,%0" : : "r" (p) : "memory");
+#else
+	(void)p;
+#endif
+}
+
+/*
+ * Hints that a line is about to be read.  Never faults.
+ */
+static inline void memops_dcbt(const void *p)
+{
+#if defined(__powerpc__)
+	asm volatile ("dcbt 0,%0" : : "r" (p));
+#else
+	(void)p;
+#endif
+}
+
+/*
+ * Copies upwards.  Each line is loaded completely before it is stored, so
+ * this is also safe for memmove() when the destination is below the source.
+ * 'zero_lines' allows destination lines to be allocated with dcbz, only
+ * when the areas do not overlap.
+ */
+static inline void memops_copy_forward(unsigned char *q, const unsigned char *p,
+				       size_t n, int zero_lines)
+{
+	if (n >= 16) {
+		while ((uintptr_t)q & 3) {
+			*q++ = *p++;
+			n--;
+		}
+
+		memops_word *dw = (memops_word *)q;
+		unsigned int shift = ((uintptr_t)p & 3) * 8;
+		if (shift == 0) {
+			const memops_word *sw = (const memops_word *)p;
+			while (((uintptr_t)dw & (MEMOPS_LINE - 1)) && n >= 4) {
+				*dw++ = *sw++;
+				n -= 4;
+			}
+			if (zero_lines)
+				zero_lines = memops_can_dcbz(dw, n & ~(size_t)(MEMOPS_LINE - 1));
+			for (; n >= MEMOPS_LINE; n -= MEMOPS_LINE) {
+				uint32_t w0 = sw[0], w1 = sw[1], w2 = sw[2], w3 = sw[3];
+				uint32_t w4 = sw[4], w5 = sw[5], w6 = sw[6], w7 = sw[7];
+				memops_dcbt(sw + 2 * MEMOPS_LINE_WORDS);
+				if (zero_lines)
+					memops_dcbz((void *)dw);
+				dw[0] = w0; dw[1] = w1; dw[2] = w2; dw[3] = w3;
+				dw[4] = w4; dw[5] = w5; dw[6] = w6; dw[7] = w7;
+				sw += MEMOPS_LINE_WORDS;
+				dw += MEMOPS_LINE_WORDS;
+			}
+			for (; n >= 4; n -= 4)
+				*dw++ = *sw++;
+			p = (const unsigned char *)sw;
+		} else {
+			/* aligned loads only, the source words are shifted together */
+			const memops_word *sw = (const memops_word *)(p - shift / 8);
+			uint32_t lo = *sw++;
+			for (; n >= 4; n -= 4) {
+				uint32_t hi = *sw++;
+				*dw++ = MEMOPS_MERGE(lo, hi, shift);
+				lo = hi;
+			}
+			p += (unsigned char *)dw - q;
+		}
+		q = (unsigned char *)dw;
+	}
+
+	while (n--)
+		*q++ = *p++;
+}
+
+/*
+ * Copies downwards, from the end, for memmove() when the destination is
+ * above the source.
+ */
+static inline void memops_copy_backward(unsigned char *q, const unsigned char *p,
+					size_t n)
+{
+	q += n;
+	p += n;
+
+	if (n >= 16) {
+		while ((uintptr_t)q & 3) {
+			*--q = *--p;
+			n--;
+		}
+
+		memops_word *dw = (memops_word *)q;
+		unsigned int shift = ((uintptr_t)p & 3) * 8;
+		if (shift == 0) {
+			const memops_word *sw = (const memops_word *)p;
+			while (((uintptr_t)dw & (MEMOPS_LINE - 1)) && n >= 4) {
+				*--dw = *--sw;
+				n -= 4;
+			}
+			for (; n >= MEMOPS_LINE; n -= MEMOPS_LINE) {
+				sw -= MEMOPS_LINE_WORDS;
+				dw -= MEMOPS_LINE_WORDS;
+				uint32_t w0 = sw[0], w1 = sw[1], w2 = sw[2], w3 = sw[3];
+				uint32_t w4 = sw[4], w5 = sw[5], w6 = sw[6], w7 = sw[7];
+				memops_dcbt(sw - MEMOPS_LINE_WORDS);
+				dw[0] = w0; dw[1] = w1; dw[2] = w2; dw[3] = w3;
+				dw[4] = w4; dw[5] = w5; dw[6] = w6; dw[7] = w7;
+			}
+			for (; n >= 4; n -= 4)
+				*--dw = *--sw;
+			p = (const unsigned char *)sw;
+		} else {
+			/* 'hi' starts as the word holding the last source byte */
+			const memops_word *sw = (const memops_word *)(p - shift / 8);
+			uint32_t hi = *sw;
+			for (; n >= 4; n -= 4) {
+				uint32_t lo = *--sw;
+				*--dw = MEMOPS_MERGE(lo, hi, shift);
+				hi = lo;
+			}
+			p -= q - (unsigned char *)dw;
+		}
+		q = (unsigned char *)dw;
+	}
+
+	while (n--)
+		*--q = *--p;
+}
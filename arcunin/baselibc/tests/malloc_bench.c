@@ -0,0 +1,154 @@
+/*
+ * Replays an allocation trace against malloc(), realloc() and free(),
+ * and reports the time per operation, the peak heap use and how
+ * fragmented the free memory gets.
+ * Not run by run_tests, build it with "make tests/malloc_bench" and run
+ * "tests/malloc_bench < tests/malloc_boot.trc".
+ *
+ * A trace is one operation per line, '#' starts a comment:
+ *   m <id> <size>    malloc
+ *   r <id> <size>    realloc
+ *   f <id>           free
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "unittests.h"
+
+/* As much heap as the firmware has. */
+#define HEAP_SIZE 0x400000
+#define MAX_IDS 4096
+#define MAX_OPS 0x10000
+#define TRACE_SIZE 0x100000
+#define PASSES 500
+
+size_t read(int fd, void *buf, size_t count);
+
+struct trace_op {
+    char op;
+    unsigned short id;
+    size_t size;
+};
+
+static unsigned char heap[HEAP_SIZE] __attribute__((aligned(32)));
+static char text[TRACE_SIZE];
+static struct trace_op ops[MAX_OPS];
+static void *blocks[MAX_IDS];
+
+static uint64_t now(void)
+{
+#if defined(__powerpc__)
+    uint32_t hi, lo, hi2;
+    do {
+        asm volatile ("mftbu %0" : "=r" (hi));
+        asm volatile ("mftb %0" : "=r" (lo));
+        asm volatile ("mftbu %0" : "=r" (hi2));
+    } while (hi != hi2);
+    return ((uint64_t)hi << 32) | lo;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+static size_t load_trace(void)
+{
+    size_t length = 0, got, count = 0;
+    while (length < sizeof(text) - 1 && (got = read(0, text + length, sizeof(text) - 1 - length)) > 0 && got != (size_t)-1)
+        length += got;
+    text[length] = 0;
+
+    for (char *line = text; line && *line; ) {
+        char *end = strchr(line, '\n');
+        if (end)
+            *end++ = 0;
+        if ((line[0] == 'm' || line[0] == 'r' || line[0] == 'f') && count < MAX_OPS) {
+            char *p = line + 1;
+            unsigned long id = strtoul(p, &p, 10);
+            if (id < MAX_IDS) {
+                ops[count].op = line[0];
+                ops[count].id = (unsigned short)id;
+                ops[count].size = strtoul(p, NULL, 10);
+                count++;
+            }
+        }
+        line = end;
+    }
+    return count;
+}
+
+static void run_op(const struct trace_op *op)
+{
+    switch (op->op) {
+    case 'm':
+        blocks[op->id] = malloc(op->size);
+        break;
+    case 'r':
+        blocks[op->id] = realloc(blocks[op->id], op->size);
+        break;
+    default:
+        free(blocks[op->id]);
+        blocks[op->id] = NULL;
+        break;
+    }
+}
+
+/* Whatever the trace leaves allocated, so that every pass starts alike. */
+static void free_all(void)
+{
+    for (int i = 0; i < MAX_IDS; i++) {
+        free(blocks[i]);
+        blocks[i] = NULL;
+    }
+}
+
+int main()
+{
+    size_t count = load_trace();
+    if (count == 0) {
+        printf("No trace on standard input\n");
+        return 1;
+    }
+    add_malloc_block(heap, sizeof(heap));
+
+    /* Once with statistics after every operation. */
+    struct malloc_stats stats;
+    size_t worst_fragmented = 0, worst_free = 0, most_free_blocks = 0;
+    for (size_t i = 0; i < count; i++) {
+        run_op(&ops[i]);
+        get_malloc_stats(&stats);
+        if (stats.free_bytes - stats.largest_free > worst_fragmented) {
+            worst_fragmented = stats.free_bytes - stats.largest_free;
+            worst_free = stats.free_bytes;
+        }
+        if (stats.free_blocks > most_free_blocks)
+            most_free_blocks = stats.free_blocks;
+    }
+    free_all();
+    get_malloc_stats(&stats);
+
+    printf("%u operations, %u allocations, %u failed\n",
+           (unsigned)count, (unsigned)stats.allocations, (unsigned)stats.failures);
+    printf("peak in use %u bytes\n", (unsigned)stats.peak_in_use);
+    printf("most free blocks %u, most fragmented %u of %u free bytes outside the largest block\n",
+           (unsigned)most_free_blocks, (unsigned)worst_fragmented, (unsigned)worst_free);
+    printf("after freeing everything: %u free blocks, largest %u bytes\n",
+           (unsigned)stats.free_blocks, (unsigned)stats.largest_free);
+
+    /* Then timed. */
+    uint64_t ticks = 0;
+    for (int pass = 0; pass < PASSES; pass++) {
+        uint64_t start = now();
+        for (size_t i = 0; i < count; i++)
+            run_op(&ops[i]);
+        ticks += now() - start;
+        free_all();
+    }
+    uint64_t hundredths = ticks * 100 / ((uint64_t)count * PASSES);
+    printf("%u.%02u ticks per operation\n", (unsigned)(hundredths / 100), (unsigned)(hundredths % 100));
+
+    return 0;
+}
@@ -0,0 +1,133 @@
+/*
+ * Times memcpy(), memmove() and memset() against byte at a time loops.
+ * Not run by run_tests, build it with "make tests/memory_bench".
+ *
+ * On PowerPC the time base is used, so under an emulator that counts
+ * it per instruction (qemu with -icount) the results are repeatable.
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "unittests.h"
+
+#define BUFFER_SIZE 0x10000
+#define ITERATIONS_BYTES 0x400000
+
+static unsigned char dst_buf[BUFFER_SIZE + 64 + 64] __attribute__((aligned(32)));
+static unsigned char src_buf[BUFFER_SIZE + 64] __attribute__((aligned(32)));
+
+static uint64_t now(void)
+{
+#if defined(__powerpc__)
+    uint32_t hi, lo, hi2;
+    do {
+        asm volatile ("mftbu %0" : "=r" (hi));
+        asm volatile ("mftb %0" : "=r" (lo));
+        asm volatile ("mftbu %0" : "=r" (hi2));
+    } while (hi != hi2);
+    return ((uint64_t)hi << 32) | lo;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+/* The loops the library used before; kept as loops, not turned into calls. */
+#define BYTE_LOOP __attribute__((noinline, optimize("no-tree-loop-distribute-patterns")))
+
+static BYTE_LOOP void *byte_copy(void *dst, const void *src, size_t n)
+{
+    const char *p = src;
+    char *q = dst;
+    while (n--)
+        *q++ = *p++;
+    return dst;
+}
+
+static BYTE_LOOP void *byte_move(void *dst, const void *src, size_t n)
+{
+    const char *p = src;
+    char *q = dst;
+    if (q < p) {
+        while (n--)
+            *q++ = *p++;
+    } else {
+        p += n;
+        q += n;
+        while (n--)
+            *--q = *--p;
+    }
+    return dst;
+}
+
+static BYTE_LOOP void *byte_set(void *dst, int c, size_t n)
+{
+    char *q = dst;
+    while (n--)
+        *q++ = c;
+    return dst;
+}
+
+typedef void *(*copy_fn)(void *, const void *, size_t);
+typedef void *(*set_fn)(void *, int, size_t);
+
+static uint64_t time_copy(copy_fn fn, unsigned char *src, size_t dst_off, size_t src_off, size_t n)
+{
+    size_t iterations = ITERATIONS_BYTES / n;
+    uint64_t start = now();
+    for (size_t i = 0; i < iterations; i++)
+        fn(dst_buf + dst_off, src + src_off, n);
+    return now() - start;
+}
+
+static uint64_t time_set(set_fn fn, size_t dst_off, int c, size_t n)
+{
+    size_t iterations = ITERATIONS_BYTES / n;
+    uint64_t start = now();
+    for (size_t i = 0; i < iterations; i++)
+        fn(dst_buf + dst_off, c, n);
+    return now() - start;
+}
+
+static void report(const char *name, size_t dst_off, size_t src_off, size_t n, uint64_t lib, uint64_t ref)
+{
+    /* baselibc's printf has no left justification */
+    printf("%6s dst+%u src+%u %6u bytes: %8u ticks/MB, byte loop %8u (%u.%02ux)\n",
+           name, (unsigned)dst_off, (unsigned)src_off, (unsigned)n,
+           (unsigned)(lib / (ITERATIONS_BYTES / 0x100000)), (unsigned)(ref / (ITERATIONS_BYTES / 0x100000)),
+           (unsigned)(ref / (lib ? lib : 1)), (unsigned)((ref * 100 / (lib ? lib : 1)) % 100));
+}
+
+int main()
+{
+    static const size_t sizes[] = { 16, 64, 512, 4096, BUFFER_SIZE };
+    static const size_t offsets[][2] = { { 0, 0 }, { 1, 1 }, { 0, 3 }, { 5, 2 } };
+
+    memset(src_buf, 0x5a, sizeof(src_buf));
+    /* so that zeroing can use dcbz, this memory is ordinary cacheable RAM */
+    memops_set_cacheable(dst_buf, sizeof(dst_buf));
+
+    COMMENT("memcpy");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        for (size_t o = 0; o < sizeof(offsets) / sizeof(offsets[0]); o++) {
+            size_t d = offsets[o][0], a = offsets[o][1];
+            report("memcpy", d, a, sizes[s], time_copy(memcpy, src_buf, d, a, sizes[s]), time_copy(byte_copy, src_buf, d, a, sizes[s]));
+        }
+    }
+
+    COMMENT("memmove, overlapping");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]) - 1; s++) {
+        report("down", 0, 40, sizes[s], time_copy(memmove, dst_buf, 0, 40, sizes[s]), time_copy(byte_move, dst_buf, 0, 40, sizes[s]));
+        report("up", 40, 0, sizes[s], time_copy(memmove, dst_buf, 40, 0, sizes[s]), time_copy(byte_move, dst_buf, 40, 0, sizes[s]));
+    }
+
+    COMMENT("memset");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        report("memset", 1, 0, sizes[s], time_set(memset, 1, 0xa5, sizes[s]), time_set(byte_set, 1, 0xa5, sizes[s]));
+        report("zero", 0, 0, sizes[s], time_set(memset, 0, 0, sizes[s]), time_set(byte_set, 0, 0, sizes[s]));
+    }
+
+    return 0;
+}
@@ -14,6 +14,20 @@ int main()
         TEST(snprintf(buf, sizeof(buf), "01234567890123456789") == 20);
         TEST(strcmp(buf, "0123456789012345678") == 0);
     }
+
+    {
+        COMMENT("Testing text between conversions and long padding");
+        char buf[64];
+
+        snprintf(buf, sizeof(buf), "a%db%sc", 1, "xy");
+        TEST(strcmp(buf, "a1bxyc") == 0);
+
+        snprintf(buf, sizeof(buf), "[%20d]", -42);
+        TEST(strcmp(buf, "[                 -42]") == 0);
+
+        snprintf(buf, sizeof(buf), "[%020x]", 0xbeef);
+        TEST(strcmp(buf, "[0000000000000000beef]") == 0);
+    }
         
     if (status != 0)
         fprintf(stdout, "\n\nSome tests FAILED!\n");
@@ -678,6 +678,21 @@ PARC_DISPLAY_STATUS
     IN ULONG FileId
     );
 
+typedef
+ARC_STATUS
+(*PARC_READ_ASYNC_ROUTINE) (
+    IN ULONG FileId,
+    OUT PVOID Buffer,
+    IN ULONG Length
+    );
+
+typedef
+ARC_STATUS
+(*PARC_READ_ASYNC_WAIT_ROUTINE) (
+    IN ULONG FileId,
+    OUT PU32LE Count
+    );
+
 // Data structures starting at 0x8000_4000.
 enum {
     ARC_SYSTEM_TABLE_ADDRESS_PHYS = 0x4000,
@@ -857,6 +872,9 @@ typedef struct ARC_LE _FIRMWARE_VECTOR_TABLE {
     PARC_FLUSH_ALL_CACHES_ROUTINE FlushAllCachesRoutine;
     PARC_TEST_UNICODE_CHARACTER_ROUTINE TestUnicodeCharacterRoutine;
     PARC_GET_DISPLAY_STATUS_ROUTINE GetDisplayStatusRoutine;
+    // Extensions, only present when FirmwareVectorLength covers them.
+    PARC_READ_ASYNC_ROUTINE ReadAsyncRoutine;
+    PARC_READ_ASYNC_WAIT_ROUTINE ReadAsyncWaitRoutine;
 } FIRMWARE_VECTOR_TABLE, *PFIRMWARE_VECTOR_TABLE;
 
 typedef struct _VENDOR_VECTOR_TABLE {
@@ -897,6 +915,11 @@ typedef struct _VENDOR_VECTOR_TABLE {
     PARC_FLUSH_ALL_CACHES_ROUTINE FlushAllCachesRoutine;
     PARC_TEST_UNICODE_CHARACTER_ROUTINE TestUnicodeCharacterRoutine;
     PARC_GET_DISPLAY_STATUS_ROUTINE GetDisplayStatusRoutine;
+    // Extensions, only present when VendorVectorLength covers them.
+    // Starts a read at the current file position, ReadStatusRoutine returns _EAGAIN until it completes.
+    PARC_READ_ASYNC_ROUTINE ReadAsyncRoutine;
+    // Waits for the started read, returning its status and the number of bytes read.
+    PARC_READ_ASYNC_WAIT_ROUTINE ReadAsyncWaitRoutine;
 } VENDOR_VECTOR_TABLE, * PVENDOR_VECTOR_TABLE;
 
 typedef struct ARC_LE _LITTLE_ENDIAN32 {
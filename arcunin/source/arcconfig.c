@@ -13,10 +13,14 @@
 #include "arcmem.h"
 #include "arcio.h"
 #include "arcdisk.h"
+#include "arcramdisk.h"
 #include "runtime.h"
 
 enum {
-    MAXIMUM_DEVICE_COUNT = 256
+    MAXIMUM_DEVICE_COUNT = 256,
+    COMPONENT_INDEX_SLOTS = 1024,
+    FNV_OFFSET_BASIS = 0x811c9dc5,
+    FNV_PRIME = 0x01000193,
 };
 
 // Declare stub routines
@@ -300,6 +304,89 @@ static ULONG g_AdditionalComponentsCount = 0;
 static ULONG g_ConfigurationDataOffset = 0;
 _Static_assert(sizeof(DEVICE_ENTRY) < 0x100);
 
+// Index of the components by canonical path ("multi(0)disk(0)rdisk(0)"), for ArcGetComponent.
+// Open addressed; a slot holds the hash of the component's path, and the component.
+typedef struct _COMPONENT_INDEX_SLOT {
+    ULONG Hash;
+    PDEVICE_ENTRY Entry;
+} COMPONENT_INDEX_SLOT, *PCOMPONENT_INDEX_SLOT;
+
+static COMPONENT_INDEX_SLOT s_ComponentIndex[COMPONENT_INDEX_SLOTS] = { 0 };
+_Static_assert((COMPONENT_INDEX_SLOTS & (COMPONENT_INDEX_SLOTS - 1)) == 0);
+_Static_assert(COMPONENT_INDEX_SLOTS >= (MAXIMUM_DEVICE_COUNT * 2));
+
+static inline ARC_FORCEINLINE ULONG ComponentHashChar(ULONG Hash, CHAR Character) {
+    return (Hash ^ (UCHAR)Character) * FNV_PRIME;
+}
+
+// Continues the hash of a parent's path with one path element, as "name(key)".
+static ULONG ComponentHashElement(ULONG Hash, PCHAR Name, ULONG NameLength, ULONG Key) {
+    for (ULONG i = 0; i < NameLength; i++) Hash = ComponentHashChar(Hash, Name[i] | 0x20);
+    Hash = ComponentHashChar(Hash, '(');
+    char Digits[10];
+    ULONG DigitCount = 0;
+    do {
+        Digits[DigitCount++] = '0' + (Key % 10);
+        Key /= 10;
+    } while (Key != 0);
+    while (DigitCount != 0) Hash = ComponentHashChar(Hash, Digits[--DigitCount]);
+    return ComponentHashChar(Hash, ')');
+}
+
+static bool ComponentTypeIsValid(PDEVICE_ENTRY Entry) {
+    return Entry->Component.Type < (sizeof(DeviceTable) / sizeof(DeviceTable[0]));
+}
+
+static ULONG ComponentHashPath(PDEVICE_ENTRY Entry) {
+    // The root is not part of any path.
+    if (Entry == &Root || Entry->Parent == NULL) return FNV_OFFSET_BASIS;
+    // A component of unknown type can't be found by path, nor can anything below it.
+    PCHAR Name = ComponentTypeIsValid(Entry) ? DeviceTable[Entry->Component.Type] : "?";
+    return ComponentHashElement(ComponentHashPath(Entry->Parent), Name, strlen(Name), Entry->Component.Key);
+}
+
+static void ComponentIndexInsert(PDEVICE_ENTRY Entry) {
+    if (!ComponentTypeIsValid(Entry)) return;
+    ULONG Hash = ComponentHashPath(Entry);
+    ULONG Slot = Hash & (COMPONENT_INDEX_SLOTS - 1);
+    while (s_ComponentIndex[Slot].Entry != NULL) Slot = (Slot + 1) & (COMPONENT_INDEX_SLOTS - 1);
+    s_ComponentIndex[Slot].Hash = Hash;
+    s_ComponentIndex[Slot].Entry = Entry;
+}
+
+static void ComponentIndexInsertTree(PDEVICE_ENTRY Parent) {
+    // Peers in order, so that where two match the same path the first is found, as when walking the tree.
+    for (PDEVICE_ENTRY This = Parent->Child; This != NULL; This = This->Peer) {
+        ComponentIndexInsert(This);
+        ComponentIndexInsertTree(This);
+    }
+}
+
+static void ComponentIndexRebuild(void) {
+    memset(s_ComponentIndex, 0, sizeof(s_ComponentIndex));
+    ComponentIndexInsertTree(&Root);
+}
+
+// Finds the child of Parent whose path element is "name(key)", given the hash of its whole path.
+static PDEVICE_ENTRY ComponentIndexFind(ULONG Hash, PDEVICE_ENTRY Parent, PCHAR Name, ULONG NameLength, ULONG Key) {
+    for (
+        ULONG Slot = Hash & (COMPONENT_INDEX_SLOTS - 1);
+        s_ComponentIndex[Slot].Entry != NULL;
+        Slot = (Slot + 1) & (COMPONENT_INDEX_SLOTS - 1)
+    ) {
+        if (s_ComponentIndex[Slot].Hash != Hash) continue;
+        PDEVICE_ENTRY This = s_ComponentIndex[Slot].Entry;
+        if (This->Parent != Parent || This->Component.Key != Key) continue;
+        PCHAR Expected = DeviceTable[This->Component.Type];
+        ULONG i = 0;
+        for (; i < NameLength; i++) {
+            if ((Name[i] | 0x20) != Expected[i]) break;
+        }
+        if (i == NameLength && Expected[i] == 0) return This;
+    }
+    return NULL;
+}
+
 // Config functions implementation.
 
 static bool DeviceEntryIsValidImpl(PCONFIGURATION_COMPONENT Component, PULONG Index) {
@@ -389,6 +476,9 @@ static PCONFIGURATION_COMPONENT ArcAddChild(
         This->Peer = Entry;
     }
 
+    // It's the last child, so it goes after the others of the same path in the index.
+    ComponentIndexInsert(Entry);
+
     // All done.
     return &Entry->Component;
 }
@@ -420,6 +510,9 @@ static ARC_STATUS ArcDeleteComponent(IN PCONFIGURATION_COMPONENT Component) {
     // Zero out the parent to remove the entry from the component hierarchy.
     Entry->Parent = NULL;
 
+    // Deletes are rare, don't bother with tombstones.
+    ComponentIndexRebuild();
+
     return _ESUCCESS;
 }
 
@@ -516,20 +609,42 @@ static bool IsDevice(PDEVICE_ENTRY This, PCHAR* pPath) {
 static PCONFIGURATION_COMPONENT ArcGetComponent(IN PCHAR PathName) {
     // Get the root component.
     PDEVICE_ENTRY Match = &Root;
+    ULONG Hash = FNV_OFFSET_BASIS;
 
     // Keep searching until there are no more entries.
     PCHAR Pointer = PathName;
     while (*Pointer != 0) {
-        // Search each child.
-        PDEVICE_ENTRY This;
-        for (This = Match->Child; This != NULL; This = This->Peer) {
-            if (IsDevice(This, &Pointer)) {
-                Match = This;
-                break;
+        // Parse the next element, as ArcDeviceParse would.
+        PCHAR Name = Pointer;
+        PCHAR Path = Pointer;
+        while (*Path != '(' && *Path != 0) Path++;
+        if (*Path != '(') break;
+        ULONG NameLength = Path - Name;
+        Path++;
+
+        ULONG Key = 0;
+        while (*Path >= '0' && *Path <= '9') {
+            Key *= 10;
+            Key += (*Path - '0');
+            Path++;
+        }
+        if (*Path != ')') break;
+        Path++;
+
+        ULONG ElementHash = ComponentHashElement(Hash, Name, NameLength, Key);
+        PDEVICE_ENTRY This = ComponentIndexFind(ElementHash, Match, Name, NameLength, Key);
+        if (This == NULL) {
+            // Callers may change a component after adding it, so search the children before giving up.
+            for (This = Match->Child; This != NULL; This = This->Peer) {
+                PCHAR ChildPath = Pointer;
+                if (IsDevice(This, &ChildPath)) break;
             }
+            if (This == NULL) break;
         }
 
-        if (This == NULL) break;
+        Match = This;
+        Hash = ElementHash;
+        Pointer = Path;
     }
 
     return &Match->Component;
@@ -589,8 +704,8 @@ static ARC_STATUS ArcGetData(OUT PVOID ConfigurationData, IN PCONFIGURATION_COMP
 }
 
 static ARC_STATUS ArcSaveConfiguration(void) {
-    // No operation.
-    return _ESUCCESS;
+    // The configuration is not stored, but the environment is: treat this as an explicit commit.
+    return ArcEnvCommit();
 }
 
 static ARC_DISPLAY_STATUS s_DisplayStatus = { 0 };
@@ -678,6 +793,123 @@ static CONFIGURATION_COMPONENT s_RamdiskController = ARC_MAKE_COMPONENT(AdapterC
 static CONFIGURATION_COMPONENT s_RamdiskDisk = ARC_MAKE_COMPONENT(ControllerClass, DiskController, ARC_DEVICE_INPUT | ARC_DEVICE_OUTPUT, 0, 0);
 static CONFIGURATION_COMPONENT s_RamdiskFdisk = ARC_MAKE_COMPONENT(PeripheralClass, FloppyDiskPeripheral, ARC_DEVICE_INPUT | ARC_DEVICE_OUTPUT, 0, 0);
 
+// A compressed ramdisk is decompressed a block at a time, the first time each block is read.
+// The NT driver is given the address of the whole image, so its memory is allocated up front and the blocks are decompressed into it.
+static PRAMDISK_COMPRESSED_HEADER s_RamdiskCompressed = NULL;
+static PUCHAR s_RamdiskImage = NULL;
+static ULONG s_RamdiskBlockShift = 0;
+static ULONG s_RamdiskBlocksLeft = 0;
+static ULONG s_RamdiskBlockPresent[RAMDISK_MAXIMUM_IMAGE_SIZE / RAMDISK_MINIMUM_BLOCK_SIZE / 32] = { 0 };
+
+static bool RdLz4Decompress(const UCHAR* Source, ULONG SourceLength, PUCHAR Dest, ULONG DestLength) {
+    const UCHAR* SourceEnd = Source + SourceLength;
+    PUCHAR DestStart = Dest;
+    PUCHAR DestEnd = Dest + DestLength;
+
+    while (Source < SourceEnd) {
+        // Each sequence is a token, literals, then a match; the last sequence is only literals.
+        UCHAR Token = *Source++;
+        ULONG Literals = Token >> 4;
+        if (Literals == 15) {
+            UCHAR Extra;
+            do {
+                if (Source == SourceEnd) return false;
+                Extra = *Source++;
+                Literals += Extra;
+            } while (Extra == 255);
+        }
+        if (Literals > (ULONG)(SourceEnd - Source) || Literals > (ULONG)(DestEnd - Dest)) return false;
+        memcpy(Dest, Source, Literals);
+        Dest += Literals;
+        Source += Literals;
+        if (Source == SourceEnd) break;
+
+        if ((SourceEnd - Source) < 2) return false;
+        ULONG Offset = Source[0] | (Source[1] << 8);
+        Source += 2;
+        if (Offset == 0 || Offset > (ULONG)(Dest - DestStart)) return false;
+        ULONG MatchLength = (Token & 15) + 4;
+        if ((Token & 15) == 15) {
+            UCHAR Extra;
+            do {
+                if (Source == SourceEnd) return false;
+                Extra = *Source++;
+                MatchLength += Extra;
+            } while (Extra == 255);
+        }
+        if (MatchLength > (ULONG)(DestEnd - Dest)) return false;
+
+        const UCHAR* Match = Dest - Offset;
+        if (Offset >= MatchLength) {
+            memcpy(Dest, Match, MatchLength);
+            Dest += MatchLength;
+        }
+        else {
+            // The match overlaps what it produces, which repeats the last Offset bytes.
+            for (ULONG i = 0; i < MatchLength; i++) *Dest++ = *Match++;
+        }
+    }
+
+    return Dest == DestEnd;
+}
+
+static ARC_STATUS RdDecompressBlock(ULONG Block) {
+    ULONG Bit = 1 << (Block & 31);
+    if ((s_RamdiskBlockPresent[Block / 32] & Bit) != 0) return _ESUCCESS;
+
+    PRAMDISK_COMPRESSED_HEADER Header = s_RamdiskCompressed;
+    ULONG Start = Block << s_RamdiskBlockShift;
+    ULONG Length = Header->ImageSize - Start;
+    if (Length > Header->BlockSize) Length = Header->BlockSize;
+    ULONG StoredStart = Header->Offsets[Block];
+    ULONG StoredLength = Header->Offsets[Block + 1] - StoredStart;
+    PUCHAR Stored = (PUCHAR)Header + StoredStart;
+
+    if (StoredLength == Length) memcpy(&s_RamdiskImage[Start], Stored, Length);
+    else if (!RdLz4Decompress(Stored, StoredLength, &s_RamdiskImage[Start], Length)) {
+        printf("Ramdisk: block %d is corrupt\r\n", Block);
+        return _EIO;
+    }
+
+    s_RamdiskBlockPresent[Block / 32] |= Bit;
+    s_RamdiskBlocksLeft--;
+    return _ESUCCESS;
+}
+
+static ARC_STATUS RdDecompressRange(ULONG Start, ULONG Length) {
+    if (s_RamdiskCompressed == NULL || s_RamdiskBlocksLeft == 0) return _ESUCCESS;
+    ULONG Last = (Start + Length - 1) >> s_RamdiskBlockShift;
+    for (ULONG Block = Start >> s_RamdiskBlockShift; Block <= Last; Block++) {
+        ARC_STATUS Status = RdDecompressBlock(Block);
+        if (ARC_FAIL(Status)) return Status;
+    }
+    return _ESUCCESS;
+}
+
+void ArcDiskRamdiskComplete(void) {
+    if (s_RamdiskCompressed == NULL || s_RamdiskBlocksLeft == 0) return;
+    RdDecompressRange(0, s_RamdiskCompressed->ImageSize);
+}
+
+static bool RdCompressedHeaderValid(PRAMDISK_COMPRESSED_HEADER Header, ULONG FileSize) {
+    if (FileSize < sizeof(*Header)) return false;
+    if (Header->Magic != RAMDISK_COMPRESSED_MAGIC || Header->Version != RAMDISK_COMPRESSED_VERSION) return false;
+    ULONG BlockSize = Header->BlockSize;
+    if (BlockSize < RAMDISK_MINIMUM_BLOCK_SIZE || BlockSize > RAMDISK_MAXIMUM_BLOCK_SIZE || (BlockSize & (BlockSize - 1)) != 0) return false;
+    if (Header->ImageSize == 0 || Header->ImageSize > RAMDISK_MAXIMUM_IMAGE_SIZE) return false;
+    if (Header->BlockCount != (Header->ImageSize + BlockSize - 1) / BlockSize) return false;
+
+    // Every block must be inside the file, after the offset table.
+    ULONG TableEnd = sizeof(*Header) + ((Header->BlockCount + 1) * sizeof(Header->Offsets[0]));
+    if (TableEnd > FileSize || Header->Offsets[0] < TableEnd) return false;
+    for (ULONG i = 0; i < Header->BlockCount; i++) {
+        ULONG Length = Header->ImageSize - (i * BlockSize);
+        if (Length > BlockSize) Length = BlockSize;
+        if (Header->Offsets[i + 1] < Header->Offsets[i] || Header->Offsets[i + 1] > FileSize) return false;
+        if (Header->Offsets[i + 1] - Header->Offsets[i] > Length) return false;
+    }
+    return true;
+}
 
 static ARC_STATUS RdRead(ULONG FileId, PVOID Buffer, ULONG Length, PULONG Count) {
     //printf("Read %x => (%p) %x bytes\n", FileId, Buffer, Length);
@@ -701,6 +933,9 @@ static ARC_STATUS RdRead(ULONG FileId, PVOID Buffer, ULONG Length, PULONG Count)
         return _ESUCCESS;
     }
 
+    ARC_STATUS Status = RdDecompressRange(Pos, Length);
+    if (ARC_FAIL(Status)) return Status;
+
     memcpy(Buffer, (PVOID)(s_RamdiskResource.Descriptors[0].Memory.Start.LowPart + Pos), Length);
     *Count = Length;
     File->Position = PosEnd;
@@ -767,8 +1002,9 @@ static const DEVICE_VECTORS s_RdVectors = {
 bool ArcHasRamdiskLoaded(void);
 PVOID ArcGetRamDisk(PULONG Length);
 void ArcInitRamDisk(ULONG ControllerKey, PVOID Pointer, ULONG Length);
+void ArcDropRamDisk(void);
 
-static ARC_STATUS ArcDiskInitRamdiskAfterLoad(PUCHAR Address, ULONG Length) {
+static ARC_STATUS ArcDiskAddRamdisk(PUCHAR Address, ULONG Length) {
     // Grab the root device.
     PDEVICE_ENTRY Root = ArcGetChild(NULL);
     // Add the ramdisk controller and ensure it uses an unused key.
@@ -778,6 +1014,8 @@ static ARC_STATUS ArcDiskInitRamdiskAfterLoad(PUCHAR Address, ULONG Length) {
         return _EFAULT;
     }
     while (ArcConfigKeyExists(RdControl)) RdControl->Component.Key++;
+    // The controller's path changed after it was indexed.
+    ComponentIndexRebuild();
     // Same, but for disk controller.
     // There is only one child of the rd controller, so no need to search for unused key.
     PDEVICE_ENTRY RdDisk = ArcAddChild(&RdControl->Component, &s_RamdiskDisk, NULL);
@@ -803,6 +1041,42 @@ static ARC_STATUS ArcDiskInitRamdiskAfterLoad(PUCHAR Address, ULONG Length) {
     return _ESUCCESS;
 }
 
+// Takes ownership of the loaded drivers.img: on failure, its memory is freed.
+static ARC_STATUS ArcDiskInitRamdiskAfterLoad(PUCHAR Address, ULONG Length) {
+    PRAMDISK_COMPRESSED_HEADER Compressed = (PRAMDISK_COMPRESSED_HEADER)Address;
+    if (Length < sizeof(Compressed->Magic) || Compressed->Magic != RAMDISK_COMPRESSED_MAGIC) {
+        ARC_STATUS Status = ArcDiskAddRamdisk(Address, Length);
+        if (ARC_FAIL(Status)) ArcMemFree(Address);
+        return Status;
+    }
+
+    if (!RdCompressedHeaderValid(Compressed, Length)) {
+        printf("Ramdisk: compressed image is corrupt\r\n");
+        ArcMemFree(Address);
+        return _EBADF;
+    }
+    // The image itself is what gets described to NT, so allocate all of it now.
+    PUCHAR Image = (PUCHAR)ArcMemAllocDirect(Compressed->ImageSize);
+    if (Image == NULL) {
+        ArcMemFree(Address);
+        return _ENOMEM;
+    }
+    s_RamdiskCompressed = Compressed;
+    s_RamdiskImage = Image;
+    s_RamdiskBlockShift = __builtin_ctz(Compressed->BlockSize);
+    s_RamdiskBlocksLeft = Compressed->BlockCount;
+    memset(s_RamdiskBlockPresent, 0, sizeof(s_RamdiskBlockPresent));
+
+    ARC_STATUS Status = ArcDiskAddRamdisk(Image, Compressed->ImageSize);
+    if (ARC_FAIL(Status)) {
+        s_RamdiskCompressed = NULL;
+        s_RamdiskImage = NULL;
+        ArcMemFree(Image);
+        ArcMemFree(Address);
+    }
+    return Status;
+}
+
 ARC_STATUS ArcDiskInitRamdisk(void) {
     if (ArcHasRamdiskLoaded()) return _ESUCCESS;
     // Ensure there are enough spaces for 3 components (controller, disk, fdisk).
@@ -814,7 +1088,10 @@ ARC_STATUS ArcDiskInitRamdisk(void) {
     
     Ramdisk = ArcGetRamDisk(&FileSize32);
     if (Ramdisk != NULL && FileSize32 != 0) {
-        return ArcDiskInitRamdiskAfterLoad(Ramdisk, FileSize32);
+        ARC_STATUS Status = ArcDiskInitRamdiskAfterLoad(Ramdisk, FileSize32);
+        // The image passed in by stage1 was freed if that failed.
+        if (ARC_FAIL(Status)) ArcDropRamDisk();
+        return Status;
     }
 
     PVENDOR_VECTOR_TABLE Api = ARC_VENDOR_VECTORS();
@@ -843,22 +1120,35 @@ ARC_STATUS ArcDiskInitRamdisk(void) {
             if (ARC_FAIL(Status)) break;
 
             // if over 4MB don't bother
-            if (Info.EndingAddress.QuadPart > 0x400000) break;
+            if (Info.EndingAddress.QuadPart > RAMDISK_MAXIMUM_FILE_SIZE) break;
 
             FileSize32 = Info.EndingAddress.LowPart;
 
+            // Read the start of the file, to see if it's compressed.
+            // A compressed image is only needed until it's all been decompressed, before NT starts.
+            RAMDISK_COMPRESSED_HEADER Header;
+            U32LE Count;
+            bool IsCompressed = false;
+            Status = Api->ReadRoutine(FileId.v, &Header, sizeof(Header), &Count);
+            if (ARC_SUCCESS(Status) && Count.v == sizeof(Header)) IsCompressed = Header.Magic == RAMDISK_COMPRESSED_MAGIC;
+            LARGE_INTEGER SeekOffset = INT32_TO_LARGE_INTEGER(0);
+            Status = Api->SeekRoutine(FileId.v, &SeekOffset, SeekAbsolute);
+            if (ARC_FAIL(Status)) break;
+
             // Allocate some RAM
-            Ramdisk = ArcMemAllocDirect(FileSize32);
+            if (IsCompressed) Ramdisk = ArcMemAllocTemp(FileSize32);
+            else Ramdisk = ArcMemAllocDirect(FileSize32);
             if (Ramdisk == NULL) break;
 
             // Read image into RAM.
-            U32LE Count;
             Status = Api->ReadRoutine(FileId.v, Ramdisk, FileSize32, &Count);
             if (ARC_FAIL(Status)) {
+                ArcMemFree(Ramdisk);
                 FileSize32 = 0;
                 break;
             }
             if (Count.v != FileSize32) {
+                ArcMemFree(Ramdisk);
                 FileSize32 = 0;
                 Status = _EIO;
                 break;
@@ -928,4 +1218,7 @@ void ArcConfigInit(void) {
     // Set up the system / chipset identifier
     Root.Component.Identifier = (size_t)s_RootIdentifier;
     Root.Component.IdentifierLength = sizeof(s_RootIdentifier);
+
+    // Index the default components.
+    ComponentIndexRebuild();
 }
\ No newline at end of file
@@ -18,6 +18,23 @@
 #define FONT_YGAP			0
 #define TAB_SIZE			4
 
+// Largest text grid kept in the shadow buffer, enough for 2560x2048.
+#define CON_MAX_COLS	320
+#define CON_MAX_ROWS	128
+
+// Glyph rows are drawn from tables of the 8 pixels for each font byte, one table per colour pair.
+// A few are kept, so that text in a different colour does not rebuild the table every time.
+#define CON_GLYPH_TABLES	4
+
+#define FB_WRITE(ptr, x) NativeWrite32((ptr), (x))
+
+// One character cell as it is on screen.
+// attr is the colour table index of the foreground in the low nibble, background in the high nibble.
+typedef struct _console_cell_s {
+	unsigned char chr;
+	unsigned char attr;
+} console_cell_s;
+
 typedef struct _console_data_s {
 	void* destbuffer;
 	unsigned char* font;
@@ -30,6 +47,18 @@ typedef struct _console_data_s {
 	int foreground, background;
 	unsigned int real_foreground, real_background;
 	bool high_intensity, underscore, reverse;
+	unsigned char attr;
+
+	// Shadow of the text, so that nothing is ever read back from the framebuffer.
+	// Rows are a ring: screen row 0 is at shadow_top, scrolling just moves it.
+	// Writes only change the shadow and mark the cells dirty; at the end of each write the dirty cells
+	// that differ from what is in the framebuffer (screen, by screen row) are drawn.
+	console_cell_s* shadow;
+	console_cell_s* screen;
+	int shadow_top;
+	bool dirty;
+	short dirty_from[CON_MAX_ROWS], dirty_to[CON_MAX_ROWS];
+	unsigned int margin_colour; // colour of the pixels outside the text grid
 } console_data_s;
 
 //color table
@@ -55,113 +84,267 @@ static const unsigned int color_table[] =
 
 static struct _console_data_s stdcon;
 static struct _console_data_s* curr_con = NULL;
+static console_cell_s s_ConsoleShadow[CON_MAX_COLS * CON_MAX_ROWS];
+static console_cell_s s_ConsoleScreen[CON_MAX_COLS * CON_MAX_ROWS];
+
+typedef struct _console_glyph_table_s {
+	unsigned short key; // attr | 0x100, 0 if the table is unused
+	unsigned int pixels[256][FONT_XSIZE];
+} console_glyph_table_s;
+
+static console_glyph_table_s s_GlyphTables[CON_GLYPH_TABLES];
+static console_glyph_table_s* s_GlyphTableLast = &s_GlyphTables[0];
+static int s_GlyphTableNext = 0;
 ULONG g_framebuffer_phys = 0;
 
 extern u8 console_font_8x16[];
 
 
-static void __console_drawc(int c)
+static console_cell_s* __console_row(console_data_s* con, int row)
+{
+	row += con->shadow_top;
+	if (row >= con->con_rows) row -= con->con_rows;
+	return &con->shadow[row * con->con_cols];
+}
+
+// Spaces are kept with the foreground equal to the background, they look the same whatever the foreground is.
+static unsigned char __console_cell_attr(unsigned char chr, unsigned char attr)
+{
+	if (chr == ' ') return (attr & 0xf0) | (attr >> 4);
+	return attr;
+}
+
+// Gets the expanded glyph rows for a colour pair, building them if they are not cached.
+static const unsigned int (*__console_glyph_table(unsigned char attr))[FONT_XSIZE]
+{
+	unsigned short key = attr | 0x100;
+	console_glyph_table_s* table = s_GlyphTableLast;
+	int i, bits, x;
+
+	if (table->key == key) return table->pixels;
+	for (i = 0; i < CON_GLYPH_TABLES; i++) {
+		if (s_GlyphTables[i].key == key) {
+			s_GlyphTableLast = &s_GlyphTables[i];
+			return s_GlyphTables[i].pixels;
+		}
+	}
+
+	// Replace the oldest.
+	table = &s_GlyphTables[s_GlyphTableNext];
+	s_GlyphTableNext = (s_GlyphTableNext + 1) % CON_GLYPH_TABLES;
+	unsigned int fgcolor = color_table[attr & 0xf];
+	unsigned int bgcolor = color_table[attr >> 4];
+	for (bits = 0; bits < 256; bits++) {
+		for (x = 0; x < FONT_XSIZE; x++)
+			table->pixels[bits][x] = (bits & (0x80 >> x)) ? fgcolor : bgcolor;
+	}
+	table->key = key;
+	s_GlyphTableLast = table;
+	return table->pixels;
+}
+
+static void __console_drawc(console_data_s* con, int row, int col, int c, unsigned char attr)
 {
-	console_data_s* con;
 	int ay;
 	unsigned int* ptr;
 	unsigned char* pbits;
-	unsigned char bits;
-	unsigned int color;
-	unsigned int fgcolor, bgcolor;
 	unsigned int nextline;
+	const unsigned int (*glyph)[FONT_XSIZE];
 
-	if (!curr_con) return;
-	con = curr_con;
-
-	ptr = (unsigned int*)(con->destbuffer + (con->con_stride * con->cursor_row * FONT_YSIZE) + ((con->cursor_col * FONT_XSIZE) * 4));
+	ptr = (unsigned int*)(con->destbuffer + (con->con_stride * row * FONT_YSIZE) + ((col * FONT_XSIZE) * 4));
 	pbits = &con->font[c * FONT_YSIZE];
 	nextline = con->con_stride;
-	fgcolor = con->real_foreground;
-	bgcolor = con->real_background;
+	glyph = __console_glyph_table(attr);
 
 	for (ay = 0; ay < FONT_YSIZE; ay++)
 	{
 		/* hard coded loop unrolling ! */
 		/* this depends on FONT_XSIZE = 8*/
 #if FONT_XSIZE == 8
-		bits = *pbits++;
-		unsigned int* ptrOld = ptr;
+		const unsigned int* pixels = glyph[*pbits++];
 
-#define PLOT_FLAG(x) do {\
-	if (bits & (x)) color = fgcolor;\
-	else color = bgcolor;\
-	NativeWrite32(ptr, color);\
-	ptr++;\
-} while (0)
+		FB_WRITE(&ptr[0], pixels[0]);
+		FB_WRITE(&ptr[1], pixels[1]);
+		FB_WRITE(&ptr[2], pixels[2]);
+		FB_WRITE(&ptr[3], pixels[3]);
+		FB_WRITE(&ptr[4], pixels[4]);
+		FB_WRITE(&ptr[5], pixels[5]);
+		FB_WRITE(&ptr[6], pixels[6]);
+		FB_WRITE(&ptr[7], pixels[7]);
 
-		/* bits 1 & 2 */
-		PLOT_FLAG(0x80);
-		PLOT_FLAG(0x40);
+		/* next line */
+		ptr = (unsigned int*)((ULONG)ptr + nextline);
+#else
+#endif
+	}
+}
 
-		/* bits 3 & 4 */
-		PLOT_FLAG(0x20);
-		PLOT_FLAG(0x10);
+static void __console_mark(console_data_s* con, int row, int from, int to)
+{
+	if (from >= to) return;
+	if (from < con->dirty_from[row]) con->dirty_from[row] = from;
+	if (to > con->dirty_to[row]) con->dirty_to[row] = to;
+	con->dirty = true;
+}
 
-		/* bits 5 & 6 */
-		PLOT_FLAG(0x08);
-		PLOT_FLAG(0x04);
+static bool __console_printable(BYTE chr)
+{
+	switch (chr) {
+	case '\0':
+	case '\n':
+	case 0xb: // VT
+	case '\f': // FF
+	case '\r':
+	case '\b':
+	case '\t':
+	case 0x1b:
+	case 0x9b:
+		return false;
+	default:
+		return true;
+	}
+}
 
-		/* bits 7 & 8 */
-		PLOT_FLAG(0x02);
-		PLOT_FLAG(0x01);
+// Puts a run of printable characters at the cursor, and moves the cursor past them.
+static void __console_puts(console_data_s* con, const BYTE* str, size_t len)
+{
+	console_cell_s* cells = __console_row(con, con->cursor_row);
+	int last = con->con_cols - 1;
+	int col = con->cursor_col;
+	int from = col, to;
+
+	while (len > 0 && col < last) {
+		cells[col].chr = *str;
+		cells[col].attr = __console_cell_attr(*str, con->attr);
+		str++;
+		len--;
+		col++;
+	}
+	to = col;
+	if (len > 0) {
+		// do not wrap around, says jazz arc fw impl: the rest all go in the last column, so only the final one is seen
+		cells[last].chr = str[len - 1];
+		cells[last].attr = __console_cell_attr(str[len - 1], con->attr);
+		col = last;
+		to = last + 1;
+		if (from > last) from = last;
+	}
 
-		/* next line */
-		ptr = (unsigned int*)((ULONG)ptrOld + nextline);
-#else
-#endif
+	__console_mark(con, con->cursor_row, from, to);
+	con->cursor_col = col;
+}
+
+static void __console_fill_rect(console_data_s* con, int x, int y, int width, int height, unsigned int colour)
+{
+	unsigned int* line = (unsigned int*)(con->destbuffer + (con->con_stride * y) + (x * 4));
+	if (width <= 0) return;
+
+	while (height-- > 0) {
+		unsigned int* ptr = line;
+		for (int c = 0; c < width; c++) {
+			FB_WRITE(ptr, colour);
+			ptr++;
+		}
+		line = (unsigned int*)((ULONG)line + con->con_stride);
 	}
 }
+
+// Paints the pixels outside the text grid, if they are not already the background colour.
+static void __console_clear_margins(console_data_s* con)
+{
+	int text_width = con->con_cols * FONT_XSIZE;
+	int text_height = con->con_rows * FONT_YSIZE;
+
+	if (con->margin_colour == con->real_background) return;
+	__console_fill_rect(con, text_width, 0, con->con_xres - text_width, text_height, con->real_background);
+	__console_fill_rect(con, 0, text_height, con->con_xres, con->con_yres - text_height, con->real_background);
+	con->margin_colour = con->real_background;
+}
+
 static void __console_clear_line(int line, int from, int to) {
 	console_data_s* con;
-	unsigned int c;
-	unsigned int* p;
-	unsigned int x_pixels;
-	unsigned int px_per_col = FONT_XSIZE;
-	unsigned int line_height = FONT_YSIZE;
-	unsigned int line_width;
+	console_cell_s* cells;
+	unsigned char attr;
+	int col;
 
 	if (!(con = curr_con)) return;
-	// For some reason there are xres/2 pixels per screen width
-	x_pixels = con->con_xres;
+	if (line < 0 || line >= con->con_rows) return;
 
-	line_width = (to - from) * px_per_col;
-	p = (unsigned int*)con->destbuffer;
+	cells = __console_row(con, line);
+	attr = __console_cell_attr(' ', con->attr);
+	for (col = from; col < to; col++) {
+		cells[col].chr = ' ';
+		cells[col].attr = attr;
+	}
+	__console_mark(con, line, from, to);
+}
 
-	// Move pointer to the current line and column offset
-	p += line * (FONT_YSIZE * x_pixels) + from * px_per_col;
+// Moves the text up a row. Nothing is drawn until the flush, so scrolling many times in one write costs no more than once.
+static void __console_scroll(console_data_s* con)
+{
+	unsigned char blank = __console_cell_attr(' ', con->attr);
+	int row, col;
+
+	// The old top row becomes the new bottom row.
+	console_cell_s* bottom = __console_row(con, 0);
+	for (col = 0; col < con->con_cols; col++) {
+		bottom[col].chr = ' ';
+		bottom[col].attr = blank;
+	}
+	con->shadow_top++;
+	if (con->shadow_top >= con->con_rows) con->shadow_top = 0;
+
+	for (row = 0; row < con->con_rows; row++)
+		__console_mark(con, row, 0, con->con_cols);
+}
 
-	// Clears 1 line of pixels at a time, line_height times
-	while (line_height--) {
-		c = line_width;
-		while (c--) {
-			NativeWrite32(p, con->real_background);
-			p++;
+// Draws the dirty cells that differ from the framebuffer. Runs of blank cells are filled a pixel row at a time.
+static void __console_flush(console_data_s* con)
+{
+	int row, col, start;
+
+	if (!con->dirty) return;
+	con->dirty = false;
+
+	for (row = 0; row < con->con_rows; row++) {
+		int to = con->dirty_to[row];
+		col = con->dirty_from[row];
+		if (col >= to) continue;
+		con->dirty_from[row] = con->con_cols;
+		con->dirty_to[row] = 0;
+
+		console_cell_s* want = __console_row(con, row);
+		console_cell_s* have = &con->screen[row * con->con_cols];
+		while (col < to) {
+			unsigned char chr = want[col].chr, attr = want[col].attr;
+			if (have[col].chr == chr && have[col].attr == attr) {
+				col++;
+				continue;
+			}
+			if (chr != ' ') {
+				__console_drawc(con, row, col, chr, attr);
+				have[col] = want[col];
+				col++;
+				continue;
+			}
+			for (start = col; col < to && want[col].chr == ' ' && want[col].attr == attr &&
+				(have[col].chr != ' ' || have[col].attr != attr); col++)
+				have[col] = want[col];
+			__console_fill_rect(con, start * FONT_XSIZE, row * FONT_YSIZE, (col - start) * FONT_XSIZE, FONT_YSIZE, color_table[attr >> 4]);
 		}
-		p -= line_width;
-		p += x_pixels;
 	}
 }
+
 static void __console_clear(void)
 {
 	console_data_s* con;
-	unsigned int c;
-	unsigned int* p;
+	int row;
 
 	if (!(con = curr_con)) return;
 
-	c = (con->con_xres * con->con_yres);
-	p = (unsigned int*)con->destbuffer;
-
-	while (c--) {
-		NativeWrite32(p, con->real_background);
-		p++;
-	}
+	for (row = 0; row < con->con_rows; row++)
+		__console_clear_line(row, 0, con->con_cols);
+	__console_clear_margins(con);
 
 	con->cursor_row = 0;
 	con->cursor_col = 0;
@@ -177,7 +360,7 @@ static void __console_clear_from_cursor(void) {
 
 	__console_clear_line(cur_row, con->cursor_col, con->con_cols);
 
-	while (cur_row++ < con->con_rows)
+	while (++cur_row < con->con_rows)
 		__console_clear_line(cur_row, 0, con->con_cols);
 
 }
@@ -207,6 +390,8 @@ void ArcConsoleInit(void* framebuffer, int xstart, int ystart, int xres, int yre
 	con->con_yres = yres;
 	con->con_cols = (xres - xstart) / FONT_XSIZE;
 	con->con_rows = (yres - ystart) / FONT_YSIZE;
+	if (con->con_cols > CON_MAX_COLS) con->con_cols = CON_MAX_COLS;
+	if (con->con_rows > CON_MAX_ROWS) con->con_rows = CON_MAX_ROWS;
 	con->con_stride = con->tgt_stride = stride;
 	con->target_x = xstart;
 	con->target_y = ystart;
@@ -224,6 +409,23 @@ void ArcConsoleInit(void* framebuffer, int xstart, int ystart, int xres, int yre
 	con->high_intensity = false;
 	con->underscore = false;
 	con->reverse = false;
+	con->attr = 7;
+
+	// The loader cleared the screen to black.
+	con->shadow = s_ConsoleShadow;
+	con->screen = s_ConsoleScreen;
+	con->shadow_top = 0;
+	for (int cell = 0; cell < con->con_cols * con->con_rows; cell++) {
+		con->shadow[cell].chr = ' ';
+		con->shadow[cell].attr = __console_cell_attr(' ', con->attr);
+		con->screen[cell] = con->shadow[cell];
+	}
+	con->dirty = false;
+	for (int row = 0; row < con->con_rows; row++) {
+		con->dirty_from[row] = con->con_cols;
+		con->dirty_to[row] = 0;
+	}
+	con->margin_colour = color_table[0];
 
 	curr_con = con;
 }
@@ -409,6 +611,7 @@ static int __console_parse_escsequence(const BYTE* pchr)
 			con->real_background = con->real_foreground;
 			con->real_foreground = con->background;
 		}
+		con->attr = con->real_foreground | (con->real_background << 4);
 		con->real_background = color_table[con->real_background];
 		con->real_foreground = color_table[con->real_foreground];
 		break;
@@ -432,6 +635,17 @@ int ArcConsoleWrite(const BYTE* ptr, size_t len)
 	i = 0;
 	while (*tmp != '\0' && i < len)
 	{
+		if (__console_printable(*tmp))
+		{
+			/* a run of printable characters, up to the next control character */
+			size_t run = 1;
+			while (i + run < len && __console_printable(tmp[run])) run++;
+			__console_puts(con, tmp, run);
+			tmp += run;
+			i += run;
+			continue;
+		}
+
 		chr = *tmp++;
 		i++;
 		if (chr == 0x9b || ((chr == 0x1b) && (*tmp == '[')))
@@ -469,41 +683,23 @@ int ArcConsoleWrite(const BYTE* ptr, size_t len)
 			case '\t':
 				if (con->cursor_col % TAB_SIZE) con->cursor_col += (con->cursor_col % TAB_SIZE);
 				else con->cursor_col += TAB_SIZE;
+				if (con->cursor_col >= con->con_cols) con->cursor_col = con->con_cols - 1;
 				break;
 			default:
-				__console_drawc(chr);
-				con->cursor_col++;
-
-				if (con->cursor_col >= con->con_cols)
-				{
-					con->cursor_col = con->con_cols - 1; // do not wrap around, says jazz arc fw impl
-				}
+				/* ESC not starting a sequence */
+				__console_puts(con, &chr, 1);
 			}
 		}
 
 		if (con->cursor_row >= con->con_rows)
 		{
 			/* if bottom border reached scroll */
-			ULONG srcPtr = (ULONG)con->destbuffer + con->con_stride * (FONT_YSIZE * FONT_YFACTOR + FONT_YGAP);
-			for (ULONG destPtr = (ULONG)con->destbuffer; destPtr < (ULONG)con->destbuffer + con->con_stride * (FONT_YSIZE * FONT_YFACTOR + FONT_YGAP); srcPtr += 4, destPtr += 4) {
-				NativeWrite32((PVOID)destPtr, NativeRead32((PVOID)srcPtr));
-			}
-#if 0
-			memcpy(con->destbuffer,
-				con->destbuffer + con->con_stride * (FONT_YSIZE * FONT_YFACTOR + FONT_YGAP),
-				con->con_stride * con->con_yres - FONT_YSIZE);
-#endif
-
-			unsigned int cnt = (con->con_stride * (FONT_YSIZE * FONT_YFACTOR + FONT_YGAP)) / 4;
-			unsigned int* ptr = (unsigned int*)(con->destbuffer + con->con_stride * (con->con_yres - FONT_YSIZE));
-			while (cnt--) {
-				NativeWrite32(ptr, con->background);
-				ptr++;
-			}
+			__console_scroll(con);
 			con->cursor_row--;
 		}
 	}
 
+	__console_flush(con);
 	return i;
 }
 
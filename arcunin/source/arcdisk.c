@@ -17,6 +17,7 @@
 #include "usbmsc.h"
 #include "usbdisk.h"
 #include "ide.h"
+#include "arcdiskcache.h"
 
 // ARC firmware support for disks:
 // USB mass storage, and IDE
@@ -71,6 +72,8 @@ void ARC_WEAK usbdisk_create(usbdev_t* dev) {
 
 	MountEntry->Address = (ULONG)dev->address;
 	MountEntry->ReferenceCount = 0;
+	// Mount entries get reused, so make sure nothing from a previous device is cached.
+	ArcDiskCacheInvalidate(MountEntry);
 	MountEntry->Mount = dev;
 	MountEntry->SectorSize = MSC_INST(dev)->blocksize;
 }
@@ -80,6 +83,7 @@ void ARC_WEAK usbdisk_remove(usbdev_t* dev) {
 	for (ULONG i = 0; i < sizeof(s_MountTable) / sizeof(s_MountTable[0]); i++) {
 		if (s_MountTable[i].Mount == dev) {
 			// found it, wipe it
+			ArcDiskCacheInvalidate(&s_MountTable[i]);
 			if (s_MountTable[i].ReferenceCount != 0) {
 				// something's using this. just wipe the pointer for now
 				s_MountTable[i].Mount = NULL;
@@ -147,6 +151,8 @@ static ARC_STATUS IdeMount(PCHAR MountPath, MOUNT_OPERATION Operation);
 static ARC_STATUS IdeSeek(ULONG FileId, PLARGE_INTEGER Offset, SEEK_MODE SeekMode);
 static ARC_STATUS IdeRead(PARC_FILE_TABLE FileEntry, ULONG StartSector, ULONG CountSectors, PVOID Buffer);
 static ARC_STATUS IdeWrite(PARC_FILE_TABLE FileEntry, ULONG StartSector, ULONG CountSectors, PVOID Buffer);
+static ULONG IdeStartRead(PARC_FILE_TABLE FileEntry, ULONG StartSector, ULONG CountSectors, PVOID Buffer);
+static ARC_STATUS IdePollRead(PARC_FILE_TABLE FileEntry);
 static ARC_STATUS IdeGetReadStatus(ULONG FileId);
 static ARC_STATUS IdeGetFileInformation(ULONG FileId, PFILE_INFORMATION FileInfo);
 
@@ -333,7 +339,7 @@ static ARC_STATUS DeblockerRead(ULONG FileId, PVOID Buffer, ULONG Length, PULONG
 	else CurrentSector = (FileEntry->Position - Offset) / SectorSize;
 	
 	if (Offset != 0) {
-		Status = FileEntry->ReadSectors(FileEntry, CurrentSector + SectorStart, 1, LocalPointer);
+		Status = ArcDiskCacheRead(FileEntry, SectorSize, CurrentSector + SectorStart, 1, LocalPointer);
 		if (ARC_FAIL(Status)) {
 			return Status;
 		}
@@ -362,7 +368,7 @@ static ARC_STATUS DeblockerRead(ULONG FileId, PVOID Buffer, ULONG Length, PULONG
 
 		if (SectorsToTransfer == 0) break;
 
-		Status = FileEntry->ReadSectors(FileEntry, CurrentSector + SectorStart, SectorsToTransfer, Buffer);
+		Status = ArcDiskCacheRead(FileEntry, SectorSize, CurrentSector + SectorStart, SectorsToTransfer, Buffer);
 		if (ARC_FAIL(Status)) {
 			return Status;
 		}
@@ -378,7 +384,7 @@ static ARC_STATUS DeblockerRead(ULONG FileId, PVOID Buffer, ULONG Length, PULONG
 
 	// If there's any data left to read, read the last sector.
 	if (Length != 0) {
-		Status = FileEntry->ReadSectors(FileEntry, CurrentSector + SectorStart, 1, LocalPointer);
+		Status = ArcDiskCacheRead(FileEntry, SectorSize, CurrentSector + SectorStart, 1, LocalPointer);
 		if (ARC_FAIL(Status)) {
 			return Status;
 		}
@@ -424,7 +430,7 @@ static ARC_STATUS DeblockerWrite(ULONG FileId, PVOID Buffer, ULONG Length, PULON
 	else CurrentSector = (FileEntry->Position - Offset) / SectorSize;
 	
 	if (Offset != 0) {
-		Status = FileEntry->ReadSectors(FileEntry, CurrentSector + SectorStart, 1, LocalPointer);
+		Status = ArcDiskCacheRead(FileEntry, SectorSize, CurrentSector + SectorStart, 1, LocalPointer);
 		if (ARC_FAIL(Status)) {
 			return Status;
 		}
@@ -435,7 +441,7 @@ static ARC_STATUS DeblockerWrite(ULONG FileId, PVOID Buffer, ULONG Length, PULON
 		memcpy(&LocalPointer[Offset], Buffer, Limit);
 
 		// Write the sector.
-		Status = FileEntry->WriteSectors(FileEntry, CurrentSector + SectorStart, 1, LocalPointer);
+		Status = ArcDiskCacheWrite(FileEntry, SectorSize, CurrentSector + SectorStart, 1, LocalPointer);
 		if (ARC_FAIL(Status)) {
 			return Status;
 		}
@@ -460,7 +466,7 @@ static ARC_STATUS DeblockerWrite(ULONG FileId, PVOID Buffer, ULONG Length, PULON
 
 		if (SectorsToTransfer == 0) break;
 
-		Status = FileEntry->WriteSectors(FileEntry, CurrentSector + SectorStart, SectorsToTransfer, Buffer);
+		Status = ArcDiskCacheWrite(FileEntry, SectorSize, CurrentSector + SectorStart, SectorsToTransfer, Buffer);
 		if (ARC_FAIL(Status)) return Status;
 
 		ULONG Limit = SectorsToTransfer * SectorSize;
@@ -474,14 +480,14 @@ static ARC_STATUS DeblockerWrite(ULONG FileId, PVOID Buffer, ULONG Length, PULON
 
 	// If there's any data left to write, read the last sector seperately, replace the data, and write back to disk.
 	if (Length != 0) {
-		Status = FileEntry->ReadSectors(FileEntry, CurrentSector + SectorStart, 1, LocalPointer);
+		Status = ArcDiskCacheRead(FileEntry, SectorSize, CurrentSector + SectorStart, 1, LocalPointer);
 		if (ARC_FAIL(Status)) {
 			return Status;
 		}
 
 		memcpy(LocalPointer, Buffer, Length);
 
-		Status = FileEntry->WriteSectors(FileEntry, CurrentSector + SectorStart, 1, LocalPointer);
+		Status = ArcDiskCacheWrite(FileEntry, SectorSize, CurrentSector + SectorStart, 1, LocalPointer);
 		if (ARC_FAIL(Status)) return Status;
 
 		*Count += Length;
@@ -629,6 +635,8 @@ static ARC_STATUS IdeOpen(PCHAR OpenPath, OPEN_MODE OpenMode, PULONG FileId) {
 		if (IsCdRom) IdeDrive = ob_ide_open(Channel, Unit);
 		if (IdeDrive == NULL) return _ENODEV;
 	}
+	// If the drive saw its media change since it was last used, what's cached from it is stale.
+	if (ob_ide_media_changed(IdeDrive)) ArcDiskCacheInvalidate(IdeDrive);
 	FileEntry->u.DiskContext.IdeDrive = IdeDrive;
 	FileEntry->u.DiskContext.MaxSectorTransfer = IdeDrive->max_sectors;
 
@@ -638,6 +646,8 @@ static ARC_STATUS IdeOpen(PCHAR OpenPath, OPEN_MODE OpenMode, PULONG FileId) {
 	FileEntry->GetSectorSize = IdeGetSectorSize;
 	FileEntry->ReadSectors = IdeRead;
 	FileEntry->WriteSectors = IdeWrite;
+	FileEntry->StartReadSectors = IdeStartRead;
+	FileEntry->PollReadSectors = IdePollRead;
 
 	ULONG DiskSectors = IdeDrive->sectors;
 	ULONG PartitionSectors = DiskSectors;
@@ -693,6 +703,18 @@ static ARC_STATUS IdeWrite(PARC_FILE_TABLE FileEntry, ULONG StartSector, ULONG C
 	return _ESUCCESS;
 }
 
+static ULONG IdeStartRead(PARC_FILE_TABLE FileEntry, ULONG StartSector, ULONG CountSectors, PVOID Buffer) {
+	// Bypasses the sector cache; the read goes straight into the caller's buffer by DMA.
+	return ob_ide_read_blocks_start(FileEntry->u.DiskContext.IdeDrive, Buffer, StartSector, CountSectors);
+}
+
+static ARC_STATUS IdePollRead(PARC_FILE_TABLE FileEntry) {
+	int Result = ob_ide_read_blocks_poll(FileEntry->u.DiskContext.IdeDrive);
+	if (Result < 0) return _EAGAIN;
+	if (Result != 0) return _EIO;
+	return _ESUCCESS;
+}
+
 static ARC_STATUS IdeGetReadStatus(ULONG FileId) {
 	PARC_FILE_TABLE FileEntry = ArcIoGetFile(FileId);
 	if (FileEntry == NULL) return _EBADF;
@@ -729,6 +751,8 @@ ARC_STATUS ArcDiskTryEject(ULONG FileId) {
 	if (FileEntry->DeviceEntryTable->GetReadStatus == IdeGetReadStatus) {
 		PIDE_DRIVE Drive = FileEntry->u.DiskContext.IdeDrive;
 		if (Drive == NULL) return _EBADF;
+		ArcDiskCacheInvalidate(Drive);
+		FsInvalidateForDevice(FileId);
 		if (ob_ide_eject(Drive)) return _ESUCCESS;
 		return _EIO;
 	}
@@ -806,6 +830,7 @@ ULONG ArcDiskGetSizeMb(ULONG Disk) {
 ARC_STATUS ArcDiskInitRamdisk(void);
 
 void ArcDiskInit() {
+	ArcDiskCacheInit();
 	ArcDiskIdeInit();
 	ArcDiskUsbInit();
 
@@ -0,0 +1,317 @@
+#include <stddef.h>
+#include <memory.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "arc.h"
+#include "arcio.h"
+#include "arcmem.h"
+#include "arcdiskcache.h"
+
+// Sector cache shared by all disk devices, sitting between the deblocker and the low-level ReadSectors/WriteSectors.
+// Cached in lines of several sectors, evicted least recently used first.
+// Misses that continue the previous access to a device read ahead, doubling the amount each time up to a limit.
+// Writes go straight to the device, then update any cached copy.
+// Each device also has a media generation, so that layers above can tell whether what they read from it earlier still holds.
+
+enum {
+	CACHE_LINE_SIZE = 0x1000,
+	CACHE_LINE_COUNT = 128,
+	CACHE_HASH_SIZE = 64,
+	CACHE_DEVICE_COUNT = 8,
+	CACHE_READAHEAD_MAX = 16, // lines
+	CACHE_BYPASS_SIZE = CACHE_READAHEAD_MAX * CACHE_LINE_SIZE, // transfers this big or bigger go straight to the device
+	CACHE_BOOT_REGION_SIZE = 0x10000, // writes to this much of the start of a partition change the media generation
+};
+
+typedef struct _DISK_CACHE_LINE DISK_CACHE_LINE, *PDISK_CACHE_LINE;
+struct _DISK_CACHE_LINE {
+	PDISK_CACHE_LINE LruPrev, LruNext; // LRU list, head is most recently used
+	PDISK_CACHE_LINE HashNext;
+	PVOID Device; // NULL if unused
+	ULONG Line; // Absolute sector / sectors per line
+	ULONG SectorSize;
+	PUCHAR Data;
+};
+
+typedef struct _DISK_CACHE_DEVICE {
+	PVOID Device;
+	ULONG NextSector; // Sector following the last access
+	ULONG ReadAhead; // Lines to read on the next sequential miss
+	ULONG Generation; // Media generation
+} DISK_CACHE_DEVICE, *PDISK_CACHE_DEVICE;
+
+static DISK_CACHE_LINE s_Lines[CACHE_LINE_COUNT];
+static PDISK_CACHE_LINE s_Hash[CACHE_HASH_SIZE];
+static PDISK_CACHE_LINE s_LruHead = NULL, s_LruTail = NULL;
+static DISK_CACHE_DEVICE s_Devices[CACHE_DEVICE_COUNT];
+static ULONG s_NextDevice = 0;
+static ULONG s_LastGeneration = 0;
+static PUCHAR s_ReadAheadBuffer = NULL;
+static ARC_DISK_CACHE_STATS s_Stats = { 0 };
+
+static inline ARC_FORCEINLINE ULONG CacheHash(PVOID Device, ULONG Line) {
+	return (((ULONG)Device >> 4) ^ Line) & (CACHE_HASH_SIZE - 1);
+}
+
+static inline ARC_FORCEINLINE ULONG CacheSectorShift(ULONG SectorSize) {
+	// Only power of two sector sizes smaller than the line size can be cached; returns 0 for anything else.
+	if (SectorSize == 0 || SectorSize >= CACHE_LINE_SIZE || (SectorSize & (SectorSize - 1)) != 0) return 0;
+	return __builtin_ctz(CACHE_LINE_SIZE / SectorSize);
+}
+
+static void CacheLruRemove(PDISK_CACHE_LINE Entry) {
+	if (Entry->LruPrev != NULL) Entry->LruPrev->LruNext = Entry->LruNext;
+	else s_LruHead = Entry->LruNext;
+	if (Entry->LruNext != NULL) Entry->LruNext->LruPrev = Entry->LruPrev;
+	else s_LruTail = Entry->LruPrev;
+	Entry->LruPrev = Entry->LruNext = NULL;
+}
+
+static void CacheLruPushHead(PDISK_CACHE_LINE Entry) {
+	Entry->LruPrev = NULL;
+	Entry->LruNext = s_LruHead;
+	if (s_LruHead != NULL) s_LruHead->LruPrev = Entry;
+	else s_LruTail = Entry;
+	s_LruHead = Entry;
+}
+
+static void CacheLruPushTail(PDISK_CACHE_LINE Entry) {
+	Entry->LruNext = NULL;
+	Entry->LruPrev = s_LruTail;
+	if (s_LruTail != NULL) s_LruTail->LruNext = Entry;
+	else s_LruHead = Entry;
+	s_LruTail = Entry;
+}
+
+static void CacheHashRemove(PDISK_CACHE_LINE Entry) {
+	PDISK_CACHE_LINE* Link = &s_Hash[CacheHash(Entry->Device, Entry->Line)];
+	for (; *Link != NULL; Link = &(*Link)->HashNext) {
+		if (*Link != Entry) continue;
+		*Link = Entry->HashNext;
+		break;
+	}
+	Entry->HashNext = NULL;
+}
+
+static PDISK_CACHE_LINE CacheLookup(PVOID Device, ULONG SectorSize, ULONG Line) {
+	for (PDISK_CACHE_LINE Entry = s_Hash[CacheHash(Device, Line)]; Entry != NULL; Entry = Entry->HashNext) {
+		if (Entry->Device == Device && Entry->Line == Line && Entry->SectorSize == SectorSize) return Entry;
+	}
+	return NULL;
+}
+
+static void CacheDrop(PDISK_CACHE_LINE Entry) {
+	CacheHashRemove(Entry);
+	Entry->Device = NULL;
+	// Unused lines get reused first.
+	CacheLruRemove(Entry);
+	CacheLruPushTail(Entry);
+}
+
+static void CacheInsert(PVOID Device, ULONG SectorSize, ULONG Line, PVOID Data) {
+	// Take the least recently used line.
+	PDISK_CACHE_LINE Entry = s_LruTail;
+	if (Entry->Device != NULL) CacheHashRemove(Entry);
+
+	Entry->Device = Device;
+	Entry->Line = Line;
+	Entry->SectorSize = SectorSize;
+	memcpy(Entry->Data, Data, CACHE_LINE_SIZE);
+
+	ULONG Hash = CacheHash(Device, Line);
+	Entry->HashNext = s_Hash[Hash];
+	s_Hash[Hash] = Entry;
+
+	CacheLruRemove(Entry);
+	CacheLruPushHead(Entry);
+}
+
+static PDISK_CACHE_DEVICE CacheGetDevice(PVOID Device) {
+	for (ULONG i = 0; i < CACHE_DEVICE_COUNT; i++) {
+		if (s_Devices[i].Device == Device) return &s_Devices[i];
+	}
+
+	// Not tracked yet, replace the oldest entry.
+	// Generations are never reused, so a device that drops out of this table gets a new one when it comes back.
+	PDISK_CACHE_DEVICE Entry = &s_Devices[s_NextDevice];
+	s_NextDevice = (s_NextDevice + 1) % CACHE_DEVICE_COUNT;
+	Entry->Device = Device;
+	Entry->NextSector = 0xFFFFFFFF;
+	Entry->ReadAhead = 1;
+	Entry->Generation = ++s_LastGeneration;
+	return Entry;
+}
+
+static ARC_STATUS CacheDeviceRead(PARC_FILE_TABLE FileEntry, ULONG StartSector, ULONG CountSectors, PVOID Buffer) {
+	s_Stats.DeviceReads++;
+	return FileEntry->ReadSectors(FileEntry, StartSector, CountSectors, Buffer);
+}
+
+static ARC_STATUS CacheFill(PARC_FILE_TABLE FileEntry, PDISK_CACHE_DEVICE Dev, ULONG SectorSize, ULONG Shift, ULONG Line, ULONG LineLimit) {
+	PVOID Device = FileEntry->u.DiskContext.Device;
+
+	// Work out how many lines to read: stop at the read-ahead window, the end of the partition, or a line that's already cached.
+	ULONG MaxLines = FileEntry->u.DiskContext.MaxSectorTransfer >> Shift;
+	if (MaxLines > Dev->ReadAhead) MaxLines = Dev->ReadAhead;
+	ULONG Lines = 1;
+	while (Lines < MaxLines && (Line + Lines) < LineLimit && CacheLookup(Device, SectorSize, Line + Lines) == NULL) Lines++;
+
+	ARC_STATUS Status = CacheDeviceRead(FileEntry, Line << Shift, Lines << Shift, s_ReadAheadBuffer);
+	if (ARC_FAIL(Status) && Lines > 1) {
+		// Read-ahead failed, try again with just the line that's needed.
+		Lines = 1;
+		Status = CacheDeviceRead(FileEntry, Line << Shift, 1 << Shift, s_ReadAheadBuffer);
+	}
+	if (ARC_FAIL(Status)) return Status;
+
+	s_Stats.ReadAheadLines += Lines - 1;
+	// Insert backwards, so the line that was needed is the most recently used.
+	for (ULONG i = Lines; i != 0; i--) {
+		CacheInsert(Device, SectorSize, Line + i - 1, &s_ReadAheadBuffer[(i - 1) * CACHE_LINE_SIZE]);
+	}
+	return _ESUCCESS;
+}
+
+ARC_STATUS ArcDiskCacheRead(PARC_FILE_TABLE FileEntry, ULONG SectorSize, ULONG StartSector, ULONG CountSectors, PVOID Buffer) {
+	ULONG Shift = CacheSectorShift(SectorSize);
+	if (s_ReadAheadBuffer == NULL || Shift == 0 || (CountSectors * SectorSize) >= CACHE_BYPASS_SIZE) {
+		// Big transfers would just flush everything else out, so send them to the device.
+		return CacheDeviceRead(FileEntry, StartSector, CountSectors, Buffer);
+	}
+
+	PVOID Device = FileEntry->u.DiskContext.Device;
+	PDISK_CACHE_DEVICE Dev = CacheGetDevice(Device);
+	ULONG SectorsPerLine = 1 << Shift;
+	// Lines must not go past the end of the partition, it may be the end of the device.
+	ULONG SectorLimit = FileEntry->u.DiskContext.SectorStart + FileEntry->u.DiskContext.SectorCount;
+	ULONG LineLimit = SectorLimit >> Shift;
+	bool Sequential = (StartSector == Dev->NextSector);
+	bool Missed = false;
+	PUCHAR Pointer = (PUCHAR)Buffer;
+
+	while (CountSectors != 0) {
+		ULONG Line = StartSector >> Shift;
+		ULONG Offset = StartSector & (SectorsPerLine - 1);
+		ULONG Sectors = SectorsPerLine - Offset;
+		if (Sectors > CountSectors) Sectors = CountSectors;
+
+		PDISK_CACHE_LINE Entry = CacheLookup(Device, SectorSize, Line);
+		if (Entry != NULL) {
+			s_Stats.Hits++;
+			CacheLruRemove(Entry);
+			CacheLruPushHead(Entry);
+		}
+		else {
+			s_Stats.Misses++;
+			if (Line >= LineLimit) {
+				// Line straddles the end of the partition, read directly.
+				ARC_STATUS Status = CacheDeviceRead(FileEntry, StartSector, Sectors, Pointer);
+				if (ARC_FAIL(Status)) return Status;
+				Entry = NULL;
+			}
+			else {
+				// Adapt the read-ahead window: grow it while accesses are sequential, start over when they are not.
+				if (!Missed) {
+					if (Sequential) {
+						Dev->ReadAhead *= 2;
+						if (Dev->ReadAhead > CACHE_READAHEAD_MAX) Dev->ReadAhead = CACHE_READAHEAD_MAX;
+					}
+					else Dev->ReadAhead = 1;
+					Missed = true;
+				}
+
+				ARC_STATUS Status = CacheFill(FileEntry, Dev, SectorSize, Shift, Line, LineLimit);
+				if (ARC_FAIL(Status)) return Status;
+				Entry = s_LruHead;
+			}
+		}
+
+		if (Entry != NULL) memcpy(Pointer, &Entry->Data[Offset * SectorSize], Sectors * SectorSize);
+
+		StartSector += Sectors;
+		CountSectors -= Sectors;
+		Pointer += Sectors * SectorSize;
+	}
+
+	Dev->NextSector = StartSector;
+	return _ESUCCESS;
+}
+
+ARC_STATUS ArcDiskCacheWrite(PARC_FILE_TABLE FileEntry, ULONG SectorSize, ULONG StartSector, ULONG CountSectors, PVOID Buffer) {
+	s_Stats.DeviceWrites++;
+	ARC_STATUS Status = FileEntry->WriteSectors(FileEntry, StartSector, CountSectors, Buffer);
+
+	// Writing the start of a partition (or of the disk, where the partition tables are) can change what's mounted from it.
+	PVOID Device = FileEntry->u.DiskContext.Device;
+	ULONG BootStart = FileEntry->u.DiskContext.SectorStart;
+	ULONG BootEnd = BootStart + (CACHE_BOOT_REGION_SIZE / SectorSize);
+	if (StartSector < BootEnd && (StartSector + CountSectors) > BootStart) CacheGetDevice(Device)->Generation = ++s_LastGeneration;
+
+	ULONG Shift = CacheSectorShift(SectorSize);
+	if (s_ReadAheadBuffer == NULL || Shift == 0) return Status;
+
+	ULONG SectorsPerLine = 1 << Shift;
+	PUCHAR Pointer = (PUCHAR)Buffer;
+	while (CountSectors != 0) {
+		ULONG Line = StartSector >> Shift;
+		ULONG Offset = StartSector & (SectorsPerLine - 1);
+		ULONG Sectors = SectorsPerLine - Offset;
+		if (Sectors > CountSectors) Sectors = CountSectors;
+
+		PDISK_CACHE_LINE Entry = CacheLookup(Device, SectorSize, Line);
+		if (Entry != NULL) {
+			// If the write failed, what's on the device is unknown now.
+			if (ARC_FAIL(Status)) CacheDrop(Entry);
+			else memcpy(&Entry->Data[Offset * SectorSize], Pointer, Sectors * SectorSize);
+		}
+
+		StartSector += Sectors;
+		CountSectors -= Sectors;
+		Pointer += Sectors * SectorSize;
+	}
+
+	return Status;
+}
+
+void ArcDiskCacheInvalidate(PVOID Device) {
+	for (ULONG i = 0; i < CACHE_LINE_COUNT; i++) {
+		if (s_Lines[i].Device == Device) CacheDrop(&s_Lines[i]);
+	}
+
+	for (ULONG i = 0; i < CACHE_DEVICE_COUNT; i++) {
+		if (s_Devices[i].Device != Device) continue;
+		s_Devices[i].NextSector = 0xFFFFFFFF;
+		s_Devices[i].ReadAhead = 1;
+		s_Devices[i].Generation = ++s_LastGeneration;
+	}
+}
+
+ULONG ArcDiskCacheGetGeneration(PVOID Device) {
+	return CacheGetDevice(Device)->Generation;
+}
+
+void ArcDiskCacheGetStats(PARC_DISK_CACHE_STATS Stats) {
+	*Stats = s_Stats;
+}
+
+void ArcDiskCacheInit(void) {
+	if (s_ReadAheadBuffer != NULL) return;
+
+	PUCHAR Data = (PUCHAR)ArcMemAllocTemp(CACHE_LINE_COUNT * CACHE_LINE_SIZE);
+	if (Data == NULL) return;
+	PUCHAR ReadAhead = (PUCHAR)ArcMemAllocTemp(CACHE_READAHEAD_MAX * CACHE_LINE_SIZE);
+	if (ReadAhead == NULL) return;
+
+	memset(s_Lines, 0, sizeof(s_Lines));
+	memset(s_Hash, 0, sizeof(s_Hash));
+	memset(s_Devices, 0, sizeof(s_Devices));
+	s_LruHead = s_LruTail = NULL;
+	for (ULONG i = 0; i < CACHE_LINE_COUNT; i++) {
+		s_Lines[i].Data = &Data[i * CACHE_LINE_SIZE];
+		CacheLruPushTail(&s_Lines[i]);
+	}
+
+	s_ReadAheadBuffer = ReadAhead;
+}
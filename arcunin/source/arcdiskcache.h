@@ -0,0 +1,56 @@
+#pragma once
+
+typedef struct _ARC_DISK_CACHE_STATS {
+	ULONG Hits; // Cache lines found in the cache.
+	ULONG Misses; // Cache lines that had to be read from a device.
+	ULONG DeviceReads; // Read commands issued to devices, including bypassed reads.
+	ULONG DeviceWrites; // Write commands issued to devices.
+	ULONG ReadAheadLines; // Lines read ahead of the line that missed.
+} ARC_DISK_CACHE_STATS, *PARC_DISK_CACHE_STATS;
+
+/// <summary>
+/// Reads sectors from a disk device through the sector cache.
+/// </summary>
+/// <param name="FileEntry">Device file table entry.</param>
+/// <param name="SectorSize">Sector size of the device.</param>
+/// <param name="StartSector">Absolute sector to start reading from.</param>
+/// <param name="CountSectors">Number of sectors to read.</param>
+/// <param name="Buffer">Buffer to read into.</param>
+/// <returns>ARC status code.</returns>
+ARC_STATUS ArcDiskCacheRead(PARC_FILE_TABLE FileEntry, ULONG SectorSize, ULONG StartSector, ULONG CountSectors, PVOID Buffer);
+
+/// <summary>
+/// Writes sectors to a disk device, updating any cached copies of them. (write-through)
+/// </summary>
+/// <param name="FileEntry">Device file table entry.</param>
+/// <param name="SectorSize">Sector size of the device.</param>
+/// <param name="StartSector">Absolute sector to start writing to.</param>
+/// <param name="CountSectors">Number of sectors to write.</param>
+/// <param name="Buffer">Buffer to write from.</param>
+/// <returns>ARC status code.</returns>
+ARC_STATUS ArcDiskCacheWrite(PARC_FILE_TABLE FileEntry, ULONG SectorSize, ULONG StartSector, ULONG CountSectors, PVOID Buffer);
+
+/// <summary>
+/// Drops every cached sector of a device, for when its media may have changed.
+/// </summary>
+/// <param name="Device">Low-level device pointer from the disk context.</param>
+void ArcDiskCacheInvalidate(PVOID Device);
+
+/// <summary>
+/// Gets the media generation of a device. It changes when the device's sectors are invalidated (the driver saw a media change, the media was ejected, or a USB device came or went), or the start of a partition on it is written.
+/// Closing the device does not change it.
+/// </summary>
+/// <param name="Device">Low-level device pointer from the disk context.</param>
+/// <returns>Media generation, never 0.</returns>
+ULONG ArcDiskCacheGetGeneration(PVOID Device);
+
+/// <summary>
+/// Gets the sector cache counters.
+/// </summary>
+/// <param name="Stats">Obtains the counters.</param>
+void ArcDiskCacheGetStats(PARC_DISK_CACHE_STATS Stats);
+
+/// <summary>
+/// Allocates the sector cache. If this fails, all transfers go directly to the device.
+/// </summary>
+void ArcDiskCacheInit(void);
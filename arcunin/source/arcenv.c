@@ -15,83 +15,94 @@
 
 enum {
 	SIZE_OF_ENV = ARC_ENV_VARS_SIZE,
-	SIZE_OF_VAL = ARC_ENV_MAXIMUM_VALUE_SIZE
+	SIZE_OF_VAL = ARC_ENV_MAXIMUM_VALUE_SIZE,
+	// Hash slots per environment area. A variable takes at least 4 bytes ("K=V\0"), so the table is never more than half full.
+	ENV_INDEX_SLOTS = 512,
+	FNV_OFFSET_BASIS = 0x811c9dc5,
+	FNV_PRIME = 0x01000193,
 };
 
+_Static_assert((ENV_INDEX_SLOTS & (ENV_INDEX_SLOTS - 1)) == 0);
+_Static_assert(ENV_INDEX_SLOTS >= (SIZE_OF_ENV / 4) * 2);
+
+// Hash index over the keys of an environment area, open addressed.
+// Each slot holds the offset of a key plus one, zero is an empty slot.
+typedef struct _ENV_INDEX {
+	USHORT Slots[ENV_INDEX_SLOTS];
+} ENV_INDEX, *PENV_INDEX;
+
 static BYTE s_EnvironmentVariableArea[SIZE_OF_ENV] ARC_ALIGNED(32);
 static BYTE s_EnvironmentVariableAreaDevices[SIZE_OF_ENV] ARC_ALIGNED(32);
 static BYTE s_EnvironmentVariableOut[SIZE_OF_VAL];
+static ENV_INDEX s_EnvironmentVariableIndex;
+static ENV_INDEX s_EnvironmentVariableIndexDevices;
 
 static char s_NvDiskPath[SIZE_OF_VAL];
+// Set when a caller has changed the environment and it has not yet been written to disk.
+static bool s_EnvironmentDirty = false;
 
 const BYTE* ArcEnvGetVars(void) {
 	return s_EnvironmentVariableArea;
 }
 
-static ARC_STATUS EnvFindVarDevice(PCHAR Variable, PULONG OffsetKey, PULONG OffsetValue) {
-	ULONG Index = 0;
+static inline ARC_FORCEINLINE char EnvUpperCase(char Character) {
+	if (Character >= 'a' && Character <= 'z') Character &= ~0x20;
+	return Character;
+}
 
-	if (Variable == NULL || *Variable == 0) return _ENOENT;
+// Hashes a key, up to its terminating null or equals character.
+static ULONG EnvHashKey(const BYTE* Key, ULONG Length) {
+	ULONG Hash = FNV_OFFSET_BASIS;
+	for (ULONG i = 0; i < Length && Key[i] != 0 && Key[i] != '='; i++) {
+		Hash = (Hash ^ (BYTE)EnvUpperCase(Key[i])) * FNV_PRIME;
+	}
+	return Hash;
+}
 
-	while (true) {
-		PCHAR String = Variable;
-		ULONG LocalOffsetKey = Index;
-		for (; Index < SIZE_OF_ENV; Index++) {
-			char Character = s_EnvironmentVariableAreaDevices[Index];
-			char ExpectedChar = *String;
-			// Convert to uppercase.
-			if (ExpectedChar >= 'a' && ExpectedChar <= 'z') ExpectedChar &= ~0x20;
-			if (Character != ExpectedChar) break;
+static void EnvIndexBuild(PENV_INDEX EnvIndex, const BYTE* Area) {
+	memset(EnvIndex->Slots, 0, sizeof(EnvIndex->Slots));
+	for (ULONG Index = 0; Index < SIZE_OF_ENV; Index++) {
+		// Skip any gap between vars, as a linear search would.
+		if (Area[Index] == 0) continue;
 
-			String++;
-		}
-
-		if (*String == 0 && s_EnvironmentVariableAreaDevices[Index] == '=') {
-			// Found the match.
-			*OffsetKey = LocalOffsetKey;
-			*OffsetValue = Index + 1;
-			return _ESUCCESS;
-		}
+		ULONG Slot = EnvHashKey(&Area[Index], SIZE_OF_ENV - Index) & (ENV_INDEX_SLOTS - 1);
+		while (EnvIndex->Slots[Slot] != 0) Slot = (Slot + 1) & (ENV_INDEX_SLOTS - 1);
+		EnvIndex->Slots[Slot] = Index + 1;
 
 		// Move to the next var.
-		for (; s_EnvironmentVariableAreaDevices[Index] != 0; Index++) {
-			if (Index >= SIZE_OF_ENV) return _ENOENT;
-		}
-		Index++;
+		while (Index < SIZE_OF_ENV && Area[Index] != 0) Index++;
 	}
 }
 
-static ARC_STATUS EnvFindVar(PCHAR Variable, PULONG OffsetKey, PULONG OffsetValue) {
-	ULONG Index = 0;
-
+static ARC_STATUS EnvIndexFind(PENV_INDEX EnvIndex, const BYTE* Area, PCHAR Variable, PULONG OffsetKey, PULONG OffsetValue) {
 	if (Variable == NULL || *Variable == 0) return _ENOENT;
 
-	while (true) {
+	ULONG Slot = EnvHashKey((const BYTE*)Variable, SIZE_OF_ENV) & (ENV_INDEX_SLOTS - 1);
+	for (; EnvIndex->Slots[Slot] != 0; Slot = (Slot + 1) & (ENV_INDEX_SLOTS - 1)) {
+		ULONG LocalOffsetKey = EnvIndex->Slots[Slot] - 1;
+		ULONG Index = LocalOffsetKey;
 		PCHAR String = Variable;
-		ULONG LocalOffsetKey = Index;
 		for (; Index < SIZE_OF_ENV; Index++) {
-			char Character = s_EnvironmentVariableArea[Index];
-			char ExpectedChar = *String;
-			// Convert to uppercase.
-			if (ExpectedChar >= 'a' && ExpectedChar <= 'z') ExpectedChar &= ~0x20;
-			if (Character != ExpectedChar) break;
-
+			if (Area[Index] != EnvUpperCase(*String)) break;
 			String++;
 		}
 
-		if (*String == 0 && s_EnvironmentVariableArea[Index] == '=') {
+		if (*String == 0 && Index < SIZE_OF_ENV && Area[Index] == '=') {
 			// Found the match.
 			*OffsetKey = LocalOffsetKey;
 			*OffsetValue = Index + 1;
 			return _ESUCCESS;
 		}
-
-		// Move to the next var.
-		for (; s_EnvironmentVariableArea[Index] != 0; Index++) {
-			if (Index >= SIZE_OF_ENV) return _ENOENT;
-		}
-		Index++;
 	}
+	return _ENOENT;
+}
+
+static ARC_STATUS EnvFindVarDevice(PCHAR Variable, PULONG OffsetKey, PULONG OffsetValue) {
+	return EnvIndexFind(&s_EnvironmentVariableIndexDevices, s_EnvironmentVariableAreaDevices, Variable, OffsetKey, OffsetValue);
+}
+
+static ARC_STATUS EnvFindVar(PCHAR Variable, PULONG OffsetKey, PULONG OffsetValue) {
+	return EnvIndexFind(&s_EnvironmentVariableIndex, s_EnvironmentVariableArea, Variable, OffsetKey, OffsetValue);
 }
 
 /// <summary>
@@ -196,14 +207,18 @@ ARC_STATUS ArcEnvSetDevice(PCHAR Key, PCHAR Value) {
 		memset(&s_EnvironmentVariableAreaDevices[OffsetKey + LengthToCopy], 0, SIZE_OF_ENV - OffsetKey - LengthToCopy);
 
 		// If Value is empty string return success, variable has been deleted which is what caller wanted.
-		if (*Value == 0) return _ESUCCESS;
+		if (*Value == 0) {
+			EnvIndexBuild(&s_EnvironmentVariableIndexDevices, s_EnvironmentVariableAreaDevices);
+			return _ESUCCESS;
+		}
 
-		// Correct the index to take the additional space into account
-		Index = EnvGetEmptySpaceDevice(Index);
+		// Correct the index to take the additional space into account.
+		// (Search from the end of the area: Index can be past the end of it when it was full.)
+		Index = EnvGetEmptySpaceDevice(SIZE_OF_ENV - 1);
 	}
 	else {
-		// Is there enough space to hold new variable?
-		ULONG NewVarLen = KeyLen + ValueLen + 1;
+		// Is there enough space to hold new variable? (key, equals character, value, null terminator)
+		ULONG NewVarLen = KeyLen + ValueLen + 2;
 		if (Length < NewVarLen) return _ENOSPC;
 	}
 
@@ -224,16 +239,12 @@ ARC_STATUS ArcEnvSetDevice(PCHAR Key, PCHAR Value) {
 	}
 	// Ensure null terminated.
 	s_EnvironmentVariableAreaDevices[Index] = 0;
+	EnvIndexBuild(&s_EnvironmentVariableIndexDevices, s_EnvironmentVariableAreaDevices);
 	return _ESUCCESS;
 }
 
-/// <summary>
-/// Sets an environment variable in memory.
-/// </summary>
-/// <param name="Key">Environment variable key.</param>
-/// <param name="Value">Environment variable value.</param>
-/// <returns>ARC status.</returns>
-ARC_STATUS ArcEnvSetVarInMem(PCHAR Key, PCHAR Value) {
+static ARC_STATUS EnvSetVar(PCHAR Key, PCHAR Value, bool* Changed) {
+	*Changed = false;
 	// Check if variable already exists.
 	ULONG OffsetKey, OffsetVal;
 	ARC_STATUS Status = EnvFindVar(Key, &OffsetKey, &OffsetVal);
@@ -268,16 +279,21 @@ ARC_STATUS ArcEnvSetVarInMem(PCHAR Key, PCHAR Value) {
 		ULONG LengthToCopy = SIZE_OF_ENV - OffsetPastExisting;
 		memcpy(&s_EnvironmentVariableArea[OffsetKey], &s_EnvironmentVariableArea[OffsetPastExisting], LengthToCopy);
 		memset(&s_EnvironmentVariableArea[OffsetKey + LengthToCopy], 0, SIZE_OF_ENV - OffsetKey - LengthToCopy);
+		*Changed = true;
 
 		// If Value is empty string return success, variable has been deleted which is what caller wanted.
-		if (*Value == 0) return _ESUCCESS;
+		if (*Value == 0) {
+			EnvIndexBuild(&s_EnvironmentVariableIndex, s_EnvironmentVariableArea);
+			return _ESUCCESS;
+		}
 
-		// Correct the index to take the additional space into account
-		Index = EnvGetEmptySpace(Index);
+		// Correct the index to take the additional space into account.
+		// (Search from the end of the area: Index can be past the end of it when it was full.)
+		Index = EnvGetEmptySpace(SIZE_OF_ENV - 1);
 	}
 	else {
-		// Is there enough space to hold new variable?
-		ULONG NewVarLen = KeyLen + ValueLen + 1;
+		// Is there enough space to hold new variable? (key, equals character, value, null terminator)
+		ULONG NewVarLen = KeyLen + ValueLen + 2;
 		if (Length < NewVarLen) return _ENOSPC;
 	}
 
@@ -298,9 +314,22 @@ ARC_STATUS ArcEnvSetVarInMem(PCHAR Key, PCHAR Value) {
 	}
 	// Ensure null terminated.
 	s_EnvironmentVariableArea[Index] = 0;
+	*Changed = true;
+	EnvIndexBuild(&s_EnvironmentVariableIndex, s_EnvironmentVariableArea);
 	return _ESUCCESS;
 }
 
+/// <summary>
+/// Sets an environment variable in memory.
+/// </summary>
+/// <param name="Key">Environment variable key.</param>
+/// <param name="Value">Environment variable value.</param>
+/// <returns>ARC status.</returns>
+ARC_STATUS ArcEnvSetVarInMem(PCHAR Key, PCHAR Value) {
+	bool Changed;
+	return EnvSetVar(Key, Value, &Changed);
+}
+
 static ARC_STATUS ArcEnvSaveToDisk(void) {
 	if (s_NvDiskPath[0] == 0) return _ENODEV;
 
@@ -329,17 +358,37 @@ static ARC_STATUS ArcEnvSaveToDisk(void) {
 	return Status;
 }
 
+/// <summary>
+/// Writes the environment to ARC non-volatile storage, if it has been changed since it was last written.
+/// </summary>
+/// <returns>ARC status.</returns>
+ARC_STATUS ArcEnvCommit(void) {
+	if (!s_EnvironmentDirty) return _ESUCCESS;
+
+	ARC_STATUS Status = ArcEnvSaveToDisk();
+	// On failure, leave it dirty so the next commit tries again.
+	if (ARC_SUCCESS(Status)) s_EnvironmentDirty = false;
+	return Status;
+}
+
 static ARC_STATUS ArcSetEnvVar(PCHAR Key, PCHAR Value) {
-	ARC_STATUS Status = ArcEnvSetVarInMem(Key, Value);
+	bool Changed;
+	ARC_STATUS Status = EnvSetVar(Key, Value, &Changed);
 	if (ARC_FAIL(Status)) return Status;
 
-	return ArcEnvSaveToDisk();
+	if (s_NvDiskPath[0] == 0) return _ENODEV;
+
+	// Callers tend to set several variables in a row, so the disk is written once, by the next commit.
+	if (Changed) s_EnvironmentDirty = true;
+	return _ESUCCESS;
 }
 
 void ArcEnvSetDiskAfterFormat(PCHAR DevicePath) {
 	strncpy(s_NvDiskPath, DevicePath, sizeof(s_NvDiskPath));
 	// Wipe the in-RAM ARC environment
 	memset(s_EnvironmentVariableArea, 0, sizeof(s_EnvironmentVariableArea));
+	EnvIndexBuild(&s_EnvironmentVariableIndex, s_EnvironmentVariableArea);
+	s_EnvironmentDirty = false;
 }
 
 void ArcEnvLoad(void) {
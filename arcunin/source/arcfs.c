@@ -12,6 +12,8 @@
 #include "arcenv.h"
 #include "arcio.h"
 #include "arcfs.h"
+#include "arcdiskcache.h"
+#include "arctrace.h"
 #include "coff.h"
 #include "lib9660.h"
 #include "diskio.h"
@@ -1900,11 +1902,44 @@ enum {
 	FAT_SECTOR_SIZE = 512
 };
 
+enum {
+	ISO_DIR_INDEX_COUNT = 16, // Number of directories indexed per mounted ISO9660 volume.
+	ISO_DIR_INDEX_MIN_BUCKETS = 16,
+	ISO_DIR_INDEX_END = 0xFFFFFFFF
+};
+
+enum {
+	FS_MOUNT_CACHE_COUNT = 4, // Number of volumes kept mounted after their device is closed.
+};
+
+typedef struct _ISO_DIR_INDEX_ENTRY {
+	ULONG Hash;
+	ULONG Next; // Next entry in the same hash bucket.
+	ULONG FirstSector;
+	ULONG Length;
+	ULONG NameOffset;
+	UCHAR NameLength;
+	bool Directory;
+} ISO_DIR_INDEX_ENTRY, *PISO_DIR_INDEX_ENTRY;
+
+// Name index of one directory, allocated as a single block: header, buckets, entries, names.
+typedef struct _ISO_DIR_INDEX {
+	ULONG FirstSector; // Directory that this indexes.
+	ULONG LastUse;
+	ULONG Count;
+	ULONG BucketMask;
+	PULONG Buckets;
+	PISO_DIR_INDEX_ENTRY Entries;
+	PCHAR Names;
+} ISO_DIR_INDEX, *PISO_DIR_INDEX;
+
 typedef struct _FS_METADATA {
 	union {
 		struct {
 			l9660_fs Iso9660;
 			ULONG DeviceId;
+			PISO_DIR_INDEX DirIndex[ISO_DIR_INDEX_COUNT];
+			ULONG DirIndexClock;
 		};
 		struct {
 			FATFS Fat;
@@ -1916,10 +1951,21 @@ typedef struct _FS_METADATA {
 	};
 	FS_TYPE Type;
 	ULONG SectorSize;
+	ULONG Generation; // Media generation the volume was mounted at.
 } FS_METADATA, *PFS_METADATA;
 _Static_assert(FILE_TABLE_SIZE < 100);
 
+// A volume whose device was closed, kept mounted in case the same device path is opened again.
+typedef struct _FS_MOUNT_CACHE_ENTRY {
+	CHAR DeviceName[ARC_DEVICE_PATH_SIZE]; // Empty if unused.
+	PVOID Device; // Low-level device the volume is on.
+	ULONG LastUse;
+	FS_METADATA Metadata;
+} FS_MOUNT_CACHE_ENTRY, *PFS_MOUNT_CACHE_ENTRY;
+
 static FS_METADATA s_Metadata[FILE_TABLE_SIZE] = { 0 };
+static FS_MOUNT_CACHE_ENTRY s_MountCache[FS_MOUNT_CACHE_COUNT] = { 0 };
+static ULONG s_MountCacheClock = 0;
 
 //static ULONG s_CurrentDeviceId = FILE_IS_RAW_DEVICE;
 
@@ -1963,6 +2009,34 @@ DRESULT disk_readp(ULONG DeviceId, BYTE* buff, DWORD sector, UINT offset, UINT c
 	return RES_OK;
 }
 
+DRESULT disk_readm(ULONG DeviceId, BYTE* buff, DWORD sector, UINT count) {
+	// Reads whole sectors straight into the caller's buffer, bypassing the single sector buffer.
+	if (DeviceId >= FILE_TABLE_SIZE) return RES_PARERR;
+	PFS_METADATA Meta = &s_Metadata[DeviceId];
+	if (Meta->Type != FS_FAT) return RES_PARERR;
+	// If a write transaction in progress, read will fail
+	if (Meta->InWrite) return RES_ERROR;
+
+	PVENDOR_VECTOR_TABLE Api = ARC_VENDOR_VECTORS();
+	// Seek to requested sector.
+	int64_t Position64 = sector;
+	Position64 *= FAT_SECTOR_SIZE;
+	LARGE_INTEGER Position = Int64ToLargeInteger(Position64);
+
+	ARC_STATUS Status = Api->SeekRoutine(DeviceId, &Position, SeekAbsolute);
+	if (ARC_FAIL(Status)) return RES_ERROR;
+
+	// Read all sectors in one request.
+	ULONG Length = count * FAT_SECTOR_SIZE;
+
+	U32LE Count;
+	Status = Api->ReadRoutine(DeviceId, buff, Length, &Count);
+	if (ARC_FAIL(Status)) return RES_ERROR;
+
+	if (Count.v != Length) return RES_ERROR;
+	return RES_OK;
+}
+
 DRESULT disk_writep(ULONG DeviceId, const BYTE* buff, DWORD sc) {
 	if (DeviceId >= FILE_TABLE_SIZE) return RES_PARERR;
 	PFS_METADATA Meta = &s_Metadata[DeviceId];
@@ -2059,7 +2133,7 @@ static ARC_STATUS FatErrorToArc(FRESULT fr) {
 	}
 }
 
-static bool FsMediumIsoReadSectors(l9660_fs* fs, void* buffer, ULONG sector) {
+static bool FsMediumIsoReadSectorsMulti(l9660_fs* fs, void* buffer, ULONG sector, ULONG count) {
 	PFS_METADATA Metadata = (PFS_METADATA)fs;
 	if (Metadata->Type != FS_ISO9660) return false;
 	
@@ -2075,19 +2149,293 @@ static bool FsMediumIsoReadSectors(l9660_fs* fs, void* buffer, ULONG sector) {
 		return false;
 	}
 
-	// Read to buffer.
-	ULONG Length = ISO9660_SECTOR_SIZE;
+	// Read to buffer, the device layer splits this up by its maximum transfer length.
+	ULONG Length = ISO9660_SECTOR_SIZE * count;
 
 	U32LE Count;
 	Status = Api->ReadRoutine(Metadata->DeviceId, buffer, Length, &Count);
 	if (ARC_FAIL(Status)) {
-		printf("ISO: could not read sector %x\r\n", sector);
+		printf("ISO: could not read %d sectors at %x\r\n", count, sector);
 		return false;
 	}
 
 	return Length == Count.v;
 }
 
+static bool FsMediumIsoReadSectors(l9660_fs* fs, void* buffer, ULONG sector) {
+	return FsMediumIsoReadSectorsMulti(fs, buffer, sector, 1);
+}
+
+static char IsoNameFold(char Chr) {
+	if (Chr >= 'A' && Chr <= 'Z') return Chr | 0x20;
+	return Chr;
+}
+
+static ULONG IsoNameHash(const char* Name, ULONG Length) {
+	// FNV-1a over the case-folded name.
+	ULONG Hash = 0x811C9DC5;
+	for (ULONG i = 0; i < Length; i++) {
+		Hash ^= (UCHAR)IsoNameFold(Name[i]);
+		Hash *= 0x01000193;
+	}
+	return Hash;
+}
+
+static ULONG IsoDirentNameLength(l9660_dirent* Dirent) {
+	// Compare names without the revision tag, and without the trailing dot of a name without extension.
+	ULONG Length = 0;
+	while (Length < Dirent->name_len && Dirent->name[Length] != ';') Length++;
+	if (Length > 1 && Dirent->name[Length - 1] == '.') Length--;
+	return Length;
+}
+
+static PISO_DIR_INDEX_ENTRY IsoDirIndexLookup(PISO_DIR_INDEX Index, const char* Name, ULONG Length, ULONG Hash) {
+	for (ULONG i = Index->Buckets[Hash & Index->BucketMask]; i != ISO_DIR_INDEX_END; i = Index->Entries[i].Next) {
+		PISO_DIR_INDEX_ENTRY Entry = &Index->Entries[i];
+		if (Entry->Hash != Hash || Entry->NameLength != Length) continue;
+		PCHAR EntryName = &Index->Names[Entry->NameOffset];
+		ULONG c = 0;
+		for (; c < Length; c++) {
+			if (IsoNameFold(EntryName[c]) != IsoNameFold(Name[c])) break;
+		}
+		if (c == Length) return Entry;
+	}
+	return NULL;
+}
+
+static ARC_STATUS IsoDirIndexBuild(l9660_dir* Dir, PISO_DIR_INDEX* Index) {
+	l9660_dirent* Dirent;
+
+	// Size the index.
+	ULONG Count = 0;
+	ULONG NamesLength = 0;
+	ARC_STATUS Status = IsoErrorToArc(l9660_seekdir(Dir, 0));
+	while (ARC_SUCCESS(Status)) {
+		Status = IsoErrorToArc(l9660_readdir(Dir, &Dirent));
+		if (ARC_FAIL(Status) || Dirent == NULL) break;
+		Count++;
+		NamesLength += IsoDirentNameLength(Dirent);
+	}
+	if (ARC_FAIL(Status)) return Status;
+
+	ULONG BucketCount = ISO_DIR_INDEX_MIN_BUCKETS;
+	while (BucketCount < Count) BucketCount <<= 1;
+
+	PISO_DIR_INDEX NewIndex = (PISO_DIR_INDEX)malloc(
+		sizeof(ISO_DIR_INDEX) +
+		(BucketCount * sizeof(ULONG)) +
+		(Count * sizeof(ISO_DIR_INDEX_ENTRY)) +
+		NamesLength
+	);
+	if (NewIndex == NULL) return _ENOMEM;
+	NewIndex->FirstSector = Dir->file.first_sector;
+	NewIndex->LastUse = 0;
+	NewIndex->Count = 0;
+	NewIndex->BucketMask = BucketCount - 1;
+	NewIndex->Buckets = (PULONG)&NewIndex[1];
+	NewIndex->Entries = (PISO_DIR_INDEX_ENTRY)&NewIndex->Buckets[BucketCount];
+	NewIndex->Names = (PCHAR)&NewIndex->Entries[Count];
+	memset(NewIndex->Buckets, 0xFF, BucketCount * sizeof(ULONG));
+
+	// Fill it in. The directory sectors were just read, so this pass is served by the disk cache.
+	ULONG NameOffset = 0;
+	Status = IsoErrorToArc(l9660_seekdir(Dir, 0));
+	while (ARC_SUCCESS(Status) && NewIndex->Count < Count) {
+		Status = IsoErrorToArc(l9660_readdir(Dir, &Dirent));
+		if (ARC_FAIL(Status) || Dirent == NULL) break;
+
+		ULONG NameLength = IsoDirentNameLength(Dirent);
+		if (NameOffset + NameLength > NamesLength) break;
+		ULONG Hash = IsoNameHash(Dirent->name, NameLength);
+		// Like a directory scan, the first entry of a given name wins.
+		if (IsoDirIndexLookup(NewIndex, Dirent->name, NameLength, Hash) != NULL) continue;
+
+		l9660_file Extent;
+		l9660_openent(&Extent, Dir->file.fs, Dirent);
+
+		ULONG i = NewIndex->Count++;
+		PISO_DIR_INDEX_ENTRY Entry = &NewIndex->Entries[i];
+		Entry->Hash = Hash;
+		Entry->FirstSector = Extent.first_sector;
+		Entry->Length = Extent.length;
+		Entry->NameOffset = NameOffset;
+		Entry->NameLength = NameLength;
+		Entry->Directory = l9660_dirent_isdir(Dirent);
+		memcpy(&NewIndex->Names[NameOffset], Dirent->name, NameLength);
+		NameOffset += NameLength;
+
+		ULONG Bucket = Hash & NewIndex->BucketMask;
+		Entry->Next = NewIndex->Buckets[Bucket];
+		NewIndex->Buckets[Bucket] = i;
+	}
+
+	if (ARC_FAIL(Status)) {
+		free(NewIndex);
+		return Status;
+	}
+
+	*Index = NewIndex;
+	return _ESUCCESS;
+}
+
+static ARC_STATUS IsoDirIndexGet(PFS_METADATA Meta, l9660_dir* Dir, PISO_DIR_INDEX* Index) {
+	Meta->DirIndexClock++;
+
+	ULONG Victim = 0;
+	for (ULONG i = 0; i < ISO_DIR_INDEX_COUNT; i++) {
+		PISO_DIR_INDEX This = Meta->DirIndex[i];
+		if (This == NULL) {
+			if (Meta->DirIndex[Victim] != NULL) Victim = i;
+			continue;
+		}
+		if (This->FirstSector == Dir->file.first_sector) {
+			This->LastUse = Meta->DirIndexClock;
+			*Index = This;
+			return _ESUCCESS;
+		}
+		if (Meta->DirIndex[Victim] != NULL && This->LastUse < Meta->DirIndex[Victim]->LastUse) Victim = i;
+	}
+
+	// Not indexed yet, replace the least recently used index.
+	PISO_DIR_INDEX NewIndex;
+	ARC_STATUS Status = IsoDirIndexBuild(Dir, &NewIndex);
+	if (ARC_FAIL(Status)) return Status;
+
+	if (Meta->DirIndex[Victim] != NULL) free(Meta->DirIndex[Victim]);
+	NewIndex->LastUse = Meta->DirIndexClock;
+	Meta->DirIndex[Victim] = NewIndex;
+	*Index = NewIndex;
+	return _ESUCCESS;
+}
+
+static void IsoDirIndexFlush(PFS_METADATA Meta) {
+	for (ULONG i = 0; i < ISO_DIR_INDEX_COUNT; i++) {
+		if (Meta->DirIndex[i] == NULL) continue;
+		free(Meta->DirIndex[i]);
+		Meta->DirIndex[i] = NULL;
+	}
+}
+
+static ARC_STATUS IsoOpen(PFS_METADATA Meta, const char* Path, l9660_file* File) {
+	// Open root directory
+	l9660_dir* Dir = (l9660_dir*)File;
+	ARC_STATUS Status = IsoErrorToArc(l9660_fs_open_root(Dir, &Meta->Iso9660));
+	if (ARC_FAIL(Status)) return Status;
+
+	// The directory index can not represent empty path components, leave those to lib9660.
+	const char* FullPath = Path;
+	bool UseIndex = *Path != 0;
+	for (const char* Chr = Path; UseIndex && *Chr != 0; Chr++) {
+		if (Chr[0] == '\\' && (Chr[1] == '\\' || Chr[1] == 0)) UseIndex = false;
+	}
+
+	// Failures map to the same status l9660_openat would have given.
+	bool Directory = true;
+	while (UseIndex && *Path != 0) {
+		const char* Segment = Path;
+		while (*Path != 0 && *Path != '\\') Path++;
+		ULONG SegmentLength = Path - Segment;
+		if (*Path != 0) Path++;
+
+		if (!Directory) return IsoErrorToArc(L9660_ENOTDIR);
+
+		// ISO9660 stores '.' as '\0' and '..' as '\1'
+		if (SegmentLength == 1 && Segment[0] == '.') Segment = "\0";
+		else if (SegmentLength == 2 && Segment[0] == '.' && Segment[1] == '.') {
+			Segment = "\1";
+			SegmentLength = 1;
+		}
+		else if (SegmentLength > 1 && Segment[SegmentLength - 1] == '.') SegmentLength--;
+
+		PISO_DIR_INDEX Index;
+		Status = IsoDirIndexGet(Meta, Dir, &Index);
+		if (Status == _ENOMEM) {
+			UseIndex = false;
+			break;
+		}
+		if (ARC_FAIL(Status)) return Status;
+
+		PISO_DIR_INDEX_ENTRY Entry = IsoDirIndexLookup(Index, Segment, SegmentLength, IsoNameHash(Segment, SegmentLength));
+		if (Entry == NULL) return IsoErrorToArc(L9660_ENOENT);
+
+		File->fs = &Meta->Iso9660;
+		File->first_sector = Entry->FirstSector;
+		File->length = Entry->Length;
+		File->position = 0;
+		Directory = Entry->Directory;
+	}
+
+	if (!UseIndex) {
+		// Could not use the index, so scan the directories.
+		l9660_dir root;
+		Status = IsoErrorToArc(l9660_fs_open_root(&root, &Meta->Iso9660));
+		if (ARC_FAIL(Status)) return Status;
+		return IsoErrorToArc(l9660_openat(File, &root, FullPath));
+	}
+
+	if (Directory) return IsoErrorToArc(L9660_ENOTFILE);
+	return _ESUCCESS;
+}
+
+static void FsMountCacheDrop(PFS_MOUNT_CACHE_ENTRY Entry) {
+	if (Entry->Metadata.Type == FS_ISO9660) IsoDirIndexFlush(&Entry->Metadata);
+	memset(Entry, 0, sizeof(*Entry));
+}
+
+static bool FsMountCacheTake(ULONG DeviceId, PARC_FILE_TABLE Device, ULONG SectorSize, ULONG Generation) {
+	PCHAR DeviceName = ArcIoGetDeviceName(DeviceId);
+	if (DeviceName == NULL) return false;
+
+	for (ULONG i = 0; i < FS_MOUNT_CACHE_COUNT; i++) {
+		PFS_MOUNT_CACHE_ENTRY Entry = &s_MountCache[i];
+		if (Entry->DeviceName[0] == 0 || strcmp(Entry->DeviceName, DeviceName) != 0) continue;
+
+		// Same path, but if the media has changed since it was mounted the volume is gone.
+		if (Entry->Device != Device->u.DiskContext.Device || Entry->Metadata.Generation != Generation || Entry->Metadata.SectorSize != SectorSize) {
+			FsMountCacheDrop(Entry);
+			return false;
+		}
+
+		PFS_METADATA FsMeta = &s_Metadata[DeviceId];
+		*FsMeta = Entry->Metadata;
+		memset(Entry, 0, sizeof(*Entry));
+		// The device may have a different ID this time.
+		if (FsMeta->Type == FS_ISO9660) FsMeta->DeviceId = DeviceId;
+		else {
+			FsMeta->Fat.DeviceId = DeviceId;
+			FsMeta->SectorPresent = 0xFFFFFFFF;
+		}
+		return true;
+	}
+	return false;
+}
+
+static bool FsMountCachePut(ULONG DeviceId) {
+	PCHAR DeviceName = ArcIoGetDeviceName(DeviceId);
+	PARC_FILE_TABLE Device = ArcIoGetFile(DeviceId);
+	if (DeviceName == NULL || Device == NULL) return false;
+	ULONG NameLength = strlen(DeviceName) + 1;
+	if (NameLength > ARC_DEVICE_PATH_SIZE) return false;
+
+	// Replace an older mount of the same path, an unused entry, or the least recently used one.
+	PFS_MOUNT_CACHE_ENTRY Victim = NULL;
+	for (ULONG i = 0; i < FS_MOUNT_CACHE_COUNT; i++) {
+		PFS_MOUNT_CACHE_ENTRY Entry = &s_MountCache[i];
+		if (Entry->DeviceName[0] != 0 && strcmp(Entry->DeviceName, DeviceName) == 0) {
+			Victim = Entry;
+			break;
+		}
+		if (Victim == NULL || (Victim->DeviceName[0] != 0 && (Entry->DeviceName[0] == 0 || Entry->LastUse < Victim->LastUse))) Victim = Entry;
+	}
+	if (Victim->DeviceName[0] != 0) FsMountCacheDrop(Victim);
+
+	memcpy(Victim->DeviceName, DeviceName, NameLength);
+	Victim->Device = Device->u.DiskContext.Device;
+	Victim->LastUse = ++s_MountCacheClock;
+	Victim->Metadata = s_Metadata[DeviceId];
+	return true;
+}
+
 ARC_STATUS FsInitialiseForDevice(ULONG DeviceId) {
 	if (DeviceId >= FILE_TABLE_SIZE) return _EBADF;
 	PFS_METADATA FsMeta = &s_Metadata[DeviceId];
@@ -2102,7 +2450,13 @@ ARC_STATUS FsInitialiseForDevice(ULONG DeviceId) {
 
 	if (FsMeta->SectorSize == SectorSize) return _ESUCCESS;
 
+	// If this device was open before, its volume may still be mounted.
+	ULONG Generation = ArcDiskCacheGetGeneration(Device->u.DiskContext.Device);
+	if (FsMountCacheTake(DeviceId, Device, SectorSize, Generation)) return _ESUCCESS;
+
+	ArcTraceBegin("FsMount", DeviceId);
 	FsMeta->SectorSize = SectorSize;
+	FsMeta->Generation = Generation;
 
 	bool Mounted = false;
 	if (SectorSize <= ISO9660_SECTOR_SIZE) {
@@ -2110,6 +2464,7 @@ ARC_STATUS FsInitialiseForDevice(ULONG DeviceId) {
 		FsMeta->DeviceId = DeviceId;
 		l9660_status IsoStatus = l9660_openfs(&FsMeta->Iso9660, FsMediumIsoReadSectors);
 		Mounted = IsoStatus == L9660_OK;
+		if (Mounted) FsMeta->Iso9660.read_sectors = FsMediumIsoReadSectorsMulti;
 	}
 	if (!Mounted && SectorSize <= FAT_SECTOR_SIZE) {
 		// ISO9660 mount failed, attempt FAT
@@ -2124,9 +2479,11 @@ ARC_STATUS FsInitialiseForDevice(ULONG DeviceId) {
 
 	if (!Mounted) {
 		memset(FsMeta, 0, sizeof(*FsMeta));
+		ArcTraceEnd("FsMount", _EBADF);
 		return _EBADF;
 	}
 
+	ArcTraceEnd("FsMount", _ESUCCESS);
 	return _ESUCCESS;
 }
 
@@ -2135,10 +2492,21 @@ ARC_STATUS FsUnmountForDevice(ULONG DeviceId) {
 	PFS_METADATA FsMeta = &s_Metadata[DeviceId];
 	if (FsMeta->SectorSize == 0) return _EBADF;
 
+	// Keep the volume, along with its directory indexes, for when this device is opened again.
+	if (!FsMountCachePut(DeviceId) && FsMeta->Type == FS_ISO9660) IsoDirIndexFlush(FsMeta);
 	memset(FsMeta, 0, sizeof(*FsMeta));
 	return _ESUCCESS;
 }
 
+ARC_STATUS FsInvalidateForDevice(ULONG DeviceId) {
+	if (DeviceId >= FILE_TABLE_SIZE) return _EBADF;
+	PFS_METADATA FsMeta = &s_Metadata[DeviceId];
+	if (FsMeta->SectorSize == 0) return _EBADF;
+
+	if (FsMeta->Type == FS_ISO9660) IsoDirIndexFlush(FsMeta);
+	return _ESUCCESS;
+}
+
 
 
 // Filesystem device functions.
@@ -2170,26 +2538,16 @@ static ARC_STATUS FsOpen(PCHAR OpenPath, OPEN_MODE OpenMode, PULONG FileId) {
 
 	//PCHAR EndOfPath = strrchr(OpenPath, '\\');
 	File->u.FileContext.FileSize.QuadPart = 0;
+	File->Position = 0;
 
 	switch (Meta->Type) {
 	case FS_ISO9660:
-		// ISO9660 open file.
-	{
-		// Open root directory
-		l9660_dir root;
-		Status = IsoErrorToArc(l9660_fs_open_root(&root, &Meta->Iso9660));
-		//printf("l9660_fs_open_root %d\r\n", Status);
-		if (ARC_FAIL(Status)) return Status;
-
-		// Open file.
-		Status = IsoErrorToArc(l9660_openat(&File->u.FileContext.Iso9660, &root, &OpenPath[1]));
-		//printf("l9660_fs_openat %d\r\n", Status);
+		// ISO9660 open file, through the directory index.
+		Status = IsoOpen(Meta, &OpenPath[1], &File->u.FileContext.Iso9660);
 		if (ARC_FAIL(Status)) return Status;
 
 		File->u.FileContext.FileSize.LowPart = File->u.FileContext.Iso9660.length;
-
 		break;
-	}
 
 	case FS_FAT:
 		// FATFS open file.
@@ -2254,14 +2612,21 @@ static ARC_STATUS FsRead(ULONG FileId, PVOID Buffer, ULONG Length, PULONG Count)
 
 	PFS_METADATA Meta = &s_Metadata[File->DeviceId];
 
+	ARC_STATUS Status;
 	switch (Meta->Type) {
 	case FS_ISO9660:
-		return IsoErrorToArc(l9660_read(&File->u.FileContext.Iso9660, Buffer, Length, Count));
+		Status = IsoErrorToArc(l9660_read(&File->u.FileContext.Iso9660, Buffer, Length, Count));
+		break;
 	case FS_FAT:
-		return FatErrorToArc(pf_read(&File->u.FileContext.Fat, Buffer, Length, Count));
+		Status = FatErrorToArc(pf_read(&File->u.FileContext.Fat, Buffer, Length, Count));
+		break;
 	default:
 		return _EBADF;
 	}
+
+	// Keep the position in step with the filesystem, relative seeks and asynchronous reads start from it.
+	if (ARC_SUCCESS(Status)) File->Position += *Count;
+	return Status;
 }
 
 static ARC_STATUS FsWrite(ULONG FileId, PVOID Buffer, ULONG Length, PULONG Count) {
@@ -2271,14 +2636,20 @@ static ARC_STATUS FsWrite(ULONG FileId, PVOID Buffer, ULONG Length, PULONG Count
 	if (File == NULL) return _EBADF;
 
 	PFS_METADATA Meta = &s_Metadata[File->DeviceId];
+	ARC_STATUS Status;
 	switch (Meta->Type) {
 	case FS_ISO9660:
 		return _EBADF; // no writing to iso fs
 	case FS_FAT:
-		return FatErrorToArc(pf_write(&File->u.FileContext.Fat, Buffer, Length, Count));
+		Status = FatErrorToArc(pf_write(&File->u.FileContext.Fat, Buffer, Length, Count));
+		break;
 	default:
 		return _EBADF;
 	}
+
+	// As for reads, the position follows the filesystem.
+	if (ARC_SUCCESS(Status)) File->Position += *Count;
+	return Status;
 }
 
 static ARC_STATUS FsSeek(ULONG FileId, PLARGE_INTEGER Offset, SEEK_MODE SeekMode) {
@@ -2344,6 +2715,42 @@ static ARC_STATUS FsGetDirectoryEntry(ULONG FileId, PDIRECTORY_ENTRY DirEntry, U
 	return _EBADF;
 }
 
+static ARC_STATUS FsGetSectorRun(ULONG FileId, ULONG Length, int64_t* DeviceOffset, PULONG RunLength) {
+	// Get the file table
+	PARC_FILE_TABLE File = ArcIoGetFile(FileId);
+	if (File == NULL) return _EBADF;
+
+	PFS_METADATA Meta = &s_Metadata[File->DeviceId];
+	*RunLength = 0;
+
+	switch (Meta->Type) {
+	case FS_ISO9660:
+	{
+		// ISO9660 files are always contiguous.
+		l9660_file* Iso = &File->u.FileContext.Iso9660;
+		ULONG Remaining = Iso->length - Iso->position;
+		if (Length > Remaining) Length = Remaining;
+		*DeviceOffset = ((int64_t)Iso->first_sector * ISO9660_SECTOR_SIZE) + Iso->position;
+		*RunLength = Length;
+		return _ESUCCESS;
+	}
+	case FS_FAT:
+	{
+		// Don't go around a write transaction in progress.
+		if (Meta->InWrite) return _EBUSY;
+		DWORD Sector;
+		UINT Run;
+		ARC_STATUS Status = FatErrorToArc(pf_run(&File->u.FileContext.Fat, Length, &Sector, &Run));
+		if (ARC_FAIL(Status)) return Status;
+		*DeviceOffset = (int64_t)Sector * FAT_SECTOR_SIZE;
+		*RunLength = Run;
+		return _ESUCCESS;
+	}
+	default:
+		return _EBADF;
+	}
+}
+
 // Filesystem device vectors.
 static const DEVICE_VECTORS FsVectors = {
 	.Open = FsOpen,
@@ -2355,7 +2762,8 @@ static const DEVICE_VECTORS FsVectors = {
 	.GetReadStatus = NULL,
 	.GetFileInformation = FsGetFileInformation,
 	.SetFileInformation = FsSetFileInformation,
-	.GetDirectoryEntry = FsGetDirectoryEntry
+	.GetDirectoryEntry = FsGetDirectoryEntry,
+	.GetSectorRun = FsGetSectorRun
 };
 
 
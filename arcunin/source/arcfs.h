@@ -117,4 +117,11 @@ ARC_STATUS FsInitialiseForDevice(ULONG DeviceId);
 
 ARC_STATUS FsUnmountForDevice(ULONG DeviceId);
 
+/// <summary>
+/// Drops cached filesystem lookups for a device whose media may have changed.
+/// </summary>
+/// <param name="DeviceId">Device ID</param>
+/// <returns>ARC status code</returns>
+ARC_STATUS FsInvalidateForDevice(ULONG DeviceId);
+
 void FsInitialiseTable(PARC_FILE_TABLE File);
@@ -7,6 +7,7 @@
 enum {
     FILE_TABLE_SIZE = 16,
     FILE_IS_RAW_DEVICE = 0xffff,
+    ARC_DEVICE_PATH_SIZE = 64,
     DCACHE_LINE_SIZE = 0x20
 };
 
@@ -16,6 +17,7 @@ struct ide_drive;
 // Define context for a disk.
 typedef struct _DISK_CONTEXT {
     union {
+        PVOID Device; // Low-level device, whichever kind it is
         struct _USB_DEVICE_MOUNT_TABLE* DeviceMount; // USB device mount entry
         struct ide_drive* IdeDrive; // IDE drive entry
     };
@@ -49,6 +51,8 @@ struct _ARC_FILE_TABLE;
 
 typedef ARC_STATUS(*PARC_GET_SECTOR_SIZE) (ULONG DeviceId, PULONG SectorSize);
 typedef ARC_STATUS(*PARC_TRANSFER_SECTOR) (struct _ARC_FILE_TABLE* FileEntry, ULONG StartSector, ULONG CountSectors, PVOID Buffer);
+typedef ULONG(*PARC_START_TRANSFER_SECTOR) (struct _ARC_FILE_TABLE* FileEntry, ULONG StartSector, ULONG CountSectors, PVOID Buffer);
+typedef ARC_STATUS(*PARC_POLL_TRANSFER_SECTOR) (struct _ARC_FILE_TABLE* FileEntry);
 
 typedef struct _ARC_FILE_TABLE {
     ARC_FILE_FLAGS Flags;
@@ -57,6 +61,8 @@ typedef struct _ARC_FILE_TABLE {
     PDEVICE_VECTORS DeviceEntryTable;
     PARC_GET_SECTOR_SIZE GetSectorSize; // Function pointer to get sector size.
     PARC_TRANSFER_SECTOR ReadSectors, WriteSectors;
+    PARC_START_TRANSFER_SECTOR StartReadSectors; // Optional: starts a read without waiting for it, returns the number of sectors started.
+    PARC_POLL_TRANSFER_SECTOR PollReadSectors; // Polls the started read, _EAGAIN while it is running.
     UCHAR FileNameLength;
     CHAR FileName[MAXIMUM_FILE_NAME_LENGTH];
     union {
@@ -79,4 +85,11 @@ PARC_FILE_TABLE ArcIoGetFile(ULONG FileId);
 /// <returns>File table entry.</returns>
 PARC_FILE_TABLE ArcIoGetFileForOpen(ULONG FileId);
 
+/// <summary>
+/// Gets the canonical ARC path of an open device.
+/// </summary>
+/// <param name="DeviceId">Device ID.</param>
+/// <returns>Device path, or NULL if the device is not open.</returns>
+PCHAR ArcIoGetDeviceName(ULONG DeviceId);
+
 void ArcIoInit();
\ No newline at end of file
@@ -7,6 +7,8 @@
 #include <unistd.h>
 #include "arc.h"
 #include "arcmem.h"
+#include "arcenv.h"
+#include "arcramdisk.h"
 #include "processor.h"
 #include "runtime.h"
 
@@ -38,6 +40,12 @@ void sync_before_exec(const void* p, ULONG len)
 static ULONG s_BootMemPages = 0;
 
 static void ArcFlushAllCaches(void) {
+	// osloader flushes caches just before it transfers control to the kernel, which never returns here.
+	// Commit any environment variables it has set, as it will not call into the firmware again.
+	ArcEnvCommit();
+	// NT's ramdisk driver reads the ramdisk image directly, so it must all be decompressed by now.
+	ArcDiskRamdiskComplete();
+
 	// Flush only the first 8MB.
 	ULONG Start = 0x80000000;
 	ULONG Length = 0x800000;
@@ -295,6 +303,39 @@ PVOID ArcMemAllocDirect(size_t length) {
 	return ArcMemAllocImpl(length, MemoryFirmwarePermanent);
 }
 
+static void ArcMemMergeWithNext(PARC_MEMORY_CHUNK Chunk) {
+	PARC_MEMORY_CHUNK Next = Chunk->Next;
+	if (Next == NULL) return;
+	if (Chunk->Descriptor.MemoryType != MemoryFree || Next->Descriptor.MemoryType != MemoryFree) return;
+	if ((Chunk->Descriptor.BasePage + Chunk->Descriptor.PageCount) != Next->Descriptor.BasePage) return;
+
+	Chunk->Descriptor.PageCount += Next->Descriptor.PageCount;
+	Chunk->Next = Next->Next;
+	if (Chunk->Next != NULL) Chunk->Next->Prev = Chunk;
+	// Unlinked, so ArcMemFindFreeChunk can hand it out again.
+	Next->Next = Next->Prev = NULL;
+}
+
+/// <summary>
+/// Frees a chunk of memory allocated by ArcMemAllocTemp or ArcMemAllocDirect.
+/// </summary>
+/// <param name="Pointer">Pointer to allocated memory.</param>
+void ArcMemFree(PVOID Pointer) {
+	if (Pointer == NULL) return;
+	ULONG BasePage = ((ULONG)Pointer & ~0x80000000) / PAGE_SIZE;
+	PMEMORY_DESCRIPTOR Desc = ArcMemFindAnyChunkWithoutLength(BasePage);
+	// Allocations are whole chunks, so the pointer must be the start of one.
+	if (Desc == NULL || Desc->BasePage != BasePage) return;
+	if (Desc->MemoryType != MemoryFirmwareTemporary && Desc->MemoryType != MemoryFirmwarePermanent) return;
+	Desc->MemoryType = MemoryFree;
+
+	// Merge with free chunks either side, so repeated allocations don't run out of descriptors.
+	PARC_MEMORY_CHUNK Chunk = (PARC_MEMORY_CHUNK)Desc;
+	PARC_MEMORY_CHUNK Prev = Chunk->Prev;
+	ArcMemMergeWithNext(Chunk);
+	if (Prev != NULL) ArcMemMergeWithNext(Prev);
+}
+
 static inline ARC_FORCEINLINE ULONG MegabytesInPages(ULONG Size) {
 	return Size * ((1024 * 1024) / PAGE_SIZE);
 }
@@ -13,22 +13,27 @@
 #include "runtime.h"
 
 static void ArcHalt(void) {
+	ArcEnvCommit();
 	PxiPowerOffSystem(true);
 }
 
 static void ArcPowerOff(void) {
+	ArcEnvCommit();
 	PxiPowerOffSystem(false);
 }
 
 static void ArcRestart(void) {
+	ArcEnvCommit();
 	PxiPowerOffSystem(true);
 }
 
 static void ArcReboot(void) {
+	ArcEnvCommit();
 	PxiPowerOffSystem(true);
 }
 
 static void ArcEnterInteractiveMode(void) {
+	ArcEnvCommit();
 	PxiPowerOffSystem(true);
 }
 
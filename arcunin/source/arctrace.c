@@ -0,0 +1,187 @@
+#include <stddef.h>
+#include <memory.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "arc.h"
+#include "timer.h"
+#include "arctrace.h"
+
+// Boot trace: timestamped events recorded into a fixed ring in RAM.
+// Recording only stores the timebase and a pointer to the static event name, names are copied out when the trace is saved.
+
+enum {
+	TRACE_RING_SIZE = 2048, // must be a power of two
+	TRACE_SAVE_CHUNK = 64, // records converted per write when saving
+};
+
+typedef struct _TRACE_EVENT {
+	unsigned long long Ticks;
+	const char* Name;
+	ULONG Arg;
+	UCHAR Type;
+	UCHAR Depth;
+} TRACE_EVENT, *PTRACE_EVENT;
+
+static TRACE_EVENT s_TraceRing[TRACE_RING_SIZE];
+static ULONG s_TraceNext = 0; // Total events recorded, the ring index is this modulo the ring size.
+static UCHAR s_TraceDepth = 0;
+
+static void ArcTraceRecord(const char* Name, ULONG Arg, ARC_TRACE_TYPE Type) {
+	if (Type == ArcTraceTypeEnd && s_TraceDepth != 0) s_TraceDepth--;
+
+	PTRACE_EVENT Event = &s_TraceRing[s_TraceNext & (TRACE_RING_SIZE - 1)];
+	Event->Ticks = currticks();
+	Event->Name = Name;
+	Event->Arg = Arg;
+	Event->Type = Type;
+	Event->Depth = s_TraceDepth;
+	s_TraceNext++;
+
+	if (Type == ArcTraceTypeBegin) s_TraceDepth++;
+}
+
+void ArcTraceBegin(const char* Name, ULONG Arg) {
+	ArcTraceRecord(Name, Arg, ArcTraceTypeBegin);
+}
+
+void ArcTraceEnd(const char* Name, ULONG Arg) {
+	ArcTraceRecord(Name, Arg, ArcTraceTypeEnd);
+}
+
+void ArcTraceMark(const char* Name, ULONG Arg) {
+	ArcTraceRecord(Name, Arg, ArcTraceTypeMark);
+}
+
+static ULONG ArcTraceFirst(void) {
+	if (s_TraceNext <= TRACE_RING_SIZE) return 0;
+	return s_TraceNext - TRACE_RING_SIZE;
+}
+
+static ULONG ArcTraceTicksToUs(unsigned long long Ticks) {
+	ULONG TicksPerUs = timer_frequency() / 1000000;
+	if (TicksPerUs == 0) return 0;
+	return (ULONG)(Ticks / TicksPerUs);
+}
+
+// Nesting deeper than this is printed at this depth.
+static const char s_TraceIndent[] = "                                ";
+
+void ArcTraceDump(void) {
+	PVENDOR_VECTOR_TABLE Api = ARC_VENDOR_VECTORS();
+	ULONG Rows = Api->GetDisplayStatusRoutine(0)->CursorMaxYPosition;
+	if (Rows < 4) Rows = 4;
+
+	ULONG First = ArcTraceFirst();
+	if (First != 0) printf(" %d earlier events were lost\r\n", First);
+
+	// Start time of the begun events at each depth, to print how long each phase took when it ends.
+	unsigned long long BeginTicks[256] = { 0 };
+	unsigned long long BaseTicks = s_TraceRing[First & (TRACE_RING_SIZE - 1)].Ticks;
+	ULONG Lines = 0;
+	for (ULONG i = First; i < s_TraceNext; i++) {
+		PTRACE_EVENT Event = &s_TraceRing[i & (TRACE_RING_SIZE - 1)];
+		// printf has no '*' width, so indent with the end of a string of spaces.
+		ULONG Indent = Event->Depth * 2;
+		if (Indent > sizeof(s_TraceIndent) - 1) Indent = sizeof(s_TraceIndent) - 1;
+		printf("%10dus %s", ArcTraceTicksToUs(Event->Ticks - BaseTicks), &s_TraceIndent[sizeof(s_TraceIndent) - 1 - Indent]);
+		switch (Event->Type) {
+		case ArcTraceTypeBegin:
+			BeginTicks[Event->Depth] = Event->Ticks;
+			printf("%s (%x)\r\n", Event->Name, Event->Arg);
+			break;
+		case ArcTraceTypeEnd:
+			printf("%s done (%x) in %dus\r\n", Event->Name, Event->Arg, ArcTraceTicksToUs(Event->Ticks - BeginTicks[Event->Depth]));
+			break;
+		default:
+			printf("* %s (%x)\r\n", Event->Name, Event->Arg);
+			break;
+		}
+
+		Lines++;
+		if (Lines == Rows - 2 && i + 1 < s_TraceNext) {
+			Lines = 0;
+			printf(" Press any key for more, Esc to stop...\r\n");
+			if (IOSKBD_ReadChar() == 0x1b) return;
+		}
+	}
+
+	printf(" Press any key to continue...\r\n");
+	IOSKBD_ReadChar();
+}
+
+ARC_STATUS ArcTraceSave(PCHAR Path) {
+	PVENDOR_VECTOR_TABLE Api = ARC_VENDOR_VECTORS();
+	// Take the events recorded so far, the save itself is traced too.
+	ULONG First = ArcTraceFirst();
+	ULONG Next = s_TraceNext;
+
+	U32LE FileId;
+	ARC_STATUS Status = Api->OpenRoutine(Path, ArcOpenWriteOnly, &FileId);
+	if (ARC_FAIL(Status)) return Status;
+
+	do {
+		FILE_INFORMATION Info;
+		Status = Api->GetFileInformationRoutine(FileId.v, &Info);
+		if (ARC_FAIL(Status)) break;
+		ULONG Length = sizeof(ARC_TRACE_FILE_HEADER) + (Next - First) * sizeof(ARC_TRACE_FILE_RECORD);
+		if (Info.EndingAddress.QuadPart < Length) {
+			printf(" %s must be at least %d bytes\r\n", Path, Length);
+			Status = _ENOSPC;
+			break;
+		}
+
+		// The header and the records are written together in chunks, as the filesystem writes whole sectors only.
+		static ARC_TRACE_FILE_RECORD s_Chunk[TRACE_SAVE_CHUNK];
+		PARC_TRACE_FILE_HEADER Header = (PARC_TRACE_FILE_HEADER)s_Chunk;
+		_Static_assert(sizeof(*Header) <= sizeof(s_Chunk[0]));
+		memset(s_Chunk, 0, sizeof(s_Chunk));
+		Header->Magic = ARC_TRACE_MAGIC;
+		Header->Version = ARC_TRACE_VERSION;
+		Header->RecordSize = sizeof(ARC_TRACE_FILE_RECORD);
+		Header->TicksPerSecond = timer_frequency();
+		Header->Count = Next - First;
+		Header->Lost = First;
+		ULONG Offset = sizeof(*Header);
+
+		for (ULONG i = First; i < Next;) {
+			PUCHAR Chunk = (PUCHAR)s_Chunk;
+			for (; i < Next && Offset + sizeof(ARC_TRACE_FILE_RECORD) <= sizeof(s_Chunk); i++) {
+				PTRACE_EVENT Event = &s_TraceRing[i & (TRACE_RING_SIZE - 1)];
+				ARC_TRACE_FILE_RECORD Record = { 0 };
+				Record.Ticks = Event->Ticks;
+				Record.Arg = Event->Arg;
+				Record.Type = Event->Type;
+				Record.Depth = Event->Depth;
+				strncpy(Record.Name, Event->Name, sizeof(Record.Name));
+				memcpy(&Chunk[Offset], &Record, sizeof(Record));
+				Offset += sizeof(Record);
+			}
+
+			U32LE Count;
+			Status = Api->WriteRoutine(FileId.v, Chunk, Offset, &Count);
+			if (ARC_FAIL(Status)) break;
+			if (Count.v != Offset) {
+				Status = _EIO;
+				break;
+			}
+			Offset = 0;
+		}
+		if (ARC_FAIL(Status)) break;
+
+		if (First == Next) {
+			// No records, write the header alone.
+			U32LE Count;
+			Status = Api->WriteRoutine(FileId.v, s_Chunk, sizeof(*Header), &Count);
+			if (ARC_FAIL(Status)) break;
+		}
+
+		// Finish the last sector.
+		U32LE Count;
+		Status = Api->WriteRoutine(FileId.v, s_Chunk, 0, &Count);
+	} while (false);
+
+	Api->CloseRoutine(FileId.v);
+	return Status;
+}
@@ -52,6 +52,15 @@
 #define WIN_READ_EXT		0x24
 #define WIN_WRITE		0x30
 #define WIN_WRITE_EXT		0x34
+#define WIN_READDMA		0xC8
+#define WIN_READDMA_EXT		0x25
+#define WIN_WRITEDMA		0xCA
+#define WIN_WRITEDMA_EXT	0x35
+#define WIN_MULTREAD		0xC4
+#define WIN_MULTREAD_EXT	0x29
+#define WIN_MULTWRITE		0xC5
+#define WIN_MULTWRITE_EXT	0x39
+#define WIN_SETMULT		0xC6
 #define WIN_IDENTIFY		0xEC
 #define WIN_PACKET		0xA0
 #define WIN_IDENTIFY_PACKET	0xA1
@@ -70,6 +79,7 @@
  * atapi sense keys
  */
 #define ATAPI_SENSE_NOT_READY	0x02
+#define ATAPI_SENSE_UNIT_ATTENTION	0x06
 
 /*
  * supported device types
@@ -96,6 +106,15 @@ enum {
 	ide_lba48,
 };
 
+/*
+ * busmastering state, the first dma read of a drive is checked against pio
+ */
+enum {
+	ide_dma_none,
+	ide_dma_untested,
+	ide_dma_ok,
+};
+
 /*
  * simple ata command that works for everything (except 48-bit lba commands)
  */
@@ -148,6 +167,9 @@ struct ide_drive {
 	char		type;		/* ata or atapi */
 	char		media;		/* disk, cdrom, etc */
 	char		addressing;	/* chs/lba28/lba48 */
+	char		dma;		/* none/untested/ok */
+	char		dma_errors;	/* dma failures in a row */
+	char		media_changed;	/* unit attention or not ready seen */
 	char        atapi_ready; // drive is ready for atapi-cd
 
 	char		model[41];	/* name */
@@ -156,6 +178,7 @@ struct ide_drive {
 	unsigned long	sectors;
 
 	unsigned int	max_sectors;
+	unsigned int	multi;		/* sectors per drq block, 0: single */
 
 	/*
 	 * for legacy chs crap
@@ -179,6 +202,11 @@ struct ide_channel {
 	unsigned long mmio;
 	int channel;
 
+	/*
+	 * dbdma channel registers, 0 if this channel is pio only
+	 */
+	unsigned long dma_regs;
+
 	/*
 	 * can be set to a mmio hook, default it legacy outb/inb
 	 */
@@ -196,7 +224,6 @@ struct ide_channel {
 	struct ide_drive drives[2];
 	char selected;
 	char present;
-        char has_lba48;
 
 	/*
 	 * only one can be busy per channel
@@ -232,8 +259,28 @@ static ARC_FORCEINLINE ULONG ob_ide_block_size(PIDE_DRIVE drive) {
 ULONG ob_ide_read_blocks(PIDE_DRIVE drive, PVOID buffer, ULONG sector, ULONG count);
 ULONG ob_ide_write_blocks(PIDE_DRIVE drive, PVOID buffer, ULONG sector, ULONG count);
 
+/*
+ * start a dma read of up to 'count' sectors and return without waiting for
+ * it. returns the number of sectors started, 0 if this read can't be done
+ * that way. only one read is in flight at a time, any other request to the
+ * driver waits for it first.
+ */
+ULONG ob_ide_read_blocks_start(PIDE_DRIVE drive, PVOID buffer, ULONG sector, ULONG count);
+
+/*
+ * -1 while the read started by ob_ide_read_blocks_start is running, 0 once
+ * it completed, 1 if it failed
+ */
+int ob_ide_read_blocks_poll(PIDE_DRIVE drive);
+
 bool ob_ide_eject(PIDE_DRIVE drive);
 
+/*
+ * true if the drive reported a media change (unit attention, or not ready)
+ * since the last call. ob_ide_open asks an atapi drive, so call it after that.
+ */
+bool ob_ide_media_changed(PIDE_DRIVE drive);
+
 const IDE_CHANNEL* ob_ide_get_first_channel(void);
 
 #endif
@@ -105,6 +105,7 @@ l9660_status l9660_openfs(
     bool (*read_sector)(l9660_fs *fs, void *buf, uint32_t sector))
 {
     fs->read_sector = read_sector;
+    fs->read_sectors = NULL;
 
 #ifndef L9660_SINGLEBUFFER
     l9660_vdesc_primary *pvd = PVD(&fs->pvd);
@@ -246,10 +247,7 @@ static l9660_status openat_raw(l9660_file *child, l9660_dir *parent, const char
             break;
         }
 
-        child->fs           = parent->file.fs;
-        child->first_sector = READ32(dent->sector) + dent->xattr_length;
-        child->length       = READ32(dent->size);
-        child->position     = 0;
+        l9660_openent(child, parent->file.fs, dent);
 
         if (*name && (dent->flags & DENT_ISDIR) == 0)
             return L9660_ENOTDIR;
@@ -268,6 +266,19 @@ static l9660_status openat_raw(l9660_file *child, l9660_dir *parent, const char
     return L9660_OK;
 }
 
+void l9660_openent(l9660_file *child, l9660_fs *fs, l9660_dirent *dent)
+{
+    child->fs           = fs;
+    child->first_sector = READ32(dent->sector) + dent->xattr_length;
+    child->length       = READ32(dent->size);
+    child->position     = 0;
+}
+
+bool l9660_dirent_isdir(l9660_dirent *dent)
+{
+    return (dent->flags & DENT_ISDIR) != 0;
+}
+
 l9660_status l9660_opendirat(l9660_dir *dir, l9660_dir *parent, const char *path)
 {
     return openat_raw(&dir->file, parent, path, true);
@@ -315,6 +326,9 @@ l9660_status l9660_seek(l9660_file *f, int whence, int32_t offset)
 {
     l9660_status rv;
     uint32_t cursect = fsector(f);
+    // At a sector boundary the buffer does not hold cursect (it holds the
+    // previous sector, or nothing if that was read directly to the caller)
+    bool curbuffered = fsectoff(f) != 0;
 
     switch (whence) {
         case SEEK_SET:
@@ -330,7 +344,7 @@ l9660_status l9660_seek(l9660_file *f, int whence, int32_t offset)
             break;
     }
 
-    if (fsector(f) != cursect && fsectoff(f) != 0) {
+    if ((fsector(f) != cursect || !curbuffered) && fsectoff(f) != 0) {
         if ((rv = buffer(f)))
             return rv;
     }
@@ -346,7 +360,7 @@ uint32_t l9660_tell(l9660_file *f)
 l9660_status l9660_read(l9660_file *f, void* buf, size_t size, size_t *read)
 {
     uint8_t* buf8 = (uint8_t*)buf;
-    l9660_status rv;
+    l9660_status rv = L9660_OK;
 
     size_t allSize = size;
     size_t _read = 0;
@@ -355,6 +369,26 @@ l9660_status l9660_read(l9660_file *f, void* buf, size_t size, size_t *read)
 
         size = allSize;
 
+        // Whole sectors at a sector boundary go straight to the caller's buffer.
+        if (f->fs->read_sectors && fsectoff(f) == 0) {
+            uint32_t count = size / 2048;
+            uint32_t left = (f->length - f->position) / 2048;
+            if (count > left)
+                count = left;
+
+            if (count != 0) {
+                if (!f->fs->read_sectors(f->fs, buf8, f->first_sector + f->position / 2048, count))
+                    return L9660_EIO;
+
+                size = count * 2048;
+                _read += size;
+                f->position += size;
+                allSize -= size;
+                buf8 += size;
+                continue;
+            }
+        }
+
         if ((rv = prebuffer(f)))
             return rv;
 
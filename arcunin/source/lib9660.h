@@ -159,6 +159,10 @@ typedef struct l9660_fs {
 
     /* read_sector func */
     bool (*read_sector)(struct l9660_fs *fs, void *buf, uint32_t sector);
+
+    /* optional multi-sector read func, used to read whole sectors straight
+     * into the caller's buffer. set after l9660_openfs; NULL to disable */
+    bool (*read_sectors)(struct l9660_fs *fs, void *buf, uint32_t sector, uint32_t count);
 } l9660_fs;
 
 typedef struct {
@@ -199,6 +203,12 @@ l9660_status l9660_readdir(l9660_dir *dir, l9660_dirent **dirent);
 /*! Open the file given by \p path in \p parent */
 l9660_status l9660_openat(l9660_file *file, l9660_dir *parent, const char *path);
 
+/*! Set up \p child to read the extent of \p dent, a directory entry returned
+ *  by l9660_readdir for a directory on \p fs */
+void l9660_openent(l9660_file *child, l9660_fs *fs, l9660_dirent *dent);
+/*! Returns whether \p dent is a directory */
+bool l9660_dirent_isdir(l9660_dirent *dent);
+
 /*! Read \p size bytes into \p buf. The number of bytes read will be returned in
  *  \p *read. May be less than \p size (but only 0 on EOF)
  */
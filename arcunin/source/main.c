@@ -15,7 +15,9 @@
 #include "arctime.h"
 #include "arcconsole.h"
 #include "arcfs.h"
+#include "arcramdisk.h"
 #include "getstr.h"
+#include "arctrace.h"
 //#include "ppchook.h"
 #include "hwdesc.h"
 
@@ -237,6 +239,11 @@ void ArcInitRamDisk(ULONG ControllerKey, PVOID Pointer, ULONG Length) {
 	s_RamdiskLoaded = true;
 }
 
+void ArcDropRamDisk(void) {
+	s_RuntimeRamdisk.Buffer.PointerArc = 0;
+	s_RuntimeRamdisk.Buffer.Length = 0;
+}
+
 static void ArcMain() {
 	// Initialise the ARC firmware.
 	PSYSTEM_PARAMETER_BLOCK Spb = ARC_SYSTEM_TABLE();
@@ -273,17 +280,35 @@ static void ArcMain() {
 	}
 
 	// Initialise sub-components.
+	ArcTraceBegin("ArcMemInit", 0);
 	ArcMemInit();
+	ArcTraceEnd("ArcMemInit", 0);
+	ArcTraceBegin("ArcTermInit", 0);
 	ArcTermInit();
+	ArcTraceEnd("ArcTermInit", 0);
+	ArcTraceBegin("ArcEnvInit", 0);
 	ArcEnvInit();
+	ArcTraceEnd("ArcEnvInit", 0);
+	ArcTraceBegin("ArcLoadInit", 0);
 	ArcLoadInit();
+	ArcTraceEnd("ArcLoadInit", 0);
+	ArcTraceBegin("ArcConfigInit", 0);
 	ArcConfigInit();
+	ArcTraceEnd("ArcConfigInit", 0);
+	ArcTraceBegin("ArcIoInit", 0);
 	ArcIoInit();
+	ArcTraceEnd("ArcIoInit", 0);
+	ArcTraceBegin("ArcDiskInit", 0);
 	ArcDiskInit();
+	ArcTraceEnd("ArcDiskInit", 0);
+	ArcTraceBegin("ArcTimeInit", 0);
 	ArcTimeInit();
+	ArcTraceEnd("ArcTimeInit", 0);
 
 	// Load environment from HD if possible.
+	ArcTraceBegin("ArcEnvLoad", 0);
 	ArcEnvLoad();
+	ArcTraceEnd("ArcEnvLoad", 0);
 
 #if 0 // Already checked by stage1
 	// Ensure we have valid decrementer frequency
@@ -721,6 +746,7 @@ void ARC_NORETURN FwMain(PHW_DESCRIPTION Desc) {
 	HW_DESCRIPTION StackDesc;
 	memcpy(&StackDesc, Desc, sizeof(StackDesc));
 	Desc = &StackDesc;
+	ArcTraceMark("FwMain", 0);
 
 	// Initialise the console. We know where it is. Just convert it from physical address to our BAT mapping.
 	ArcConsoleInit(PciPhysToVirt(Desc->FrameBufferBase), 0, 0, Desc->FrameBufferWidth, Desc->FrameBufferHeight, Desc->FrameBufferStride);
@@ -733,6 +759,10 @@ void ARC_NORETURN FwMain(PHW_DESCRIPTION Desc) {
 	if (ArcMemInitDescriptors(Desc->MemoryLength) < 0) {
 		FwEarlyPanic("[ARC] Could not initialise memory description");
 	}
+	// DBAT0 maps the first 256MB of RAM cached, so memset/memcpy can use dcbz there.
+	ULONG CacheableLength = Desc->MemoryLength;
+	if (CacheableLength > 0x10000000) CacheableLength = 0x10000000;
+	memops_set_cacheable((PVOID)0x80000000, CacheableLength);
 	// Carve out some space for heap.
 	// We will use 4MB. All Grackle + Heathrow/Paddington systems are guaranteed to have at least 32MB of RAM.
 	// This allocates from the end of RAM that's accessible by BAT.
@@ -764,7 +794,11 @@ void ARC_NORETURN FwMain(PHW_DESCRIPTION Desc) {
 	}
 
 	if (Desc->DriversImgBase != 0) {
-		PUCHAR Ramdisk = ArcMemAllocDirect(Desc->DriversImgSize);
+		// A compressed image is only needed until it's been decompressed, which is done before NT starts.
+		PRAMDISK_COMPRESSED_HEADER Compressed = (PRAMDISK_COMPRESSED_HEADER)(Desc->DriversImgBase + 0x80000000u);
+		PUCHAR Ramdisk;
+		if (Compressed->Magic == RAMDISK_COMPRESSED_MAGIC) Ramdisk = ArcMemAllocTemp(Desc->DriversImgSize);
+		else Ramdisk = ArcMemAllocDirect(Desc->DriversImgSize);
 		memcpy(Ramdisk, (PVOID)(Desc->DriversImgBase + 0x80000000u), Desc->DriversImgSize);
 		s_RuntimeRamdisk.Buffer.Length = Desc->DriversImgSize;
 		s_RuntimeRamdisk.Buffer.PointerArc = ((ULONG)Ramdisk & ~0x80000000);
@@ -776,26 +810,34 @@ void ARC_NORETURN FwMain(PHW_DESCRIPTION Desc) {
 	setup_timers(Desc->DecrementerFrequency);
 	// PXI.
 	printf("Init pxi...\r\n");
+	ArcTraceBegin("pxi", 0);
 	PxiInit(PciPhysToVirt(Desc->MacIoStart + 0x16000), (Desc->MrFlags & MRF_IN_EMULATOR) != 0);
+	ArcTraceEnd("pxi", 0);
 	// ADB.
 	if ((Desc->MrFlags & MRF_NO_ADB) == 0) {
 		int adb_bus_init(bool IsEmulator);
 		printf("Init adb...\r\n");
+		ArcTraceBegin("adb", 0);
 		adb_bus_init((Desc->MrFlags & MRF_IN_EMULATOR) != 0);
+		ArcTraceEnd("adb", 0);
 	}
 
 	// USB controllers.
 	void ob_usb_ohci_init(PVOID addr);
 	printf("Init usb...\r\n");
+	ArcTraceBegin("usb", 0);
 	if (Desc->UsbOhciStart[0] != 0) ob_usb_ohci_init(PciPhysToVirt(Desc->UsbOhciStart[0]));
 	if (Desc->UsbOhciStart[1] != 0) ob_usb_ohci_init(PciPhysToVirt(Desc->UsbOhciStart[1]));
+	ArcTraceEnd("usb", 0);
 
 	// IDE controllers.
 	printf("Init ide...\r\n");
+	ArcTraceBegin("ide", 0);
 	int macio_ide_init(uint32_t addr, int nb_channels);
 	macio_ide_init((ULONG) PciPhysToVirt(Desc->MacIoStart), 3);
 	if (Desc->MioAta6Start[0] != 0) macio_ide_init((ULONG)PciPhysToVirt(Desc->MioAta6Start[0]), 1);
 	if (Desc->MioAta6Start[1] != 0) macio_ide_init((ULONG)PciPhysToVirt(Desc->MioAta6Start[1]), 1);
+	ArcTraceEnd("ide", 0);
 
 
 	printf("Early driver init done.\r\n");
@@ -0,0 +1,95 @@
+#pragma once
+
+// PE base relocation engine.
+// Only depends on types.h and coff.h, so RelocBench can build it for the host too.
+
+#include "types.h"
+#include "coff.h"
+
+typedef enum _PE_RELOC_RESULT {
+    PE_RELOC_OK, // All entries were applied.
+    PE_RELOC_BAD_TYPE, // An entry has a type that is invalid for PowerPC.
+    PE_RELOC_HIGHADJ_OVERFLOW // A HIGHADJ entry is the last entry of the block.
+} PE_RELOC_RESULT;
+
+enum {
+    PE_RELOC_OFFSET_MASK = ARC_BIT(12) - 1,
+    PE_RELOC_TYPE_SHIFT = 12
+};
+
+// Defines a relocation routine for one endianness of image data.
+// A run of entries of the same type is applied by a loop specialised for that type,
+// and consecutive HIGHADJ entries (each followed by the low half it adjusts with) are applied as a batch of pairs.
+// The high half of a HIGHADJ pair is always adjusted with the low half taken as unsigned, the same as the original loader did.
+#define PE_RELOC_DEFINE_BLOCK(Name, U16Type, U32Type, AdjType) \
+static inline PE_RELOC_RESULT Name(PUCHAR Page, ULONG Length, PU16LE Block, LONG Diff, PUSHORT BadType) { \
+    USHORT DiffHigh = (USHORT)((ULONG)Diff >> 16); \
+    USHORT DiffLow = (USHORT)Diff; \
+    ULONG Index = 0; \
+    while (Index < Length) { \
+        USHORT Type = Block[Index].v >> PE_RELOC_TYPE_SHIFT; \
+        switch (Type) { \
+        case IMAGE_REL_BASED_HIGHLOW: \
+            do { \
+                U32Type Value; \
+                PUCHAR Fixup = Page + (Block[Index].v & PE_RELOC_OFFSET_MASK); \
+                __builtin_memcpy(&Value, Fixup, sizeof(Value)); \
+                Value.v += Diff; \
+                __builtin_memcpy(Fixup, &Value, sizeof(Value)); \
+                Index++; \
+            } while (Index < Length && (Block[Index].v >> PE_RELOC_TYPE_SHIFT) == IMAGE_REL_BASED_HIGHLOW); \
+            break; \
+        case IMAGE_REL_BASED_HIGH: \
+            do { \
+                ((U16Type*)(Page + (Block[Index].v & PE_RELOC_OFFSET_MASK)))->v += DiffHigh; \
+                Index++; \
+            } while (Index < Length && (Block[Index].v >> PE_RELOC_TYPE_SHIFT) == IMAGE_REL_BASED_HIGH); \
+            break; \
+        case IMAGE_REL_BASED_LOW: \
+            do { \
+                ((U16Type*)(Page + (Block[Index].v & PE_RELOC_OFFSET_MASK)))->v += DiffLow; \
+                Index++; \
+            } while (Index < Length && (Block[Index].v >> PE_RELOC_TYPE_SHIFT) == IMAGE_REL_BASED_LOW); \
+            break; \
+        case IMAGE_REL_BASED_HIGHADJ: \
+            do { \
+                if (Index + 1 >= Length) return PE_RELOC_HIGHADJ_OVERFLOW; \
+                U16Type* Fixup = (U16Type*)(Page + (Block[Index].v & PE_RELOC_OFFSET_MASK)); \
+                ULONG Temp = ((ULONG)Fixup->v << 16) + ((AdjType*)&Block[Index + 1])->v; \
+                Temp += (ULONG)Diff + (INT16_MAX + 1); \
+                Fixup->v = Temp >> 16; \
+                Index += 2; \
+            } while (Index < Length && (Block[Index].v >> PE_RELOC_TYPE_SHIFT) == IMAGE_REL_BASED_HIGHADJ); \
+            break; \
+        case IMAGE_REL_BASED_ABSOLUTE: \
+            Index++; \
+            break; \
+        default: \
+            *BadType = Type; \
+            return PE_RELOC_BAD_TYPE; \
+        } \
+    } \
+    return PE_RELOC_OK; \
+}
+
+// Little endian images (PowerPC NT).
+PE_RELOC_DEFINE_BLOCK(PeRelocateBlockLittle, U16LE, U32LE, U16LE)
+// Big endian images. The low half of a HIGHADJ pair is taken as big endian too, as the original loader did.
+PE_RELOC_DEFINE_BLOCK(PeRelocateBlockBig, U16BE, U32BE, U16BE)
+
+#undef PE_RELOC_DEFINE_BLOCK
+
+/// <summary>
+/// Applies one block of base relocations.
+/// </summary>
+/// <param name="Page">Address of the page the block applies to.</param>
+/// <param name="Length">Number of entries in the block.</param>
+/// <param name="Block">Relocation entries.</param>
+/// <param name="Diff">Difference between the address the image was loaded at and the address it was linked at.</param>
+/// <param name="IsLittleEndian">True if the image data is little endian.</param>
+/// <param name="BadType">Obtains the type of an invalid entry.</param>
+/// <returns>Result code.</returns>
+static inline PE_RELOC_RESULT PeRelocateBlock(PUCHAR Page, ULONG Length, PU16LE Block, LONG Diff, bool IsLittleEndian, PUSHORT BadType) {
+    if (IsLittleEndian) return PeRelocateBlockLittle(Page, Length, Block, Diff, BadType);
+    return PeRelocateBlockBig(Page, Length, Block, Diff, BadType);
+}
@@ -18,6 +18,13 @@
 #define PF_FS_FAT16		1	/* FAT16 */
 #define PF_FS_FAT32		1	/* FAT32 */
 
+#define PF_EXTENT_MAP	32	/* Number of cluster extents cached per open file (0:Disable) */
+/* Each open file keeps a list of its runs of contiguous clusters, built lazily
+/  from the FAT, so that seeks and cluster advances do not walk the FAT chain.
+/  A file with more fragments than this falls back to walking the chain past
+/  the last cached extent.
+*/
+
 
 /*---------------------------------------------------------------------------/
 / Locale and Namespace Configurations
@@ -54,6 +54,7 @@ extern void mdelay(unsigned int msecs);
 extern unsigned long long currticks(void);
 unsigned long long currusecs(void);
 unsigned long currmsecs(void);
+unsigned long timer_frequency(void);
 //unsigned long currsecs(void);
 
 /* arch/ppc/timebase.S */
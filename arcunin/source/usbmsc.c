@@ -37,6 +37,8 @@
 #define htonl(x) __builtin_bswap32(x)
 #define ntohl(x) __builtin_bswap32(x)
 #define htonw(x) __builtin_bswap16(x)
+#define htonll(x) __builtin_bswap64(x)
+#define ntohll(x) __builtin_bswap64(x)
 
 enum {
 	msc_subclass_rbc = 0x1,
@@ -189,34 +191,36 @@ execute_command (usbdev_t *dev, cbw_direction dir, const u8 *cb, int cblen,
 {
 	cbw_t cbw;
 	csw_t csw;
+	bulk_xfer_t xfers[3];
 
 	int always_succeed = 0;
 	if ((cb[0] == 0x1b) && (cb[4] == 1)) {	//start command, always succeed
 		always_succeed = 1;
 	}
 	wrap_cbw (&cbw, buflen, dir, cb, cblen);
-	if (dev->controller->
-	    bulk (MSC_INST (dev)->bulk_out, sizeof (cbw), (u8 *) &cbw, 0)) {
+	/* queue the command, data and status phases together, the device
+	   naks the later ones until it's ready for them */
+	int n = 0;
+	xfers[n++] = (bulk_xfer_t) { MSC_INST (dev)->bulk_out, sizeof (cbw), (u8 *) &cbw, 0 };
+	if (buflen > 0) {
+		xfers[n++] = (bulk_xfer_t) { (dir == cbw_direction_data_in) ?
+			MSC_INST (dev)->bulk_in : MSC_INST (dev)->bulk_out,
+			buflen, buf, 0 };
+	}
+	xfers[n++] = (bulk_xfer_t) { MSC_INST (dev)->bulk_in, sizeof (csw), (u8 *) &csw, 1 };
+	dev->controller->bulk_queue (xfers, n);
+	if (xfers[0].result) {
 		reset_transport (dev);
 		return 1;
 	}
-	mdelay (10);
-	if (buflen > 0) {
-		if (dir == cbw_direction_data_in) {
-			if (dev->controller->
-			    bulk (MSC_INST (dev)->bulk_in, buflen, buf, 0)) {
-				clear_stall (MSC_INST (dev)->bulk_in);
-				return 1;
-			}
-		} else {
-			if (dev->controller->
-			    bulk (MSC_INST (dev)->bulk_out, buflen, buf, 0)) {
-				clear_stall (MSC_INST (dev)->bulk_out);
-				return 1;
-			}
-		}
+	if ((buflen > 0) && xfers[1].result) {
+		/* the stall was cleared by the controller, the device still
+		   sends a status for the command */
+		get_csw (MSC_INST (dev)->bulk_in, &csw);
+		return 1;
 	}
-	get_csw (MSC_INST (dev)->bulk_in, &csw);
+	if (xfers[n - 1].result)
+		get_csw (MSC_INST (dev)->bulk_in, &csw);
 	if (always_succeed == 1) {
 		// return success, regardless of message
 		return 0;
@@ -253,6 +257,15 @@ typedef struct {
 	unsigned char res4;	//5
 } __attribute__ ((packed)) cmdblock6_t;
 
+typedef struct {
+	unsigned char command;	//0
+	unsigned char action;	//1
+	unsigned long long block;	//2-9
+	unsigned int numblocks;	//10-13
+	unsigned char res1;	//14
+	unsigned char res2;	//15 - the block is 16 bytes long
+} __attribute__ ((packed)) cmdblock16_t;
+
 /**
  * Like readwrite_blocks, but for soft-sectors of 512b size. Converts the
  * start and count from 512b units.
@@ -277,8 +290,8 @@ readwrite_blocks_512 (usbdev_t *dev, int start, int n,
 
 /**
  * Reads or writes a number of sequential blocks on a USB storage device.
- * As it uses the READ(10) SCSI-2 command, it's limited to storage devices
- * of at most 2TB. It assumes sectors of 512 bytes.
+ * It uses the READ(10) SCSI-2 command, or READ(16) for devices of more
+ * than 2^32 blocks and for more than 65535 blocks at once.
  *
  * @param dev device to access
  * @param start first sector to access
@@ -290,6 +303,23 @@ readwrite_blocks_512 (usbdev_t *dev, int start, int n,
 int
 readwrite_blocks (usbdev_t *dev, int start, int n, cbw_direction dir, u8 *buf)
 {
+	if (MSC_INST (dev)->lba64 || ((unsigned int) n > 0xffff)) {
+		cmdblock16_t cb;
+		memset (&cb, 0, sizeof (cb));
+		if (dir == cbw_direction_data_in) {
+			// read
+			cb.command = 0x88;
+		} else {
+			// write
+			cb.command = 0x8a;
+		}
+		cb.block = htonll ((unsigned int) start);
+		cb.numblocks = htonl (n);
+
+		return execute_command (dev, dir, (u8 *) &cb, sizeof (cb), buf,
+					n * MSC_INST(dev)->blocksize);
+	}
+
 	cmdblock_t cb;
 	memset (&cb, 0, sizeof (cb));
 	if (dir == cbw_direction_data_in) {
@@ -341,6 +371,30 @@ spin_up (usbdev_t *dev)
 				sizeof (cb), 0, 0);
 }
 
+static void
+read_capacity_16 (usbdev_t *dev)
+{
+	cmdblock16_t cb;
+	memset (&cb, 0, sizeof (cb));
+	cb.command = 0x9e;	// service action in
+	cb.action = 0x10;	// read capacity (16)
+	cb.numblocks = htonl (32);	// allocation length
+	u8 buf[32];
+
+	MSC_INST (dev)->lba64 = 1;
+	if (execute_command
+	    (dev, cbw_direction_data_in, (u8 *) &cb, sizeof (cb), buf, 32)) {
+		printf ("  assuming 2 TB with 512-byte sectors as READ CAPACITY(16) didn't answer.\n");
+		MSC_INST (dev)->numblocks = 0xffffffff;
+		MSC_INST (dev)->blocksize = 512;
+		return;
+	}
+	unsigned long long numblocks = ntohll (*(unsigned long long *) buf) + 1;
+	// block numbers are 32 bits wide above here, so only the start of the device is usable
+	MSC_INST (dev)->numblocks = (numblocks > 0xffffffff) ? 0xffffffff : numblocks;
+	MSC_INST (dev)->blocksize = ntohl (*(u32 *) (buf + 8));
+}
+
 static void
 read_capacity (usbdev_t *dev)
 {
@@ -361,6 +415,9 @@ read_capacity (usbdev_t *dev)
 		printf ("  assuming 2 TB with 512-byte sectors as READ CAPACITY didn't answer.\n");
 		MSC_INST (dev)->numblocks = 0xffffffff;
 		MSC_INST (dev)->blocksize = 512;
+	} else if (ntohl (*(u32 *) buf) == 0xffffffff) {
+		// too large for READ CAPACITY(10), so use the 16-byte commands
+		read_capacity_16 (dev);
 	} else {
 		MSC_INST (dev)->numblocks = ntohl (*(u32 *) buf) + 1;
 		MSC_INST (dev)->blocksize = ntohl (*(u32 *) (buf + 4));
@@ -407,6 +464,7 @@ usb_msc_init (usbdev_t *dev)
 		fatal("Not enough memory for USB MSC device.\n");
 
 	MSC_INST (dev)->protocol = interface->bInterfaceSubClass;
+	MSC_INST (dev)->lba64 = 0;
 	MSC_INST (dev)->bulk_in = 0;
 	MSC_INST (dev)->bulk_out = 0;
 
@@ -88,17 +88,93 @@ static void ofmem_posix_memalign(void** memptr, size_t alignment, size_t size) {
 	*memptr = aligned_malloc(size, alignment);
 }
 
+void DCFlushRangeNoSync(PVOID Start, ULONG Length);
+
+static void
+ohci_dma_flush (void *buf, unsigned int len)
+{
+	DCFlushRangeNoSync(buf, len);
+	__asm__ __volatile__("sync");
+}
+
+/*
+ * general TDs come from a pool allocated with the controller, falling back
+ * to the heap if it runs dry
+ */
+static td_t *
+ohci_alloc_td (ohci_t *const ohci)
+{
+	td_t *td = ohci->td_free;
+	if (td != NULL)
+		ohci->td_free = (td_t *)td->next_td;
+	else
+		ofmem_posix_memalign((void **)&td, sizeof(td_t) * 2, sizeof(td_t));
+	if (td != NULL)
+		memset((void *)td, 0, sizeof(*td));
+	return td;
+}
+
+static void
+ohci_free_td (ohci_t *const ohci, td_t *const td)
+{
+	if (td >= ohci->td_pool && td < &ohci->td_pool[OHCI_TD_POOL_SIZE]) {
+		td->next_td = (u32)ohci->td_free;
+		ohci->td_free = td;
+	} else
+		aligned_free((void *)td);
+}
+
+static int
+ohci_create_pools (ohci_t *const ohci)
+{
+	int i;
+
+	ofmem_posix_memalign((void **)&ohci->bulk_ed, sizeof(ed_t) * 2, sizeof(ed_t) * OHCI_BULK_EDS * 2);
+	ofmem_posix_memalign((void **)&ohci->td_pool, sizeof(td_t) * 2, sizeof(td_t) * OHCI_TD_POOL_SIZE);
+	if (ohci->bulk_ed == NULL || ohci->td_pool == NULL)
+		return 0;
+
+	ohci->td_free = NULL;
+	for (i = OHCI_TD_POOL_SIZE - 1; i >= 0; i--)
+		ohci_free_td(ohci, &ohci->td_pool[i]);
+
+	for (i = 0; i < OHCI_BOUNCE_COUNT; i++) {
+		ohci->bounce[i] = aligned_malloc(OHCI_BOUNCE_SIZE, 0x20);
+		if (ohci->bounce[i] == NULL)
+			return 0;
+	}
+	return 1;
+}
+
+static void
+ohci_destroy_pools (ohci_t *const ohci)
+{
+	int i;
+
+	for (i = 0; i < OHCI_BOUNCE_COUNT; i++) {
+		if (ohci->bounce[i] != NULL)
+			aligned_free(ohci->bounce[i]);
+	}
+	if (ohci->td_pool != NULL)
+		aligned_free((void *)ohci->td_pool);
+	if (ohci->bulk_ed != NULL)
+		aligned_free((void *)ohci->bulk_ed);
+}
+
 static void ohci_start (hci_t *controller);
 static void ohci_stop (hci_t *controller);
 static void ohci_reset (hci_t *controller);
 static void ohci_shutdown (hci_t *controller);
 static int ohci_bulk (endpoint_t *ep, int size, u8 *data, int finalize);
+static int ohci_bulk_queue (bulk_xfer_t *xfers, int count);
 static int ohci_control (usbdev_t *dev, direction_t dir, int drlen, void *devreq,
 			 int dalen, u8 *data);
 static void* ohci_create_intr_queue (endpoint_t *ep, int reqsize, int reqcount, int reqtiming);
 static void ohci_destroy_intr_queue (endpoint_t *ep, void *queue);
 static u8* ohci_poll_intr_queue (void *queue);
 static void ohci_process_done_queue(ohci_t *ohci, int spew_debug);
+static void ohci_reap_done_queue(ohci_t *ohci, int spew_debug, td_t **watch, int watch_count);
+static void ohci_release_idle_eds(ohci_t *ohci);
 
 #ifdef USB_DEBUG_ED
 static void
@@ -223,6 +299,13 @@ ohci_init (void *bar)
 		printk("Not enough memory creating USB controller instance.\n");
                 return NULL;
         }
+	memset(controller->instance, 0, sizeof (ohci_t));
+	if (!ohci_create_pools(OHCI_INST (controller))) {
+		printk("Not enough memory creating USB controller pools.\n");
+		ohci_destroy_pools(OHCI_INST (controller));
+		free (controller->instance);
+		return NULL;
+	}
 
 	controller->type = OHCI;
 
@@ -232,6 +315,7 @@ ohci_init (void *bar)
 	controller->init = ohci_reinit;
 	controller->shutdown = ohci_shutdown;
 	controller->bulk = ohci_bulk;
+	controller->bulk_queue = ohci_bulk_queue;
 	controller->control = ohci_control;
 	controller->set_address = generic_set_address;
 	controller->finish_device_config = NULL;
@@ -323,7 +407,9 @@ ohci_shutdown (hci_t *controller)
 	OHCI_INST (controller)->roothub->destroy (OHCI_INST (controller)->
 						  roothub);
 	controller->reset (controller);
+	ohci_release_idle_eds (OHCI_INST (controller));
 	aligned_free ((void *)OHCI_INST (controller)->periodic_ed);
+	ohci_destroy_pools (OHCI_INST (controller));
 	free (OHCI_INST (controller));
 	free (controller);
 }
@@ -371,11 +457,17 @@ static void DumpHex(const void* data, size_t size) {
 	}
 }
 
+/*
+ * wait for the last TD of each of count EDs to come back on the done queue,
+ * which the controller writes back at the end of the frame the TD retired
+ * in. returns how many EDs completed, in order, before one halted or the
+ * wait timed out.
+ */
 static int
-wait_for_ed(usbdev_t* dev, ed_t* head, int pages)
+wait_for_ed(usbdev_t* dev, ed_t* head, td_t** last_td, int count, int pages)
 {
+	ohci_t *const ohci = OHCI_INST(dev->controller);
 	usb_debug("Waiting for %d pages on dev %08x with head %08x\n", pages, dev, head);
-	mdelay(1);
 #if 0
 	printf("config:%x, head:%x, tail:%x, next:%x\r\n",
 		__le32_to_cpu(head->config),
@@ -392,15 +484,33 @@ wait_for_ed(usbdev_t* dev, ed_t* head, int pages)
 
 	/* wait for results */
 	/* TOTEST: how long to wait?
-	 *         give 2s per TD (2 pages) plus another 2s for now
+	 *         give 2s per TD (2 pages) plus another 2s per ED for now
 	 */
-	int timeout = pages * 1000 + 2000;
-	while (((__le32_to_cpu(head->head_pointer) & ~3) != __le32_to_cpu(head->tail_pointer)) &&
-		!(__le32_to_cpu(head->head_pointer) & 1) &&
-		((__le32_to_cpu((((td_t*)phys_to_virt(__le32_to_cpu(head->head_pointer) & ~3)))->config)
-			& TD_CC_MASK) >= TD_CC_NOACCESS) && timeout--) {
+	const unsigned long timeout = pages * 1000 + count * 2000;
+	const unsigned long start = currmsecs();
+	unsigned long elapsed, logged = 0;
+	int timed_out = 0, halted = 0, done = 0;
+	while (1) {
+		if (READ_OPREG(ohci, HcInterruptStatus) & WritebackDoneHead)
+			ohci_reap_done_queue(ohci, 0, last_td, count);
+		/* an ED is done once its last TD has come back, unless it halted on the way */
+		while (done < count && last_td[done] == NULL &&
+			!(__le32_to_cpu(head[done].head_pointer) & 1))
+			done++;
+		if (done == count)
+			break;
+		if (__le32_to_cpu(head[done].head_pointer) & 1) {
+			halted = 1;
+			break;
+		}
+		elapsed = currmsecs() - start;
+		if (elapsed >= timeout) {
+			timed_out = 1;
+			break;
+		}
 		/* don't log every ms */
-		if (!(timeout % 1000)) {
+		if (elapsed / 1000 != logged) {
+			logged = elapsed / 1000;
 			// no timeout, keep waiting forever if need be
 			//timeout = 1999;
 #if 0
@@ -415,9 +525,10 @@ wait_for_ed(usbdev_t* dev, ed_t* head, int pages)
 				(__le32_to_cpu(((td_t*)phys_to_virt(__le32_to_cpu(head->head_pointer) & ~3))->config) & TD_CC_MASK) >> TD_CC_SHIFT);
 #endif
 		}
-		mdelay(1);
+		/* the done head is written back at the next frame boundary, poll for it rather than sleeping a frame */
+		udelay(OHCI_POLL_USECS);
 	}
-	if (timeout < 0)
+	if (timed_out)
 		usb_debug("Error: ohci: endpoint "
 			"descriptor processing timed out.\n");
 
@@ -463,18 +574,31 @@ wait_for_ed(usbdev_t* dev, ed_t* head, int pages)
 		//DumpHex((void*)((ULONG)curr_td & 0xffffff00), 0x100);
 	}
 
-	/* Clear the done queue. */
-	ohci_process_done_queue(OHCI_INST(dev->controller), 1);
-
-	if (__le32_to_cpu(head->head_pointer) & 1) {
+	if (halted)
 		usb_debug("HALTED!\n");
-		return 1;
-	}
-	return 0;
+	return done;
+}
+
+/*
+ * take a list off the schedule when a transfer on it failed: once a frame
+ * has started with the list disabled, the controller no longer holds any of
+ * its EDs. the done head is written back at the same frame boundary, so
+ * reclaim the TDs too.
+ */
+static void
+ohci_stop_list (ohci_t *const ohci, const u32 list_enable)
+{
+	WRITE_OPREG(ohci->opreg->HcControl, READ_OPREG(ohci, HcControl) & __cpu_to_le32(~list_enable));
+	WRITE_OPREG(ohci->opreg->HcInterruptStatus, __cpu_to_le32(StartofFrame));
+	const unsigned long long start = currusecs();
+	while (!(READ_OPREG(ohci, HcInterruptStatus) & StartofFrame) &&
+		(currusecs() - start) < OHCI_LIST_STOP_USECS)
+		udelay(OHCI_POLL_USECS);
+	ohci_process_done_queue(ohci, 0);
 }
 
 static void
-ohci_free_ed (ed_t *const head)
+ohci_free_ed (ohci_t *const ohci, ed_t *const head)
 {
 	/* In case the transfer canceled, we have to free unprocessed TDs. */
 	while ((__le32_to_cpu(head->head_pointer) & ~0x3) != __le32_to_cpu(head->tail_pointer)) {
@@ -485,18 +609,33 @@ ohci_free_ed (ed_t *const head)
 		head->head_pointer = cur_td->next_td;
 		/* Free current TD. */
 		//printf("free cur_td %08x %08x\r\n", cur_td, ((void**)cur_td)[-1]);
-		aligned_free((void *)cur_td);
+		ohci_free_td(ohci, cur_td);
 	}
 
 	/* Always free the dummy TD */
 	if ((__le32_to_cpu(head->head_pointer) & ~0x3) == __le32_to_cpu(head->tail_pointer)) {
 		void* dummy_td = phys_to_virt(__le32_to_cpu(head->head_pointer) & ~0x3);
 		//printf("free dummy_td %08x %08x\r\n", dummy_td, ((void**)dummy_td)[-1]);
-		aligned_free(phys_to_virt(__le32_to_cpu(head->head_pointer) & ~0x3));
+		ohci_free_td(ohci, (td_t *)phys_to_virt(__le32_to_cpu(head->head_pointer) & ~0x3));
 	}
-	/* and the ED. */
+	/* and the ED, unless it's one of the shared bulk EDs. */
 	//printf("free head_ed %08x %08x\r\n", head, ((void**)head)[-1]);
-	aligned_free((void *)head);
+	if (head < ohci->bulk_ed || head >= &ohci->bulk_ed[OHCI_BULK_EDS * 2])
+		aligned_free((void *)head);
+}
+
+/* free the EDs that completed transfers left idle on the control and bulk lists */
+static void
+ohci_release_idle_eds (ohci_t *const ohci)
+{
+	int e;
+
+	if (ohci->control_ed != NULL)
+		ohci_free_ed(ohci, ohci->control_ed);
+	ohci->control_ed = NULL;
+	for (e = 0; e < ohci->bulk_idle; ++e)
+		ohci_free_ed(ohci, &ohci->bulk_ed[ohci->bulk_bank * OHCI_BULK_EDS + e]);
+	ohci->bulk_idle = 0;
 }
 
 static int
@@ -609,6 +748,7 @@ ohci_control (usbdev_t *dev, direction_t dir, int drlen, void *devreq, int dalen
 		TD_CC_NOACCESS);
 	cur->current_buffer_pointer = 0;
 	cur->buffer_end = 0;
+	td_t *last_td = cur;
 
 	/* Final dummy TD. */
 	td_t *const final_td;
@@ -643,18 +783,23 @@ ohci_control (usbdev_t *dev, direction_t dir, int drlen, void *devreq, int dalen
 	/* activate schedule */
 	WRITE_OPREG(OHCI_INST(dev->controller)->opreg->HcControlHeadED, __cpu_to_le32(virt_to_phys(head)));
 	WRITE_OPREG(OHCI_INST(dev->controller)->opreg->HcControl, READ_OPREG(OHCI_INST(dev->controller), HcControl) | __cpu_to_le32(ControlListEnable));
-	WRITE_OPREG(OHCI_INST(dev->controller)->opreg->HcInterruptStatus, __cpu_to_le32((1u << 30) | 0x7F));
+	WRITE_OPREG(OHCI_INST(dev->controller)->opreg->HcInterruptStatus, __cpu_to_le32(((1u << 30) | 0x7F) & ~WritebackDoneHead));
 	WRITE_OPREG(OHCI_INST(dev->controller)->opreg->HcCommandStatus, __cpu_to_le32(ControlListFilled));
 
-	int failure = wait_for_ed(dev, head,
-			pages);
-	/* Wait some frames before and one after disabling list access. */
-	mdelay(4);
-	WRITE_OPREG(OHCI_INST(dev->controller)->opreg->HcControl, READ_OPREG(OHCI_INST(dev->controller), HcControl) & __cpu_to_le32(~ControlListEnable));
-	mdelay(1);
-
-	/* free memory */
-	ohci_free_ed(head);
+	int failure = wait_for_ed(dev, head, &last_td, 1,
+			pages) != 1;
+	ed_t *const idle_ed = OHCI_INST(dev->controller)->control_ed;
+	if (failure) {
+		/* Disable list access, and wait for the controller to let go of the ED. */
+		ohci_stop_list(OHCI_INST(dev->controller), ControlListEnable);
+		ohci_free_ed(OHCI_INST(dev->controller), head);
+		head = NULL;
+	}
+	/* The controller went past the previous transfer's ED to reach this one, so it can go.
+	   This one stays on the list, idle, until the next transfer replaces it. */
+	if (idle_ed != NULL)
+		ohci_free_ed(OHCI_INST(dev->controller), idle_ed);
+	OHCI_INST(dev->controller)->control_ed = head;
 
 	// If this is a successful read, endian swap the data in place and then copy it back to the passed-in buffer.
 	//printf("end: dir=%s, fail=%d, len=%x(%x)\r\n", s_directions[dir], failure, origLen, dalen_aligned);
@@ -672,28 +817,101 @@ ohci_control (usbdev_t *dev, direction_t dir, int drlen, void *devreq, int dalen
 	return failure;
 }
 
-/* finalize == 1: if data is of packet aligned size, add a zero length packet */
+/*
+ * whether the controller can transfer straight to or from the caller's
+ * buffer: it must be in cached ram, in whole cache lines so flushing it can
+ * not clobber anything around it
+ */
 static int
-ohci_bulk (endpoint_t *ep, int dalen, u8 *data, int finalize)
+ohci_bulk_direct (const u8 *data, int dalen)
 {
-	int i;
-	usb_debug("bulk: %x bytes from %08x, finalize: %x, maxpacketsize: %x\n", dalen, data, finalize, ep->maxpacketsize);
+	if (dalen == 0)
+		return 0;
+	if ((((u32)data | (u32)dalen) & OHCI_DMA_ALIGN_MASK) != 0)
+		return 0;
+	return ((u32)data >= 0x80000000) && (((u32)data + dalen) <= 0x90000000);
+}
 
-	td_t *cur, *next;
+/* what ohci_bulk_queue keeps about each transfer */
+typedef struct {
+	u8 *buf;	/* what the controller transfers to or from */
+	int direct;	/* buf is the caller's buffer */
+	int allocated;	/* buf was allocated for this transfer */
+	int td_count;
+	int pages;
+	td_t *last;	/* the TD that writes the done head back */
+} ohci_bulk_state_t;
+
+static int
+ohci_bulk_prepare (ohci_t *const ohci, bulk_xfer_t *const xfer,
+		   ohci_bulk_state_t *const state, const int index)
+{
+	u8 *const data = xfer->data;
+	const int dalen = xfer->size;
 
-	unsigned char* origData = data;
-	int origLen = dalen;
-	// Allocate some uncached memory to use for the cocontrol-block, on a 32-byte (256-bit) alignment
 	// Ensure the length is aligned to 64 bits
 	ULONG alignment = dalen & 7;
 	if (alignment != 0) alignment = 8 - alignment;
 	ULONG dalen_aligned = dalen + alignment;
-	data = aligned_malloc(dalen_aligned, 0x20);
-	// Endian swap the data to the new buffer if this is a write.
-	if (ep->direction == OUT) {
-		memcpy(data, origData, dalen);
-		endian_swap64(data, dalen_aligned);
+	// Transfer straight to or from the caller's buffer if possible, otherwise through an uncached bounce buffer:
+	// one of the preallocated ones, or a new one for a transfer too large for them.
+	state->direct = ohci_bulk_direct(data, dalen);
+	state->allocated = 0;
+	if (state->direct) {
+		// The controller sees the 64-bit lanes swapped, so for a write swap the caller's buffer in place.
+		if (xfer->ep->direction == OUT) endian_swap64(data, dalen);
+		ohci_dma_flush(data, dalen);
+		state->buf = data;
+		return 1;
+	}
+	if (index < OHCI_BOUNCE_COUNT && dalen_aligned <= OHCI_BOUNCE_SIZE) {
+		state->buf = ohci->bounce[index];
+	} else {
+		state->buf = aligned_malloc(dalen_aligned, 0x20);
+		if (state->buf == NULL) return 0;
+		state->allocated = 1;
+	}
+	// Endian swap the data to the bounce buffer if this is a write.
+	if (xfer->ep->direction == OUT) {
+		memcpy(state->buf, data, dalen);
+		endian_swap64(state->buf, dalen_aligned);
 	}
+	return 1;
+}
+
+static void
+ohci_bulk_complete (bulk_xfer_t *const xfer, ohci_bulk_state_t *const state)
+{
+	const int dalen = xfer->size;
+	if (state->direct) {
+		// Drop any lines the cpu pulled in while the controller wrote the buffer.
+		if (xfer->ep->direction == IN) ohci_dma_flush(state->buf, dalen);
+		// Swap the caller's buffer back to cpu order: to restore a write, or to return the data of a successful read.
+		if (xfer->ep->direction == OUT || xfer->result == 0) endian_swap64(state->buf, dalen);
+		return;
+	}
+	// If this is a successful read, endian swap the data in place and then copy it back to the passed-in buffer.
+	if (xfer->ep->direction == IN && xfer->result == 0) {
+		endian_swap64(state->buf, (dalen + 7) & ~7);
+		memcpy(xfer->data, state->buf, dalen);
+	}
+
+	// free data
+	if (state->allocated) aligned_free(state->buf);
+}
+
+/*
+ * queue the TDs of one transfer: next is the ED's current dummy TD, which
+ * becomes the transfer's first TD. returns the new dummy TD.
+ * finalize == 1: if data is of packet aligned size, add a zero length packet
+ */
+static td_t *
+ohci_bulk_fill (ohci_t *const ohci, endpoint_t *const ep, td_t *next,
+		u8 *data, int dalen, const int finalize,
+		ohci_bulk_state_t *const state)
+{
+	int i;
+	td_t *cur = next;
 
 	// pages are specified as 4K in OHCI, so don't use getpagesize()
 	int first_page = (unsigned long)data / 4096;
@@ -705,12 +923,8 @@ ohci_bulk (endpoint_t *ep, int dalen, u8 *data, int finalize)
 	if (finalize && ((dalen % ep->maxpacketsize) == 0)) {
 		td_count++;
 	}
-
-	/* First TD. */
-	td_t *const first_td;
-	ofmem_posix_memalign((void **)&first_td, sizeof(td_t) * 2, sizeof(td_t));
-	memset((void *)first_td, 0, sizeof(*first_td));
-	cur = next = first_td;
+	state->td_count = td_count;
+	state->pages = pages;
 
 	for (i = 0; i < td_count; ++i) {
 		/* Advance to next TD. */
@@ -746,75 +960,191 @@ ohci_bulk (endpoint_t *ep, int dalen, u8 *data, int finalize)
 			data += second_page_size;
 		}
 		/* One more TD. */
-		ofmem_posix_memalign((void **)&next, sizeof(td_t) * 2, sizeof(td_t));
-		memset((void *)next, 0, sizeof(*next));
+		next = ohci_alloc_td(ohci);
 		/* Linked to the previous. */
 		cur->next_td = __cpu_to_le32(virt_to_phys(next));
 	}
 
-	if (origLen == 0) pages = 0;
-	else pages = (last_page - first_page) + 1;
-
 	/* Write done head after last TD. */
-	cur->config &= __cpu_to_le32(~TD_DELAY_INTERRUPT_MASK);
-	/* Advance to final, dummy TD. */
-	cur = next;
+	state->last = NULL;
+	if (td_count != 0) {
+		cur->config &= __cpu_to_le32(~TD_DELAY_INTERRUPT_MASK);
+		state->last = cur;
+	}
+	/* The final, dummy TD. */
+	return next;
+}
 
-	/* Data structures */
-	ed_t *head;
-	ofmem_posix_memalign((void **)&head, sizeof(ed_t) * 2, sizeof(ed_t));
-	memset((void*)head, 0, sizeof(*head));
-	head->config = __cpu_to_le32((ep->dev->address << ED_FUNC_SHIFT) |
-		((ep->endpoint & 0xf) << ED_EP_SHIFT) |
-		(((ep->direction==IN)?OHCI_IN:OHCI_OUT) << ED_DIR_SHIFT) |
-		(ep->dev->speed?ED_LOWSPEED:0) |
-		(ep->maxpacketsize << ED_MPS_SHIFT));
-	head->tail_pointer = __cpu_to_le32(virt_to_phys(cur));
-	head->head_pointer = __cpu_to_le32(virt_to_phys(first_td) | (ep->toggle?ED_TOGGLE:0));
+/*
+ * work out how far an ED got: transfers before the TD it stopped at have
+ * completed, the one it stopped in failed if the ED halted or timed out
+ * while being waited for, and the rest didn't run
+ */
+static void
+ohci_bulk_results (ed_t *const head, endpoint_t *const ep, const int waited,
+		   bulk_xfer_t *const xfers, ohci_bulk_state_t *const state, const int count)
+{
+	int i, total = 0, remaining = 0;
+	const u32 tail = __le32_to_cpu(head->tail_pointer);
+	u32 cur = __le32_to_cpu(head->head_pointer) & ~3;
+	const int halted = (__le32_to_cpu(head->head_pointer) & 1) != 0;
+
+	/* The TDs from the head on haven't been retired, so are still linked. */
+	for (; cur != tail; remaining++)
+		cur = __le32_to_cpu(((td_t *)phys_to_virt(cur))->next_td);
+
+	for (i = 0; i < count; i++)
+		if (xfers[i].ep == ep) total += state[i].td_count;
+
+	/* A halted ED has retired the TD that failed, so it's the one before the head. */
+	const int stopped = halted ? total - remaining - 1 : total - remaining;
+	const int stopped_result = (halted || waited) ? 1 : -1;
+
+	total = 0;
+	for (i = 0; i < count; i++) {
+		if (xfers[i].ep != ep) continue;
+		if (remaining == 0 && !halted)
+			xfers[i].result = 0;
+		else if (stopped >= total + state[i].td_count)
+			xfers[i].result = 0;
+		else if (stopped >= total)
+			xfers[i].result = stopped_result;
+		else
+			xfers[i].result = -1;
+		total += state[i].td_count;
+	}
+}
 
-	usb_debug("doing bulk transfer with %x(%x),%x. first_td at %lx, last %lx\n",
-		__le32_to_cpu(head->config) & ED_FUNC_MASK,
-		(__le32_to_cpu(head->config) & ED_EP_MASK) >> ED_EP_SHIFT,
-		__le32_to_cpu(head->config),
-		virt_to_phys(first_td), virt_to_phys(cur));
-	
-	// Clear the done queue first, to avoid losing any async EDs
-	ohci_process_done_queue(OHCI_INST(ep->dev->controller), 0);
-	
-	/* activate schedule */
-	WRITE_OPREG(OHCI_INST(ep->dev->controller)->opreg->HcBulkHeadED, __cpu_to_le32(virt_to_phys(head)));
-	WRITE_OPREG(OHCI_INST(ep->dev->controller)->opreg->HcControl, READ_OPREG(OHCI_INST(ep->dev->controller), HcControl) | __cpu_to_le32(BulkListEnable));
-	WRITE_OPREG(OHCI_INST(ep->dev->controller)->opreg->HcInterruptStatus, __cpu_to_le32((1u << 30) | 0x7F));
-	WRITE_OPREG(OHCI_INST(ep->dev->controller)->opreg->HcCommandStatus, __cpu_to_le32(BulkListFilled));
-
-	int failure = wait_for_ed(ep->dev, head, pages);
-	/* Wait some frames before and one after disabling list access. */
-	mdelay(4);
-	WRITE_OPREG(OHCI_INST(ep->dev->controller)->opreg->HcControl, READ_OPREG(OHCI_INST(ep->dev->controller), HcControl) & __cpu_to_le32(~BulkListEnable));
-	mdelay(1);
+/*
+ * transfers on the same endpoint share an ED and run in order. the EDs are
+ * chained on the bulk list, so transfers on different endpoints are all
+ * scheduled together. the first failure cancels everything still queued.
+ */
+static int
+ohci_bulk_queue (bulk_xfer_t *const xfers, const int count)
+{
+	int i, e;
+	if (count <= 0 || count > OHCI_BULK_QUEUE_MAX) return -1;
+
+	usbdev_t *const dev = xfers[0].ep->dev;
+	ohci_t *const ohci = OHCI_INST(dev->controller);
+	endpoint_t *eps[OHCI_BULK_EDS];
+	td_t *last_td[OHCI_BULK_EDS];
+	int pages = 0;
+	ohci_bulk_state_t state[OHCI_BULK_QUEUE_MAX];
+	int ep_count = 0;
+
+	usb_debug("bulk queue: %d transfers\n", count);
+
+	/* One ED per endpoint. */
+	for (i = 0; i < count; ++i) {
+		xfers[i].result = -1;
+		for (e = 0; e < ep_count && eps[e] != xfers[i].ep; ++e);
+		if (e < ep_count) continue;
+		if (ep_count == OHCI_BULK_EDS) return -1;
+		eps[ep_count++] = xfers[i].ep;
+	}
 
-	ep->toggle = __le32_to_cpu(head->head_pointer) & ED_TOGGLE;
+	for (i = 0; i < count; ++i) {
+		if (!ohci_bulk_prepare(ohci, &xfers[i], &state[i], i)) {
+			while (i--) ohci_bulk_complete(&xfers[i], &state[i]);
+			return -1;
+		}
+	}
 
-	/* free memory */
-	ohci_free_ed(head);
+	/* Use the bank of EDs the last transfer didn't leave on the list. */
+	ed_t *const bank = &ohci->bulk_ed[(ohci->bulk_bank ^ 1) * OHCI_BULK_EDS];
+	for (e = 0; e < ep_count; ++e) {
+		endpoint_t *const ep = eps[e];
+		td_t *const first_td = ohci_alloc_td(ohci);
+		td_t *cur = first_td;
+		last_td[e] = NULL;
+		for (i = 0; i < count; ++i) {
+			if (xfers[i].ep != ep) continue;
+			usb_debug("bulk: %x bytes from %08x, finalize: %x, maxpacketsize: %x\n",
+				xfers[i].size, xfers[i].data, xfers[i].finalize, ep->maxpacketsize);
+			cur = ohci_bulk_fill(ohci, ep, cur, state[i].buf, xfers[i].size,
+				xfers[i].finalize, &state[i]);
+			pages += state[i].pages;
+			if (state[i].last != NULL)
+				last_td[e] = state[i].last;
+		}
 
-	if (failure) {
-		/* try cleanup */
-		clear_stall(ep);
+		/* Data structures */
+		ed_t *const head = &bank[e];
+		memset((void*)head, 0, sizeof(*head));
+		head->config = __cpu_to_le32((ep->dev->address << ED_FUNC_SHIFT) |
+			((ep->endpoint & 0xf) << ED_EP_SHIFT) |
+			(((ep->direction==IN)?OHCI_IN:OHCI_OUT) << ED_DIR_SHIFT) |
+			(ep->dev->speed?ED_LOWSPEED:0) |
+			(ep->maxpacketsize << ED_MPS_SHIFT));
+		head->tail_pointer = __cpu_to_le32(virt_to_phys(cur));
+		head->head_pointer = __cpu_to_le32(virt_to_phys(first_td) | (ep->toggle?ED_TOGGLE:0));
+		if (e != 0)
+			bank[e - 1].next_ed = __cpu_to_le32(virt_to_phys(head));
+
+		usb_debug("doing bulk transfer with %x(%x),%x. first_td at %lx, last %lx\n",
+			__le32_to_cpu(head->config) & ED_FUNC_MASK,
+			(__le32_to_cpu(head->config) & ED_EP_MASK) >> ED_EP_SHIFT,
+			__le32_to_cpu(head->config),
+			virt_to_phys(first_td), virt_to_phys(cur));
 	}
 
-	// If this is a successful read, endian swap the data in place and then copy it back to the passed-in buffer.
-	if (ep->direction == IN && failure == 0) {
-		endian_swap64(data, dalen_aligned);
-		memcpy(origData, data, origLen);
+	// Clear the done queue first, to avoid losing any async EDs
+	ohci_process_done_queue(ohci, 0);
+
+	/* activate schedule */
+	WRITE_OPREG(ohci->opreg->HcBulkHeadED, __cpu_to_le32(virt_to_phys(bank)));
+	WRITE_OPREG(ohci->opreg->HcControl, READ_OPREG(ohci, HcControl) | __cpu_to_le32(BulkListEnable));
+	WRITE_OPREG(ohci->opreg->HcInterruptStatus, __cpu_to_le32(((1u << 30) | 0x7F) & ~WritebackDoneHead));
+	WRITE_OPREG(ohci->opreg->HcCommandStatus, __cpu_to_le32(BulkListFilled));
+
+	/* Wait for each ED in turn, giving up on the rest once one fails. */
+	const int done = wait_for_ed(dev, bank, last_td, ep_count, pages);
+	const int waited = (done < ep_count) ? done + 1 : ep_count;
+	if (done < ep_count) {
+		/* Disable list access, and wait for the controller to let go of the EDs. */
+		ohci_stop_list(ohci, BulkListEnable);
+	}
+	/* The controller went past the previous transfer's EDs to reach these, so they can go.
+	   These stay on the list, idle, until the next transfer replaces them. */
+	for (e = 0; e < ohci->bulk_idle; ++e)
+		ohci_free_ed(ohci, &ohci->bulk_ed[ohci->bulk_bank * OHCI_BULK_EDS + e]);
+	ohci->bulk_bank ^= 1;
+	ohci->bulk_idle = (done < ep_count) ? 0 : ep_count;
+
+	int failure = 0;
+	for (e = 0; e < ep_count; ++e) {
+		ed_t *const head = &bank[e];
+		const int halted = (__le32_to_cpu(head->head_pointer) & 1) != 0;
+		ohci_bulk_results(head, eps[e], e < waited, xfers, state, count);
+		eps[e]->toggle = __le32_to_cpu(head->head_pointer) & ED_TOGGLE;
+
+		/* free memory */
+		if (done < ep_count)
+			ohci_free_ed(ohci, head);
+
+		if (halted) {
+			/* try cleanup */
+			clear_stall(eps[e]);
+		}
 	}
 
-	// free data
-	aligned_free(data);
+	for (i = 0; i < count; ++i) {
+		if (xfers[i].result != 0) failure = 1;
+		ohci_bulk_complete(&xfers[i], &state[i]);
+	}
 
 	return failure;
 }
 
+static int
+ohci_bulk (endpoint_t *ep, int dalen, u8 *data, int finalize)
+{
+	bulk_xfer_t xfer = { ep, dalen, data, finalize, 0 };
+	return ohci_bulk_queue(&xfer, 1);
+}
+
 
 struct _intr_queue;
 
@@ -1032,10 +1362,15 @@ ohci_poll_intr_queue(void *const q_)
 	return ohci_poll_intr_queue_check_list(intrq);
 }
 
+/*
+ * reap the done queue, if it has been written back. any TD in watch that
+ * came back is set to NULL.
+ */
 static void
-ohci_process_done_queue(ohci_t *const ohci, const int spew_debug)
+ohci_reap_done_queue(ohci_t *const ohci, const int spew_debug,
+		     td_t **const watch, const int watch_count)
 {
-	int i, j;
+	int i, j, w;
 
 	/* Temporary queue of interrupt queue TDs (to reverse order). */
 	intrq_td_t *temp_tdq = NULL;
@@ -1059,9 +1394,14 @@ ohci_process_done_queue(ohci_t *const ohci, const int spew_debug)
 
 		switch (__le32_to_cpu(done_td->config) & TD_QUEUETYPE_MASK) {
 		case TD_QUEUETYPE_ASYNC:
+			/* Note the TDs being waited for. */
+			for (w = 0; w < watch_count; ++w) {
+				if (watch[w] == done_td)
+					watch[w] = NULL;
+			}
 			/* Free processed async TDs. */
 			//printf("free done_td %x\r\n", done_td);
-			aligned_free((void *)done_td);
+			ohci_free_td(ohci, done_td);
 			break;
 		case TD_QUEUETYPE_INTR: {
 			intrq_td_t *const td = INTRQ_TD_FROM_TD(done_td);
@@ -1119,6 +1459,12 @@ ohci_process_done_queue(ohci_t *const ohci, const int spew_debug)
 		usb_debug("processed %d done tds, %d intr tds thereof.\n", i, j);
 }
 
+static void
+ohci_process_done_queue(ohci_t *const ohci, const int spew_debug)
+{
+	ohci_reap_done_queue(ohci, spew_debug, NULL, 0);
+}
+
 int ob_usb_ohci_init (PVOID addr)
 {
 	hci_t *ctrl;
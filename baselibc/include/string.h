@@ -18,6 +18,9 @@ __extern void *memset(void *, int, size_t);
 __extern void *memmem(const void *, size_t, const void *, size_t);
 __extern void memswap(void *, void *, size_t);
 __extern void bzero(void *, size_t);
+/* Declares cacheable RAM, which memcpy() and memset() may then allocate
+ * cache lines in with dcbz on PowerPC.  None by default. */
+__extern void memops_set_cacheable(void *, size_t);
 __extern int strcasecmp(const char *, const char *);
 __extern int strncasecmp(const char *, const char *, size_t);
 __extern char *strcat(char *, const char *);
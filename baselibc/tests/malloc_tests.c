@@ -0,0 +1,116 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "unittests.h"
+
+#define ARENA_SIZE 0x40000
+#define SLOTS 512
+
+static unsigned char arena[ARENA_SIZE] __attribute__((aligned(32)));
+static unsigned char *blocks[SLOTS];
+static size_t sizes[SLOTS];
+
+static unsigned int seed = 1;
+static unsigned int next_random(void)
+{
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+/* Mostly small sizes, some large, as the firmware allocates. */
+static size_t random_size(void)
+{
+    unsigned int r = next_random();
+    if (r % 8 == 0)
+        return 1 + (next_random() % 0x4000);
+    return 1 + (next_random() % 600);
+}
+
+static int check_pattern(int i)
+{
+    for (size_t j = 0; j < sizes[i]; j++) {
+        if (blocks[i][j] != (unsigned char)(i + j))
+            return 0;
+    }
+    return 1;
+}
+
+/* Random allocations and frees, every block keeps its contents and lies in the arena. */
+static int check_random(void)
+{
+    for (int round = 0; round < 20000; round++) {
+        int i = next_random() % SLOTS;
+        if (blocks[i]) {
+            if (!check_pattern(i))
+                return 0;
+            free(blocks[i]);
+            blocks[i] = NULL;
+            continue;
+        }
+        sizes[i] = random_size();
+        blocks[i] = malloc(sizes[i]);
+        if (!blocks[i])
+            continue;
+        if (blocks[i] < arena || blocks[i] + sizes[i] > arena + ARENA_SIZE)
+            return 0;
+        for (size_t j = 0; j < sizes[i]; j++)
+            blocks[i][j] = (unsigned char)(i + j);
+    }
+    for (int i = 0; i < SLOTS; i++) {
+        if (blocks[i] && !check_pattern(i))
+            return 0;
+    }
+    return 1;
+}
+
+static void free_all(void)
+{
+    for (int i = 0; i < SLOTS; i++) {
+        free(blocks[i]);
+        blocks[i] = NULL;
+    }
+}
+
+int main()
+{
+    int status = 0;
+    struct malloc_stats stats;
+
+    add_malloc_block(arena, sizeof(arena));
+
+    {
+        COMMENT("Testing random allocations and frees");
+        TEST(check_random());
+        get_malloc_stats(&stats);
+        TEST(stats.peak_in_use >= stats.in_use);
+        TEST(stats.in_use + stats.free_bytes == sizeof(arena));
+    }
+
+    {
+        COMMENT("Testing that freeing everything coalesces the arena");
+        free_all();
+        get_malloc_stats(&stats);
+        TEST(stats.in_use == 0);
+        TEST(stats.free_blocks == 1);
+        TEST(stats.largest_free == sizeof(arena));
+    }
+
+    {
+        COMMENT("Testing that small blocks are reused");
+        void *a = malloc(24);
+        void *b = malloc(24);
+        free(a);
+        TEST(malloc(20) == a);
+        free(b);
+        get_malloc_stats(&stats);
+        size_t failures = stats.failures;
+        TEST(malloc(ARENA_SIZE) == NULL);
+        get_malloc_stats(&stats);
+        TEST(stats.failures == failures + 1);
+    }
+
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+
+    return status;
+}
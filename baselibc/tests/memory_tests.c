@@ -0,0 +1,128 @@
+#include <string.h>
+#include <stdint.h>
+#include "unittests.h"
+
+/* Enough for several cache lines either side of the area under test. */
+#define AREA 512
+#define GUARD 64
+
+static unsigned char dst_buf[AREA + 2 * GUARD] __attribute__((aligned(32)));
+static unsigned char ref_buf[AREA + 2 * GUARD] __attribute__((aligned(32)));
+static unsigned char src_buf[AREA + 2 * GUARD] __attribute__((aligned(32)));
+
+static void fill(unsigned char *buf, size_t n, unsigned int seed)
+{
+    for (size_t i = 0; i < n; i++)
+        buf[i] = (unsigned char)((i * 7 + seed * 13) ^ (i >> 3));
+}
+
+/* Byte at a time versions to check against. */
+static void ref_copy(unsigned char *q, const unsigned char *p, size_t n)
+{
+    if (q < p) {
+        for (size_t i = 0; i < n; i++)
+            q[i] = p[i];
+    } else {
+        while (n--)
+            q[n] = p[n];
+    }
+}
+
+static void ref_set(unsigned char *q, int c, size_t n)
+{
+    while (n--)
+        *q++ = (unsigned char)c;
+}
+
+/* Every destination and source alignment within a cache line, every length up to a few lines. */
+static int check_memcpy(void)
+{
+    for (size_t da = 0; da < 32; da++) {
+        for (size_t sa = 0; sa < 32; sa++) {
+            for (size_t n = 0; n <= 160; n++) {
+                fill(src_buf, sizeof(src_buf), (unsigned int)n);
+                fill(dst_buf, sizeof(dst_buf), 99);
+                memcpy(ref_buf, dst_buf, sizeof(ref_buf));
+                ref_copy(ref_buf + GUARD + da, src_buf + GUARD + sa, n);
+                if (memcpy(dst_buf + GUARD + da, src_buf + GUARD + sa, n) != dst_buf + GUARD + da)
+                    return 0;
+                if (memcmp(dst_buf, ref_buf, sizeof(dst_buf)) != 0)
+                    return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/* Overlapping moves in both directions, by distances below and above a cache line. */
+static int check_memmove(void)
+{
+    static const int distances[] = { -65, -33, -32, -31, -8, -5, -4, -3, -1, 1, 3, 4, 5, 8, 31, 32, 33, 65 };
+
+    for (size_t d = 0; d < sizeof(distances) / sizeof(distances[0]); d++) {
+        for (size_t a = 0; a < 32; a++) {
+            for (size_t n = 0; n <= 200; n += (n < 40) ? 1 : 7) {
+                unsigned char *p = dst_buf + GUARD + 80 + a;
+                unsigned char *q = p + distances[d];
+                fill(dst_buf, sizeof(dst_buf), (unsigned int)(n + a));
+                memcpy(ref_buf, dst_buf, sizeof(ref_buf));
+                ref_copy(ref_buf + (q - dst_buf), ref_buf + (p - dst_buf), n);
+                if (memmove(q, p, n) != q)
+                    return 0;
+                if (memcmp(dst_buf, ref_buf, sizeof(dst_buf)) != 0)
+                    return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+static int check_memset(int c)
+{
+    for (size_t da = 0; da < 32; da++) {
+        for (size_t n = 0; n <= 300; n++) {
+            fill(dst_buf, sizeof(dst_buf), (unsigned int)n);
+            memcpy(ref_buf, dst_buf, sizeof(ref_buf));
+            ref_set(ref_buf + GUARD + da, c, n);
+            if (memset(dst_buf + GUARD + da, c, n) != dst_buf + GUARD + da)
+                return 0;
+            if (memcmp(dst_buf, ref_buf, sizeof(dst_buf)) != 0)
+                return 0;
+        }
+    }
+    return 1;
+}
+
+int main()
+{
+    int status = 0;
+
+    {
+        COMMENT("Testing memcpy at every alignment");
+        TEST(check_memcpy());
+    }
+
+    {
+        COMMENT("Testing overlapping memmove");
+        TEST(check_memmove());
+    }
+
+    {
+        COMMENT("Testing memset at every alignment");
+        TEST(check_memset(0));
+        TEST(check_memset(0xa5));
+        TEST(check_memset(0x1ff));
+    }
+
+    {
+        COMMENT("Testing memset with a cacheable range declared");
+        memops_set_cacheable(dst_buf + GUARD, AREA);
+        TEST(check_memset(0));
+        memops_set_cacheable(NULL, 0);
+    }
+
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+
+    return status;
+}